@@ -0,0 +1,207 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "arena.h"
+
+static int ArenaBench_printHelp;
+static int ArenaBench_printVersion;
+static unsigned int ArenaBench_statements = 1000000;
+
+static struct option ArenaBench_longOptions[] =
+{
+    { "statements", required_argument, 0, 'n' },
+    { "help",     no_argument, &ArenaBench_printHelp, 1 },
+    { "version",  no_argument, &ArenaBench_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+/* Allocations made while parsing one statement: mostly tree nodes of a
+ * few fixed sizes, interleaved with short strings.  */
+static const size_t ArenaBench_pattern[] =
+{
+  48, 6, 32, 48, 9, 48, 48, 32, 12, 48, 48, 5, 32, 48, 3, 40
+};
+
+/* Statements in a typical script file */
+#define ARENA_BENCH_FILE_STATEMENTS 10000
+
+#define ARENA_BENCH_PATTERN_LENGTH (sizeof (ArenaBench_pattern) / sizeof (ArenaBench_pattern[0]))
+
+static double
+ArenaBench_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/* Touches allocated memory so the work can not be optimized away */
+static void
+ArenaBench_Touch (void *data, size_t size, uintptr_t *checksum)
+{
+  memset (data, 0, size);
+  *checksum += (uintptr_t) data;
+}
+
+static double
+ArenaBench_Malloc (uintptr_t *checksum)
+{
+  void *allocations[ARENA_BENCH_PATTERN_LENGTH];
+  double start;
+  unsigned int i, j;
+
+  start = ArenaBench_Now ();
+
+  for (i = 0; i < ArenaBench_statements; ++i)
+    {
+      for (j = 0; j < ARENA_BENCH_PATTERN_LENGTH; ++j)
+        {
+          if (!(allocations[j] = malloc (ArenaBench_pattern[j])))
+            err (EX_OSERR, "malloc failed");
+
+          ArenaBench_Touch (allocations[j], ArenaBench_pattern[j], checksum);
+        }
+
+      for (j = 0; j < ARENA_BENCH_PATTERN_LENGTH; ++j)
+        free (allocations[j]);
+    }
+
+  return ArenaBench_Now () - start;
+}
+
+/* Allocates every statement in one arena, resetting it after
+ * `statementsPerReset' statements.  */
+static double
+ArenaBench_Arena (unsigned int statementsPerReset, size_t alignment,
+                  struct arena_stats *stats, uintptr_t *checksum)
+{
+  struct arena_info arena;
+  double start;
+  unsigned int i, j;
+
+  arena_init (&arena);
+
+  start = ArenaBench_Now ();
+
+  for (i = 0; i < ArenaBench_statements; ++i)
+    {
+      for (j = 0; j < ARENA_BENCH_PATTERN_LENGTH; ++j)
+        ArenaBench_Touch (arena_alloc_aligned (&arena, ArenaBench_pattern[j], alignment),
+                          ArenaBench_pattern[j], checksum);
+
+      if (!((i + 1) % statementsPerReset))
+        arena_reset (&arena);
+    }
+
+  start = ArenaBench_Now () - start;
+
+  arena_get_stats (&arena, stats);
+  arena_free (&arena);
+
+  return start;
+}
+
+static void
+ArenaBench_Report (const char *name, double elapsed, const struct arena_stats *stats)
+{
+  double count;
+
+  count = (double) ArenaBench_statements * ARENA_BENCH_PATTERN_LENGTH;
+
+  printf ("%-24s %7.2f ns/allocation", name, elapsed * 1.0e9 / count);
+
+  if (stats)
+    printf ("  peak %zu KiB in %zu blocks (%zu KiB)",
+            stats->peak / 1024, stats->blocks, stats->reserved / 1024);
+
+  putchar ('\n');
+}
+
+int
+main (int argc, char **argv)
+{
+  struct arena_stats stats;
+  uintptr_t checksum = 0;
+  int i;
+
+  while (-1 != (i = getopt_long (argc, argv, "n:", ArenaBench_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 'n':
+
+          ArenaBench_statements = strtol (optarg, 0, 0);
+
+          if (!ArenaBench_statements)
+            errx (EX_USAGE, "Statement count must be positive");
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (ArenaBench_printHelp)
+    {
+      fprintf (stdout,
+               "Usage: %s [OPTION]...\n"
+               "\n"
+               "Compares arena allocation against malloc for the allocation pattern of\n"
+               "the script parser.\n"
+               "\n"
+               "  -n, --statements=COUNT   simulate parsing COUNT statements\n"
+               "      --help     display this help and exit\n"
+               "      --version  display version information\n"
+               "\n"
+               "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (ArenaBench_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (optind != argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  ArenaBench_Report ("malloc/free", ArenaBench_Malloc (&checksum), NULL);
+
+  /* Streaming conversion resets the arena after every statement, while
+   * whole-file conversion keeps a file's statements until it is done.  */
+
+  ArenaBench_Report ("arena, reset per stmt",
+                     ArenaBench_Arena (1, ARENA_DEFAULT_ALIGNMENT, &stats, &checksum), &stats);
+  ArenaBench_Report ("arena, reset per file",
+                     ArenaBench_Arena (ARENA_BENCH_FILE_STATEMENTS, ARENA_DEFAULT_ALIGNMENT,
+                                       &stats, &checksum), &stats);
+  ArenaBench_Report ("arena, 64 byte aligned",
+                     ArenaBench_Arena (ARENA_BENCH_FILE_STATEMENTS, 64, &stats, &checksum), &stats);
+
+  fprintf (stderr, "Checksum: %lx\n", (unsigned long) checksum);
+
+  return EXIT_SUCCESS;
+}
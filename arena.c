@@ -1,152 +1,275 @@
 #include <stdio.h>
 #include <assert.h>
 #include <err.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "arena.h"
 
-#define ARENA_BLOCK_SIZE (256 * 1024)
+/* The first block of an arena has the minimum size, and each following
+ * block is twice the size of the previous one, up to the maximum.  Larger
+ * allocations get a block of their own.  */
+#define ARENA_MIN_BLOCK_SIZE (64 * 1024)
+#define ARENA_MAX_BLOCK_SIZE (16 * 1024 * 1024)
 
-void
-arena_init(struct arena_info* arena)
+/* Upper bound on the total size of blocks cached by each thread */
+#define ARENA_CACHE_LIMIT (64 * 1024 * 1024)
+
+struct arena_block
 {
-  memset(arena, 0, sizeof(*arena));
+  struct arena_block* next;
+  size_t size;
+  size_t used;
+};
+
+#define ARENA_BLOCK_DATA(block) ((char*) ((block) + 1))
+
+/* Blocks released by arena_free on one thread */
+struct arena_cache
+{
+  struct arena_block* blocks;
+  size_t size;
+};
+
+static pthread_key_t arena_cache_key;
+static pthread_once_t arena_cache_once = PTHREAD_ONCE_INIT;
+
+static void
+arena_cache_destroy(void* arg)
+{
+  struct arena_cache* cache = arg;
+
+  while(cache->blocks)
+  {
+    struct arena_block* tmp;
+
+    tmp = cache->blocks;
+    cache->blocks = tmp->next;
+
+    free(tmp);
+  }
+
+  free(cache);
 }
 
-void
-arena_free(struct arena_info* arena)
+static void
+arena_cache_create_key(void)
 {
-  arena_reset (arena);
+  if(0 != pthread_key_create(&arena_cache_key, arena_cache_destroy))
+    errx(EXIT_FAILURE, "failed to create arena cache key");
+}
 
-  free(arena->data);
+static struct arena_cache*
+arena_get_cache(void)
+{
+  struct arena_cache* cache;
 
+  pthread_once(&arena_cache_once, arena_cache_create_key);
+
+  if(!(cache = pthread_getspecific(arena_cache_key)))
+  {
+    if(!(cache = calloc(1, sizeof(*cache))))
+      err(EXIT_FAILURE, "failed to allocate memory for arena cache");
+
+    pthread_setspecific(arena_cache_key, cache);
+  }
+
+  return cache;
+}
+
+/* Returns a block of at least `size' bytes, preferring the smallest such
+ * block in the thread's cache.  */
+static struct arena_block*
+arena_acquire_block(size_t size)
+{
+  struct arena_cache* cache;
+  struct arena_block** prev;
+  struct arena_block** best = 0;
+  struct arena_block* block;
+
+  cache = arena_get_cache();
+
+  for(prev = &cache->blocks; *prev; prev = &(*prev)->next)
+  {
+    if((*prev)->size >= size && (!best || (*prev)->size < (*best)->size))
+      best = prev;
+  }
+
+  if(best)
+  {
+    block = *best;
+    *best = block->next;
+    cache->size -= block->size;
+
+    return block;
+  }
+
+  if(!(block = malloc(sizeof(*block) + size)))
+    err(EXIT_FAILURE, "failed to allocate memory for arena data");
+
+  block->size = size;
+
+  return block;
+}
+
+static void
+arena_release_block(struct arena_block* block)
+{
+  struct arena_cache* cache;
+
+  cache = arena_get_cache();
+
+  if(cache->size + block->size > ARENA_CACHE_LIMIT)
+  {
+    free(block);
+
+    return;
+  }
+
+  block->next = cache->blocks;
+  cache->blocks = block;
+  cache->size += block->size;
+}
+
+void
+arena_init(struct arena_info* arena)
+{
   memset(arena, 0, sizeof(*arena));
+
+  arena->next_block_size = ARENA_MIN_BLOCK_SIZE;
 }
 
 void
-arena_reset(struct arena_info* arena)
+arena_free(struct arena_info* arena)
 {
-  struct arena_info* node;
+  struct arena_block* block;
 
-  node = arena->next;
+  block = arena->first;
 
-  while(node)
+  while(block)
   {
-    struct arena_info* tmp;
+    struct arena_block* tmp;
 
-    tmp = node;
-    node = node->next;
+    tmp = block;
+    block = block->next;
 
-    free(tmp->data);
-    free(tmp);
+    arena_release_block(tmp);
   }
 
-  arena->used = 0;
-  arena->next = 0;
-  arena->last = 0;
+  arena_init(arena);
 }
 
-void*
-arena_alloc(struct arena_info* arena, size_t size)
+void
+arena_reset(struct arena_info* arena)
 {
-  void* result;
-  struct arena_info* node;
+  /* Blocks after the first are cleared as allocation reaches them */
 
-  if(!size)
-    return 0;
+  arena->current = arena->first;
 
-  size = (size + 3) & ~3;
+  if(arena->current)
+    arena->current->used = 0;
 
-  if(size > ARENA_BLOCK_SIZE)
-  {
-    struct arena_info* new_arena;
+  arena->stats.used = 0;
+}
 
-    new_arena = malloc(sizeof(*new_arena));
+/* Adds a block of at least `size' bytes after the current one, and makes it
+ * current.  */
+static struct arena_block*
+arena_add_block(struct arena_info* arena, size_t size)
+{
+  struct arena_block* block;
+  size_t block_size;
 
-    if(!new_arena)
-      err(EXIT_SUCCESS, "failed to allocate memory for arena object");
+  /* Arenas cleared with memset instead of arena_init start at the minimum
+   * size too */
 
-    new_arena->data = malloc(size);
+  if(!arena->next_block_size)
+    arena->next_block_size = ARENA_MIN_BLOCK_SIZE;
 
-    if(!new_arena->data)
-      err(EXIT_SUCCESS, "failed to allocate memory for arena data");
+  block_size = arena->next_block_size;
 
-    new_arena->size = size;
-    new_arena->used = size;
-    new_arena->next = 0;
+  if(size > block_size)
+    block_size = size;
+  else if(arena->next_block_size < ARENA_MAX_BLOCK_SIZE)
+    arena->next_block_size *= 2;
 
-    if(!arena->last)
-    {
-      arena->next = new_arena;
-      arena->last = new_arena;
-    }
-    else
-    {
-      arena->last->next = new_arena;
-      arena->last = new_arena;
-    }
+  block = arena_acquire_block(block_size);
+  block->used = 0;
 
-    return new_arena->data;
+  if(arena->current)
+  {
+    block->next = arena->current->next;
+    arena->current->next = block;
   }
-
-  if(arena->last)
-    node = arena->last;
   else
   {
-    if(!arena->data)
-    {
-      arena->data = malloc(ARENA_BLOCK_SIZE);
+    block->next = arena->first;
+    arena->first = block;
+  }
 
-      if(!arena->data)
-        err(EXIT_SUCCESS, "failed to allocate memory for arena data");
+  arena->current = block;
 
-      arena->size = ARENA_BLOCK_SIZE;
-    }
+  ++arena->stats.blocks;
+  arena->stats.reserved += block->size;
 
-    node = arena;
-  }
+  return block;
+}
 
-  if(size > node->size - node->used)
-  {
-    struct arena_info* new_arena;
+void*
+arena_alloc_aligned(struct arena_info* arena, size_t size, size_t alignment)
+{
+  struct arena_block* block;
+  uintptr_t base;
+  size_t offset;
 
-    new_arena = malloc(sizeof(*new_arena));
+  assert(alignment && !(alignment & (alignment - 1)));
 
-    if(!new_arena)
-      err(EXIT_SUCCESS, "failed to allocate memory for arena object");
+  if(!size)
+    return 0;
+
+  for(block = arena->current; ; )
+  {
+    if(block)
+    {
+      base = (uintptr_t) ARENA_BLOCK_DATA(block);
+      offset = ((base + block->used + alignment - 1) & ~(uintptr_t) (alignment - 1)) - base;
 
-    new_arena->data = malloc(ARENA_BLOCK_SIZE);
+      if(offset <= block->size && size <= block->size - offset)
+        break;
 
-    if(!new_arena->data)
-      err(EXIT_SUCCESS, "failed to allocate memory for arena data");
+      /* Continue in a block kept by arena_reset, if the allocation fits */
 
-    new_arena->size = ARENA_BLOCK_SIZE;
-    new_arena->used = 0;
-    new_arena->next = 0;
+      if(block->next && block->next->size >= size + alignment - 1)
+      {
+        block = block->next;
+        block->used = 0;
+        arena->current = block;
 
-    if(!arena->last)
-    {
-      arena->next = new_arena;
-      arena->last = new_arena;
-    }
-    else
-    {
-      arena->last->next = new_arena;
-      arena->last = new_arena;
+        continue;
+      }
     }
 
-    node = new_arena;
+    block = arena_add_block(arena, size + alignment - 1);
   }
 
-  assert(node->size == ARENA_BLOCK_SIZE);
-  assert(node->used < node->size);
-  assert(size <= node->size - node->used);
+  ++arena->stats.allocations;
+  arena->stats.requested += size;
+  arena->stats.used += offset + size - block->used;
 
-  result = (char*) node->data + node->used;
-  node->used += size;
+  if(arena->stats.used > arena->stats.peak)
+    arena->stats.peak = arena->stats.used;
 
-  return result;
+  block->used = offset + size;
+
+  return (char*) base + offset;
+}
+
+void*
+arena_alloc(struct arena_info* arena, size_t size)
+{
+  return arena_alloc_aligned(arena, size, ARENA_DEFAULT_ALIGNMENT);
 }
 
 void*
@@ -161,12 +284,52 @@ arena_calloc(struct arena_info* arena, size_t size)
   return result;
 }
 
+void*
+arena_realloc(struct arena_info* arena, void* ptr, size_t old_size, size_t size)
+{
+  struct arena_block* block;
+  void* result;
+  size_t offset;
+
+  if(!ptr)
+    return arena_alloc(arena, size);
+
+  block = arena->current;
+
+  if(block && (char*) ptr + old_size == ARENA_BLOCK_DATA(block) + block->used)
+  {
+    offset = (char*) ptr - ARENA_BLOCK_DATA(block);
+
+    if(size <= block->size - offset)
+    {
+      arena->stats.requested += size - old_size;
+      arena->stats.used += size - old_size;
+
+      if(arena->stats.used > arena->stats.peak)
+        arena->stats.peak = arena->stats.used;
+
+      block->used = offset + size;
+
+      return ptr;
+    }
+  }
+
+  if(size <= old_size)
+    return ptr;
+
+  result = arena_alloc(arena, size);
+
+  memcpy(result, ptr, old_size);
+
+  return result;
+}
+
 char*
 arena_strdup(struct arena_info* arena, const char* string)
 {
   char* result;
 
-  result = arena_alloc(arena, strlen(string) + 1);
+  result = arena_alloc_aligned(arena, strlen(string) + 1, 1);
 
   strcpy(result, string);
 
@@ -178,10 +341,43 @@ arena_strndup(struct arena_info* arena, const char* string, size_t length)
 {
   char* result;
 
-  result = arena_alloc(arena, length + 1);
+  result = arena_alloc_aligned(arena, length + 1, 1);
 
   memcpy(result, string, length);
   result[length] = 0;
 
   return result;
 }
+
+struct arena_mark
+arena_get_mark(const struct arena_info* arena)
+{
+  struct arena_mark result;
+
+  result.block = arena->current;
+  result.used = arena->current ? arena->current->used : 0;
+  result.stats_used = arena->stats.used;
+
+  return result;
+}
+
+void
+arena_rewind(struct arena_info* arena, struct arena_mark mark)
+{
+  if(!mark.block)
+  {
+    arena_reset(arena);
+
+    return;
+  }
+
+  arena->current = mark.block;
+  arena->current->used = mark.used;
+  arena->stats.used = mark.stats_used;
+}
+
+void
+arena_get_stats(const struct arena_info* arena, struct arena_stats* stats)
+{
+  *stats = arena->stats;
+}
@@ -7,37 +7,99 @@
 extern "C" {
 #endif
 
-struct arena_info
+/* Alignment of memory returned by arena_alloc, sufficient for any scalar
+ * type */
+#define ARENA_DEFAULT_ALIGNMENT 16
+
+struct arena_block;
+
+struct arena_stats
 {
-  void* data;
-  size_t size;
+  /* Number of arena_alloc calls, and the bytes they asked for */
+  size_t allocations;
+  size_t requested;
+
+  /* Bytes handed out, including alignment padding */
   size_t used;
 
-  struct arena_info* next;
-  struct arena_info* last;
+  /* Blocks owned by the arena, and their total size */
+  size_t blocks;
+  size_t reserved;
+
+  /* Highest value of `used' since the arena was initialized */
+  size_t peak;
+};
+
+/* An arena hands out memory from a list of blocks, each at least twice the
+ * size of the previous one.  Memory is released all at once with
+ * arena_reset or arena_rewind, which keep the blocks for reuse.  An arena
+ * must not be used by several threads at the same time, but different
+ * arenas may be used concurrently.  */
+struct arena_info
+{
+  struct arena_block* first;
+  struct arena_block* current;
+
+  size_t next_block_size;
+
+  struct arena_stats stats;
+};
+
+/* A position in an arena, returned by arena_get_mark */
+struct arena_mark
+{
+  struct arena_block* block;
+  size_t used;
+  size_t stats_used;
 };
 
 void
 arena_init(struct arena_info* arena);
 
+/* Releases all allocations, keeping the blocks for reuse */
 void
 arena_reset(struct arena_info* arena);
 
+/* Releases all allocations and blocks.  Blocks are kept in a cache local to
+ * the calling thread, from which arena_alloc on the same thread takes
+ * blocks before calling malloc.  */
 void
 arena_free(struct arena_info* arena);
 
 void*
 arena_alloc(struct arena_info* arena, size_t size);
 
+/* Allocates memory aligned to `alignment', which must be a power of two,
+ * such as 64 for data processed with SIMD instructions.  */
+void*
+arena_alloc_aligned(struct arena_info* arena, size_t size, size_t alignment);
+
 void*
 arena_calloc(struct arena_info* arena, size_t size);
 
+/* Resizes `ptr', an allocation of `old_size' bytes, to `size' bytes.  The
+ * most recent allocation grows in place while its block has room, and
+ * shrinks in place always.  Otherwise the contents move to a new
+ * allocation, and the old one stays in the arena until it is released.  */
+void*
+arena_realloc(struct arena_info* arena, void* ptr, size_t old_size, size_t size);
+
 char*
 arena_strdup(struct arena_info* arena, const char* string);
 
 char*
 arena_strndup(struct arena_info* arena, const char* string, size_t length);
 
+struct arena_mark
+arena_get_mark(const struct arena_info* arena);
+
+/* Releases everything allocated since `mark' was taken */
+void
+arena_rewind(struct arena_info* arena, struct arena_mark mark);
+
+void
+arena_get_stats(const struct arena_info* arena, struct arena_stats* stats);
+
 #ifdef __cplusplus
 }
 #endif
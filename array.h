@@ -101,6 +101,52 @@ array_grow(void* elements, size_t* alloc, size_t new_alloc,
     }                                                                         \
   while(0)
 
+/* Makes room for at least `count' more elements, growing the allocation
+ * geometrically.  Sets ARRAY_RESULT to -1 on failure.  Together with
+ * ARRAY_END and ARRAY_ADVANCE, this lets a caller write many elements with
+ * a single capacity check:
+
+  ARRAY_GROW(&my_struct, length);
+
+  if(ARRAY_RESULT(&my_struct))
+    err(EX_OSERR, "memory allocation failed");
+
+  out = ARRAY_END(&my_struct);
+  ... write at most `length' elements to out ...
+  ARRAY_ADVANCE(&my_struct, out - ARRAY_END(&my_struct));
+*/
+#define ARRAY_GROW(array, count)                                              \
+  do                                                                          \
+    {                                                                         \
+      size_t need, new_alloc;                                                 \
+      assert((array)->array_result == 0);                                     \
+      need = (array)->array_element_count + (count);                          \
+      if(need > (array)->array_element_alloc)                                 \
+        {                                                                     \
+          new_alloc = (array)->array_element_alloc * 3 / 2 + 16;              \
+          if(new_alloc < need)                                                \
+            new_alloc = need;                                                 \
+          (array)->array_result =                                             \
+            array_grow(&(array)->array_elements,                              \
+                       &(array)->array_element_alloc, new_alloc,              \
+                       sizeof(*(array)->array_elements));                     \
+        }                                                                     \
+    }                                                                         \
+  while(0)
+
+/* Address of the first unused element */
+#define ARRAY_END(array) ((array)->array_elements + (array)->array_element_count)
+
+/* Counts `count' elements written at ARRAY_END as added */
+#define ARRAY_ADVANCE(array, count)                                           \
+  do                                                                          \
+    {                                                                         \
+      assert((array)->array_element_count + (count)                           \
+             <= (array)->array_element_alloc);                                \
+      (array)->array_element_count += (count);                                \
+    }                                                                         \
+  while(0)
+
 #define ARRAY_ADD(array, value)                                               \
   do                                                                          \
     {                                                                         \
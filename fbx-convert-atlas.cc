@@ -0,0 +1,199 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <err.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "fbx-convert.h"
+
+/* UV coordinates may exceed the [0, 1] range of a texture by this much
+ * before the texture is considered to repeat */
+#define FBXCONVERT_ATLAS_UV_EPSILON (1.0f / 4096.0f)
+
+struct FbxConvert_AtlasPage
+{
+  std::string uri;
+  unsigned int width, height;
+};
+
+/* Position of a source texture on an atlas page, in pixels from the top
+ * left corner */
+struct FbxConvert_AtlasImage
+{
+  size_t page;
+  unsigned int x, y, width, height;
+};
+
+/* Splits a line of tab separated fields in place */
+static std::vector<char *>
+FbxConvert_SplitFields (char *line)
+{
+  std::vector<char *> fields;
+  char *end;
+
+  if ((end = strchr (line, '\n')))
+    *end = 0;
+
+  for (;;)
+    {
+      fields.push_back (line);
+
+      if (!(end = strchr (line, '\t')))
+        break;
+
+      *end = 0;
+      line = end + 1;
+    }
+
+  return fields;
+}
+
+/* Reads a layout written by bm-texture-atlas */
+static void
+FbxConvert_ReadAtlas (std::vector<FbxConvert_AtlasPage> &pages,
+                      std::map<std::string, FbxConvert_AtlasImage> &images,
+                      const char *path)
+{
+  FILE *input;
+  char *line = NULL;
+  size_t lineAlloc = 0;
+  unsigned int lineNumber = 0;
+
+  if (!(input = fopen (path, "r")))
+    err (EXIT_FAILURE, "Failed to open `%s' for reading", path);
+
+  while (-1 != getline (&line, &lineAlloc, input))
+    {
+      std::vector<char *> fields;
+
+      ++lineNumber;
+
+      fields = FbxConvert_SplitFields (line);
+
+      if (fields.size () == 4 && !strcmp (fields[0], "page"))
+        {
+          FbxConvert_AtlasPage page;
+
+          page.uri = fields[1];
+          page.width = strtoul (fields[2], NULL, 10);
+          page.height = strtoul (fields[3], NULL, 10);
+
+          if (!page.width || !page.height)
+            errx (EX_DATAERR, "%s:%u: Empty page", path, lineNumber);
+
+          pages.push_back (page);
+        }
+      else if (fields.size () == 7 && !strcmp (fields[0], "image"))
+        {
+          FbxConvert_AtlasImage image;
+
+          image.page = strtoul (fields[2], NULL, 10);
+          image.x = strtoul (fields[3], NULL, 10);
+          image.y = strtoul (fields[4], NULL, 10);
+          image.width = strtoul (fields[5], NULL, 10);
+          image.height = strtoul (fields[6], NULL, 10);
+
+          if (image.page >= pages.size ()
+              || image.x + image.width > pages[image.page].width
+              || image.y + image.height > pages[image.page].height)
+            errx (EX_DATAERR, "%s:%u: Image outside its page", path, lineNumber);
+
+          images[fields[1]] = image;
+        }
+      else if (fields[0][0] && fields[0][0] != '#')
+        errx (EX_DATAERR, "%s:%u: Expected a page or an image", path, lineNumber);
+    }
+
+  if (ferror (input))
+    err (EXIT_FAILURE, "Failed to read `%s'", path);
+
+  free (line);
+  fclose (input);
+}
+
+void
+FbxConvertApplyAtlas (fbx_model &model, const char *path)
+{
+  std::vector<FbxConvert_AtlasPage> pages;
+  std::map<std::string, FbxConvert_AtlasImage> images;
+  std::set<std::string> texturesBefore, texturesAfter;
+  size_t i, remapped = 0, repeating = 0;
+
+  FbxConvert_ReadAtlas (pages, images, path);
+
+  for (auto &mesh : model.meshes)
+    {
+      if (mesh.diffuseTexture.empty ())
+        continue;
+
+      texturesBefore.insert (mesh.diffuseTexture);
+
+      auto image = images.find (mesh.diffuseTexture);
+
+      if (image != images.end ())
+        {
+          const FbxConvert_AtlasPage &page = pages[image->second.page];
+          float min[2], max[2], scale[2], offset[2];
+
+          min[0] = min[1] = HUGE_VALF;
+          max[0] = max[1] = -HUGE_VALF;
+
+          for (i = 0; i < mesh.uv.size (); ++i)
+            {
+              if (mesh.uv[i] < min[i & 1])
+                min[i & 1] = mesh.uv[i];
+
+              if (mesh.uv[i] > max[i & 1])
+                max[i & 1] = mesh.uv[i];
+            }
+
+          /* Whole texture repeats are dropped, as in BiasUVCoordinates;
+           * anything wider would sample its neighbours in the atlas */
+
+          min[0] = mesh.uv.empty () ? 0.0f : floor (min[0]);
+          min[1] = mesh.uv.empty () ? 0.0f : floor (min[1]);
+
+          if (!mesh.uv.empty ()
+              && (max[0] - min[0] > 1.0f + FBXCONVERT_ATLAS_UV_EPSILON
+                  || max[1] - min[1] > 1.0f + FBXCONVERT_ATLAS_UV_EPSILON))
+            {
+              ++repeating;
+            }
+          else
+            {
+              /* V grows upwards, while the layout counts rows from the top */
+
+              scale[0] = (float) image->second.width / page.width;
+              scale[1] = (float) image->second.height / page.height;
+              offset[0] = (float) image->second.x / page.width;
+              offset[1] = (float) (page.height - image->second.y - image->second.height) / page.height;
+
+              for (i = 0; i < mesh.uv.size (); ++i)
+                mesh.uv[i] = (mesh.uv[i] - min[i & 1]) * scale[i & 1] + offset[i & 1];
+
+              mesh.diffuseTexture = page.uri;
+              ++remapped;
+            }
+        }
+
+      texturesAfter.insert (mesh.diffuseTexture);
+    }
+
+  fprintf (stderr, "Texture binds: %zu before atlas, %zu after; %zu meshes moved to the atlas",
+           texturesBefore.size (), texturesAfter.size (), remapped);
+
+  if (repeating)
+    fprintf (stderr, ", %zu left out for repeating their texture", repeating);
+
+  fputc ('\n', stderr);
+}
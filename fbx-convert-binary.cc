@@ -8,6 +8,7 @@
 #include <assert.h>
 
 #include "fbx-convert.h"
+#include "float-kernels.h"
 
 static void
 FbxConvert_EmitByte (FILE *output, unsigned int byte)
@@ -21,6 +22,13 @@ FbxConvert_EmitU16 (FILE *output, unsigned int u16)
   fprintf (output, "%02x%02x", u16 & 0xff, (u16 >> 8) & 0xff);
 }
 
+static void
+FbxConvert_EmitU32 (FILE *output, unsigned int u32)
+{
+  fprintf (output, "%02x%02x%02x%02x",
+           u32 & 0xff, (u32 >> 8) & 0xff, (u32 >> 16) & 0xff, (u32 >> 24) & 0xff);
+}
+
 static void
 FbxConvert_EmitFloat (FILE *output, float value)
 {
@@ -39,6 +47,7 @@ static void
 FbxConvert_EmitVertexBuffer (FILE *output, const fbx_mesh &mesh)
 {
   size_t i, vertexCount;
+  std::vector<uint16_t> uv;
 
   fprintf (output, "(vertex-buffer");
 
@@ -46,6 +55,11 @@ FbxConvert_EmitVertexBuffer (FILE *output, const fbx_mesh &mesh)
 
   assert (vertexCount * 2 == mesh.uv.size ());
 
+  uv.resize (mesh.uv.size ());
+
+  if (!uv.empty ())
+    float_quantize_u16 (&uv[0], &mesh.uv[0], uv.size (), 4096.0f);
+
   if (!mesh.weights.size ())
     {
       fprintf (output, " data:data(");
@@ -55,8 +69,8 @@ FbxConvert_EmitVertexBuffer (FILE *output, const fbx_mesh &mesh)
           FbxConvert_EmitFloat (output, mesh.xyz[i * 3 + 0]);
           FbxConvert_EmitFloat (output, mesh.xyz[i * 3 + 1]);
           FbxConvert_EmitFloat (output, mesh.xyz[i * 3 + 2]);
-          FbxConvert_EmitU16 (output, mesh.uv[i * 2 + 0] * 4096.0f);
-          FbxConvert_EmitU16 (output, mesh.uv[i * 2 + 1] * 4096.0f);
+          FbxConvert_EmitU16 (output, uv[i * 2 + 0]);
+          FbxConvert_EmitU16 (output, uv[i * 2 + 1]);
         }
 
       fprintf (output, " )");
@@ -73,8 +87,8 @@ FbxConvert_EmitVertexBuffer (FILE *output, const fbx_mesh &mesh)
           FbxConvert_EmitFloat (output, mesh.xyz[i * 3 + 0]);
           FbxConvert_EmitFloat (output, mesh.xyz[i * 3 + 1]);
           FbxConvert_EmitFloat (output, mesh.xyz[i * 3 + 2]);
-          FbxConvert_EmitU16 (output, mesh.uv[i * 2 + 0] * 4096.0f);
-          FbxConvert_EmitU16 (output, mesh.uv[i * 2 + 1] * 4096.0f);
+          FbxConvert_EmitU16 (output, uv[i * 2 + 0]);
+          FbxConvert_EmitU16 (output, uv[i * 2 + 1]);
 
           FbxConvert_EmitByte (output, mesh.weights[i * 4 + 0]);
           FbxConvert_EmitByte (output, mesh.weights[i * 4 + 1]);
@@ -172,6 +186,40 @@ FbxConvert_EmitTake (FILE *output, const fbx_take &take)
   fprintf (output, ")"); /* take */
 }
 
+static void
+FbxConvert_EmitBVH (FILE *output, const fbx_model &model)
+{
+  size_t i;
+
+  if (model.bvh.empty ())
+    return;
+
+  fprintf (output, "(bvh");
+  fprintf (output, " nodes:data(");
+
+  for (auto &node : model.bvh)
+    {
+      for (i = 0; i < 3; ++i)
+        FbxConvert_EmitFloat (output, node.boundsMin.v[i]);
+      for (i = 0; i < 3; ++i)
+        FbxConvert_EmitFloat (output, node.boundsMax.v[i]);
+
+      FbxConvert_EmitU32 (output, node.offset);
+      FbxConvert_EmitU16 (output, node.count);
+      FbxConvert_EmitU16 (output, node.axis);
+    }
+
+  fprintf (output, ")");
+  fprintf (output, " node-count:%u", (unsigned int) model.bvh.size ());
+  fprintf (output, " meshes:data(");
+
+  for (auto mesh : model.bvhMeshes)
+    FbxConvert_EmitU32 (output, mesh);
+
+  fprintf (output, ")");
+  fprintf (output, ")");
+}
+
 void
 FbxConvertExportBinary (fbx_model &model, unsigned int pointerSize)
 {
@@ -189,4 +237,6 @@ FbxConvertExportBinary (fbx_model &model, unsigned int pointerSize)
 
   for (auto take : model.takes)
     FbxConvert_EmitTake (pipe, take);
+
+  FbxConvert_EmitBVH (pipe, model);
 }
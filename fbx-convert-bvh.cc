@@ -0,0 +1,268 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include <assert.h>
+#include <float.h>
+
+#include "fbx-convert.h"
+#include "float-kernels.h"
+
+#define FBXCONVERT_BVH_BINS      12
+#define FBXCONVERT_BVH_LEAF_SIZE 4
+
+struct FbxConvert_BVHPrimitive
+{
+  uint32_t mesh;
+  fbx_vector boundsMin, boundsMax;
+  fbx_vector center;
+};
+
+struct FbxConvert_BVHBin
+{
+  fbx_vector boundsMin, boundsMax;
+  size_t count;
+};
+
+static void
+FbxConvert_EmptyBounds (fbx_vector &min, fbx_vector &max)
+{
+  for (size_t i = 0; i < 3; ++i)
+    {
+      min.v[i] = FLT_MAX;
+      max.v[i] = -FLT_MAX;
+    }
+}
+
+static void
+FbxConvert_GrowBounds (fbx_vector &min, fbx_vector &max,
+                       const fbx_vector &otherMin, const fbx_vector &otherMax)
+{
+  for (size_t i = 0; i < 3; ++i)
+    {
+      if (otherMin.v[i] < min.v[i])
+        min.v[i] = otherMin.v[i];
+
+      if (otherMax.v[i] > max.v[i])
+        max.v[i] = otherMax.v[i];
+    }
+}
+
+static float
+FbxConvert_SurfaceArea (const fbx_vector &min, const fbx_vector &max)
+{
+  float dx, dy, dz;
+
+  if (min.v[0] > max.v[0])
+    return 0.0f;
+
+  dx = max.v[0] - min.v[0];
+  dy = max.v[1] - min.v[1];
+  dz = max.v[2] - min.v[2];
+
+  return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+/* Computes the world space bounding box of a mesh by transforming the eight
+ * corners of its local bounding box.  */
+static void
+FbxConvert_WorldBounds (FbxConvert_BVHPrimitive &primitive, const fbx_mesh &mesh)
+{
+  float corners[8 * 3];
+  size_t i;
+
+  for (i = 0; i < 8; ++i)
+    {
+      corners[i * 3 + 0] = (i & 1) ? mesh.boundsMax.v[0] : mesh.boundsMin.v[0];
+      corners[i * 3 + 1] = (i & 2) ? mesh.boundsMax.v[1] : mesh.boundsMin.v[1];
+      corners[i * 3 + 2] = (i & 4) ? mesh.boundsMax.v[2] : mesh.boundsMin.v[2];
+    }
+
+  float_transform3 (corners, 8, mesh.matrix.v);
+  float_bounds3 (corners, 8, primitive.boundsMin.v, primitive.boundsMax.v);
+
+  for (i = 0; i < 3; ++i)
+    primitive.center.v[i] = (primitive.boundsMin.v[i] + primitive.boundsMax.v[i]) * 0.5f;
+}
+
+static void
+FbxConvert_MakeLeaf (fbx_model &model, size_t node,
+                     std::vector<FbxConvert_BVHPrimitive>::iterator begin,
+                     std::vector<FbxConvert_BVHPrimitive>::iterator end)
+{
+  model.bvh[node].offset = model.bvhMeshes.size ();
+  model.bvh[node].count = end - begin;
+  model.bvh[node].axis = 0;
+
+  for (auto i = begin; i != end; ++i)
+    model.bvhMeshes.push_back (i->mesh);
+}
+
+/* Builds the subtree for the given primitives using a binned surface area
+ * heuristic.  Nodes are stored depth first, so the left child of an interior
+ * node always follows its parent and `offset' holds the right child.  */
+static void
+FbxConvert_BuildNode (fbx_model &model,
+                      std::vector<FbxConvert_BVHPrimitive>::iterator begin,
+                      std::vector<FbxConvert_BVHPrimitive>::iterator end)
+{
+  FbxConvert_BVHBin bins[FBXCONVERT_BVH_BINS];
+  fbx_vector centerMin, centerMax;
+  size_t i, node, count, axis = 0, bestSplit = 0;
+  float extent = 0.0f, bestCost = FLT_MAX, area;
+
+  count = end - begin;
+  node = model.bvh.size ();
+  model.bvh.push_back (fbx_bvh_node ());
+
+  FbxConvert_EmptyBounds (model.bvh[node].boundsMin, model.bvh[node].boundsMax);
+  FbxConvert_EmptyBounds (centerMin, centerMax);
+
+  for (auto p = begin; p != end; ++p)
+    {
+      FbxConvert_GrowBounds (model.bvh[node].boundsMin, model.bvh[node].boundsMax,
+                             p->boundsMin, p->boundsMax);
+      FbxConvert_GrowBounds (centerMin, centerMax, p->center, p->center);
+    }
+
+  for (i = 0; i < 3; ++i)
+    {
+      if (centerMax.v[i] - centerMin.v[i] > extent)
+        {
+          extent = centerMax.v[i] - centerMin.v[i];
+          axis = i;
+        }
+    }
+
+  if (count <= 1 || !extent)
+    {
+      if (count <= FBXCONVERT_BVH_LEAF_SIZE)
+        {
+          FbxConvert_MakeLeaf (model, node, begin, end);
+
+          return;
+        }
+
+      /* Coincident centers; no plane separates them, so split by count */
+
+      auto middle = begin + count / 2;
+
+      FbxConvert_BuildNode (model, begin, middle);
+      model.bvh[node].offset = model.bvh.size ();
+      model.bvh[node].count = 0;
+      model.bvh[node].axis = axis;
+      FbxConvert_BuildNode (model, middle, end);
+
+      return;
+    }
+
+  for (i = 0; i < FBXCONVERT_BVH_BINS; ++i)
+    {
+      FbxConvert_EmptyBounds (bins[i].boundsMin, bins[i].boundsMax);
+      bins[i].count = 0;
+    }
+
+  auto binIndex = [&](const FbxConvert_BVHPrimitive &p) -> size_t
+    {
+      size_t bin;
+
+      bin = (p.center.v[axis] - centerMin.v[axis]) / extent * FBXCONVERT_BVH_BINS;
+
+      return std::min (bin, (size_t) FBXCONVERT_BVH_BINS - 1);
+    };
+
+  for (auto p = begin; p != end; ++p)
+    {
+      FbxConvert_BVHBin &bin = bins[binIndex (*p)];
+
+      FbxConvert_GrowBounds (bin.boundsMin, bin.boundsMax, p->boundsMin, p->boundsMax);
+      ++bin.count;
+    }
+
+  area = FbxConvert_SurfaceArea (model.bvh[node].boundsMin, model.bvh[node].boundsMax);
+
+  for (i = 0; i + 1 < FBXCONVERT_BVH_BINS; ++i)
+    {
+      fbx_vector leftMin, leftMax, rightMin, rightMax;
+      size_t j, leftCount = 0, rightCount = 0;
+      float cost;
+
+      FbxConvert_EmptyBounds (leftMin, leftMax);
+      FbxConvert_EmptyBounds (rightMin, rightMax);
+
+      for (j = 0; j <= i; ++j)
+        {
+          FbxConvert_GrowBounds (leftMin, leftMax, bins[j].boundsMin, bins[j].boundsMax);
+          leftCount += bins[j].count;
+        }
+
+      for (; j < FBXCONVERT_BVH_BINS; ++j)
+        {
+          FbxConvert_GrowBounds (rightMin, rightMax, bins[j].boundsMin, bins[j].boundsMax);
+          rightCount += bins[j].count;
+        }
+
+      if (!leftCount || !rightCount)
+        continue;
+
+      cost = 0.125f + (leftCount * FbxConvert_SurfaceArea (leftMin, leftMax)
+                       + rightCount * FbxConvert_SurfaceArea (rightMin, rightMax)) / area;
+
+      if (cost < bestCost)
+        {
+          bestCost = cost;
+          bestSplit = i;
+        }
+    }
+
+  if (count <= FBXCONVERT_BVH_LEAF_SIZE && bestCost >= count)
+    {
+      FbxConvert_MakeLeaf (model, node, begin, end);
+
+      return;
+    }
+
+  auto middle = std::partition (begin, end,
+                                [&](const FbxConvert_BVHPrimitive &p)
+                                  {
+                                    return binIndex (p) <= bestSplit;
+                                  });
+
+  assert (middle != begin && middle != end);
+
+  FbxConvert_BuildNode (model, begin, middle);
+  model.bvh[node].offset = model.bvh.size ();
+  model.bvh[node].count = 0;
+  model.bvh[node].axis = axis;
+  FbxConvert_BuildNode (model, middle, end);
+}
+
+void
+FbxConvertBuildBVH (fbx_model &model)
+{
+  std::vector<FbxConvert_BVHPrimitive> primitives;
+
+  model.bvh.clear ();
+  model.bvhMeshes.clear ();
+
+  for (size_t i = 0; i < model.meshes.size (); ++i)
+    {
+      FbxConvert_BVHPrimitive primitive;
+
+      if (model.meshes[i].xyz.empty ())
+        continue;
+
+      primitive.mesh = i;
+      FbxConvert_WorldBounds (primitive, model.meshes[i]);
+
+      primitives.push_back (primitive);
+    }
+
+  if (primitives.empty ())
+    return;
+
+  FbxConvert_BuildNode (model, primitives.begin (), primitives.end ());
+}
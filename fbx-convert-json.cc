@@ -146,5 +146,39 @@ FbxConvertExportJSON (fbx_model &model)
       firstTake = false;
     }
 
-  printf ("]}");
+  printf ("]");
+
+  if (!model.bvh.empty ())
+    {
+      printf (",\"bvh\":{\"nodes\":[");
+
+      for (size_t i = 0; i < model.bvh.size (); ++i)
+        {
+          const fbx_bvh_node &node = model.bvh[i];
+
+          if (i)
+            putchar (',');
+
+          printf ("{\"min-bounds\":[%.7g, %.7g, %.7g], \"max-bounds\":[%.7g, %.7g, %.7g],"
+                  " \"offset\":%u, \"count\":%u, \"axis\":%u}",
+                  node.boundsMin.v[0], node.boundsMin.v[1], node.boundsMin.v[2],
+                  node.boundsMax.v[0], node.boundsMax.v[1], node.boundsMax.v[2],
+                  (unsigned int) node.offset, (unsigned int) node.count,
+                  (unsigned int) node.axis);
+        }
+
+      printf ("], \"meshes\":[");
+
+      for (size_t i = 0; i < model.bvhMeshes.size (); ++i)
+        {
+          if (i)
+            putchar (',');
+
+          printf ("%u", (unsigned int) model.bvhMeshes[i]);
+        }
+
+      printf ("]}");
+    }
+
+  putchar ('}');
 }
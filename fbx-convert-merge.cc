@@ -0,0 +1,213 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <assert.h>
+#include <stdio.h>
+
+#include "fbx-convert.h"
+#include "float-kernels.h"
+
+/* Index buffers are emitted as 16 bit values, so no batch may exceed this */
+#define FBXCONVERT_MAX_BATCH_VERTICES 0x10000
+
+struct FbxConvert_MergeItem
+{
+  size_t mesh;
+  fbx_vector center;
+};
+
+static bool
+FbxConvert_IsStatic (const fbx_mesh &mesh)
+{
+  return mesh.weights.empty () && mesh.bindPose.empty ();
+}
+
+static void
+FbxConvert_BakeTransform (fbx_mesh &mesh)
+{
+  size_t i;
+
+  float_transform3 (&mesh.xyz[0], mesh.xyz.size () / 3, mesh.matrix.v);
+
+  for (i = 0; i < 16; ++i)
+    mesh.matrix.v[i] = (i % 5) ? 0.0f : 1.0f;
+}
+
+static fbx_vector
+FbxConvert_Center (const fbx_mesh &mesh)
+{
+  fbx_vector result, min, max;
+  size_t i;
+
+  float_bounds3 (&mesh.xyz[0], mesh.xyz.size () / 3, min.v, max.v);
+
+  for (i = 0; i < 3; ++i)
+    result.v[i] = (min.v[i] + max.v[i]) * 0.5f;
+
+  return result;
+}
+
+static void
+FbxConvert_EmitBatch (std::vector<fbx_mesh> &output,
+                      const std::vector<fbx_mesh> &input,
+                      const std::vector<FbxConvert_MergeItem> &items)
+{
+  output.push_back (input[items.front ().mesh]);
+
+  fbx_mesh &batch = output.back ();
+
+  for (size_t i = 1; i < items.size (); ++i)
+    {
+      const fbx_mesh &mesh = input[items[i].mesh];
+      unsigned int base;
+
+      base = batch.xyz.size () / 3;
+
+      batch.xyz.insert (batch.xyz.end (), mesh.xyz.begin (), mesh.xyz.end ());
+      batch.uv.insert (batch.uv.end (), mesh.uv.begin (), mesh.uv.end ());
+
+      for (auto index : mesh.indices)
+        batch.indices.push_back (index + base);
+    }
+}
+
+/* Recursively splits a set of meshes into octants until every batch both fits
+ * within `chunkSize' along each axis and can be addressed with 16 bit
+ * indices.  Meshes are never split themselves; they are assigned to octants
+ * by the center of their bounding box.  */
+static void
+FbxConvert_SplitBatch (std::vector<fbx_mesh> &output,
+                       const std::vector<fbx_mesh> &input,
+                       std::vector<FbxConvert_MergeItem> &items,
+                       float chunkSize)
+{
+  fbx_vector min, max;
+  size_t i, j, vertexCount = 0;
+
+  min = max = items.front ().center;
+
+  for (auto &item : items)
+    {
+      vertexCount += input[item.mesh].xyz.size () / 3;
+
+      for (j = 0; j < 3; ++j)
+        {
+          if (item.center.v[j] < min.v[j])
+            min.v[j] = item.center.v[j];
+
+          if (item.center.v[j] > max.v[j])
+            max.v[j] = item.center.v[j];
+        }
+    }
+
+  if (items.size () == 1
+      || (vertexCount <= FBXCONVERT_MAX_BATCH_VERTICES
+          && (!chunkSize
+              || (max.v[0] - min.v[0] <= chunkSize
+                  && max.v[1] - min.v[1] <= chunkSize
+                  && max.v[2] - min.v[2] <= chunkSize))))
+    {
+      FbxConvert_EmitBatch (output, input, items);
+
+      return;
+    }
+
+  std::vector<FbxConvert_MergeItem> octants[8];
+  size_t used = 0;
+
+  for (auto &item : items)
+    {
+      unsigned int octant = 0;
+
+      for (j = 0; j < 3; ++j)
+        {
+          if (item.center.v[j] > (min.v[j] + max.v[j]) * 0.5f)
+            octant |= 1 << j;
+        }
+
+      octants[octant].push_back (item);
+    }
+
+  for (i = 0; i < 8; ++i)
+    used += !octants[i].empty ();
+
+  if (used == 1)
+    {
+      /* All centers coincide; split the list in half instead */
+
+      std::vector<FbxConvert_MergeItem> lower (items.begin (), items.begin () + items.size () / 2);
+      std::vector<FbxConvert_MergeItem> upper (items.begin () + items.size () / 2, items.end ());
+
+      FbxConvert_SplitBatch (output, input, lower, chunkSize);
+      FbxConvert_SplitBatch (output, input, upper, chunkSize);
+
+      return;
+    }
+
+  for (i = 0; i < 8; ++i)
+    {
+      if (!octants[i].empty ())
+        FbxConvert_SplitBatch (output, input, octants[i], chunkSize);
+    }
+}
+
+void
+FbxConvertMergeStatic (fbx_model &model, float chunkSize)
+{
+  std::map<std::pair<std::string, float>, std::vector<size_t>> groups;
+  std::vector<fbx_mesh> output;
+  size_t i, drawCallsBefore;
+
+  drawCallsBefore = model.meshes.size ();
+
+  for (i = 0; i < model.meshes.size (); ++i)
+    {
+      const fbx_mesh &mesh = model.meshes[i];
+
+      if (!FbxConvert_IsStatic (mesh) || mesh.xyz.empty ())
+        {
+          output.push_back (mesh);
+
+          continue;
+        }
+
+      groups[std::make_pair (mesh.diffuseTexture, mesh.lod)].push_back (i);
+    }
+
+  for (auto &group : groups)
+    {
+      std::vector<FbxConvert_MergeItem> items;
+
+      if (group.second.size () == 1)
+        {
+          output.push_back (model.meshes[group.second.front ()]);
+
+          continue;
+        }
+
+      for (auto index : group.second)
+        {
+          FbxConvert_MergeItem item;
+
+          FbxConvert_BakeTransform (model.meshes[index]);
+
+          item.mesh = index;
+          item.center = FbxConvert_Center (model.meshes[index]);
+
+          items.push_back (item);
+        }
+
+      FbxConvert_SplitBatch (output, model.meshes, items, chunkSize);
+    }
+
+  model.meshes.swap (output);
+
+  fprintf (stderr, "Draw calls: %zu before static merge, %zu after\n",
+           drawCallsBefore, model.meshes.size ());
+}
@@ -15,16 +15,25 @@
 #include <PVRTTriStrip.h>
 
 #include "fbx-convert.h"
+#include "float-kernels.h"
 
 static int FbxConvert_printHelp;
 static int FbxConvert_printVersion;
 static const char *FbxConvert_format = "binary";
 static unsigned int FbxConvert_pointerSize = 32;
+static int FbxConvert_mergeStatic;
+static float FbxConvert_mergeChunkSize = 50.0f;
+static int FbxConvert_bvh;
+static const char *FbxConvert_atlas;
 
 static struct option FbxConvert_longOptions[] =
 {
     { "format", required_argument, 0, 'f' },
     { "pointer-size", required_argument, 0, 'p' },
+    { "merge-static", no_argument, &FbxConvert_mergeStatic, 1 },
+    { "merge-chunk-size", required_argument, 0, 'm' },
+    { "bvh", no_argument, &FbxConvert_bvh, 1 },
+    { "atlas", required_argument, 0, 'a' },
     { "help",     no_argument, &FbxConvert_printHelp, 1 },
     { "version",  no_argument, &FbxConvert_printVersion, 1 },
     { 0, 0, 0, 0 }
@@ -90,6 +99,18 @@ main(int argc, char** argv)
 
           break;
 
+        case 'm':
+
+          FbxConvert_mergeChunkSize = strtod (optarg, NULL);
+
+          break;
+
+        case 'a':
+
+          FbxConvert_atlas = optarg;
+
+          break;
+
         case '?':
 
           fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
@@ -105,10 +126,16 @@ main(int argc, char** argv)
               "\n"
               "      --format\n"
               "      --pointer-size\n"
+              "      --merge-static           merge unskinned meshes sharing a texture\n"
+              "      --merge-chunk-size=SIZE  maximum extent of a merged batch (%g)\n"
+              "      --bvh                    emit a world space bounding volume hierarchy\n"
+              "      --atlas=FILE             use the texture atlas laid out in FILE by\n"
+              "                               bm-texture-atlas; with --merge-static,\n"
+              "                               meshes sharing a page are merged too\n"
               "      --help     display this help and exit\n"
               "      --version  display version information\n"
               "\n"
-              "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+              "Report bugs to <morten.hustveit@gmail.com>\n", argv[0], FbxConvert_mergeChunkSize);
 
       return EXIT_SUCCESS;
     }
@@ -175,10 +202,19 @@ main(int argc, char** argv)
   for (i = 0; i < takeNames.GetCount(); i++)
     ConvertTakeToIntermediate (model, scene, takeNames[i]);
 
+  if (FbxConvert_atlas)
+    FbxConvertApplyAtlas (model, FbxConvert_atlas);
+
+  if (FbxConvert_mergeStatic)
+    FbxConvertMergeStatic (model, FbxConvert_mergeChunkSize);
+
   GenTriStrips (model);
   BiasUVCoordinates (model);
   FindBoundingBox (model);
 
+  if (FbxConvert_bvh)
+    FbxConvertBuildBVH (model);
+
   if (!strcmp (FbxConvert_format, "binary"))
     FbxConvertExportBinary (model, FbxConvert_pointerSize);
   else if (!strcmp (FbxConvert_format, "json"))
@@ -251,31 +287,22 @@ BiasUVCoordinates (fbx_model &model)
 
   for (auto &mesh : model.meshes)
     {
-      float min_u = 0.0f, min_v = 0.0f;
-      size_t i;
+      float min[2] = { 0.0f, 0.0f };
 
-      for (i = 0; i < mesh.uv.size (); i += 2)
-        {
-          if (mesh.uv[i] < min_u)
-            min_u = mesh.uv[i];
+      if (mesh.uv.empty ())
+        continue;
 
-          if (mesh.uv[i + 1] < min_v)
-            min_v = mesh.uv[i + 1];
-        }
+      float_min2 (&mesh.uv[0], mesh.uv.size () / 2, min);
 
-      min_u = floor (min_u);
-      min_v = floor (min_v);
+      min[0] = floor (min[0]);
+      min[1] = floor (min[1]);
 
-      if (!min_u && !min_v)
+      if (!min[0] && !min[1])
         continue;
 
-      fprintf (stderr, "Bias %.2f %.2f\n", min_u, min_v);
+      fprintf (stderr, "Bias %.2f %.2f\n", min[0], min[1]);
 
-      for (i = 0; i < mesh.uv.size (); i += 2)
-        {
-          mesh.uv[i] -= min_u;
-          mesh.uv[i] -= min_v;
-        }
+      float_add2 (&mesh.uv[0], mesh.uv.size () / 2, -min[0], -min[1]);
     }
 }
 
@@ -284,40 +311,11 @@ FindBoundingBox (fbx_model &model)
 {
   for (auto &mesh : model.meshes)
     {
-      float minX = 0, minY = 0, minZ = 0;
-      float maxX = 0, maxY = 0, maxZ = 0;
-
       if (mesh.xyz.empty ())
         continue;
 
-      minX = maxX = mesh.xyz[0];
-      minY = maxY = mesh.xyz[1];
-      minZ = maxZ = mesh.xyz[2];
-
-      for (size_t i = 3; i < mesh.xyz.size (); i += 3)
-        {
-          if (mesh.xyz[i] < minX)
-            minX = mesh.xyz[i];
-          else if (mesh.xyz[i] > maxX)
-            maxX = mesh.xyz[i];
-
-          if (mesh.xyz[i + 1] < minY)
-            minY = mesh.xyz[i + 1];
-          else if (mesh.xyz[i + 1] > maxY)
-            maxY = mesh.xyz[i + 1];
-
-          if (mesh.xyz[i + 2] < minZ)
-            minZ = mesh.xyz[i + 2];
-          else if (mesh.xyz[i + 2] > maxZ)
-            maxZ = mesh.xyz[i + 2];
-        }
-
-      mesh.boundsMin.v[0] = minX;
-      mesh.boundsMin.v[1] = minY;
-      mesh.boundsMin.v[2] = minZ;
-      mesh.boundsMax.v[0] = maxX;
-      mesh.boundsMax.v[1] = maxY;
-      mesh.boundsMax.v[2] = maxZ;
+      float_bounds3 (&mesh.xyz[0], mesh.xyz.size () / 3,
+                     mesh.boundsMin.v, mesh.boundsMax.v);
     }
 }
 
@@ -50,13 +50,41 @@ struct fbx_take
   std::vector<fbx_frame> frames;
 };
 
+/* Flattened bounding volume hierarchy node.  Interior nodes have a zero
+ * `count', their left child immediately follows them and `offset' is the
+ * index of the right child.  Leaves reference `count' entries of
+ * fbx_model::bvhMeshes starting at `offset', which in turn are indices into
+ * fbx_model::meshes.  */
+struct fbx_bvh_node
+{
+  fbx_vector boundsMin, boundsMax;
+  uint32_t offset;
+  uint16_t count;
+  uint16_t axis;
+};
+
 struct fbx_model
 {
   std::vector<fbx_mesh> meshes;
   std::vector<fbx_take_range> takeRanges;
   std::vector<fbx_take> takes;
+
+  std::vector<fbx_bvh_node> bvh;
+  std::vector<uint32_t> bvhMeshes;
 };
 
+/* Moves meshes whose diffuse texture was packed by bm-texture-atlas onto
+ * its atlas page, rewriting their UV coordinates.  Meshes whose UVs
+ * repeat the texture are left alone.  */
+void
+FbxConvertApplyAtlas (fbx_model &model, const char *path);
+
+void
+FbxConvertMergeStatic (fbx_model &model, float chunkSize);
+
+void
+FbxConvertBuildBVH (fbx_model &model);
+
 void
 FbxConvertExportBinary (fbx_model &model, unsigned int pointerSize);
 
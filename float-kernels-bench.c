@@ -0,0 +1,295 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "float-kernels.h"
+
+/* Builds the scalar fallbacks a second time under their own names, so both
+ * paths can run in the same program */
+
+#if defined(__SSE2__)
+#define FLOAT_KERNELS_BENCH_SSE2 1
+#undef __SSE2__
+#endif
+#define float_bounds3 scalar_bounds3
+#define float_min2 scalar_min2
+#define float_add2 scalar_add2
+#define float_transform3 scalar_transform3
+#define float_quantize_u16 scalar_quantize_u16
+#include "float-kernels.c"
+#undef float_bounds3
+#undef float_min2
+#undef float_add2
+#undef float_transform3
+#undef float_quantize_u16
+
+static int FloatKernelsBench_printHelp;
+static int FloatKernelsBench_printVersion;
+static unsigned int FloatKernelsBench_iterations = 100;
+static unsigned int FloatKernelsBench_count = 100000;
+
+static struct option FloatKernelsBench_longOptions[] =
+{
+    { "iterations", required_argument, 0, 'n' },
+    { "count",    required_argument, 0, 'c' },
+    { "help",     no_argument, &FloatKernelsBench_printHelp, 1 },
+    { "version",  no_argument, &FloatKernelsBench_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+/* Data shared by every kernel: `count' XYZ points, or 1.5 times as many UV
+ * pairs, or three times as many scalars */
+static float *FloatKernelsBench_input;
+static float *FloatKernelsBench_outputA, *FloatKernelsBench_outputB;
+static uint16_t *FloatKernelsBench_quantizedA, *FloatKernelsBench_quantizedB;
+
+static const float FloatKernelsBench_matrix[16] =
+{
+  0.8f, 0.6f, 0.0f, 0.0f,
+  -0.6f, 0.8f, 0.0f, 0.0f,
+  0.0f, 0.0f, 2.0f, 0.0f,
+  10.0f, -5.0f, 3.0f, 1.0f
+};
+
+static volatile float FloatKernelsBench_sink;
+
+static double
+FloatKernelsBench_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static void
+FloatKernelsBench_Bounds3 (int scalar, float *result)
+{
+  if (scalar)
+    scalar_bounds3 (FloatKernelsBench_input, FloatKernelsBench_count, result, result + 3);
+  else
+    float_bounds3 (FloatKernelsBench_input, FloatKernelsBench_count, result, result + 3);
+}
+
+static void
+FloatKernelsBench_Min2 (int scalar, float *result)
+{
+  result[0] = result[1] = HUGE_VALF;
+
+  if (scalar)
+    scalar_min2 (FloatKernelsBench_input, FloatKernelsBench_count * 3 / 2, result);
+  else
+    float_min2 (FloatKernelsBench_input, FloatKernelsBench_count * 3 / 2, result);
+}
+
+static void
+FloatKernelsBench_Add2 (int scalar, float *result)
+{
+  if (scalar)
+    scalar_add2 (result, FloatKernelsBench_count * 3 / 2, 0.25f, -0.5f);
+  else
+    float_add2 (result, FloatKernelsBench_count * 3 / 2, 0.25f, -0.5f);
+}
+
+static void
+FloatKernelsBench_Transform3 (int scalar, float *result)
+{
+  if (scalar)
+    scalar_transform3 (result, FloatKernelsBench_count, FloatKernelsBench_matrix);
+  else
+    float_transform3 (result, FloatKernelsBench_count, FloatKernelsBench_matrix);
+}
+
+static void
+FloatKernelsBench_QuantizeU16 (int scalar, float *result)
+{
+  if (scalar)
+    scalar_quantize_u16 (FloatKernelsBench_quantizedB, FloatKernelsBench_input,
+                         FloatKernelsBench_count * 3, 65535.0f);
+  else
+    float_quantize_u16 (FloatKernelsBench_quantizedA, FloatKernelsBench_input,
+                        FloatKernelsBench_count * 3, 65535.0f);
+}
+
+/* Runs one path of a kernel.  In-place kernels restart from the input on
+ * every iteration, outside the timed region.  */
+static double
+FloatKernelsBench_Time (void (*kernel) (int, float *), int scalar, int inPlace, float *result)
+{
+  double start, elapsed = 0.0;
+  unsigned int i;
+
+  for (i = 0; i < FloatKernelsBench_iterations; ++i)
+    {
+      if (inPlace)
+        memcpy (result, FloatKernelsBench_input, FloatKernelsBench_count * 3 * sizeof (float));
+
+      start = FloatKernelsBench_Now ();
+      kernel (scalar, result);
+      elapsed += FloatKernelsBench_Now () - start;
+
+      FloatKernelsBench_sink = result[0];
+    }
+
+  return elapsed;
+}
+
+/* Returns the largest difference between the two paths, relative to the
+ * magnitude of the scalar result */
+static double
+FloatKernelsBench_Compare (size_t count)
+{
+  double error = 0.0, delta;
+  size_t i;
+
+  for (i = 0; i < count; ++i)
+    {
+      delta = fabs (FloatKernelsBench_outputA[i] - FloatKernelsBench_outputB[i])
+              / (fabs (FloatKernelsBench_outputB[i]) + 1.0);
+
+      if (delta > error)
+        error = delta;
+    }
+
+  return error;
+}
+
+static int
+FloatKernelsBench_Run (const char *name, void (*kernel) (int, float *), int inPlace,
+                       size_t outputCount, double tolerance)
+{
+  double simd, scalar, error, elements;
+
+  simd = FloatKernelsBench_Time (kernel, 0, inPlace, FloatKernelsBench_outputA);
+  scalar = FloatKernelsBench_Time (kernel, 1, inPlace, FloatKernelsBench_outputB);
+
+  if (kernel == FloatKernelsBench_QuantizeU16)
+    error = memcmp (FloatKernelsBench_quantizedA, FloatKernelsBench_quantizedB,
+                    FloatKernelsBench_count * 3 * sizeof (uint16_t)) ? 1.0 : 0.0;
+  else
+    error = FloatKernelsBench_Compare (outputCount);
+
+  elements = (double) FloatKernelsBench_count * 3 * FloatKernelsBench_iterations;
+
+  printf ("%-16s %8.1f M floats/s  scalar %8.1f M floats/s  %5.2fx  %s\n", name,
+          elements / simd / 1.0e6, elements / scalar / 1.0e6, scalar / simd,
+          (error <= tolerance) ? "ok" : "MISMATCH");
+
+  return error <= tolerance;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t floatCount;
+  int i, ok = 1;
+
+  while (-1 != (i = getopt_long (argc, argv, "n:c:", FloatKernelsBench_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 'n':
+
+          FloatKernelsBench_iterations = strtol (optarg, 0, 0);
+
+          if (!FloatKernelsBench_iterations)
+            errx (EX_USAGE, "Iteration count must be positive");
+
+          break;
+
+        case 'c':
+
+          FloatKernelsBench_count = strtol (optarg, 0, 0);
+
+          /* Keeps the UV pair count of the two-component kernels whole */
+
+          if (!FloatKernelsBench_count || (FloatKernelsBench_count & 1))
+            errx (EX_USAGE, "Point count must be positive and even");
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (FloatKernelsBench_printHelp)
+    {
+      fprintf (stdout,
+               "Usage: %s [OPTION]...\n"
+               "\n"
+               "Compares the SSE float array kernels against their scalar fallbacks,\n"
+               "checking that both produce the same results.\n"
+               "\n"
+               "  -c, --count=COUNT        process COUNT XYZ points per call\n"
+               "  -n, --iterations=COUNT   call each kernel COUNT times\n"
+               "      --help     display this help and exit\n"
+               "      --version  display version information\n"
+               "\n"
+               "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (FloatKernelsBench_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (optind != argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+#if !defined(FLOAT_KERNELS_BENCH_SSE2)
+  fprintf (stderr, "%s: Built without SSE2; both paths are the scalar fallback\n", argv[0]);
+#endif
+
+  floatCount = (size_t) FloatKernelsBench_count * 3;
+
+  if (!(FloatKernelsBench_input = malloc (floatCount * sizeof (float)))
+      || !(FloatKernelsBench_outputA = malloc (floatCount * sizeof (float)))
+      || !(FloatKernelsBench_outputB = malloc (floatCount * sizeof (float)))
+      || !(FloatKernelsBench_quantizedA = malloc (floatCount * sizeof (uint16_t)))
+      || !(FloatKernelsBench_quantizedB = malloc (floatCount * sizeof (uint16_t))))
+    err (EX_OSERR, "malloc failed");
+
+  /* Values in [0, 1), as both quantizer paths expect non-negative input */
+
+  srand (1);
+
+  for (floatCount = 0; floatCount < (size_t) FloatKernelsBench_count * 3; ++floatCount)
+    FloatKernelsBench_input[floatCount] = (float) rand () / ((float) RAND_MAX + 1.0f);
+
+  ok &= FloatKernelsBench_Run ("bounds3", FloatKernelsBench_Bounds3, 0, 6, 0.0);
+  ok &= FloatKernelsBench_Run ("min2", FloatKernelsBench_Min2, 0, 2, 0.0);
+  ok &= FloatKernelsBench_Run ("add2", FloatKernelsBench_Add2, 1, floatCount, 0.0);
+  ok &= FloatKernelsBench_Run ("transform3", FloatKernelsBench_Transform3, 1, floatCount, 1.0e-6);
+  ok &= FloatKernelsBench_Run ("quantize_u16", FloatKernelsBench_QuantizeU16, 0, 0, 0.0);
+
+  free (FloatKernelsBench_quantizedB);
+  free (FloatKernelsBench_quantizedA);
+  free (FloatKernelsBench_outputB);
+  free (FloatKernelsBench_outputA);
+  free (FloatKernelsBench_input);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,223 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "float-kernels.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__SSE2__)
+static float
+float_min4 (float a, float b, float c, float d)
+{
+  a = (b < a) ? b : a;
+  c = (d < c) ? d : c;
+
+  return (c < a) ? c : a;
+}
+
+static float
+float_max4 (float a, float b, float c, float d)
+{
+  a = (b > a) ? b : a;
+  c = (d > c) ? d : c;
+
+  return (c > a) ? c : a;
+}
+#endif
+
+void
+float_bounds3 (const float *xyz, size_t count, float *min, float *max)
+{
+  size_t i = 0;
+
+  min[0] = max[0] = xyz[0];
+  min[1] = max[1] = xyz[1];
+  min[2] = max[2] = xyz[2];
+
+#if defined(__SSE2__)
+  if (count >= 4)
+    {
+      __m128 minA, minB, minC, maxA, maxB, maxC;
+      float a[4], b[4], c[4];
+
+      /* Four points span three registers with lanes XYZX, YZXY and ZXYZ */
+
+      minA = maxA = _mm_loadu_ps (xyz);
+      minB = maxB = _mm_loadu_ps (xyz + 4);
+      minC = maxC = _mm_loadu_ps (xyz + 8);
+
+      for (i = 4; i + 4 <= count; i += 4)
+        {
+          __m128 va, vb, vc;
+
+          va = _mm_loadu_ps (xyz + i * 3);
+          vb = _mm_loadu_ps (xyz + i * 3 + 4);
+          vc = _mm_loadu_ps (xyz + i * 3 + 8);
+
+          minA = _mm_min_ps (minA, va);
+          minB = _mm_min_ps (minB, vb);
+          minC = _mm_min_ps (minC, vc);
+          maxA = _mm_max_ps (maxA, va);
+          maxB = _mm_max_ps (maxB, vb);
+          maxC = _mm_max_ps (maxC, vc);
+        }
+
+      _mm_storeu_ps (a, minA);
+      _mm_storeu_ps (b, minB);
+      _mm_storeu_ps (c, minC);
+
+      min[0] = float_min4 (a[0], a[3], b[2], c[1]);
+      min[1] = float_min4 (a[1], b[0], b[3], c[2]);
+      min[2] = float_min4 (a[2], b[1], c[0], c[3]);
+
+      _mm_storeu_ps (a, maxA);
+      _mm_storeu_ps (b, maxB);
+      _mm_storeu_ps (c, maxC);
+
+      max[0] = float_max4 (a[0], a[3], b[2], c[1]);
+      max[1] = float_max4 (a[1], b[0], b[3], c[2]);
+      max[2] = float_max4 (a[2], b[1], c[0], c[3]);
+    }
+#endif
+
+  for (; i < count; ++i)
+    {
+      const float *p = xyz + i * 3;
+
+      if (p[0] < min[0]) min[0] = p[0];
+      if (p[0] > max[0]) max[0] = p[0];
+      if (p[1] < min[1]) min[1] = p[1];
+      if (p[1] > max[1]) max[1] = p[1];
+      if (p[2] < min[2]) min[2] = p[2];
+      if (p[2] > max[2]) max[2] = p[2];
+    }
+}
+
+void
+float_min2 (const float *uv, size_t count, float *min)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  if (count >= 2)
+    {
+      __m128 acc;
+      float tmp[4];
+
+      acc = _mm_setr_ps (min[0], min[1], min[0], min[1]);
+
+      for (; i + 2 <= count; i += 2)
+        acc = _mm_min_ps (acc, _mm_loadu_ps (uv + i * 2));
+
+      _mm_storeu_ps (tmp, acc);
+
+      min[0] = (tmp[0] < tmp[2]) ? tmp[0] : tmp[2];
+      min[1] = (tmp[1] < tmp[3]) ? tmp[1] : tmp[3];
+    }
+#endif
+
+  for (; i < count; ++i)
+    {
+      if (uv[i * 2] < min[0])
+        min[0] = uv[i * 2];
+
+      if (uv[i * 2 + 1] < min[1])
+        min[1] = uv[i * 2 + 1];
+    }
+}
+
+void
+float_add2 (float *uv, size_t count, float a, float b)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  __m128 bias;
+
+  bias = _mm_setr_ps (a, b, a, b);
+
+  for (; i + 2 <= count; i += 2)
+    _mm_storeu_ps (uv + i * 2, _mm_add_ps (_mm_loadu_ps (uv + i * 2), bias));
+#endif
+
+  for (; i < count; ++i)
+    {
+      uv[i * 2] += a;
+      uv[i * 2 + 1] += b;
+    }
+}
+
+void
+float_transform3 (float *xyz, size_t count, const float *m)
+{
+  size_t i;
+
+#if defined(__SSE2__)
+  __m128 c0, c1, c2, c3;
+
+  c0 = _mm_loadu_ps (m);
+  c1 = _mm_loadu_ps (m + 4);
+  c2 = _mm_loadu_ps (m + 8);
+  c3 = _mm_loadu_ps (m + 12);
+
+  for (i = 0; i < count; ++i)
+    {
+      float *p = xyz + i * 3;
+      __m128 r;
+
+      r = _mm_add_ps (_mm_add_ps (_mm_mul_ps (c0, _mm_set1_ps (p[0])),
+                                  _mm_mul_ps (c1, _mm_set1_ps (p[1]))),
+                      _mm_add_ps (_mm_mul_ps (c2, _mm_set1_ps (p[2])), c3));
+
+      _mm_storel_pi ((__m64 *) p, r);
+      _mm_store_ss (p + 2, _mm_movehl_ps (r, r));
+    }
+#else
+  for (i = 0; i < count; ++i)
+    {
+      float *p = xyz + i * 3;
+      float x, y, z;
+
+      x = p[0];
+      y = p[1];
+      z = p[2];
+
+      p[0] = x * m[0] + y * m[4] + z * m[8]  + m[12];
+      p[1] = x * m[1] + y * m[5] + z * m[9]  + m[13];
+      p[2] = x * m[2] + y * m[6] + z * m[10] + m[14];
+    }
+#endif
+}
+
+void
+float_quantize_u16 (uint16_t *output, const float *input, size_t count, float scale)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  __m128 s;
+
+  s = _mm_set1_ps (scale);
+
+  for (; i + 8 <= count; i += 8)
+    {
+      __m128i lo, hi;
+
+      lo = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (input + i), s));
+      hi = _mm_cvttps_epi32 (_mm_mul_ps (_mm_loadu_ps (input + i + 4), s));
+
+      /* Sign extend the low 16 bits so the saturating pack keeps them intact */
+
+      lo = _mm_srai_epi32 (_mm_slli_epi32 (lo, 16), 16);
+      hi = _mm_srai_epi32 (_mm_slli_epi32 (hi, 16), 16);
+
+      _mm_storeu_si128 ((__m128i *) (output + i), _mm_packs_epi32 (lo, hi));
+    }
+#endif
+
+  for (; i < count; ++i)
+    output[i] = (uint16_t) (unsigned int) (input[i] * scale);
+}
@@ -0,0 +1,42 @@
+#ifndef FLOAT_KERNELS_H_
+#define FLOAT_KERNELS_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Whole-array kernels over flat float arrays.  Each kernel has an SSE
+ * implementation and a scalar fallback selected at compile time.  */
+
+/* Finds the component-wise bounds of `count' interleaved XYZ points.  The
+ * result is undefined if `count' is zero.  */
+void
+float_bounds3 (const float *xyz, size_t count, float *min, float *max);
+
+/* Finds the component-wise minimum of `count' interleaved pairs, starting
+ * from the values already in `min'.  */
+void
+float_min2 (const float *uv, size_t count, float *min);
+
+/* Adds (`a', `b') to `count' interleaved pairs.  */
+void
+float_add2 (float *uv, size_t count, float a, float b);
+
+/* Transforms `count' interleaved XYZ points in place by a column major 4x4
+ * affine matrix.  */
+void
+float_transform3 (float *xyz, size_t count, const float *matrix);
+
+/* Stores the low 16 bits of each value multiplied by `scale' and truncated
+ * toward zero.  Inputs are expected to be non-negative.  */
+void
+float_quantize_u16 (uint16_t *output, const float *input, size_t count, float scale);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !FLOAT_KERNELS_H_ */
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <png.h>
 
 #include "png-wrapper.h"
@@ -89,93 +90,281 @@ png_write (const char *file_name, unsigned int width, unsigned int height, unsig
 }
 
 int
-png_load (const char* path, void **ret_data, unsigned int *ret_width, unsigned int *ret_height)
+png_save (const char *path, const void *data, unsigned int width, unsigned int height)
 {
-  FILE* f;
-  png_bytep* rows;
+  FILE *volatile file;
+  png_bytepp volatile rows = NULL;
   png_structp png;
-  png_infop pnginfo;
-  png_uint_32 width, height;
-  unsigned char* data;
+  png_infop info;
   unsigned int row;
-  int bit_depth, pixel_format, interlace_type;
-  f = fopen(path, "rb");
 
-  if(!f)
-    err(EXIT_FAILURE, "Failed to open '%s'", path);
+  if (!(file = fopen (path, "wb")))
+    {
+      warn ("Failed to open `%s' for writing", path);
 
-  png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+      return -1;
+    }
 
-  if(png == NULL)
-    errx(EXIT_FAILURE, "png_create_read_struct failed");
+  if (!(png = png_create_write_struct (PNG_LIBPNG_VER_STRING, 0, 0, 0))
+      || !(info = png_create_info_struct (png)))
+    {
+      warnx ("Failed to initialize libpng");
+      png_destroy_write_struct (&png, png_infopp_NULL);
+      fclose (file);
 
-  pnginfo = png_create_info_struct(png);
+      return -1;
+    }
 
-  if(pnginfo == NULL)
-    errx(EXIT_FAILURE, "png_create_info_struct failed");
+  if (setjmp (png_jmpbuf (png)))
+    {
+      warnx ("Failed to write `%s'", path);
+      png_destroy_write_struct (&png, &info);
+      fclose (file);
+      free (rows);
+
+      return -1;
+    }
 
-  if(setjmp(png_jmpbuf(png)))
-    errx(EXIT_FAILURE, "PNG decoding failed (%s)", path);
+  if (!(rows = malloc (height * sizeof (png_bytep))))
+    png_error (png, "malloc failed");
 
-  png_init_io(png, f);
+  for (row = 0; row < height; ++row)
+    rows[row] = (png_bytep) data + (size_t) (height - row - 1) * width * 4;
 
-  png_read_info(png, pnginfo);
+  png_init_io (png, file);
 
-  png_get_IHDR(png, pnginfo, &width, &height, &bit_depth, &pixel_format,
-               &interlace_type, int_p_NULL, int_p_NULL);
+  png_set_IHDR (png, info, width, height,
+                8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+                PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+  png_write_info (png, info);
+  png_set_swap_alpha (png);
+  png_write_image (png, rows);
+  png_write_end (png, info);
 
-  if(bit_depth != 8)
-    errx(EXIT_FAILURE, "Unsupported bit depth %d in %s", bit_depth, path);
+  png_destroy_write_struct (&png, &info);
+  free (rows);
 
-  switch (pixel_format)
+  if (ferror (file) | fclose (file))
     {
-    case PNG_COLOR_TYPE_GRAY:
+      warn ("Failed to write `%s'", path);
 
-      png_set_add_alpha (png, 0xff, PNG_FILLER_BEFORE);
+      return -1;
+    }
 
-    case PNG_COLOR_TYPE_GRAY_ALPHA:
+  return 0;
+}
 
-      png_set_gray_to_rgb (png);
+struct png_stream
+{
+  FILE *file;
+  png_structp png;
+  png_infop info;
+  unsigned int width, height, row;
 
-      break;
+  /* Interlaced images are decoded completely when opened, since every
+   * pass touches every row */
+  unsigned char *image;
 
-    case PNG_COLOR_TYPE_RGB_ALPHA:
+  int failed;
+};
 
-      break;
+struct png_stream *
+png_stream_open (const char *path, unsigned int *ret_width, unsigned int *ret_height,
+                 int *ret_has_alpha)
+{
+  struct png_stream *volatile stream;
+  png_uint_32 width, height, row;
+  png_bytep *volatile rows = NULL;
+  int bit_depth, pixel_format, interlace_type, has_alpha;
 
-    case PNG_COLOR_TYPE_PALETTE:
+  if (!(stream = calloc (1, sizeof (*stream))))
+    {
+      warn ("calloc failed");
 
-      png_set_palette_to_rgb (png);
+      return NULL;
+    }
 
-    case PNG_COLOR_TYPE_RGB:
+  if (!(stream->file = fopen (path, "rb")))
+    {
+      warn ("Failed to open '%s'", path);
+      free (stream);
 
-      png_set_add_alpha (png, 0xff, PNG_FILLER_BEFORE);
+      return NULL;
+    }
 
-      break;
+  if (!(stream->png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL))
+      || !(stream->info = png_create_info_struct (stream->png)))
+    {
+      warnx ("Failed to create PNG reader");
+      png_stream_close (stream);
+
+      return NULL;
+    }
 
-    default:
+  if (setjmp (png_jmpbuf (stream->png)))
+    {
+      warnx ("PNG decoding failed (%s)", path);
+      free (rows);
+      png_stream_close (stream);
 
-      errx (EXIT_FAILURE, "Unsupported pixel format %d", pixel_format);
+      return NULL;
     }
 
-  png_set_swap_alpha (png);
+  png_init_io (stream->png, stream->file);
+
+  png_read_info (stream->png, stream->info);
 
-  data = malloc(height * width * 4);
+  png_get_IHDR (stream->png, stream->info, &width, &height, &bit_depth, &pixel_format,
+                &interlace_type, int_p_NULL, int_p_NULL);
 
-  rows = malloc(sizeof(png_bytep) * height);
+  has_alpha = (pixel_format & PNG_COLOR_MASK_ALPHA)
+              || png_get_valid (stream->png, stream->info, PNG_INFO_tRNS);
+
+  /* Convert every format to 8 bit ARGB while decoding */
+
+  if (pixel_format == PNG_COLOR_TYPE_PALETTE || bit_depth < 8
+      || png_get_valid (stream->png, stream->info, PNG_INFO_tRNS))
+    png_set_expand (stream->png);
+
+  if (bit_depth == 16)
+    {
+#ifdef PNG_READ_SCALE_16_TO_8_SUPPORTED
+      png_set_scale_16 (stream->png);
+#else
+      png_set_strip_16 (stream->png);
+#endif
+    }
 
-  for(row = 0; row < height; ++row)
-    rows[row] = data + (height - row - 1) * width * 4;
+  if (!(pixel_format & PNG_COLOR_MASK_COLOR))
+    png_set_gray_to_rgb (stream->png);
 
-  png_read_image(png, rows);
+  if (!has_alpha)
+    png_set_add_alpha (stream->png, 0xff, PNG_FILLER_BEFORE);
+
+  png_set_swap_alpha (stream->png);
+
+  if (interlace_type != PNG_INTERLACE_NONE)
+    png_set_interlace_handling (stream->png);
+
+  png_read_update_info (stream->png, stream->info);
+
+  if (png_get_rowbytes (stream->png, stream->info) != (size_t) width * 4)
+    {
+      warnx ("Unsupported pixel format %d in %s", pixel_format, path);
+      png_stream_close (stream);
+
+      return NULL;
+    }
+
+  stream->width = width;
+  stream->height = height;
+
+  if (interlace_type != PNG_INTERLACE_NONE)
+    {
+      if (!(stream->image = malloc ((size_t) width * height * 4))
+          || !(rows = malloc (sizeof (*rows) * height)))
+        {
+          warn ("malloc failed");
+          free (rows);
+          png_stream_close (stream);
 
-  free(rows);
+          return NULL;
+        }
 
-  png_read_end(png, pnginfo);
+      for (row = 0; row < height; ++row)
+        rows[row] = stream->image + (size_t) row * width * 4;
 
-  png_destroy_read_struct(&png, &pnginfo, png_infopp_NULL);
+      png_read_image (stream->png, rows);
+
+      free (rows);
+    }
+
+  *ret_width = width;
+  *ret_height = height;
+
+  if (ret_has_alpha)
+    *ret_has_alpha = has_alpha;
+
+  return stream;
+}
+
+int
+png_stream_read (struct png_stream *stream, void *data, unsigned int count)
+{
+  unsigned char *output = data;
+  unsigned int i;
+
+  if (stream->failed || count > stream->height - stream->row)
+    return -1;
+
+  if (stream->image)
+    {
+      memcpy (output, stream->image + (size_t) stream->row * stream->width * 4,
+              (size_t) count * stream->width * 4);
+      stream->row += count;
+
+      return 0;
+    }
+
+  if (setjmp (png_jmpbuf (stream->png)))
+    {
+      warnx ("PNG decoding failed");
+      stream->failed = 1;
+
+      return -1;
+    }
+
+  for (i = 0; i < count; ++i, ++stream->row)
+    png_read_row (stream->png, output + (size_t) i * stream->width * 4, NULL);
+
+  return 0;
+}
+
+void
+png_stream_close (struct png_stream *stream)
+{
+  if (stream->png)
+    png_destroy_read_struct (&stream->png, stream->info ? &stream->info : png_infopp_NULL,
+                             png_infopp_NULL);
+
+  fclose (stream->file);
+  free (stream->image);
+  free (stream);
+}
+
+int
+png_load (const char* path, void **ret_data, unsigned int *ret_width, unsigned int *ret_height)
+{
+  struct png_stream *stream;
+  unsigned char *data;
+  unsigned int width, height, row;
+
+  if (!(stream = png_stream_open (path, &width, &height, NULL)))
+    return -1;
+
+  if (!(data = malloc ((size_t) width * height * 4)))
+    {
+      warn ("malloc failed");
+      png_stream_close (stream);
+
+      return -1;
+    }
+
+  /* Rows are stored bottom first */
+
+  for (row = 0; row < height; ++row)
+    {
+      if (-1 == png_stream_read (stream, data + (size_t) (height - row - 1) * width * 4, 1))
+        {
+          free (data);
+          png_stream_close (stream);
+
+          return -1;
+        }
+    }
 
-  fclose(f);
+  png_stream_close (stream);
 
   *ret_data = data;
   *ret_width = width;
@@ -8,9 +8,36 @@ extern "C" {
 int
 png_write (const char *file_name, unsigned int width, unsigned int height, unsigned char* data);
 
+/* Saves an ARGB image, with rows stored bottom first as returned by
+ * png_load.  Returns -1 on failure, after printing a warning.  */
+int
+png_save (const char *path, const void *data, unsigned int width, unsigned int height);
+
+/* Loads a PNG image as ARGB, with rows stored bottom first.  Returns -1 on
+ * failure, after printing a warning.  */
 int
 png_load (const char* path, void **ret_data, unsigned int *ret_width, unsigned int *ret_height);
 
+struct png_stream;
+
+/* Opens a PNG image for reading a band of rows at a time, so the whole
+ * image need not be in memory.  Palette, grey, 16 bit and interlaced
+ * images are converted to 8 bit ARGB; interlaced images are decoded
+ * completely when opened.  `ret_has_alpha', if not NULL, is set when the
+ * image has an alpha channel or transparent colour.  Returns NULL on
+ * failure, after printing a warning.  */
+struct png_stream *
+png_stream_open (const char *path, unsigned int *ret_width, unsigned int *ret_height,
+                 int *ret_has_alpha);
+
+/* Reads the next `count' rows as ARGB, top row first.  Returns -1 on
+ * failure, after printing a warning.  */
+int
+png_stream_read (struct png_stream *stream, void *data, unsigned int count);
+
+void
+png_stream_close (struct png_stream *stream);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
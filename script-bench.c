@@ -0,0 +1,213 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "script-vm.h"
+
+static int ScriptBench_printHelp;
+static int ScriptBench_printVersion;
+static unsigned int ScriptBench_iterations = 100;
+
+static struct option ScriptBench_longOptions[] =
+{
+    { "iterations", required_argument, 0, 'n' },
+    { "help",     no_argument, &ScriptBench_printHelp, 1 },
+    { "version",  no_argument, &ScriptBench_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+static double
+ScriptBench_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static void
+ScriptBench_ReadFile (const char *path, void **data, size_t *size)
+{
+  FILE *file;
+  long length;
+
+  if (!(file = fopen (path, "rb")))
+    err (EXIT_FAILURE, "Failed to open `%s' for reading", path);
+
+  if (-1 == fseek (file, 0, SEEK_END)
+      || -1 == (length = ftell (file))
+      || -1 == fseek (file, 0, SEEK_SET))
+    err (EXIT_FAILURE, "Failed to get size of `%s'", path);
+
+  /* malloc alignment is sufficient for pointers */
+
+  if (!(*data = malloc (length ? length : 1)))
+    err (EXIT_FAILURE, "malloc failed");
+
+  if (length != (long) fread (*data, 1, length, file))
+    err (EXIT_FAILURE, "Failed to read `%s'", path);
+
+  fclose (file);
+
+  *size = length;
+}
+
+/* Evaluates every parameter of every statement reachable from `statement',
+ * and returns the number of expressions evaluated.  */
+static size_t
+ScriptBench_EvaluateAll (const struct script_vm_file *file,
+                         const char *statement, float *checksum)
+{
+  size_t result = 0;
+
+  for (; statement; statement = script_vm_statement_next (file, statement))
+    {
+      size_t i, count;
+
+      count = script_vm_statement_parameter_count (file, statement);
+
+      for (i = 0; i < count; ++i)
+        {
+          struct script_vm_value value;
+
+          if (-1 == script_vm_evaluate (file, script_vm_statement_parameter_at (file, statement, i),
+                                        &value))
+            continue;
+
+          ++result;
+
+          if (value.type == ScriptVMValueFloat)
+            *checksum += value.v.v_float;
+          else if (value.type == ScriptVMValueU32)
+            *checksum += value.v.u32;
+          else if (value.type == ScriptVMValueStatement)
+            result += ScriptBench_EvaluateAll (file, value.v.statement, checksum);
+        }
+    }
+
+  return result;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct script_vm_file file;
+  void *pristine, *copy;
+  size_t size, evaluations = 0;
+  double start, mapTime = 0.0, relocateTime = 0.0, evaluateTime;
+  float checksum = 0.0f;
+  unsigned int iteration;
+  int i;
+
+  while (-1 != (i = getopt_long (argc, argv, "n:", ScriptBench_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 'n':
+
+          ScriptBench_iterations = strtol (optarg, 0, 0);
+
+          if (!ScriptBench_iterations)
+            errx (EX_USAGE, "Iteration count must be positive");
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (ScriptBench_printHelp)
+    {
+      fprintf (stdout,
+               "Usage: %s [OPTION]... SCRIPT\n"
+               "\n"
+               "Measures loading, relocation and evaluation of a binary script.  Scripts\n"
+               "with absolute pointers must use the native pointer size.\n"
+               "\n"
+               "  -n, --iterations=COUNT   repeat each measurement COUNT times\n"
+               "      --help     display this help and exit\n"
+               "      --version  display version information\n"
+               "\n"
+               "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (ScriptBench_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (optind + 1 != argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]... SCRIPT", argv[0]);
+
+  ScriptBench_ReadFile (argv[optind], &pristine, &size);
+
+  if (!(copy = malloc (size ? size : 1)))
+    err (EXIT_FAILURE, "malloc failed");
+
+  for (iteration = 0; iteration < ScriptBench_iterations; ++iteration)
+    {
+      start = ScriptBench_Now ();
+
+      if (-1 == script_vm_load (&file, argv[optind]))
+        err (EXIT_FAILURE, "Failed to load `%s'", argv[optind]);
+
+      mapTime += ScriptBench_Now () - start;
+
+      script_vm_unload (&file);
+
+      memcpy (copy, pristine, size);
+
+      start = ScriptBench_Now ();
+
+      if (-1 == script_vm_load_memory (&file, copy, size))
+        err (EXIT_FAILURE, "Failed to relocate `%s'", argv[optind]);
+
+      relocateTime += ScriptBench_Now () - start;
+    }
+
+  start = ScriptBench_Now ();
+
+  for (iteration = 0; iteration < ScriptBench_iterations; ++iteration)
+    evaluations += ScriptBench_EvaluateAll (&file, file.root, &checksum);
+
+  evaluateTime = ScriptBench_Now () - start;
+
+  printf ("File size:      %zu bytes\n", size);
+  printf ("Load:           %.3f ms (mmap and relocate)\n",
+          mapTime * 1.0e3 / ScriptBench_iterations);
+  printf ("Relocate:       %.3f ms (%.1f MB/s)\n",
+          relocateTime * 1.0e3 / ScriptBench_iterations,
+          size * ScriptBench_iterations / relocateTime / 1.0e6);
+  printf ("Evaluate:       %.3f ms per pass, %.2f M expressions/s\n",
+          evaluateTime * 1.0e3 / ScriptBench_iterations,
+          evaluations / evaluateTime / 1.0e6);
+  printf ("Checksum:       %g\n", checksum);
+
+  script_vm_unload (&file);
+  free (copy);
+  free (pristine);
+
+  return EXIT_SUCCESS;
+}
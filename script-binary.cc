@@ -9,98 +9,209 @@
 #include <string.h>
 #include <sysexits.h>
 
+#include <algorithm>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "script.h"
+#include "script-schema.h"
 #include "script-vm.h"
 
-static std::vector<uint32_t> script_pointerOffsets;
+#define SCRIPT_FLUSH_THRESHOLD (64 * 1024)
 
-static size_t SCRIPT_dumpOffset;
-static int SCRIPT_64bit, SCRIPT_pointerAlign;
+/* Output state for one binary script.  Bytes not yet handed to the sink
+ * start at file offset `bufferOffset'.  Nothing at or after `patchOffset'
+ * is flushed, so a pointer stored there can still be patched.  A writer
+ * without a file keeps everything in `buffer'.  */
+struct script_writer
+{
+  FILE *file;
+
+  std::vector<unsigned char> buffer;
+  size_t bufferOffset;
+  size_t patchOffset;
+
+  size_t dumpOffset;
+  unsigned int flags;
+  int is64bit;
+  unsigned int pointerAlign;
+
+  std::vector<uint32_t> pointerOffsets;
+
+  /* Interned identifiers and signatures, in order of first use */
+  std::unordered_map<std::string, uint32_t> stringIds;
+  std::vector<std::string> strings;
+
+  /* Statements whose signature is in the schema are laid out as the
+   * structs of its generated header */
+  const struct script_schema *schema;
+
+  /* State for script_writer_stream_*: offset of the first statement, and
+   * offset of the `next' pointer of the most recently emitted one.  */
+  off_t streamRoot;
+  size_t streamNext;
+};
 
 static void
-SCRIPT_EmitStatement (struct ScriptStatement *statement);
+SCRIPT_EmitStatement (struct script_writer *writer,
+                      struct ScriptStatement *statement);
 
 static void
-SCRIPT_EmitByte (unsigned int byte)
+SCRIPT_Write (struct script_writer *writer, const void *data, size_t size)
 {
-  putchar (byte & 0xff);
-  SCRIPT_dumpOffset++;
+  if (size != fwrite (data, 1, size, writer->file))
+    err (EX_IOERR, "Error writing binary script");
 }
 
 static void
-SCRIPT_EmitU32 (unsigned int u32)
+SCRIPT_Flush (struct script_writer *writer)
 {
-  assert (!(SCRIPT_dumpOffset & 3));
+  size_t length;
+
+  if (!writer->file)
+    return;
+
+  length = writer->buffer.size ();
 
-  putchar (u32 & 0xff);
-  putchar ((u32 >> 8) & 0xff);
-  putchar ((u32 >> 16) & 0xff);
-  putchar ((u32 >> 24) & 0xff);
-  SCRIPT_dumpOffset += 4;
+  if (writer->patchOffset != (size_t) -1)
+    length = writer->patchOffset - writer->bufferOffset;
+
+  if (!length)
+    return;
+
+  SCRIPT_Write (writer, &writer->buffer[0], length);
+
+  writer->buffer.erase (writer->buffer.begin (), writer->buffer.begin () + length);
+  writer->bufferOffset += length;
 }
 
 static void
-SCRIPT_EmitVarInt (unsigned int u32)
+SCRIPT_EmitBytes (struct script_writer *writer, const void *data, size_t size)
 {
-  if (u32 > (0x7f << 14))
+  const unsigned char *bytes = (const unsigned char *) data;
+
+  /* Large blocks bypass the buffer unless a pointer patch is pending */
+
+  if (writer->file
+      && size >= SCRIPT_FLUSH_THRESHOLD
+      && writer->patchOffset == (size_t) -1)
     {
-      putchar (((u32 >> 21) & 0x7f) | 0x80);
-      ++SCRIPT_dumpOffset;
+      SCRIPT_Flush (writer);
+      SCRIPT_Write (writer, bytes, size);
+
+      writer->bufferOffset += size;
+      writer->dumpOffset += size;
+
+      return;
     }
 
+  writer->buffer.insert (writer->buffer.end (), bytes, bytes + size);
+  writer->dumpOffset += size;
+
+  if (writer->buffer.size () >= SCRIPT_FLUSH_THRESHOLD
+      && writer->patchOffset == (size_t) -1)
+    SCRIPT_Flush (writer);
+}
+
+static void
+SCRIPT_EmitByte (struct script_writer *writer, unsigned int byte)
+{
+  unsigned char data = byte;
+
+  SCRIPT_EmitBytes (writer, &data, 1);
+}
+
+static void
+SCRIPT_EmitU32 (struct script_writer *writer, unsigned int u32)
+{
+  unsigned char data[4];
+
+  assert (!(writer->dumpOffset & 3));
+
+  data[0] = u32;
+  data[1] = u32 >> 8;
+  data[2] = u32 >> 16;
+  data[3] = u32 >> 24;
+
+  SCRIPT_EmitBytes (writer, data, sizeof (data));
+}
+
+static void
+SCRIPT_EmitVarInt (struct script_writer *writer, unsigned int u32)
+{
+  unsigned char data[4];
+  size_t size = 0;
+
+  if (u32 > (0x7f << 14))
+    data[size++] = ((u32 >> 21) & 0x7f) | 0x80;
+
   if (u32 > (0x7f << 7))
-    {
-      putchar (((u32 >> 14) & 0x7f) | 0x80);
-      ++SCRIPT_dumpOffset;
-    }
+    data[size++] = ((u32 >> 14) & 0x7f) | 0x80;
 
   if (u32 > 0x7f)
-    {
-      putchar (((u32 >> 7) & 0x7f) | 0x80);
-      ++SCRIPT_dumpOffset;
-    }
+    data[size++] = ((u32 >> 7) & 0x7f) | 0x80;
 
-  putchar (u32 & 0x7f);
-  ++SCRIPT_dumpOffset;
+  data[size++] = u32 & 0x7f;
+
+  SCRIPT_EmitBytes (writer, data, size);
 }
 
+/* Encodes a pointer to `ptr' stored at file offset `offset'.  Relative
+ * pointers hold the signed distance from their own location, with 0
+ * meaning NULL.  */
 static void
-SCRIPT_EmitPointer (off_t ptr)
+SCRIPT_EncodePointer (const struct script_writer *writer,
+                      unsigned char *data, size_t offset, off_t ptr)
 {
-  assert (!(SCRIPT_dumpOffset & 3));
+  unsigned int i, size;
+  uint64_t value;
 
-  if (ptr)
-    script_pointerOffsets.push_back (SCRIPT_dumpOffset);
+  size = writer->is64bit ? 8 : 4;
+  value = ptr;
 
-  putchar (ptr & 0xff);
-  putchar ((ptr >> 8) & 0xff);
-  putchar ((ptr >> 16) & 0xff);
-  putchar ((ptr >> 24) & 0xff);
+  if ((writer->flags & SCRIPT_WRITER_RELATIVE) && ptr)
+    value = (uint32_t) (int32_t) (ptr - (off_t) offset);
 
-  SCRIPT_dumpOffset += 4;
+  for (i = 0; i < size; ++i)
+    data[i] = (value >> (i * 8)) & 0xff;
+}
 
-  if (SCRIPT_64bit)
-    {
-      putchar ((ptr >> 32) & 0xff);
-      putchar ((ptr >> 40) & 0xff);
-      putchar ((ptr >> 48) & 0xff);
-      putchar ((ptr >> 56) & 0xff);
+static void
+SCRIPT_EmitPointer (struct script_writer *writer, off_t ptr)
+{
+  unsigned char data[8];
 
-      SCRIPT_dumpOffset += 4;
-    }
+  assert (!(writer->dumpOffset & 3));
+
+  if (ptr && !(writer->flags & SCRIPT_WRITER_RELATIVE))
+    writer->pointerOffsets.push_back (writer->dumpOffset);
+
+  SCRIPT_EncodePointer (writer, data, writer->dumpOffset, ptr);
+  SCRIPT_EmitBytes (writer, data, writer->is64bit ? 8 : 4);
 }
 
+/* Stores `ptr' in a pointer previously emitted at `offset', which must not
+ * have been flushed yet.  */
 static void
-SCRIPT_Align (unsigned int bias, unsigned int mask)
+SCRIPT_PatchPointer (struct script_writer *writer, size_t offset, off_t ptr)
 {
-  while ((SCRIPT_dumpOffset + bias) & mask)
-    SCRIPT_EmitByte (0xaa);
+  assert (offset >= writer->bufferOffset);
+
+  SCRIPT_EncodePointer (writer, &writer->buffer[offset - writer->bufferOffset],
+                        offset, ptr);
+}
+
+static void
+SCRIPT_Align (struct script_writer *writer, unsigned int bias, unsigned int mask)
+{
+  while ((writer->dumpOffset + bias) & mask)
+    SCRIPT_EmitByte (writer, 0xaa);
 }
 
 static off_t
-SCRIPT_EmitNumeric (const char *numeric, double scale)
+SCRIPT_EmitNumeric (struct script_writer *writer,
+                    const char *numeric, double scale)
 {
   off_t result;
 
@@ -110,115 +221,132 @@ SCRIPT_EmitNumeric (const char *numeric, double scale)
       uint32_t v_floatAsU32;
     } v_float;
 
+  unsigned char data[5];
+  uint32_t value = 0;
   char *end;
 
-  SCRIPT_Align (1, 3);
+  SCRIPT_Align (writer, 1, 3);
+
+  result = writer->dumpOffset;
 
-  result = SCRIPT_dumpOffset;
+  data[0] = ScriptVMExpressionFloat;
 
   if (!scale)
     {
-      int16_t v_longlong;
+      long long v_longlong;
 
       v_longlong = strtoll (numeric, &end, 0);
 
       if (!*end && v_longlong >= 0 && v_longlong <= 0x7FFFFFFF)
         {
-          SCRIPT_EmitByte (ScriptVMExpressionU32);
-          SCRIPT_EmitByte (v_longlong & 0xFF);
-          SCRIPT_EmitByte ((v_longlong >> 8) & 0xFF);
-          SCRIPT_EmitByte ((v_longlong >> 16) & 0xFF);
-          SCRIPT_EmitByte ((v_longlong >> 24) & 0xFF);
-
-          return result;
+          data[0] = ScriptVMExpressionU32;
+          value = v_longlong;
         }
     }
 
-  v_float.v_float = strtod (numeric, &end);
+  if (data[0] == ScriptVMExpressionFloat)
+    {
+      v_float.v_float = strtod (numeric, &end);
+
+      if (scale)
+        v_float.v_float *= scale;
 
-  if (scale)
-    v_float.v_float *= scale;
+      assert (!*end);
+
+      value = v_float.v_floatAsU32;
+    }
 
-  assert (!*end);
+  data[1] = value;
+  data[2] = value >> 8;
+  data[3] = value >> 16;
+  data[4] = value >> 24;
 
-  SCRIPT_EmitByte (ScriptVMExpressionFloat);
-  SCRIPT_EmitByte (v_float.v_floatAsU32 & 0xFF);
-  SCRIPT_EmitByte ((v_float.v_floatAsU32 >> 8) & 0xFF);
-  SCRIPT_EmitByte ((v_float.v_floatAsU32 >> 16) & 0xFF);
-  SCRIPT_EmitByte ((v_float.v_floatAsU32 >> 24) & 0xFF);
+  SCRIPT_EmitBytes (writer, data, sizeof (data));
 
   return result;
 }
 
 static void
-SCRIPT_EmitStringBytes (const char *string)
+SCRIPT_EmitStringBytes (struct script_writer *writer, const char *string)
 {
-  while (*string)
-    SCRIPT_EmitByte (*string++);
+  SCRIPT_EmitBytes (writer, string, strlen (string));
 }
 
 static off_t
-SCRIPT_EmitString (const char *string)
+SCRIPT_EmitString (struct script_writer *writer, const char *string)
 {
   off_t result;
 
-  result = SCRIPT_dumpOffset;
+  result = writer->dumpOffset;
 
-  SCRIPT_EmitByte (ScriptVMExpressionString);
+  SCRIPT_EmitByte (writer, ScriptVMExpressionString);
 
-  SCRIPT_EmitStringBytes (string);
+  SCRIPT_EmitStringBytes (writer, string);
 
-  SCRIPT_EmitByte (0);
+  SCRIPT_EmitByte (writer, 0);
 
   return result;
 }
 
 static off_t
-SCRIPT_EmitBinary (const char *string)
+SCRIPT_EmitBinary (struct script_writer *writer, const struct ScriptBinary *binary)
 {
   off_t result;
-  size_t i, length = 0;
-  const unsigned char *c;
 
-  length = strlen (string) / 2;
+  SCRIPT_Align (writer, 1, 3);
+
+  result = writer->dumpOffset;
+
+  SCRIPT_EmitByte (writer, ScriptVMExpressionBinary);
+  SCRIPT_EmitU32 (writer, binary->size);
+  SCRIPT_EmitBytes (writer, binary->data, binary->size);
+
+  return result;
+}
 
-  SCRIPT_Align (1, 3);
+static uint32_t
+SCRIPT_InternString (struct script_writer *writer, const std::string &string)
+{
+  auto inserted = writer->stringIds.insert (std::make_pair (string, writer->strings.size ()));
 
-  result = SCRIPT_dumpOffset;
+  if (inserted.second)
+    writer->strings.push_back (string);
 
-  SCRIPT_EmitByte (ScriptVMExpressionBinary);
-  SCRIPT_EmitU32 (length);
+  return inserted.first->second;
+}
 
-  c = (const unsigned char *) string;
+static off_t
+SCRIPT_EmitIdentifier (struct script_writer *writer, const char *string)
+{
+  off_t result;
 
-  for (i = 0; i < length; ++i, c += 2)
+  if (writer->flags & SCRIPT_WRITER_STRING_TABLE)
     {
-      static const unsigned char helper[] =
-        {
-          0, 10, 11, 12, 13, 14, 15,  0,
-          0,  0,  0,  0,  0,  0,  0,  0,
-          0,  1,  2,  3,  4,  5,  6,  7,
-          8,  9,  0,  0,  0,  0,  0,  0
-        };
+      SCRIPT_Align (writer, 1, 3);
+
+      result = writer->dumpOffset;
+
+      SCRIPT_EmitByte (writer, ScriptVMExpressionIdentifier);
+      SCRIPT_EmitU32 (writer, SCRIPT_InternString (writer, string));
 
-      SCRIPT_EmitByte ((helper[c[0] & 0x1f] << 4) | helper[c[1] & 0x1f]);
+      return result;
     }
 
-  return result;
-}
+  SCRIPT_Align (writer, 1, writer->pointerAlign);
 
-static void
-SCRIPT_EmitIdentifier (const char *string)
-{
-  SCRIPT_EmitByte (ScriptVMExpressionIdentifier);
+  result = writer->dumpOffset;
+
+  SCRIPT_EmitByte (writer, ScriptVMExpressionIdentifier);
 
-  SCRIPT_EmitStringBytes (string);
+  SCRIPT_EmitStringBytes (writer, string);
 
-  SCRIPT_EmitByte (0);
+  SCRIPT_EmitByte (writer, 0);
+
+  return result;
 }
 
 static void
-SCRIPT_EmitExpression (struct ScriptExpression *expression)
+SCRIPT_EmitExpression (struct script_writer *writer, struct ScriptExpression *expression)
 {
   if (expression->offset)
     return;
@@ -227,211 +355,648 @@ SCRIPT_EmitExpression (struct ScriptExpression *expression)
     {
     case ScriptExpressionNumeric:
 
-      expression->offset = SCRIPT_EmitNumeric (expression->lhs.numeric, expression->scale);
+      expression->offset = SCRIPT_EmitNumeric (writer, expression->lhs.numeric, expression->scale);
 
       break;
 
     case ScriptExpressionString:
 
-      expression->offset = SCRIPT_EmitString (expression->lhs.string);
+      expression->offset = SCRIPT_EmitString (writer, expression->lhs.string);
 
       break;
 
     case ScriptExpressionBinary:
 
-      expression->offset = SCRIPT_EmitBinary (expression->lhs.binary);
+      expression->offset = SCRIPT_EmitBinary (writer, expression->lhs.binary);
 
       break;
 
     case ScriptExpressionIdentifier:
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitIdentifier (expression->lhs.string);
+      expression->offset = SCRIPT_EmitIdentifier (writer, expression->lhs.string);
 
       break;
 
     case ScriptExpressionStatement:
 
-      SCRIPT_EmitStatement (expression->lhs.statement);
+      SCRIPT_EmitStatement (writer, expression->lhs.statement);
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitByte (ScriptVMExpressionStatement);
-      SCRIPT_EmitPointer (expression->lhs.statement->offset);
+      SCRIPT_Align (writer, 1, writer->pointerAlign);
+      expression->offset = writer->dumpOffset;
+      SCRIPT_EmitByte (writer, ScriptVMExpressionStatement);
+      SCRIPT_EmitPointer (writer, expression->lhs.statement->offset);
 
       break;
 
     case ScriptExpressionParen:
 
-      SCRIPT_EmitExpression (expression->lhs.expression);
+      SCRIPT_EmitExpression (writer, expression->lhs.expression);
       expression->offset = expression->lhs.expression->offset;
 
       break;
 
     case ScriptExpressionAbsolute:
 
-      SCRIPT_EmitExpression (expression->lhs.expression);
+      SCRIPT_EmitExpression (writer, expression->lhs.expression);
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitByte (ScriptVMExpressionAbsolute);
-      SCRIPT_EmitPointer (expression->lhs.expression->offset);
+      SCRIPT_Align (writer, 1, writer->pointerAlign);
+      expression->offset = writer->dumpOffset;
+      SCRIPT_EmitByte (writer, ScriptVMExpressionAbsolute);
+      SCRIPT_EmitPointer (writer, expression->lhs.expression->offset);
 
       break;
 
     case ScriptExpressionNegative:
 
-      SCRIPT_EmitExpression (expression->lhs.expression);
+      SCRIPT_EmitExpression (writer, expression->lhs.expression);
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitByte (ScriptVMExpressionNegative);
-      SCRIPT_EmitPointer (expression->lhs.expression->offset);
+      SCRIPT_Align (writer, 1, writer->pointerAlign);
+      expression->offset = writer->dumpOffset;
+      SCRIPT_EmitByte (writer, ScriptVMExpressionNegative);
+      SCRIPT_EmitPointer (writer, expression->lhs.expression->offset);
 
       break;
 
     case ScriptExpressionAdd:
 
-      SCRIPT_EmitExpression (expression->lhs.expression);
-      SCRIPT_EmitExpression (expression->rhs);
+      SCRIPT_EmitExpression (writer, expression->lhs.expression);
+      SCRIPT_EmitExpression (writer, expression->rhs);
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitByte (ScriptVMExpressionAdd);
-      SCRIPT_EmitPointer (expression->lhs.expression->offset);
-      SCRIPT_EmitPointer (expression->rhs->offset);
+      SCRIPT_Align (writer, 1, writer->pointerAlign);
+      expression->offset = writer->dumpOffset;
+      SCRIPT_EmitByte (writer, ScriptVMExpressionAdd);
+      SCRIPT_EmitPointer (writer, expression->lhs.expression->offset);
+      SCRIPT_EmitPointer (writer, expression->rhs->offset);
 
       break;
 
     case ScriptExpressionSubtract:
 
-      SCRIPT_EmitExpression (expression->lhs.expression);
-      SCRIPT_EmitExpression (expression->rhs);
+      SCRIPT_EmitExpression (writer, expression->lhs.expression);
+      SCRIPT_EmitExpression (writer, expression->rhs);
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitByte (ScriptVMExpressionSubtract);
-      SCRIPT_EmitPointer (expression->lhs.expression->offset);
-      SCRIPT_EmitPointer (expression->rhs->offset);
+      SCRIPT_Align (writer, 1, writer->pointerAlign);
+      expression->offset = writer->dumpOffset;
+      SCRIPT_EmitByte (writer, ScriptVMExpressionSubtract);
+      SCRIPT_EmitPointer (writer, expression->lhs.expression->offset);
+      SCRIPT_EmitPointer (writer, expression->rhs->offset);
 
       break;
 
     case ScriptExpressionMultiply:
 
-      SCRIPT_EmitExpression (expression->lhs.expression);
-      SCRIPT_EmitExpression (expression->rhs);
+      SCRIPT_EmitExpression (writer, expression->lhs.expression);
+      SCRIPT_EmitExpression (writer, expression->rhs);
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitByte (ScriptVMExpressionMultiply);
-      SCRIPT_EmitPointer (expression->lhs.expression->offset);
-      SCRIPT_EmitPointer (expression->rhs->offset);
+      SCRIPT_Align (writer, 1, writer->pointerAlign);
+      expression->offset = writer->dumpOffset;
+      SCRIPT_EmitByte (writer, ScriptVMExpressionMultiply);
+      SCRIPT_EmitPointer (writer, expression->lhs.expression->offset);
+      SCRIPT_EmitPointer (writer, expression->rhs->offset);
 
       break;
 
     case ScriptExpressionDivide:
 
-      SCRIPT_EmitExpression (expression->lhs.expression);
-      SCRIPT_EmitExpression (expression->rhs);
+      SCRIPT_EmitExpression (writer, expression->lhs.expression);
+      SCRIPT_EmitExpression (writer, expression->rhs);
 
-      SCRIPT_Align (1, SCRIPT_pointerAlign);
-      expression->offset = SCRIPT_dumpOffset;
-      SCRIPT_EmitByte (ScriptVMExpressionDivide);
-      SCRIPT_EmitPointer (expression->lhs.expression->offset);
-      SCRIPT_EmitPointer (expression->rhs->offset);
+      SCRIPT_Align (writer, 1, writer->pointerAlign);
+      expression->offset = writer->dumpOffset;
+      SCRIPT_EmitByte (writer, ScriptVMExpressionDivide);
+      SCRIPT_EmitPointer (writer, expression->lhs.expression->offset);
+      SCRIPT_EmitPointer (writer, expression->rhs->offset);
 
       break;
     }
 }
 
+static std::string
+SCRIPT_Signature (const struct ScriptStatement *statement)
+{
+  struct ScriptParameter *parameter;
+  std::string result (statement->identifier);
+
+  for (parameter = statement->parameters; parameter; parameter = parameter->next)
+    {
+      result += ':';
+      result += parameter->identifier;
+    }
+
+  return result;
+}
+
+/* Returns the schema entry for a statement's signature, or NULL if it is to
+ * use the generic layout.  */
+static const struct script_schema_statement *
+SCRIPT_StatementSchema (const struct script_writer *writer,
+                        const struct ScriptStatement *statement,
+                        uint32_t *type)
+{
+  if (!writer->schema)
+    return NULL;
+
+  auto i = writer->schema->types.find (SCRIPT_Signature (statement));
+
+  if (i == writer->schema->types.end ())
+    return NULL;
+
+  *type = i->second;
+
+  return &writer->schema->statements[i->second];
+}
+
+/* Emits what the parameters of a statement point to.  Typed statements
+ * store numbers and identifiers inline, so only their pointer fields need
+ * anything emitted.  */
 static void
-SCRIPT_EmitStatement (struct ScriptStatement *statement)
+SCRIPT_EmitParameters (struct script_writer *writer, struct ScriptStatement *statement,
+                       const struct script_schema_statement *schema)
 {
   struct ScriptParameter *parameter;
+  size_t i = 0;
 
-  if (statement->offset)
-    return;
+  for (parameter = statement->parameters; parameter; parameter = parameter->next, ++i)
+    {
+      struct ScriptExpression *expression = parameter->expression;
 
-  if (statement->next)
-    SCRIPT_EmitStatement (statement->next);
+      if (!schema)
+        {
+          SCRIPT_EmitExpression (writer, expression);
 
-  for (parameter = statement->parameters; parameter; parameter = parameter->next)
-    SCRIPT_EmitExpression (parameter->expression);
+          continue;
+        }
 
-  statement->offset = SCRIPT_dumpOffset;
+      while (expression->type == ScriptExpressionParen)
+        expression = expression->lhs.expression;
 
-  SCRIPT_EmitStringBytes (statement->identifier);
+      if (schema->parameters[i].type == ScriptSchemaStatement
+          && expression->type == ScriptExpressionStatement)
+        SCRIPT_EmitStatement (writer, expression->lhs.statement);
+      else if (script_schema_is_pointer (schema->parameters[i].type))
+        SCRIPT_EmitExpression (writer, expression);
+    }
+}
 
-  for (parameter = statement->parameters; parameter; parameter = parameter->next)
+/* Emits a statement's `next' pointer.  A placeholder to be patched later is
+ * recorded in the pointer table even though it is NULL for now.  */
+static size_t
+SCRIPT_EmitNextPointer (struct script_writer *writer, off_t next, int placeholder)
+{
+  size_t result;
+
+  result = writer->dumpOffset;
+
+  if (placeholder && !(writer->flags & SCRIPT_WRITER_RELATIVE))
+    writer->pointerOffsets.push_back (writer->dumpOffset);
+
+  SCRIPT_EmitPointer (writer, next);
+
+  return result;
+}
+
+static void
+SCRIPT_SchemaTypeError (const struct script_schema_statement *schema, size_t index)
+{
+  errx (EX_DATAERR, "Parameter `%s' of `%s' does not match its type in the schema",
+        schema->parameters[index].name.c_str (), schema->signature.c_str ());
+}
+
+static void
+SCRIPT_EmitField (struct script_writer *writer, const struct script_schema_statement *schema,
+                  size_t index, struct ScriptExpression *expression)
+{
+  enum script_schema_type type;
+  unsigned int size, align;
+  long long v_longlong;
+  double v_double;
+  char *end;
+
+  union
     {
-      SCRIPT_EmitByte (':');
-      SCRIPT_EmitStringBytes (parameter->identifier);
+      float v_float;
+      uint32_t v_floatAsU32;
+    } v_float;
+
+  type = schema->parameters[index].type;
+
+  script_schema_field_layout (type, writer->is64bit ? 8 : 4, &size, &align);
+  SCRIPT_Align (writer, 0, align - 1);
+
+  while (expression->type == ScriptExpressionParen)
+    expression = expression->lhs.expression;
+
+  switch (type)
+    {
+    case ScriptSchemaU32:
+
+      if (expression->type != ScriptExpressionNumeric || expression->scale)
+        SCRIPT_SchemaTypeError (schema, index);
+
+      v_longlong = strtoll (expression->lhs.numeric, &end, 0);
+
+      if (*end || v_longlong < 0 || v_longlong > 0xFFFFFFFFLL)
+        SCRIPT_SchemaTypeError (schema, index);
+
+      SCRIPT_EmitU32 (writer, v_longlong);
+
+      break;
+
+    case ScriptSchemaFloat:
+
+      if (expression->type != ScriptExpressionNumeric)
+        SCRIPT_SchemaTypeError (schema, index);
+
+      v_double = strtod (expression->lhs.numeric, &end);
+
+      if (*end)
+        SCRIPT_SchemaTypeError (schema, index);
+
+      if (expression->scale)
+        v_double *= expression->scale;
+
+      v_float.v_float = v_double;
+
+      SCRIPT_EmitU32 (writer, v_float.v_floatAsU32);
+
+      break;
+
+    case ScriptSchemaIdentifier:
+
+      if (expression->type != ScriptExpressionIdentifier)
+        SCRIPT_SchemaTypeError (schema, index);
+
+      SCRIPT_EmitU32 (writer, SCRIPT_InternString (writer, expression->lhs.identifier));
+
+      break;
+
+    case ScriptSchemaString:
+    case ScriptSchemaBinary:
+
+      /* Point past the opcode, at the characters or the size word */
+
+      if (expression->type != (type == ScriptSchemaString
+                               ? ScriptExpressionString : ScriptExpressionBinary))
+        SCRIPT_SchemaTypeError (schema, index);
+
+      SCRIPT_EmitPointer (writer, expression->offset + 1);
+
+      break;
+
+    case ScriptSchemaStatement:
+
+      if (expression->type != ScriptExpressionStatement)
+        SCRIPT_SchemaTypeError (schema, index);
+
+      SCRIPT_EmitPointer (writer, expression->lhs.statement->offset);
+
+      break;
+
+    case ScriptSchemaExpression:
+
+      SCRIPT_EmitPointer (writer, expression->offset);
+
+      break;
     }
+}
+
+/* Emits a statement whose parameters have been emitted, followed by or, for
+ * typed statements, starting with its `next' pointer.  Returns the offset
+ * of the `next' pointer.  */
+static size_t
+SCRIPT_EmitStatementRecord (struct script_writer *writer, struct ScriptStatement *statement,
+                            const struct script_schema_statement *schema, uint32_t type,
+                            off_t next, int placeholder)
+{
+  struct ScriptParameter *parameter;
+  size_t result, i;
+
+  if (schema)
+    {
+      SCRIPT_Align (writer, 0, writer->pointerAlign);
+
+      statement->offset = writer->dumpOffset;
+
+      SCRIPT_EmitU32 (writer, SCRIPT_SCHEMA_TYPED | type);
+      SCRIPT_Align (writer, 0, writer->pointerAlign);
+
+      result = SCRIPT_EmitNextPointer (writer, next, placeholder);
 
-  SCRIPT_EmitByte (0);
-  SCRIPT_Align (0, SCRIPT_pointerAlign);
+      for (parameter = statement->parameters, i = 0; parameter;
+           parameter = parameter->next, ++i)
+        SCRIPT_EmitField (writer, schema, i, parameter->expression);
+
+      return result;
+    }
+
+  if (writer->flags & SCRIPT_WRITER_STRING_TABLE)
+    {
+      SCRIPT_Align (writer, 0, 3);
+
+      statement->offset = writer->dumpOffset;
+
+      SCRIPT_EmitU32 (writer, SCRIPT_InternString (writer, SCRIPT_Signature (statement)));
+    }
+  else
+    {
+      statement->offset = writer->dumpOffset;
+
+      SCRIPT_EmitStringBytes (writer, statement->identifier);
+
+      for (parameter = statement->parameters; parameter; parameter = parameter->next)
+        {
+          SCRIPT_EmitByte (writer, ':');
+          SCRIPT_EmitStringBytes (writer, parameter->identifier);
+        }
+
+      SCRIPT_EmitByte (writer, 0);
+    }
+
+  SCRIPT_Align (writer, 0, writer->pointerAlign);
 
   for (parameter = statement->parameters; parameter; parameter = parameter->next)
     {
       if (!parameter->expression->offset)
         fprintf (stderr, "Warning: Parameter has zero offset\n");
 
-      SCRIPT_EmitPointer (parameter->expression->offset);
+      SCRIPT_EmitPointer (writer, parameter->expression->offset);
     }
 
+  return SCRIPT_EmitNextPointer (writer, next, placeholder);
+}
+
+static void
+SCRIPT_EmitStatement (struct script_writer *writer, struct ScriptStatement *statement)
+{
+  const struct script_schema_statement *schema;
+  uint32_t type = 0;
+
+  if (statement->offset)
+    return;
+
   if (statement->next)
-    SCRIPT_EmitPointer (statement->next->offset);
-  else
-    SCRIPT_EmitPointer (0);
+    SCRIPT_EmitStatement (writer, statement->next);
+
+  schema = SCRIPT_StatementSchema (writer, statement, &type);
+
+  SCRIPT_EmitParameters (writer, statement, schema);
+  SCRIPT_EmitStatementRecord (writer, statement, schema, type,
+                              statement->next ? statement->next->offset : 0, 0);
 }
 
-void
-SCRIPT_EmitPointerTable (void)
+static void
+SCRIPT_EmitPointerTable (struct script_writer *writer)
 {
   uint32_t previous = 0;
 
-  for (auto offset : script_pointerOffsets)
+  for (auto offset : writer->pointerOffsets)
     {
       assert (offset != previous);
-      assert (!(offset & SCRIPT_pointerAlign));
+      assert (!(offset & writer->pointerAlign));
 
-      SCRIPT_EmitVarInt ((offset - previous) / (SCRIPT_pointerAlign + 1));
+      SCRIPT_EmitVarInt (writer, (offset - previous) / (writer->pointerAlign + 1));
       previous = offset;
     }
 
-  SCRIPT_EmitByte (0);
+  SCRIPT_EmitByte (writer, 0);
+}
+
+/* Emits the interned strings, with a hash index so that a loader can find
+ * the ID of a known name without comparing it against every entry.  */
+static size_t
+SCRIPT_EmitStringTable (struct script_writer *writer)
+{
+  std::vector<uint32_t> buckets;
+  size_t i, result, bucketCount = 1, stringOffset;
+
+  while (bucketCount < writer->strings.size () * 2)
+    bucketCount <<= 1;
+
+  buckets.resize (bucketCount);
+
+  SCRIPT_Align (writer, 0, 3);
+
+  result = writer->dumpOffset;
+
+  SCRIPT_EmitU32 (writer, writer->strings.size ());
+  SCRIPT_EmitU32 (writer, bucketCount);
+
+  stringOffset = 8 + writer->strings.size () * 8 + bucketCount * 4;
+
+  for (i = 0; i < writer->strings.size (); ++i)
+    {
+      uint32_t hash, bucket;
+
+      hash = script_vm_hash (writer->strings[i].c_str ());
+
+      for (bucket = hash & (bucketCount - 1); buckets[bucket];
+           bucket = (bucket + 1) & (bucketCount - 1))
+        ;
+
+      buckets[bucket] = i + 1;
+
+      SCRIPT_EmitU32 (writer, hash);
+      SCRIPT_EmitU32 (writer, stringOffset);
+
+      stringOffset += writer->strings[i].size () + 1;
+    }
+
+  for (auto bucket : buckets)
+    SCRIPT_EmitU32 (writer, bucket);
+
+  for (auto &string : writer->strings)
+    SCRIPT_EmitBytes (writer, string.c_str (), string.size () + 1);
+
+  return result;
+}
+
+static void
+SCRIPT_Begin (struct script_writer *writer, FILE *file)
+{
+  unsigned int flags;
+
+  writer->file = file;
+  writer->pointerOffsets.clear ();
+  writer->stringIds.clear ();
+  writer->strings.clear ();
+  writer->buffer.clear ();
+  writer->dumpOffset = 0;
+  writer->bufferOffset = 0;
+  writer->patchOffset = (size_t) -1;
+  writer->streamRoot = 0;
+  writer->streamNext = (size_t) -1;
+
+  SCRIPT_EmitByte (writer, 0xBA);
+  SCRIPT_EmitByte (writer, 0xD9);
+  SCRIPT_EmitByte (writer, 0xE2);
+
+  flags = (writer->flags & SCRIPT_WRITER_RELATIVE) ? ScriptVMFlagRelative : ScriptVMFlagAbsolute;
+
+  if (writer->flags & SCRIPT_WRITER_STRING_TABLE)
+    flags |= ScriptVMFlagStringTable;
+
+  SCRIPT_EmitByte (writer, flags);
+}
+
+/* Writes the trailer.  In order, it holds a pointer to the string table if
+ * there is one, a pointer to the relocation table unless pointers are
+ * relative, and a pointer to the root statement.  */
+static void
+SCRIPT_End (struct script_writer *writer, off_t root)
+{
+  size_t stringTableOffset = 0, pointerTableOffset = 0;
+
+  if (writer->flags & SCRIPT_WRITER_STRING_TABLE)
+    stringTableOffset = SCRIPT_EmitStringTable (writer);
+
+  if (!(writer->flags & SCRIPT_WRITER_RELATIVE))
+    {
+      SCRIPT_Align (writer, 0, writer->pointerAlign);
+
+      pointerTableOffset = writer->dumpOffset;
+      SCRIPT_EmitPointerTable (writer);
+    }
+
+  SCRIPT_Align (writer, 0, writer->pointerAlign);
+
+  if (writer->flags & SCRIPT_WRITER_STRING_TABLE)
+    SCRIPT_EmitPointer (writer, stringTableOffset);
+
+  if (!(writer->flags & SCRIPT_WRITER_RELATIVE))
+    SCRIPT_EmitPointer (writer, pointerTableOffset);
+
+  SCRIPT_EmitPointer (writer, root);
+}
+
+struct script_writer *
+script_writer_create (FILE *file, int ptrsize, unsigned int flags)
+{
+  struct script_writer *writer;
+
+  writer = new script_writer;
+  writer->flags = flags;
+  writer->schema = NULL;
+
+  /* Relative pointers are 32 bit regardless of the target */
+
+  if (flags & SCRIPT_WRITER_RELATIVE)
+    ptrsize = 32;
+
+  if (0 != (writer->is64bit = (ptrsize == 64)))
+    writer->pointerAlign = 7;
+  else
+    writer->pointerAlign = 3;
+
+  SCRIPT_Begin (writer, file);
+
+  return writer;
+}
+
+void
+script_writer_reset (struct script_writer *writer, FILE *file)
+{
+  SCRIPT_Begin (writer, file);
+}
+
+void
+script_writer_set_schema (struct script_writer *writer,
+                          const struct script_schema *schema)
+{
+  assert (writer->flags & SCRIPT_WRITER_STRING_TABLE);
+  assert (!writer->dumpOffset || writer->dumpOffset == 4);
+
+  writer->schema = schema;
 }
 
 void
-script_dump_binary (struct script_parse_context *context, int ptrsize)
+script_writer_free (struct script_writer *writer)
 {
-  size_t pointerTableOffset;
-  script_pointerOffsets.clear ();
+  delete writer;
+}
 
-  SCRIPT_EmitByte (0xBA);
-  SCRIPT_EmitByte (0xD9);
-  SCRIPT_EmitByte (0xE2);
-  SCRIPT_EmitByte (0x01);
+const void *
+script_writer_data (const struct script_writer *writer, size_t *size)
+{
+  assert (!writer->file);
+
+  *size = writer->buffer.size ();
+
+  return writer->buffer.empty () ? NULL : &writer->buffer[0];
+}
+
+void
+script_writer_dump (struct script_writer *writer,
+                    struct script_parse_context *context)
+{
+  assert (!writer->streamRoot);
 
   if (!context->statements)
     return;
 
-  if (0 != (SCRIPT_64bit = (ptrsize == 64)))
-    SCRIPT_pointerAlign = 7;
+  SCRIPT_EmitStatement (writer, context->statements);
+
+  writer->streamRoot = context->statements->offset;
+}
+
+/* Emits one top-level statement after those already written.  Its `next'
+ * pointer is written as a placeholder and held in the output buffer until
+ * the following statement's offset is known, so only the output of a single
+ * statement is buffered.  */
+void
+script_writer_statement (struct script_writer *writer,
+                         struct ScriptStatement *statement)
+{
+  const struct script_schema_statement *schema;
+  uint32_t type = 0;
+  size_t next;
+
+  assert (!statement->next);
+
+  schema = SCRIPT_StatementSchema (writer, statement, &type);
+
+  SCRIPT_EmitParameters (writer, statement, schema);
+
+  /* The placeholder is recorded in the pointer table now to keep the table
+   * sorted; script_writer_finish removes it again for the last
+   * statement.  */
+  next = SCRIPT_EmitStatementRecord (writer, statement, schema, type, 0, 1);
+
+  if (writer->streamNext != (size_t) -1)
+    SCRIPT_PatchPointer (writer, writer->streamNext, statement->offset);
   else
-    SCRIPT_pointerAlign = 3;
+    writer->streamRoot = statement->offset;
+
+  writer->streamNext = next;
+
+  writer->patchOffset = writer->streamNext;
+  SCRIPT_Flush (writer);
+}
 
-  SCRIPT_EmitStatement (context->statements);
+void
+script_writer_finish (struct script_writer *writer)
+{
+  if (writer->streamNext != (size_t) -1)
+    {
+      if (!(writer->flags & SCRIPT_WRITER_RELATIVE))
+        {
+          /* Typed statements have fields after their `next' pointer */
 
-  SCRIPT_Align (0, SCRIPT_pointerAlign);
+          auto i = std::find (writer->pointerOffsets.rbegin (), writer->pointerOffsets.rend (),
+                              writer->streamNext);
+
+          assert (i != writer->pointerOffsets.rend ());
+          writer->pointerOffsets.erase (std::next (i).base ());
+        }
+
+      writer->patchOffset = (size_t) -1;
+      writer->streamNext = (size_t) -1;
+    }
 
-  pointerTableOffset = SCRIPT_dumpOffset;
-  SCRIPT_EmitPointerTable ();
+  if (writer->streamRoot || (writer->flags & SCRIPT_WRITER_RELATIVE))
+    SCRIPT_End (writer, writer->streamRoot);
 
-  SCRIPT_Align (0, SCRIPT_pointerAlign);
-  SCRIPT_EmitPointer (pointerTableOffset);
+  SCRIPT_Flush (writer);
 
-  SCRIPT_EmitPointer (context->statements->offset);
+  if (writer->file && fflush (writer->file))
+    err (EX_IOERR, "Error writing binary script");
 }
@@ -0,0 +1,263 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+
+static struct ScriptExpression *
+script_FoldExpression (struct script_parse_context *context,
+                       struct ScriptExpression *expression);
+
+/* Returns non-zero and stores the value of `expression' in `value' if it is
+ * a numeric literal.  The value is exactly what the binary writer emits, so
+ * that folding matches the VM evaluating the unfolded tree.  */
+static int
+script_NumericValue (const struct ScriptExpression *expression, float *value)
+{
+  char *end;
+
+  if (expression->type != ScriptExpressionNumeric)
+    return 0;
+
+  if (!expression->scale)
+    {
+      long long integer;
+
+      integer = strtoll (expression->lhs.numeric, &end, 0);
+
+      if (!*end && integer >= 0 && integer <= 0x7FFFFFFF)
+        {
+          *value = (float) integer;
+
+          return 1;
+        }
+    }
+
+  *value = strtod (expression->lhs.numeric, &end);
+
+  if (expression->scale)
+    *value *= expression->scale;
+
+  return 1;
+}
+
+/* Returns non-zero if `expression' is an arithmetic node.  The VM
+ * evaluates these to a float, or fails if an operand is not a number, so
+ * identities may replace an arithmetic node by its arithmetic operand
+ * without changing the result.  */
+static int
+script_IsArithmetic (const struct ScriptExpression *expression)
+{
+  switch (expression->type)
+    {
+    case ScriptExpressionNegative:
+    case ScriptExpressionAbsolute:
+    case ScriptExpressionAdd:
+    case ScriptExpressionSubtract:
+    case ScriptExpressionMultiply:
+    case ScriptExpressionDivide:
+
+      return 1;
+
+    default:
+
+      return 0;
+    }
+}
+
+/* Turns `expression' into a numeric literal holding `value'.  The literal
+ * always contains a decimal point or exponent, so it is emitted as a float
+ * like the result of the arithmetic it replaces.  */
+static void
+script_MakeNumeric (struct script_parse_context *context,
+                    struct ScriptExpression *expression, float value)
+{
+  char buffer[32];
+
+  snprintf (buffer, sizeof (buffer) - 2, "%.9g", value);
+
+  if (!strpbrk (buffer, ".eni"))
+    strcat (buffer, ".0");
+
+  expression->type = ScriptExpressionNumeric;
+  expression->lhs.numeric = arena_strdup (&context->statement_arena, buffer);
+  expression->rhs = 0;
+  expression->scale = 0.0;
+}
+
+static void
+script_FoldStatement (struct script_parse_context *context,
+                      struct ScriptStatement *statement)
+{
+  for (; statement; statement = statement->next)
+    {
+      struct ScriptParameter *parameter;
+
+      for (parameter = statement->parameters;
+           parameter; parameter = parameter->next)
+        {
+          parameter->expression = script_FoldExpression (context, parameter->expression);
+        }
+    }
+}
+
+/* Folds the tree rooted at `expression' and returns its replacement, which
+ * may be `expression' itself, modified in place, or one of its operands.  */
+static struct ScriptExpression *
+script_FoldExpression (struct script_parse_context *context,
+                       struct ScriptExpression *expression)
+{
+  struct ScriptExpression *lhs, *rhs;
+  float a, b;
+  int lhsConstant, rhsConstant;
+
+  switch (expression->type)
+    {
+    case ScriptExpressionNumeric:
+    case ScriptExpressionString:
+    case ScriptExpressionBinary:
+    case ScriptExpressionIdentifier:
+
+      return expression;
+
+    case ScriptExpressionStatement:
+
+      script_FoldStatement (context, expression->lhs.statement);
+
+      return expression;
+
+    case ScriptExpressionParen:
+
+      return script_FoldExpression (context, expression->lhs.expression);
+
+    case ScriptExpressionNegative:
+
+      lhs = script_FoldExpression (context, expression->lhs.expression);
+
+      if (script_NumericValue (lhs, &a))
+        script_MakeNumeric (context, expression, -a);
+      else if (lhs->type == ScriptExpressionNegative
+               && script_IsArithmetic (lhs->lhs.expression))
+        return lhs->lhs.expression;
+      else
+        expression->lhs.expression = lhs;
+
+      return expression;
+
+    case ScriptExpressionAbsolute:
+
+      lhs = script_FoldExpression (context, expression->lhs.expression);
+
+      if (script_NumericValue (lhs, &a))
+        script_MakeNumeric (context, expression, fabsf (a));
+      else if (lhs->type == ScriptExpressionAbsolute)
+        return lhs;
+      else if (lhs->type == ScriptExpressionNegative)
+        expression->lhs.expression = lhs->lhs.expression;
+      else
+        expression->lhs.expression = lhs;
+
+      return expression;
+
+    case ScriptExpressionAdd:
+    case ScriptExpressionSubtract:
+    case ScriptExpressionMultiply:
+    case ScriptExpressionDivide:
+
+      break;
+    }
+
+  lhs = script_FoldExpression (context, expression->lhs.expression);
+  rhs = script_FoldExpression (context, expression->rhs);
+
+  expression->lhs.expression = lhs;
+  expression->rhs = rhs;
+
+  lhsConstant = script_NumericValue (lhs, &a);
+  rhsConstant = script_NumericValue (rhs, &b);
+
+  if (lhsConstant && rhsConstant)
+    {
+      switch (expression->type)
+        {
+        case ScriptExpressionAdd:      a = a + b; break;
+        case ScriptExpressionSubtract: a = a - b; break;
+        case ScriptExpressionMultiply: a = a * b; break;
+        case ScriptExpressionDivide:   a = a / b; break;
+        default:                       break;
+        }
+
+      script_MakeNumeric (context, expression, a);
+
+      return expression;
+    }
+
+  /* Identities such as x + 0 and x × 1, applied only when x is itself
+   * arithmetic; numeric literals were folded above.  The VM fails on
+   * arithmetic with a string, identifier, statement or data literal, which
+   * must not turn into the operand itself.  */
+
+  if (lhsConstant ? !script_IsArithmetic (rhs) : !script_IsArithmetic (lhs))
+    return expression;
+
+  switch (expression->type)
+    {
+    case ScriptExpressionAdd:
+
+      if (lhsConstant && a == 0.0f)
+        return rhs;
+
+      if (rhsConstant && b == 0.0f)
+        return lhs;
+
+      break;
+
+    case ScriptExpressionSubtract:
+
+      if (rhsConstant && b == 0.0f)
+        return lhs;
+
+      if (lhsConstant && a == 0.0f)
+        {
+          expression->type = ScriptExpressionNegative;
+          expression->lhs.expression = rhs;
+          expression->rhs = 0;
+        }
+
+      break;
+
+    case ScriptExpressionMultiply:
+
+      if (lhsConstant && a == 1.0f)
+        return rhs;
+
+      if (rhsConstant && b == 1.0f)
+        return lhs;
+
+      break;
+
+    case ScriptExpressionDivide:
+
+      if (rhsConstant && b == 1.0f)
+        return lhs;
+
+      break;
+
+    default:
+
+      break;
+    }
+
+  return expression;
+}
+
+void
+SCRIPT_Fold (struct script_parse_context *context)
+{
+  script_FoldStatement (context, context->statements);
+}
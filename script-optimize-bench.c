@@ -0,0 +1,291 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "script.h"
+
+static int ScriptOptimizeBench_printHelp;
+static int ScriptOptimizeBench_printVersion;
+static unsigned int ScriptOptimizeBench_minInstances = 1000;
+static unsigned int ScriptOptimizeBench_maxInstances = 128000;
+
+static struct option ScriptOptimizeBench_longOptions[] =
+{
+    { "min-instances", required_argument, 0, 'm' },
+    { "max-instances", required_argument, 0, 'n' },
+    { "help",     no_argument, &ScriptOptimizeBench_printHelp, 1 },
+    { "version",  no_argument, &ScriptOptimizeBench_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+/* Instances share one mesh statement per this many instances */
+#define SCRIPT_OPTIMIZE_BENCH_INSTANCES_PER_MESH 16
+
+static double
+ScriptOptimizeBench_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static struct ScriptExpression *
+ScriptOptimizeBench_Expression (struct script_parse_context *context,
+                                enum ScriptExpressionType type)
+{
+  struct ScriptExpression *result;
+
+  result = arena_calloc (&context->statement_arena, sizeof (*result));
+  result->type = type;
+
+  return result;
+}
+
+static struct ScriptExpression *
+ScriptOptimizeBench_Numeric (struct script_parse_context *context, unsigned int value)
+{
+  struct ScriptExpression *result;
+  char buffer[16];
+
+  sprintf (buffer, "%u", value);
+
+  result = ScriptOptimizeBench_Expression (context, ScriptExpressionNumeric);
+  result->lhs.numeric = arena_strdup (&context->statement_arena, buffer);
+
+  return result;
+}
+
+static struct ScriptExpression *
+ScriptOptimizeBench_String (struct script_parse_context *context, const char *format,
+                            unsigned int value)
+{
+  struct ScriptExpression *result;
+  char buffer[64];
+
+  sprintf (buffer, format, value);
+
+  result = ScriptOptimizeBench_Expression (context, ScriptExpressionString);
+  result->lhs.string = arena_strdup (&context->statement_arena, buffer);
+
+  return result;
+}
+
+/* Prepends a parameter, so parameters must be added in reverse order */
+static void
+ScriptOptimizeBench_Parameter (struct script_parse_context *context,
+                               struct ScriptStatement *statement,
+                               const char *identifier, struct ScriptExpression *expression)
+{
+  struct ScriptParameter *parameter;
+
+  parameter = arena_calloc (&context->statement_arena, sizeof (*parameter));
+  parameter->identifier = identifier;
+  parameter->expression = expression;
+  parameter->next = statement->parameters;
+
+  statement->parameters = parameter;
+}
+
+static struct ScriptStatement *
+ScriptOptimizeBench_Statement (struct script_parse_context *context, const char *identifier)
+{
+  struct ScriptStatement *result;
+
+  result = arena_calloc (&context->statement_arena, sizeof (*result));
+  result->identifier = identifier;
+
+  return result;
+}
+
+/* Builds, as the parser would, one statement of the form
+
+     (instance mesh:(mesh path:"meshes/M.mesh"
+                          material:(material texture:"textures/M.png"))
+               x:X y:Y scale:(S × 0.5))
+
+   in which the mesh subtree repeats every few instances and the remaining
+   parameters are mostly unique.  */
+static struct ScriptStatement *
+ScriptOptimizeBench_Instance (struct script_parse_context *context, unsigned int index,
+                              unsigned int meshCount)
+{
+  struct ScriptStatement *instance, *mesh, *material;
+  struct ScriptExpression *expression, *scale;
+  unsigned int meshIndex;
+
+  meshIndex = index % meshCount;
+
+  material = ScriptOptimizeBench_Statement (context, "material");
+  ScriptOptimizeBench_Parameter (context, material, "texture",
+                                 ScriptOptimizeBench_String (context, "textures/%u.png",
+                                                             meshIndex));
+
+  mesh = ScriptOptimizeBench_Statement (context, "mesh");
+  expression = ScriptOptimizeBench_Expression (context, ScriptExpressionStatement);
+  expression->lhs.statement = material;
+  ScriptOptimizeBench_Parameter (context, mesh, "material", expression);
+  ScriptOptimizeBench_Parameter (context, mesh, "path",
+                                 ScriptOptimizeBench_String (context, "meshes/%u.mesh",
+                                                             meshIndex));
+
+  scale = ScriptOptimizeBench_Expression (context, ScriptExpressionMultiply);
+  scale->lhs.expression = ScriptOptimizeBench_Numeric (context, index % 7 + 1);
+  scale->rhs = ScriptOptimizeBench_Expression (context, ScriptExpressionNumeric);
+  scale->rhs->lhs.numeric = "0.5";
+
+  instance = ScriptOptimizeBench_Statement (context, "instance");
+  ScriptOptimizeBench_Parameter (context, instance, "scale", scale);
+  ScriptOptimizeBench_Parameter (context, instance, "y",
+                                 ScriptOptimizeBench_Numeric (context, index / 256));
+  ScriptOptimizeBench_Parameter (context, instance, "x",
+                                 ScriptOptimizeBench_Numeric (context, index % 256));
+  expression = ScriptOptimizeBench_Expression (context, ScriptExpressionStatement);
+  expression->lhs.statement = mesh;
+  ScriptOptimizeBench_Parameter (context, instance, "mesh", expression);
+
+  return instance;
+}
+
+static void
+ScriptOptimizeBench_Run (unsigned int instances)
+{
+  struct script_parse_context context;
+  struct ScriptStatement *statement, **meshes;
+  unsigned int i, meshCount;
+  double start, elapsed;
+
+  memset (&context, 0, sizeof (context));
+  arena_init (&context.statement_arena);
+
+  meshCount = (instances + SCRIPT_OPTIMIZE_BENCH_INSTANCES_PER_MESH - 1)
+              / SCRIPT_OPTIMIZE_BENCH_INSTANCES_PER_MESH;
+
+  for (i = 0; i < instances; ++i)
+    {
+      statement = ScriptOptimizeBench_Instance (&context, i, meshCount);
+
+      if (context.last_statement)
+        context.last_statement->next = statement;
+      else
+        context.statements = statement;
+
+      context.last_statement = statement;
+    }
+
+  start = ScriptOptimizeBench_Now ();
+
+  SCRIPT_Optimize (&context);
+
+  elapsed = ScriptOptimizeBench_Now () - start;
+
+  /* Every instance must now refer to the mesh expression of the first
+   * instance using the same mesh */
+
+  if (!(meshes = calloc (meshCount, sizeof (*meshes))))
+    err (EX_OSERR, "calloc failed");
+
+  for (i = 0, statement = context.statements; statement; ++i, statement = statement->next)
+    {
+      struct ScriptStatement *mesh;
+
+      mesh = statement->parameters->expression->lhs.statement;
+
+      if (!meshes[i % meshCount])
+        meshes[i % meshCount] = mesh;
+      else if (meshes[i % meshCount] != mesh)
+        errx (EXIT_FAILURE, "Instance %u does not share its mesh after optimization", i);
+    }
+
+  free (meshes);
+
+  printf ("%9u instances %8.3f s %8.1f ns/instance\n",
+          instances, elapsed, elapsed * 1.0e9 / instances);
+
+  arena_free (&context.statement_arena);
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned int instances;
+  int i;
+
+  while (-1 != (i = getopt_long (argc, argv, "m:n:", ScriptOptimizeBench_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 'm':
+
+          ScriptOptimizeBench_minInstances = strtol (optarg, 0, 0);
+
+          if (!ScriptOptimizeBench_minInstances)
+            errx (EX_USAGE, "Instance count must be positive");
+
+          break;
+
+        case 'n':
+
+          ScriptOptimizeBench_maxInstances = strtol (optarg, 0, 0);
+
+          if (!ScriptOptimizeBench_maxInstances)
+            errx (EX_USAGE, "Instance count must be positive");
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (ScriptOptimizeBench_printHelp)
+    {
+      fprintf (stdout,
+               "Usage: %s [OPTION]...\n"
+               "\n"
+               "Times SCRIPT_Optimize on scripts of instance statements, doubling the\n"
+               "instance count on each run.  With linear scaling, the time per\n"
+               "instance stays roughly constant.\n"
+               "\n"
+               "  -m, --min-instances=COUNT  start with COUNT instances (default 1000)\n"
+               "  -n, --max-instances=COUNT  stop after COUNT instances (default 128000)\n"
+               "      --help     display this help and exit\n"
+               "      --version  display version information\n"
+               "\n"
+               "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (ScriptOptimizeBench_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (optind != argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  for (instances = ScriptOptimizeBench_minInstances;
+       instances <= ScriptOptimizeBench_maxInstances; instances *= 2)
+    ScriptOptimizeBench_Run (instances);
+
+  return EXIT_SUCCESS;
+}
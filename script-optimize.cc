@@ -1,217 +1,260 @@
 #include <cstring>
-#include <map>
-#include <set>
+#include <functional>
+#include <unordered_map>
+#include <vector>
 
 #include "script.h"
+#include "small-array.h"
 
-typedef std::map<struct ScriptExpression *, std::set<struct ScriptExpression **>> script_ExpressionList;
+/* Structural description of an expression, in which every subexpression is
+ * replaced by the number of its equivalence class.  Two expressions are
+ * equivalent exactly when their keys are equal.  */
+struct script_ExpressionKey
+{
+  enum ScriptExpressionType type;
 
+  /* Literal contents for leaf expressions, or the statement identifier */
+  const void *data;
+  size_t size;
 
-static void
-script_CollectExpressions (struct ScriptStatement *statement,
-                           script_ExpressionList &container);
+  double scale;
 
-static void
-script_CollectExpressions (struct ScriptExpression **expression,
-                           script_ExpressionList &container)
+  /* Parameter identifiers of statement expressions.  Nearly all
+   * expressions have at most a few, so they are stored inline.  */
+  small_array<const char *, 4> names;
+
+  /* Equivalence classes of the subexpressions */
+  small_array<size_t, 4> children;
+};
+
+static size_t
+script_HashBytes (const void *data, size_t size)
 {
-  container[*expression].insert (expression);
+  const unsigned char *bytes = (const unsigned char *) data;
+  size_t result = 2166136261u;
 
-  switch ((*expression)->type)
-    {
-    case ScriptExpressionStatement:
+  while (size--)
+    result = (result ^ *bytes++) * 16777619u;
 
-      script_CollectExpressions ((*expression)->lhs.statement, container);
+  return result;
+}
 
-      break;
+struct script_ExpressionKeyHash
+{
+  size_t
+  operator() (const script_ExpressionKey &key) const
+  {
+    size_t result;
 
-    case ScriptExpressionParen:
-    case ScriptExpressionNegative:
-    case ScriptExpressionAbsolute:
+    result = key.type;
+    result = result * 31 + std::hash<double> () (key.scale);
 
-      script_CollectExpressions (&(*expression)->lhs.expression, container);
+    if (key.size)
+      result = result * 31 + script_HashBytes (key.data, key.size);
 
-      break;
+    for (auto name : key.names)
+      result = result * 31 + script_HashBytes (name, strlen (name));
 
-    case ScriptExpressionAdd:
-    case ScriptExpressionSubtract:
-    case ScriptExpressionMultiply:
-    case ScriptExpressionDivide:
+    for (auto child : key.children)
+      result = result * 31 + child;
 
-      script_CollectExpressions (&(*expression)->lhs.expression, container);
-      script_CollectExpressions (&(*expression)->rhs, container);
+    return result;
+  }
+};
 
-      break;
+struct script_ExpressionKeyEqual
+{
+  bool
+  operator() (const script_ExpressionKey &a, const script_ExpressionKey &b) const
+  {
+    size_t i;
+
+    if (a.type != b.type
+        || a.scale != b.scale
+        || a.size != b.size
+        || a.names.size () != b.names.size ()
+        || a.children != b.children)
+      return false;
+
+    if (a.size && memcmp (a.data, b.data, a.size))
+      return false;
+
+    for (i = 0; i < a.names.size (); ++i)
+      {
+        if (strcmp (a.names[i], b.names[i]))
+          return false;
+      }
+
+    return true;
+  }
+};
+
+struct script_Optimizer
+{
+  std::unordered_map<script_ExpressionKey, size_t,
+                     script_ExpressionKeyHash, script_ExpressionKeyEqual> classes;
 
-    case ScriptExpressionNumeric:
-    case ScriptExpressionString:
-    case ScriptExpressionBinary:
-    case ScriptExpressionIdentifier:
+  std::unordered_map<struct ScriptExpression *, size_t> expressionClass;
 
-      /* Nothing to do */
+  /* The expression chosen to represent each class */
+  std::vector<struct ScriptExpression *> representatives;
 
-      break;
-    }
-}
+  /* Every location holding an expression pointer */
+  std::vector<struct ScriptExpression **> references;
+};
 
 static void
-script_CollectExpressions (struct ScriptStatement *statement,
-                           script_ExpressionList &container)
+script_HashStatement (struct ScriptStatement *statement,
+                      script_Optimizer &optimizer);
+
+/* Assigns `expression' and all its subexpressions to equivalence classes,
+ * bottom-up, and returns the class of `expression'.  */
+static size_t
+script_HashExpression (struct ScriptExpression **reference,
+                       script_Optimizer &optimizer)
 {
-  while (statement)
-    {
-      struct ScriptParameter *parameter;
+  struct ScriptExpression *expression = *reference;
+  script_ExpressionKey key;
+  size_t result;
 
-      for (parameter = statement->parameters;
-           parameter; parameter = parameter->next)
-        {
-          script_CollectExpressions (&parameter->expression, container);
-        }
+  optimizer.references.push_back (reference);
 
-      statement = statement->next;
-    }
-}
+  auto existing = optimizer.expressionClass.find (expression);
 
-void
-SCRIPT_Optimize (struct script_parse_context *context)
-{
-  script_ExpressionList expressions;
-  bool dirty;
+  if (existing != optimizer.expressionClass.end ())
+    return existing->second;
 
-  script_CollectExpressions (context->statements, expressions);
+  key.type = expression->type;
+  key.data = 0;
+  key.size = 0;
+  key.scale = 0.0;
 
-  do
+  switch (expression->type)
     {
-      dirty = false;
-
-      for (auto lhs = expressions.begin (); lhs != expressions.end (); ++lhs)
-        {
-          struct ScriptExpression *a;
-
-          if (lhs->second.empty ())
-            continue;
+    case ScriptExpressionNumeric:
 
-          a = lhs->first;
+      key.data = expression->lhs.numeric;
+      key.size = strlen (expression->lhs.numeric);
+      key.scale = expression->scale;
 
-          for (auto rhs = lhs; ++rhs != expressions.end(); )
-            {
-              struct ScriptExpression *b;
+      break;
 
-              if (rhs->second.empty ())
-                continue;
+    case ScriptExpressionString:
 
-              b = rhs->first;
+      key.data = expression->lhs.string;
+      key.size = strlen (expression->lhs.string);
 
-              if (a->type != b->type)
-                continue;
+      break;
 
-              switch (a->type)
-                {
-                case ScriptExpressionNumeric:
+    case ScriptExpressionBinary:
 
-                  if (strcmp (a->lhs.numeric, b->lhs.numeric)
-                      || a->scale != b->scale)
-                    continue;
+      key.data = expression->lhs.binary->data;
+      key.size = expression->lhs.binary->size;
 
-                  break;
+      break;
 
-                case ScriptExpressionString:
+    case ScriptExpressionIdentifier:
 
-                  if (strcmp (a->lhs.string, b->lhs.string))
-                    continue;
+      key.data = expression->lhs.identifier;
+      key.size = strlen (expression->lhs.identifier);
 
-                  break;
+      break;
 
-                case ScriptExpressionBinary:
+    case ScriptExpressionStatement:
 
-                  if (strcmp (a->lhs.binary, b->lhs.binary))
-                    continue;
+        {
+          struct ScriptParameter *parameter;
 
-                  break;
+          script_HashStatement (expression->lhs.statement, optimizer);
 
-                case ScriptExpressionIdentifier:
+          key.data = expression->lhs.statement->identifier;
+          key.size = strlen (expression->lhs.statement->identifier);
 
-                  if (strcmp (a->lhs.identifier, b->lhs.identifier))
-                    continue;
+          for (parameter = expression->lhs.statement->parameters;
+               parameter; parameter = parameter->next)
+            {
+              key.names.push_back (parameter->identifier);
+              key.children.push_back (optimizer.expressionClass[parameter->expression]);
+            }
+        }
 
-                  break;
+      break;
 
-                case ScriptExpressionStatement:
+    case ScriptExpressionParen:
+    case ScriptExpressionNegative:
+    case ScriptExpressionAbsolute:
 
-                    {
-                      struct ScriptParameter *pa, *pb;
+      key.children.push_back (script_HashExpression (&expression->lhs.expression, optimizer));
 
-                      if (strcmp (a->lhs.statement->identifier,
-                                  b->lhs.statement->identifier))
-                        {
-                          continue;
-                        }
+      break;
 
-                      pa = a->lhs.statement->parameters;
-                      pb = b->lhs.statement->parameters;
+    case ScriptExpressionAdd:
+    case ScriptExpressionMultiply:
 
-                      while (pa && pb)
-                        {
-                          if (strcmp (pa->identifier, pb->identifier))
-                            break;
+      key.children.push_back (script_HashExpression (&expression->lhs.expression, optimizer));
+      key.children.push_back (script_HashExpression (&expression->rhs, optimizer));
 
-                          if (pa->expression != pb->expression)
-                            break;
+      /* Commutative; operand order does not matter */
 
-                          pa = pa->next;
-                          pb = pb->next;
-                        }
+      if (key.children[0] > key.children[1])
+        std::swap (key.children[0], key.children[1]);
 
-                      if (pa || pb)
-                        continue;
-                    }
+      break;
 
-                  break;
+    case ScriptExpressionSubtract:
+    case ScriptExpressionDivide:
 
-                case ScriptExpressionParen:
-                case ScriptExpressionNegative:
-                case ScriptExpressionAbsolute:
+      key.children.push_back (script_HashExpression (&expression->lhs.expression, optimizer));
+      key.children.push_back (script_HashExpression (&expression->rhs, optimizer));
 
-                  if (a->lhs.expression != b->lhs.expression)
-                    continue;
+      break;
+    }
 
-                  break;
+  auto inserted = optimizer.classes.insert (std::make_pair (std::move (key),
+                                                            optimizer.representatives.size ()));
 
-                case ScriptExpressionAdd:
-                case ScriptExpressionMultiply:
+  result = inserted.first->second;
 
-                  if (a->lhs.expression != b->lhs.expression
-                      || a->rhs != b->rhs)
-                    {
-                      if (a->lhs.expression != b->rhs
-                          || a->rhs != b->lhs.expression)
-                        continue;
-                    }
+  /* The first expression of a class in traversal order, which is source
+   * order, represents it.  This keeps the output independent of where the
+   * arena placed each expression.  */
 
-                  break;
+  if (inserted.second)
+    optimizer.representatives.push_back (expression);
 
-                case ScriptExpressionSubtract:
-                case ScriptExpressionDivide:
+  optimizer.expressionClass[expression] = result;
 
-                  if (a->lhs.expression != b->lhs.expression
-                      || a->rhs != b->rhs)
-                    continue;
+  return result;
+}
 
-                  break;
+static void
+script_HashStatement (struct ScriptStatement *statement,
+                      script_Optimizer &optimizer)
+{
+  while (statement)
+    {
+      struct ScriptParameter *parameter;
 
-                default:
+      for (parameter = statement->parameters;
+           parameter; parameter = parameter->next)
+        {
+          script_HashExpression (&parameter->expression, optimizer);
+        }
 
-                  continue;
-                }
+      statement = statement->next;
+    }
+}
 
-              for (auto pointer : rhs->second)
-                *pointer = a;
+/* Merges structurally identical expressions.  Every expression is hashed
+ * once, after its subexpressions, so that equivalent subtrees share a class
+ * number; then every reference is redirected to its class representative.  */
+void
+SCRIPT_Optimize (struct script_parse_context *context)
+{
+  script_Optimizer optimizer;
 
-              rhs->second.clear ();
+  script_HashStatement (context->statements, optimizer);
 
-              dirty = true;
-            }
-        }
-    }
-  while (dirty);
+  for (auto reference : optimizer.references)
+    *reference = optimizer.representatives[optimizer.expressionClass[*reference]];
 }
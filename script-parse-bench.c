@@ -0,0 +1,215 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+
+#include "script.h"
+
+static int ScriptParseBench_printHelp;
+static int ScriptParseBench_printVersion;
+static unsigned int ScriptParseBench_iterations = 5;
+static unsigned int ScriptParseBench_size = 16;
+
+static struct option ScriptParseBench_longOptions[] =
+{
+    { "iterations", required_argument, 0, 'n' },
+    { "size",     required_argument, 0, 's' },
+    { "help",     no_argument, &ScriptParseBench_printHelp, 1 },
+    { "version",  no_argument, &ScriptParseBench_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+static double
+ScriptParseBench_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/* Writes one statement dominated by string literals, some spanning lines */
+static void
+ScriptParseBench_StringStatement (FILE *output, unsigned int index)
+{
+  unsigned int i;
+
+  fprintf (output, "(text id:%u title:\"Statement number %u\" body:\"", index, index);
+
+  for (i = 0; i < 16; ++i)
+    fputs ("The quick brown fox jumps over the lazy dog.\n", output);
+
+  fputs ("\")\n", output);
+}
+
+/* Writes one statement holding a 2 KiB data() literal */
+static void
+ScriptParseBench_BinaryStatement (FILE *output, unsigned int index)
+{
+  unsigned int i;
+
+  fprintf (output, "(blob id:%u data:data(", index);
+
+  for (i = 0; i < 2048; ++i)
+    {
+      fprintf (output, "%02x", (i * 131 + index) & 0xff);
+
+      if ((i & 31) == 31)
+        fputs ("\n  ", output);
+    }
+
+  fputs ("))\n", output);
+}
+
+/* Writes one statement of numbers, identifiers and arithmetic */
+static void
+ScriptParseBench_TokenStatement (FILE *output, unsigned int index)
+{
+  fprintf (output,
+           "(node id:%u parent:n%u x:%u.25 y:(%u × 0.5) z:−%u.75 r:45° scale:(1 + %u) kind:mesh)\n",
+           index, index / 2, index, index, index, index % 7);
+}
+
+static FILE *
+ScriptParseBench_Generate (void (*statement) (FILE *, unsigned int), size_t *size)
+{
+  FILE *result;
+  unsigned int i;
+
+  if (!(result = tmpfile ()))
+    err (EXIT_FAILURE, "Failed to create temporary file");
+
+  for (i = 0; (size_t) ftell (result) < ScriptParseBench_size * 1024 * 1024; ++i)
+    statement (result, i);
+
+  if (ferror (result))
+    err (EXIT_FAILURE, "Error writing temporary file");
+
+  *size = ftell (result);
+
+  return result;
+}
+
+static void
+ScriptParseBench_Discard (struct script_parse_context *context,
+                          struct ScriptStatement *statement, void *arg)
+{
+  ++*(size_t *) arg;
+
+  arena_reset (&context->statement_arena);
+}
+
+static void
+ScriptParseBench_Run (const char *name, void (*statement) (FILE *, unsigned int))
+{
+  struct script_parse_context context;
+  size_t size, statements = 0;
+  double start, elapsed = 0.0;
+  unsigned int iteration;
+  FILE *input;
+
+  input = ScriptParseBench_Generate (statement, &size);
+
+  for (iteration = 0; iteration < ScriptParseBench_iterations; ++iteration)
+    {
+      rewind (input);
+
+      start = ScriptParseBench_Now ();
+
+      if (-1 == script_parse_file_streaming (&context, input, ScriptParseBench_Discard,
+                                             &statements))
+        errx (EXIT_FAILURE, "Failed to parse generated %s script", name);
+
+      elapsed += ScriptParseBench_Now () - start;
+
+      arena_free (&context.statement_arena);
+    }
+
+  printf ("%-16s %8.1f MB/s  %10.0f statements/s\n", name,
+          (double) size * ScriptParseBench_iterations / elapsed / 1.0e6,
+          statements / elapsed);
+
+  fclose (input);
+}
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  while (-1 != (i = getopt_long (argc, argv, "n:s:", ScriptParseBench_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 'n':
+
+          ScriptParseBench_iterations = strtol (optarg, 0, 0);
+
+          if (!ScriptParseBench_iterations)
+            errx (EX_USAGE, "Iteration count must be positive");
+
+          break;
+
+        case 's':
+
+          ScriptParseBench_size = strtol (optarg, 0, 0);
+
+          if (!ScriptParseBench_size)
+            errx (EX_USAGE, "Size must be positive");
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (ScriptParseBench_printHelp)
+    {
+      fprintf (stdout,
+               "Usage: %s [OPTION]...\n"
+               "\n"
+               "Measures parsing throughput for scripts dominated by string literals,\n"
+               "data() literals, and short tokens.\n"
+               "\n"
+               "  -n, --iterations=COUNT   parse each script COUNT times\n"
+               "  -s, --size=MIB           generate scripts of MIB megabytes\n"
+               "      --help     display this help and exit\n"
+               "      --version  display version information\n"
+               "\n"
+               "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (ScriptParseBench_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (optind != argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  ScriptParseBench_Run ("string literals", ScriptParseBench_StringStatement);
+  ScriptParseBench_Run ("data literals", ScriptParseBench_BinaryStatement);
+  ScriptParseBench_Run ("tokens", ScriptParseBench_TokenStatement);
+
+  return EXIT_SUCCESS;
+}
@@ -24,6 +24,10 @@
 void
 yyerror(YYLTYPE *loc, struct script_parse_context *context, const char *message);
 
+static void
+script_add_statement (struct script_parse_context *context,
+                      struct ScriptStatement *statement);
+
 #define scanner context->scanner
 %}
 %token EOF_
@@ -43,7 +47,7 @@ yyerror(YYLTYPE *loc, struct script_parse_context *context, const char *message)
 %token BinaryLiteral
 %type<p> BinaryLiteral
 
-%type<p> statements statement
+%type<p> statement
 %type<p> parameters parameter
 %type<p> expression
 
@@ -54,30 +58,18 @@ yyerror(YYLTYPE *loc, struct script_parse_context *context, const char *message)
 document
     : statements EOF_
       {
-        context->statements = $1; 
-
         return 0;
       }
     ;
 
 statements
-    : statement statements 
+    : statements statement
       {
-        struct ScriptStatement *lhs, *rhs;
-        lhs = $1;
-        rhs = $2;
-
-        if (lhs)
-        {
-          lhs->next = rhs;
-          $$ = lhs;
-        }
-        else
-          $$ = rhs;
+        script_add_statement (context, $2);
       }
     | statement
       {
-        $$ = $1;
+        script_add_statement (context, $1);
       }
     ;
 
@@ -171,7 +163,7 @@ expression
         struct ScriptExpression *expr;
         ALLOC (expr);
         expr->type = ScriptExpressionBinary;
-        expr->lhs.string = $1;
+        expr->lhs.binary = $1;
         $$ = expr;
       }
     | statement
@@ -246,12 +238,29 @@ expression
 %%
 #include <stdio.h>
 
-extern unsigned int character;
-extern unsigned int line;
+
+static void
+script_add_statement (struct script_parse_context *context,
+                      struct ScriptStatement *statement)
+{
+  if (context->statement_callback)
+    {
+      context->statement_callback (context, statement, context->statement_callback_arg);
+
+      return;
+    }
+
+  if (context->last_statement)
+    context->last_statement->next = statement;
+  else
+    context->statements = statement;
+
+  context->last_statement = statement;
+}
 
 void
 yyerror(YYLTYPE *loc, struct script_parse_context *context, const char *message)
 {
-  fprintf (stderr, "%s (line %u, column %u)\n", message, line, character);
+  fprintf (stderr, "%s (line %u, column %u)\n", message, context->line, context->character);
   context->error = 1;
 }
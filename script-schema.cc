@@ -0,0 +1,446 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include <err.h>
+#include <sysexits.h>
+
+#include "script.h"
+#include "script-schema.h"
+
+/* Upper bound on displacement seeds tried per bucket before giving up */
+#define SCRIPT_SCHEMA_MAX_SEED 0x1000000
+
+static const struct
+{
+  const char *name;
+  enum script_schema_type type;
+  const char *cType;
+} script_schemaTypes[] =
+{
+  { "u32",        ScriptSchemaU32,        "uint32_t" },
+  { "float",      ScriptSchemaFloat,      "float" },
+  { "string",     ScriptSchemaString,     "const char" },
+  { "binary",     ScriptSchemaBinary,     "const struct %s_binary" },
+  { "identifier", ScriptSchemaIdentifier, "uint32_t" },
+  { "statement",  ScriptSchemaStatement,  "const void" },
+  { "expression", ScriptSchemaExpression, "const unsigned char" }
+};
+
+uint32_t
+script_schema_hash (const char *string, uint32_t seed)
+{
+  uint32_t result;
+
+  result = 2166136261u ^ (seed * 0x9e3779b9u);
+
+  while (*string)
+    result = (result ^ (unsigned char) *string++) * 16777619u;
+
+  return result;
+}
+
+void
+script_schema_field_layout (enum script_schema_type type, unsigned int pointerSize,
+                            unsigned int *size, unsigned int *align)
+{
+  *size = *align = script_schema_is_pointer (type) ? pointerSize : 4;
+}
+
+int
+script_schema_is_pointer (enum script_schema_type type)
+{
+  return type != ScriptSchemaU32
+         && type != ScriptSchemaFloat
+         && type != ScriptSchemaIdentifier;
+}
+
+/* Converts a script identifier into a valid C identifier */
+static std::string
+Script_SchemaCName (const std::string &name, int upper)
+{
+  std::string result;
+
+  for (auto ch : name)
+    {
+      if (!isalnum ((unsigned char) ch))
+        ch = '_';
+      else if (upper)
+        ch = toupper ((unsigned char) ch);
+
+      result += ch;
+    }
+
+  if (result.empty () || isdigit ((unsigned char) result[0]))
+    result = "_" + result;
+
+  return result;
+}
+
+/* Names the structs and type constants of the generated header, and exits
+ * with an error if two of them, or two fields of a struct, would have the
+ * same C name.  */
+static void
+Script_SchemaAssignCNames (struct script_schema *schema, const char *path,
+                           std::unordered_map<std::string, unsigned int> &lines)
+{
+  std::unordered_map<std::string, unsigned int> identifiers;
+  std::unordered_map<std::string, std::string> constants, structs;
+
+  /* Names the header already uses, after the prefix */
+
+  constants["STATEMENT_COUNT"] = "the statement count";
+  constants["TYPED"] = "the typed statement tag";
+  constants["POINTER"] = "the pointer macro";
+  constants["SCHEMA_H_"] = "the include guard";
+  structs["binary"] = "the binary data struct";
+  structs["statement_type"] = "the statement type enum";
+
+  for (auto &statement : schema->statements)
+    ++identifiers[statement.identifier];
+
+  for (auto &statement : schema->statements)
+    {
+      std::unordered_map<std::string, std::string> fields;
+      unsigned int line;
+      std::string upper;
+
+      line = lines[statement.signature];
+
+      statement.cName = Script_SchemaCName (statement.identifier, 0);
+
+      if (identifiers[statement.identifier] > 1)
+        {
+          for (auto &parameter : statement.parameters)
+            statement.cName += "__" + Script_SchemaCName (parameter.name, 0);
+        }
+
+      upper = Script_SchemaCName (statement.cName, 1);
+
+      if (constants.count (upper))
+        errx (EX_DATAERR, "%s:%u: Type constant of `%s' would clash with %s",
+              path, line, statement.signature.c_str (), constants[upper].c_str ());
+
+      if (structs.count (statement.cName))
+        errx (EX_DATAERR, "%s:%u: Struct of `%s' would clash with %s",
+              path, line, statement.signature.c_str (), structs[statement.cName].c_str ());
+
+      constants[upper] = "`" + statement.signature + "'";
+      structs[statement.cName] = "`" + statement.signature + "'";
+
+      fields["type"] = "the type field";
+      fields["next"] = "the next field";
+
+      for (auto &parameter : statement.parameters)
+        {
+          std::string field;
+
+          field = Script_SchemaCName (parameter.name, 0);
+
+          if (fields.count (field))
+            errx (EX_DATAERR, "%s:%u: Parameter `%s' would clash with %s",
+                  path, line, parameter.name.c_str (), fields[field].c_str ());
+
+          fields[field] = "`" + parameter.name + "'";
+        }
+    }
+}
+
+/* Assigns every statement a slot using hash-and-displace: keys are grouped
+ * into buckets by an unseeded hash, and the largest buckets are placed
+ * first, each with the first seed that moves all of its keys to free
+ * slots.  */
+static void
+Script_SchemaBuildHash (struct script_schema *schema)
+{
+  std::vector<std::vector<size_t>> buckets;
+  std::vector<script_schema_statement> placed;
+  std::vector<size_t> order;
+  std::vector<bool> used;
+  size_t i, n;
+
+  n = schema->statements.size ();
+
+  buckets.resize (n);
+  used.resize (n);
+  placed.resize (n);
+  schema->displacements.assign (n, 0);
+
+  for (i = 0; i < n; ++i)
+    buckets[script_schema_hash (schema->statements[i].signature.c_str (), 0) % n].push_back (i);
+
+  for (i = 0; i < n; ++i)
+    order.push_back (i);
+
+  std::stable_sort (order.begin (), order.end (),
+                    [&](size_t a, size_t b)
+                      {
+                        return buckets[a].size () > buckets[b].size ();
+                      });
+
+  for (auto bucket : order)
+    {
+      std::vector<size_t> slots;
+      uint32_t seed;
+
+      if (buckets[bucket].empty ())
+        break;
+
+      for (seed = 1; seed < SCRIPT_SCHEMA_MAX_SEED; ++seed)
+        {
+          slots.clear ();
+
+          for (auto key : buckets[bucket])
+            {
+              size_t slot;
+
+              slot = script_schema_hash (schema->statements[key].signature.c_str (), seed) % n;
+
+              if (used[slot]
+                  || std::find (slots.begin (), slots.end (), slot) != slots.end ())
+                break;
+
+              slots.push_back (slot);
+            }
+
+          if (slots.size () == buckets[bucket].size ())
+            break;
+        }
+
+      if (seed == SCRIPT_SCHEMA_MAX_SEED)
+        errx (EXIT_FAILURE, "Failed to find a perfect hash for the schema");
+
+      schema->displacements[bucket] = seed;
+
+      for (i = 0; i < slots.size (); ++i)
+        {
+          used[slots[i]] = true;
+          placed[slots[i]] = schema->statements[buckets[bucket][i]];
+        }
+    }
+
+  schema->statements.swap (placed);
+
+  for (i = 0; i < n; ++i)
+    schema->types[schema->statements[i].signature] = i;
+}
+
+struct script_schema *
+script_schema_load (const char *path)
+{
+  struct script_schema *schema;
+  std::unordered_map<std::string, unsigned int> lines;
+  char line[4096];
+  unsigned int lineNumber = 0;
+  FILE *input;
+
+  if (!(input = fopen (path, "r")))
+    err (EXIT_FAILURE, "Failed to open `%s' for reading", path);
+
+  schema = new script_schema;
+
+  while (fgets (line, sizeof (line), input))
+    {
+      script_schema_statement statement;
+      char *token, *state;
+
+      ++lineNumber;
+
+      if (NULL != (token = strchr (line, '#')))
+        *token = 0;
+
+      if (!(token = strtok_r (line, " \t\r\n", &state)))
+        continue;
+
+      statement.identifier = token;
+      statement.signature = token;
+
+      while (NULL != (token = strtok_r (NULL, " \t\r\n", &state)))
+        {
+          script_schema_parameter parameter;
+          const char *type;
+          size_t i;
+
+          if (!(type = strchr (token, ':')))
+            errx (EX_DATAERR, "%s:%u: Expected NAME:TYPE, got `%s'", path, lineNumber, token);
+
+          parameter.name.assign (token, type++ - token);
+
+          for (i = 0; i < sizeof (script_schemaTypes) / sizeof (script_schemaTypes[0]); ++i)
+            {
+              if (!strcmp (type, script_schemaTypes[i].name))
+                break;
+            }
+
+          if (i == sizeof (script_schemaTypes) / sizeof (script_schemaTypes[0]))
+            errx (EX_DATAERR, "%s:%u: Unknown type `%s'", path, lineNumber, type);
+
+          parameter.type = script_schemaTypes[i].type;
+
+          statement.signature += ':';
+          statement.signature += parameter.name;
+          statement.parameters.push_back (parameter);
+        }
+
+      if (!lines.insert (std::make_pair (statement.signature, lineNumber)).second)
+        errx (EX_DATAERR, "%s:%u: Signature `%s' already defined on line %u",
+              path, lineNumber, statement.signature.c_str (), lines[statement.signature]);
+
+      schema->statements.push_back (statement);
+    }
+
+  if (ferror (input))
+    err (EXIT_FAILURE, "Error reading `%s'", path);
+
+  fclose (input);
+
+  if (schema->statements.empty ())
+    errx (EX_DATAERR, "%s: Schema has no statements", path);
+
+  Script_SchemaAssignCNames (schema, path, lines);
+  Script_SchemaBuildHash (schema);
+
+  return schema;
+}
+
+void
+script_schema_free (struct script_schema *schema)
+{
+  delete schema;
+}
+
+void
+script_schema_write_header (const struct script_schema *schema, FILE *output,
+                            const char *prefix)
+{
+  std::string upperPrefix;
+  size_t i;
+
+  upperPrefix = Script_SchemaCName (prefix, 1);
+
+  fprintf (output,
+           "/* Generated by bm-script-convert; do not edit.  */\n"
+           "\n"
+           "#ifndef %1$s_SCHEMA_H_\n"
+           "#define %1$s_SCHEMA_H_ 1\n"
+           "\n"
+           "#include <stdint.h>\n"
+           "#include <string.h>\n"
+           "\n"
+           "/* Files written with --relative store pointers as 32 bit offsets from\n"
+           " * the field itself; define %1$s_POINTER(type) as int32_t to read them.  */\n"
+           "#ifndef %1$s_POINTER\n"
+           "#define %1$s_POINTER(type) type *\n"
+           "#endif\n"
+           "\n"
+           "/* Set in the `type' field of statements laid out as the structs below */\n"
+           "#define %1$s_TYPED 0x%2$08xu\n"
+           "\n"
+           "enum %3$s_statement_type\n"
+           "{\n",
+           upperPrefix.c_str (), SCRIPT_SCHEMA_TYPED, prefix);
+
+  for (i = 0; i < schema->statements.size (); ++i)
+    fprintf (output, "  %s_%s = %zu, /* %s */\n",
+             upperPrefix.c_str (), Script_SchemaCName (schema->statements[i].cName, 1).c_str (),
+             i, schema->statements[i].signature.c_str ());
+
+  fprintf (output,
+           "\n"
+           "  %s_STATEMENT_COUNT = %zu\n"
+           "};\n"
+           "\n"
+           "struct %s_binary\n"
+           "{\n"
+           "  uint32_t size;\n"
+           "  unsigned char data[];\n"
+           "};\n",
+           upperPrefix.c_str (), schema->statements.size (), prefix);
+
+  for (auto &statement : schema->statements)
+    {
+      fprintf (output,
+               "\n"
+               "/* %s */\n"
+               "struct %s_%s\n"
+               "{\n"
+               "  uint32_t type;\n"
+               "  %s_POINTER (const void) next;\n",
+               statement.signature.c_str (), prefix,
+               statement.cName.c_str (),
+               upperPrefix.c_str ());
+
+      for (auto &parameter : statement.parameters)
+        {
+          char cType[128];
+
+          for (i = 0; script_schemaTypes[i].type != parameter.type; ++i)
+            ;
+
+          snprintf (cType, sizeof (cType), script_schemaTypes[i].cType, prefix);
+
+          if (script_schema_is_pointer (parameter.type))
+            fprintf (output, "  %s_POINTER (%s) %s;\n", upperPrefix.c_str (), cType,
+                     Script_SchemaCName (parameter.name, 0).c_str ());
+          else
+            fprintf (output, "  %s %s;\n", cType,
+                     Script_SchemaCName (parameter.name, 0).c_str ());
+        }
+
+      fprintf (output, "};\n");
+    }
+
+  fprintf (output,
+           "\n"
+           "static const char *const %s_signatures[%zu] =\n"
+           "{\n",
+           prefix, schema->statements.size ());
+
+  for (auto &statement : schema->statements)
+    fprintf (output, "  \"%s\",\n", statement.signature.c_str ());
+
+  fprintf (output,
+           "};\n"
+           "\n"
+           "static const uint32_t %s_displacements[%zu] =\n"
+           "{\n",
+           prefix, schema->displacements.size ());
+
+  for (i = 0; i < schema->displacements.size (); ++i)
+    fprintf (output, "%s%u,%s", (i % 8) ? " " : "  ", schema->displacements[i],
+             (i % 8 == 7 || i + 1 == schema->displacements.size ()) ? "\n" : "");
+
+  fprintf (output,
+           "};\n"
+           "\n"
+           "static inline uint32_t\n"
+           "%1$s_hash (const char *string, uint32_t seed)\n"
+           "{\n"
+           "  uint32_t result = 2166136261u ^ (seed * 0x9e3779b9u);\n"
+           "\n"
+           "  while (*string)\n"
+           "    result = (result ^ (unsigned char) *string++) * 16777619u;\n"
+           "\n"
+           "  return result;\n"
+           "}\n"
+           "\n"
+           "/* Returns the statement type with the given signature, or -1 if the\n"
+           " * signature is not in the schema.  */\n"
+           "static inline int\n"
+           "%1$s_lookup (const char *signature)\n"
+           "{\n"
+           "  uint32_t slot;\n"
+           "\n"
+           "  slot = %1$s_hash (signature, %1$s_displacements[%1$s_hash (signature, 0) %% %2$zuu]) %% %2$zuu;\n"
+           "\n"
+           "  return strcmp (signature, %1$s_signatures[slot]) ? -1 : (int) slot;\n"
+           "}\n"
+           "\n"
+           "#endif /* !%3$s_SCHEMA_H_ */\n",
+           prefix, schema->statements.size (), upperPrefix.c_str ());
+}
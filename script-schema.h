@@ -0,0 +1,72 @@
+#ifndef SCRIPT_SCHEMA_H_
+#define SCRIPT_SCHEMA_H_ 1
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "script-vm.h"
+
+/* Tag in the first word of a statement laid out as a schema struct.  The
+ * low bits hold the statement type.  Typed statements require a string
+ * table, so that the tag can not be mistaken for a signature.  */
+#define SCRIPT_SCHEMA_TYPED SCRIPT_VM_TYPED
+
+enum script_schema_type
+{
+  ScriptSchemaU32,
+  ScriptSchemaFloat,
+  ScriptSchemaString,
+  ScriptSchemaBinary,
+  ScriptSchemaIdentifier,
+  ScriptSchemaStatement,
+  ScriptSchemaExpression
+};
+
+struct script_schema_parameter
+{
+  std::string name;
+  enum script_schema_type type;
+};
+
+struct script_schema_statement
+{
+  std::string identifier;
+  std::string signature;
+
+  /* Name of the statement's struct and type constant in the generated
+   * header, without the prefix.  Overloaded identifiers have their
+   * parameter names appended.  */
+  std::string cName;
+
+  std::vector<script_schema_parameter> parameters;
+};
+
+/* Known statement signatures.  `statements' is indexed by statement type,
+ * which is the slot assigned by a minimal perfect hash of the signature:
+ *
+ *   type = script_schema_hash (signature, displacements[script_schema_hash (signature, 0) % n]) % n
+ */
+struct script_schema
+{
+  std::vector<script_schema_statement> statements;
+  std::vector<uint32_t> displacements;
+
+  std::unordered_map<std::string, uint32_t> types;
+};
+
+uint32_t
+script_schema_hash (const char *string, uint32_t seed);
+
+/* Returns non-zero if fields of the given type hold a pointer */
+int
+script_schema_is_pointer (enum script_schema_type type);
+
+/* Returns the size and alignment of a field of the given type */
+void
+script_schema_field_layout (enum script_schema_type type, unsigned int pointerSize,
+                            unsigned int *size, unsigned int *align);
+
+#endif /* !SCRIPT_SCHEMA_H_ */
@@ -0,0 +1,273 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+static int ScriptStreamBench_printHelp;
+static int ScriptStreamBench_printVersion;
+static unsigned int ScriptStreamBench_size = 2048;
+static const char *ScriptStreamBench_converter = "./bm-script-convert";
+static const char *ScriptStreamBench_script;
+
+/* Generated script, removed at exit */
+static char *ScriptStreamBench_generated;
+
+static struct option ScriptStreamBench_longOptions[] =
+{
+    { "size",     required_argument, 0, 's' },
+    { "converter", required_argument, 0, 'c' },
+    { "script",   required_argument, 0, 'S' },
+    { "help",     no_argument, &ScriptStreamBench_printHelp, 1 },
+    { "version",  no_argument, &ScriptStreamBench_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+static double
+ScriptStreamBench_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/* Writes one independent top-level statement, shaped like a level object
+ * with an embedded 4 KiB vertex data() blob */
+static void
+ScriptStreamBench_Statement (FILE *output, unsigned int index)
+{
+  unsigned int i;
+
+  fprintf (output,
+           "(object id:%u name:\"Object %u\" position:(vector x:%u.5 y:0 z:−%u.25)"
+           " rotation:%u° mesh:(mesh vertices:data(",
+           index, index, index % 1024, index / 1024, index % 360);
+
+  for (i = 0; i < 4096; ++i)
+    {
+      fprintf (output, "%02x", (i * 131 + index) & 0xff);
+
+      if ((i & 31) == 31)
+        fputs ("\n  ", output);
+    }
+
+  fputs (")))\n", output);
+}
+
+static void
+ScriptStreamBench_RemoveGenerated (void)
+{
+  if (ScriptStreamBench_generated)
+    unlink (ScriptStreamBench_generated);
+}
+
+/* Generates a script of at least `ScriptStreamBench_size' megabytes in
+ * the temporary directory, and returns its path */
+static char *
+ScriptStreamBench_Generate (size_t *size)
+{
+  const char *directory;
+  char *result;
+  FILE *output;
+  unsigned int i;
+  int fd;
+
+  if (!(directory = getenv ("TMPDIR")))
+    directory = "/tmp";
+
+  if (-1 == asprintf (&result, "%s/bm-script-stream-bench.XXXXXX", directory))
+    err (EX_OSERR, "asprintf failed");
+
+  if (-1 == (fd = mkstemp (result)))
+    err (EXIT_FAILURE, "Failed to create `%s'", result);
+
+  ScriptStreamBench_generated = result;
+  atexit (ScriptStreamBench_RemoveGenerated);
+
+  if (!(output = fdopen (fd, "w")))
+    err (EXIT_FAILURE, "fdopen failed");
+
+  for (i = 0; (size_t) ftello (output) < (size_t) ScriptStreamBench_size * 1024 * 1024; ++i)
+    ScriptStreamBench_Statement (output, i);
+
+  *size = ftello (output);
+
+  if (ferror (output) || fclose (output))
+    err (EXIT_FAILURE, "Error writing `%s'", result);
+
+  return result;
+}
+
+/* Converts `path' to binary format in a child process, discarding the
+ * output, and reports the child's peak resident set size.  The peak of
+ * each mode is only measurable in a process of its own.  */
+static void
+ScriptStreamBench_Run (const char *name, const char *path, size_t size, int stream)
+{
+  struct rusage usage;
+  double start, elapsed;
+  pid_t child;
+  int status;
+
+  fflush (stdout);
+
+  start = ScriptStreamBench_Now ();
+
+  if (-1 == (child = fork ()))
+    err (EX_OSERR, "fork failed");
+
+  /* The child leaves with _exit, so it does not remove the script */
+
+  if (!child)
+    {
+      int null;
+
+      if (-1 == (null = open ("/dev/null", O_WRONLY))
+          || -1 == dup2 (null, STDOUT_FILENO))
+        {
+          warn ("Failed to redirect output to /dev/null");
+          _exit (EX_OSERR);
+        }
+
+      if (stream)
+        execl (ScriptStreamBench_converter, ScriptStreamBench_converter,
+               "--stream", path, (char *) 0);
+      else
+        execl (ScriptStreamBench_converter, ScriptStreamBench_converter,
+               path, (char *) 0);
+
+      warn ("Failed to execute `%s'", ScriptStreamBench_converter);
+      _exit (127);
+    }
+
+  if (-1 == wait4 (child, &status, 0, &usage))
+    err (EX_OSERR, "wait4 failed");
+
+  elapsed = ScriptStreamBench_Now () - start;
+
+  if (WIFSIGNALED (status))
+    {
+      printf ("%-12s killed by signal %d, peak RSS %ld MiB\n", name,
+              WTERMSIG (status), usage.ru_maxrss / 1024);
+
+      return;
+    }
+
+  if (WEXITSTATUS (status))
+    errx (EXIT_FAILURE, "%s conversion failed with exit status %d", name,
+          WEXITSTATUS (status));
+
+  /* ru_maxrss is in kilobytes */
+
+  printf ("%-12s peak RSS %8ld MiB  %6.1f s  %8.1f MB/s\n", name,
+          usage.ru_maxrss / 1024, elapsed, size / elapsed / 1.0e6);
+}
+
+int
+main (int argc, char **argv)
+{
+  char *path;
+  size_t size;
+  struct stat st;
+  int i;
+
+  while (-1 != (i = getopt_long (argc, argv, "s:c:", ScriptStreamBench_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 's':
+
+          ScriptStreamBench_size = strtol (optarg, 0, 0);
+
+          if (!ScriptStreamBench_size)
+            errx (EX_USAGE, "Size must be positive");
+
+          break;
+
+        case 'c':
+
+          ScriptStreamBench_converter = optarg;
+
+          break;
+
+        case 'S':
+
+          ScriptStreamBench_script = optarg;
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (ScriptStreamBench_printHelp)
+    {
+      fprintf (stdout,
+               "Usage: %s [OPTION]...\n"
+               "\n"
+               "Compares peak memory use of bm-script-convert with and without --stream\n"
+               "on a generated script of independent statements with data() literals.\n"
+               "\n"
+               "  -s, --size=MIB           generate a script of MIB megabytes (default\n"
+               "                           2048)\n"
+               "  -c, --converter=PATH     run the converter at PATH (default\n"
+               "                           `./bm-script-convert')\n"
+               "      --script=FILE        convert FILE instead of generating a script\n"
+               "      --help     display this help and exit\n"
+               "      --version  display version information\n"
+               "\n"
+               "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (ScriptStreamBench_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (optind != argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]...", argv[0]);
+
+  if (ScriptStreamBench_script)
+    {
+      if (-1 == stat (ScriptStreamBench_script, &st))
+        err (EXIT_FAILURE, "Failed to stat `%s'", ScriptStreamBench_script);
+
+      path = (char *) ScriptStreamBench_script;
+      size = st.st_size;
+    }
+  else
+    path = ScriptStreamBench_Generate (&size);
+
+  printf ("%-12s %8.1f MiB\n", "script", size / 1048576.0);
+
+  ScriptStreamBench_Run ("stream", path, size, 1);
+  ScriptStreamBench_Run ("whole tree", path, size, 0);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,613 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script-vm.h"
+
+#define SCRIPT_VM_POINTER_SIZE sizeof (void *)
+
+static const unsigned char script_vmMagic[] = { 0xBA, 0xD9, 0xE2 };
+
+static const void *
+script_vm_ReadPointer (const struct script_vm_file *file, const void *location)
+{
+  const void *result;
+
+  if (file->flags & ScriptVMFlagRelative)
+    {
+      int32_t offset;
+
+      memcpy (&offset, location, sizeof (offset));
+
+      return offset ? (const char *) location + offset : NULL;
+    }
+
+  memcpy (&result, location, sizeof (result));
+
+  return result;
+}
+
+/* Reads the pointer table at `table' and converts every pointer it lists
+ * from a file offset to an address.  */
+static int
+script_vm_Relocate (unsigned char *data, size_t size, const unsigned char *table)
+{
+  const unsigned char *end;
+  size_t offset = 0;
+
+  end = data + size;
+
+  for (;;)
+    {
+      uintptr_t value;
+      size_t delta = 0;
+
+      do
+        {
+          if (table == end)
+            return -1;
+
+          delta = (delta << 7) | (*table & 0x7f);
+        }
+      while (*table++ & 0x80);
+
+      if (!delta)
+        break;
+
+      offset += delta * SCRIPT_VM_POINTER_SIZE;
+
+      if (offset > size - SCRIPT_VM_POINTER_SIZE)
+        return -1;
+
+      memcpy (&value, data + offset, sizeof (value));
+
+      if (value >= size)
+        return -1;
+
+      value += (uintptr_t) data;
+
+      memcpy (data + offset, &value, sizeof (value));
+    }
+
+  return 0;
+}
+
+uint32_t
+script_vm_hash (const char *string)
+{
+  uint32_t result = 2166136261u;
+
+  while (*string)
+    result = (result ^ (unsigned char) *string++) * 16777619u;
+
+  return result;
+}
+
+static uint32_t
+script_vm_ReadU32 (const void *location)
+{
+  uint32_t result;
+
+  memcpy (&result, location, sizeof (result));
+
+  return result;
+}
+
+/* Checks that the string table at `offset' lies within the file */
+static int
+script_vm_LoadStringTable (struct script_vm_file *file, const unsigned char *data,
+                           size_t size, size_t offset)
+{
+  uint32_t count, bucketCount;
+
+  if (offset > size - 8)
+    return -1;
+
+  count = script_vm_ReadU32 (data + offset);
+  bucketCount = script_vm_ReadU32 (data + offset + 4);
+
+  if (!bucketCount || (bucketCount & (bucketCount - 1))
+      || (uint64_t) count * 8 + (uint64_t) bucketCount * 4 > size - offset - 8)
+    return -1;
+
+  file->strings = data + offset;
+  file->stringCount = count;
+
+  return 0;
+}
+
+/* Sets up a relative file, which needs no changes to its data */
+static int
+script_vm_LoadRelative (struct script_vm_file *file, const unsigned char *data,
+                        size_t size)
+{
+  size_t i, trailerSize;
+
+  trailerSize = (file->flags & ScriptVMFlagStringTable) ? 8 : 4;
+
+  if (size < sizeof (script_vmMagic) + 1 + trailerSize || (size & 3))
+    return -1;
+
+  for (i = size - trailerSize; i < size; i += 4)
+    {
+      int32_t offset;
+
+      memcpy (&offset, data + i, sizeof (offset));
+
+      if (offset && (offset > 0 || (size_t) -offset > i))
+        return -1;
+    }
+
+  file->pointerSize = 4;
+  file->root = script_vm_ReadPointer (file, data + size - 4);
+
+  if (file->flags & ScriptVMFlagStringTable)
+    {
+      const unsigned char *table;
+
+      table = script_vm_ReadPointer (file, data + size - 8);
+
+      if (!table || -1 == script_vm_LoadStringTable (file, data, size, table - data))
+        return -1;
+    }
+
+  return 0;
+}
+
+static int
+script_vm_LoadAbsolute (struct script_vm_file *file, unsigned char *data,
+                        size_t size)
+{
+  uintptr_t stringTableOffset, tableOffset, rootOffset;
+  size_t trailerSize;
+
+  trailerSize = ((file->flags & ScriptVMFlagStringTable) ? 3 : 2) * SCRIPT_VM_POINTER_SIZE;
+
+  if (size < sizeof (script_vmMagic) + 1 + trailerSize
+      || (size & (SCRIPT_VM_POINTER_SIZE - 1)))
+    return -1;
+
+  memcpy (&tableOffset, data + size - 2 * SCRIPT_VM_POINTER_SIZE, sizeof (tableOffset));
+  memcpy (&rootOffset, data + size - SCRIPT_VM_POINTER_SIZE, sizeof (rootOffset));
+
+  if (tableOffset >= size || rootOffset >= size
+      || -1 == script_vm_Relocate (data, size, data + tableOffset))
+    return -1;
+
+  if (file->flags & ScriptVMFlagStringTable)
+    {
+      memcpy (&stringTableOffset, data + size - 3 * SCRIPT_VM_POINTER_SIZE,
+              sizeof (stringTableOffset));
+
+      if (-1 == script_vm_LoadStringTable (file, data, size, stringTableOffset))
+        return -1;
+    }
+
+  file->pointerSize = SCRIPT_VM_POINTER_SIZE;
+  file->root = (const char *) data + rootOffset;
+
+  return 0;
+}
+
+/* Returns the flags in the header of `data', or 0 if it is not a binary
+ * script this loader understands.  */
+static unsigned int
+script_vm_Flags (const unsigned char *data, size_t size)
+{
+  if (size < sizeof (script_vmMagic) + 1
+      || memcmp (data, script_vmMagic, sizeof (script_vmMagic)))
+    return 0;
+
+  switch (data[sizeof (script_vmMagic)] & ~ScriptVMFlagStringTable)
+    {
+    case ScriptVMFlagAbsolute:
+    case ScriptVMFlagRelative:
+
+      return data[sizeof (script_vmMagic)];
+
+    default:
+
+      return 0;
+    }
+}
+
+int
+script_vm_load_memory (struct script_vm_file *file, void *data, size_t size)
+{
+  int result;
+
+  memset (file, 0, sizeof (*file));
+
+  file->flags = script_vm_Flags (data, size);
+
+  if (file->flags & ScriptVMFlagRelative)
+    result = script_vm_LoadRelative (file, data, size);
+  else if (file->flags & ScriptVMFlagAbsolute)
+    result = script_vm_LoadAbsolute (file, data, size);
+  else
+    result = -1;
+
+  if (result == -1)
+    {
+      memset (file, 0, sizeof (*file));
+      errno = EINVAL;
+
+      return -1;
+    }
+
+  file->data = data;
+  file->size = size;
+
+  return 0;
+}
+
+int
+script_vm_load (struct script_vm_file *file, const char *path)
+{
+  unsigned char header[sizeof (script_vmMagic) + 1];
+  struct stat st;
+  void *data;
+  int fd, saveErrno, prot, flags;
+
+  if (-1 == (fd = open (path, O_RDONLY)))
+    return -1;
+
+  if (-1 == fstat (fd, &st))
+    {
+      saveErrno = errno;
+      close (fd);
+      errno = saveErrno;
+
+      return -1;
+    }
+
+  /* Relative files are used as they are, so they are mapped read-only and
+   * shared between processes.  Other files get a private writable mapping,
+   * so that relocation only copies the pages holding pointers and never
+   * touches the file itself.  */
+
+  if (sizeof (header) == pread (fd, header, sizeof (header), 0)
+      && (script_vm_Flags (header, sizeof (header)) & ScriptVMFlagRelative))
+    {
+      prot = PROT_READ;
+      flags = MAP_SHARED;
+    }
+  else
+    {
+      prot = PROT_READ | PROT_WRITE;
+      flags = MAP_PRIVATE;
+    }
+
+  data = mmap (NULL, st.st_size, prot, flags, fd, 0);
+
+  saveErrno = errno;
+  close (fd);
+
+  if (data == MAP_FAILED)
+    {
+      errno = saveErrno;
+
+      return -1;
+    }
+
+  if (-1 == script_vm_load_memory (file, data, st.st_size))
+    {
+      saveErrno = errno;
+      munmap (data, st.st_size);
+      errno = saveErrno;
+
+      return -1;
+    }
+
+  file->mapped = 1;
+
+  return 0;
+}
+
+void
+script_vm_unload (struct script_vm_file *file)
+{
+  if (file->mapped)
+    munmap (file->data, file->size);
+
+  memset (file, 0, sizeof (*file));
+}
+
+const char *
+script_vm_string (const struct script_vm_file *file, uint32_t id)
+{
+  if (id >= file->stringCount)
+    return NULL;
+
+  return (const char *) file->strings + script_vm_ReadU32 (file->strings + 12 + id * 8);
+}
+
+uint32_t
+script_vm_string_id (const struct script_vm_file *file, const char *string)
+{
+  uint32_t hash, bucketCount, bucket, entry;
+
+  if (!file->strings)
+    return (uint32_t) -1;
+
+  hash = script_vm_hash (string);
+  bucketCount = script_vm_ReadU32 (file->strings + 4);
+
+  for (bucket = hash & (bucketCount - 1); ; bucket = (bucket + 1) & (bucketCount - 1))
+    {
+      entry = script_vm_ReadU32 (file->strings + 8 + file->stringCount * 8 + bucket * 4);
+
+      if (!entry)
+        return (uint32_t) -1;
+
+      --entry;
+
+      if (script_vm_ReadU32 (file->strings + 8 + entry * 8) == hash
+          && !strcmp (script_vm_string (file, entry), string))
+        return entry;
+    }
+}
+
+uint32_t
+script_vm_statement_id (const struct script_vm_file *file, const char *statement)
+{
+  if (!(file->flags & ScriptVMFlagStringTable))
+    return (uint32_t) -1;
+
+  return script_vm_ReadU32 (statement);
+}
+
+const char *
+script_vm_statement_signature (const struct script_vm_file *file,
+                               const char *statement)
+{
+  uint32_t id;
+
+  if (!(file->flags & ScriptVMFlagStringTable))
+    return statement;
+
+  id = script_vm_ReadU32 (statement);
+
+  if (id & SCRIPT_VM_TYPED)
+    return NULL;
+
+  return script_vm_string (file, id);
+}
+
+/* Returns the address of the first pointer following a statement's
+ * signature.  */
+static const unsigned char *
+script_vm_StatementPointers (const struct script_vm_file *file,
+                             const char *statement)
+{
+  uintptr_t result;
+
+  if (file->flags & ScriptVMFlagStringTable)
+    result = (uintptr_t) (statement + 4);
+  else
+    result = (uintptr_t) (statement + strlen (statement) + 1);
+  result = (result + file->pointerSize - 1) & ~(uintptr_t) (file->pointerSize - 1);
+
+  return (const unsigned char *) result;
+}
+
+size_t
+script_vm_statement_parameter_count (const struct script_vm_file *file,
+                                     const char *statement)
+{
+  size_t result = 0;
+
+  /* Typed statements have no parameter pointers, so their `next' pointer
+   * directly follows the tag */
+
+  if (!(statement = script_vm_statement_signature (file, statement)))
+    return 0;
+
+  while (NULL != (statement = strchr (statement, ':')))
+    {
+      ++statement;
+      ++result;
+    }
+
+  return result;
+}
+
+const char *
+script_vm_statement_next (const struct script_vm_file *file,
+                          const char *statement)
+{
+  const unsigned char *pointers;
+
+  pointers = script_vm_StatementPointers (file, statement);
+
+  return script_vm_ReadPointer (file, pointers + script_vm_statement_parameter_count (file, statement)
+                                      * file->pointerSize);
+}
+
+const unsigned char *
+script_vm_statement_parameter_at (const struct script_vm_file *file,
+                                  const char *statement, size_t index)
+{
+  return script_vm_ReadPointer (file, script_vm_StatementPointers (file, statement)
+                                      + index * file->pointerSize);
+}
+
+const unsigned char *
+script_vm_statement_parameter (const struct script_vm_file *file,
+                               const char *statement, const char *name)
+{
+  const char *parameter;
+  size_t index = 0, length;
+
+  if (!(parameter = script_vm_statement_signature (file, statement)))
+    return NULL;
+
+  length = strlen (name);
+  parameter = strchr (parameter, ':');
+
+  while (parameter)
+    {
+      ++parameter;
+
+      if (!strncmp (parameter, name, length)
+          && (parameter[length] == ':' || !parameter[length]))
+        return script_vm_statement_parameter_at (file, statement, index);
+
+      parameter = strchr (parameter, ':');
+      ++index;
+    }
+
+  return NULL;
+}
+
+static int
+script_vm_ToFloat (const struct script_vm_value *value, float *result)
+{
+  switch (value->type)
+    {
+    case ScriptVMValueU32:
+
+      *result = (float) value->v.u32;
+
+      return 0;
+
+    case ScriptVMValueFloat:
+
+      *result = value->v.v_float;
+
+      return 0;
+
+    default:
+
+      errno = EINVAL;
+
+      return -1;
+    }
+}
+
+int
+script_vm_evaluate (const struct script_vm_file *file,
+                    const unsigned char *expression, struct script_vm_value *value)
+{
+  struct script_vm_value lhs, rhs;
+  float a, b;
+
+  switch (*expression)
+    {
+    case ScriptVMExpressionU32:
+
+      value->type = ScriptVMValueU32;
+      memcpy (&value->v.u32, expression + 1, sizeof (value->v.u32));
+
+      return 0;
+
+    case ScriptVMExpressionFloat:
+
+      value->type = ScriptVMValueFloat;
+      memcpy (&value->v.v_float, expression + 1, sizeof (value->v.v_float));
+
+      return 0;
+
+    case ScriptVMExpressionString:
+
+      value->type = ScriptVMValueString;
+      value->v.string = (const char *) expression + 1;
+
+      return 0;
+
+    case ScriptVMExpressionBinary:
+
+      value->type = ScriptVMValueBinary;
+      memcpy (&value->v.binary.size, expression + 1, sizeof (value->v.binary.size));
+      value->v.binary.data = expression + 5;
+
+      return 0;
+
+    case ScriptVMExpressionIdentifier:
+
+      value->type = ScriptVMValueIdentifier;
+
+      if (file->flags & ScriptVMFlagStringTable)
+        value->v.identifier = script_vm_string (file, script_vm_ReadU32 (expression + 1));
+      else
+        value->v.identifier = (const char *) expression + 1;
+
+      return 0;
+
+    case ScriptVMExpressionStatement:
+
+      value->type = ScriptVMValueStatement;
+      value->v.statement = script_vm_ReadPointer (file, expression + 1);
+
+      return 0;
+
+    case ScriptVMExpressionParen:
+
+      return script_vm_evaluate (file, script_vm_ReadPointer (file, expression + 1), value);
+
+    case ScriptVMExpressionNegative:
+    case ScriptVMExpressionAbsolute:
+
+      if (-1 == script_vm_evaluate (file, script_vm_ReadPointer (file, expression + 1), &lhs)
+          || -1 == script_vm_ToFloat (&lhs, &a))
+        return -1;
+
+      value->type = ScriptVMValueFloat;
+      value->v.v_float = (*expression == ScriptVMExpressionNegative) ? -a : fabsf (a);
+
+      return 0;
+
+    case ScriptVMExpressionAdd:
+    case ScriptVMExpressionSubtract:
+    case ScriptVMExpressionMultiply:
+    case ScriptVMExpressionDivide:
+
+      if (-1 == script_vm_evaluate (file, script_vm_ReadPointer (file, expression + 1), &lhs)
+          || -1 == script_vm_evaluate (file, script_vm_ReadPointer (file, expression + 1
+                                                                    + file->pointerSize),
+                                       &rhs)
+          || -1 == script_vm_ToFloat (&lhs, &a)
+          || -1 == script_vm_ToFloat (&rhs, &b))
+        return -1;
+
+      value->type = ScriptVMValueFloat;
+
+      switch (*expression)
+        {
+        case ScriptVMExpressionAdd:      value->v.v_float = a + b; break;
+        case ScriptVMExpressionSubtract: value->v.v_float = a - b; break;
+        case ScriptVMExpressionMultiply: value->v.v_float = a * b; break;
+        default:                         value->v.v_float = a / b; break;
+        }
+
+      return 0;
+
+    default:
+
+      /* Includes Mat4x4, which the compiler never emits */
+
+      errno = EINVAL;
+
+      return -1;
+    }
+}
+
+int
+script_vm_evaluate_float (const struct script_vm_file *file,
+                          const unsigned char *expression, float *result)
+{
+  struct script_vm_value value;
+
+  if (-1 == script_vm_evaluate (file, expression, &value))
+    return -1;
+
+  return script_vm_ToFloat (&value, result);
+}
@@ -1,6 +1,13 @@
 #ifndef SCRIPT_VM_H_
 #define SCRIPT_VM_H_ 1
 
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 enum ScriptVMExpressionType
 {
   ScriptVMExpressionU32,
@@ -20,4 +27,150 @@ enum ScriptVMExpressionType
   ScriptVMExpressionDivide
 };
 
+/* Fourth byte of the file header */
+enum ScriptVMFlags
+{
+  /* Pointers are absolute file offsets listed in a relocation table */
+  ScriptVMFlagAbsolute = 0x01,
+
+  /* Pointers are 32 bit offsets from their own location, and the file
+   * has no relocation table */
+  ScriptVMFlagRelative = 0x02,
+
+  /* Identifiers and statement signatures are IDs in a string table */
+  ScriptVMFlagStringTable = 0x04
+};
+
+/* Hash used by the string table index (32 bit FNV-1a) */
+uint32_t
+script_vm_hash (const char *string);
+
+/* Reference loader and evaluator for binary scripts.  Files with absolute
+ * pointers are relocated in place, and must have been written with the
+ * native pointer size.  Files with relative pointers are used as they are.  */
+
+struct script_vm_file
+{
+  void *data;
+  size_t size;
+  int mapped;
+
+  /* ScriptVMFlags from the header, and the size of pointers in the file */
+  unsigned int flags;
+  size_t pointerSize;
+
+  /* String table, if the file has one */
+  const unsigned char *strings;
+  uint32_t stringCount;
+
+  /* First top-level statement, or NULL for an empty script */
+  const char *root;
+};
+
+enum ScriptVMValueType
+{
+  ScriptVMValueU32,
+  ScriptVMValueFloat,
+  ScriptVMValueString,
+  ScriptVMValueBinary,
+  ScriptVMValueIdentifier,
+  ScriptVMValueStatement
+};
+
+struct script_vm_value
+{
+  enum ScriptVMValueType type;
+
+  union
+  {
+    uint32_t u32;
+    float v_float;
+    const char *string;
+    const char *identifier;
+    const char *statement;
+
+    struct
+    {
+      const void *data;
+      uint32_t size;
+    } binary;
+  } v;
+};
+
+/* Maps `path' and relocates it.  Returns 0 on success, or -1 with errno set
+ * on failure.  */
+int
+script_vm_load (struct script_vm_file *file, const char *path);
+
+/* Relocates a script already in memory, if it uses absolute pointers.
+ * `data' must be aligned to the pointer size and stay valid until the file
+ * is unloaded, which does not free it.  */
+int
+script_vm_load_memory (struct script_vm_file *file, void *data, size_t size);
+
+void
+script_vm_unload (struct script_vm_file *file);
+
+/* Returns the string with the given ID, or NULL if there is no such ID */
+const char *
+script_vm_string (const struct script_vm_file *file, uint32_t id);
+
+/* Returns the ID of `string' in the string table, or (uint32_t) -1 if it is
+ * not present.  Looking up the names an application handles once after
+ * loading lets it dispatch on statement IDs with integer comparisons.  */
+uint32_t
+script_vm_string_id (const struct script_vm_file *file, const char *string);
+
+/* Statements start with their signature, `identifier:param:param', either
+ * inline as a C string or as a 32 bit string table ID.  Statements written
+ * with a schema instead start with SCRIPT_VM_TYPED | type, followed by a
+ * `next' pointer and fields as described by the header generated from the
+ * schema; they have no signature and no parameters.  */
+
+#define SCRIPT_VM_TYPED 0x80000000u
+
+const char *
+script_vm_statement_signature (const struct script_vm_file *file,
+                               const char *statement);
+
+/* Returns the string table ID of a statement's signature, or (uint32_t) -1
+ * if the file has no string table.  For typed statements, returns the tag
+ * word.  */
+uint32_t
+script_vm_statement_id (const struct script_vm_file *file, const char *statement);
+
+const char *
+script_vm_statement_next (const struct script_vm_file *file,
+                          const char *statement);
+
+size_t
+script_vm_statement_parameter_count (const struct script_vm_file *file,
+                                     const char *statement);
+
+const unsigned char *
+script_vm_statement_parameter_at (const struct script_vm_file *file,
+                                  const char *statement, size_t index);
+
+/* Returns the expression of the named parameter, or NULL if the statement
+ * has no such parameter.  */
+const unsigned char *
+script_vm_statement_parameter (const struct script_vm_file *file,
+                               const char *statement, const char *name);
+
+/* Evaluates `expression'.  Arithmetic is done in single precision, with
+ * U32 operands converted to float.  Returns 0 on success, or -1 with errno
+ * set to EINVAL for operands arithmetic is not defined on.  */
+int
+script_vm_evaluate (const struct script_vm_file *file,
+                    const unsigned char *expression, struct script_vm_value *value);
+
+/* Evaluates `expression' and converts the result to a float */
+int
+script_vm_evaluate_float (const struct script_vm_file *file,
+                          const unsigned char *expression, float *result);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
 #endif /* !SCRIPT_VM_H_ */
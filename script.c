@@ -4,11 +4,17 @@
 
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "array.h"
 #include "script.h"
 #include "script-vm.h"
 
@@ -16,23 +22,356 @@ static int Script_printHelp;
 static int Script_printVersion;
 static const char *Script_format = "binary";
 static int Script_pointerSize = 32;
+static int Script_stream;
+static int Script_noFold;
+static int Script_relative;
+static int Script_stringTable;
+static const char *Script_schemaPath;
+static const char *Script_schemaHeaderPath;
+static const char *Script_schemaPrefix = "bsd";
+static struct script_schema *Script_schema;
+static int Script_batch;
+static const char *Script_manifestPath;
+static long Script_jobs;
+
+/* Input and output of one script in batch mode */
+struct Script_job
+{
+  const char *input;
+  const char *output;
+};
+
+static ARRAY(struct Script_job) Script_batchJobs;
+static size_t Script_batchNext;
+static int Script_batchFailed;
+static off_t Script_batchInputSize;
+static pthread_mutex_t Script_batchMutex = PTHREAD_MUTEX_INITIALIZER;
 
 static struct option Script_longOptions[] =
 {
     { "format", required_argument, 0, 'f' },
     { "pointer-size", required_argument, 0, 'p' },
+    { "stream",   no_argument, &Script_stream, 1 },
+    { "no-fold",  no_argument, &Script_noFold, 1 },
+    { "relative", no_argument, &Script_relative, 1 },
+    { "string-table", no_argument, &Script_stringTable, 1 },
+    { "schema",   required_argument, 0, 's' },
+    { "schema-header", required_argument, 0, 'H' },
+    { "schema-prefix", required_argument, 0, 'P' },
+    { "batch",    no_argument, &Script_batch, 1 },
+    { "manifest", required_argument, 0, 'M' },
+    { "jobs",     required_argument, 0, 'j' },
     { "help",     no_argument, &Script_printHelp, 1 },
     { "version",  no_argument, &Script_printVersion, 1 },
     { 0, 0, 0, 0 }
 };
 
+/* Optimizes and emits a single top-level statement in streaming mode, then
+ * releases all memory used for parsing it.  */
+static void
+Script_StreamStatement (struct script_parse_context *context,
+                        struct ScriptStatement *statement, void *arg)
+{
+  context->statements = statement;
+
+  if (!Script_noFold)
+    SCRIPT_Fold (context);
+
+  SCRIPT_Optimize (context);
+  script_writer_statement (arg, statement);
+
+  context->statements = 0;
+
+  arena_reset (&context->statement_arena);
+}
+
+static unsigned int
+Script_WriterFlags (void)
+{
+  unsigned int result = 0;
+
+  if (Script_relative)
+    result |= SCRIPT_WRITER_RELATIVE;
+
+  if (Script_stringTable || Script_schema)
+    result |= SCRIPT_WRITER_STRING_TABLE;
+
+  return result;
+}
+
+static struct script_writer *
+Script_CreateWriter (FILE *output)
+{
+  struct script_writer *result;
+
+  result = script_writer_create (output, Script_pointerSize, Script_WriterFlags ());
+
+  if (Script_schema)
+    script_writer_set_schema (result, Script_schema);
+
+  return result;
+}
+
+/* Writes the C header for the schema given with --schema */
+static void
+Script_WriteSchemaHeader (void)
+{
+  FILE *output;
+
+  if (!(output = fopen (Script_schemaHeaderPath, "w")))
+    err (EXIT_FAILURE, "Failed to open `%s' for writing", Script_schemaHeaderPath);
+
+  script_schema_write_header (Script_schema, output, Script_schemaPrefix);
+
+  if (fclose (output))
+    err (EX_IOERR, "Error writing `%s'", Script_schemaHeaderPath);
+}
+
+static int
+Script_ParseFile (struct script_parse_context *context, FILE *input,
+                  struct script_writer *writer)
+{
+  if (!Script_stream)
+    return script_parse_file (context, input);
+
+  return script_parse_file_streaming (context, input, Script_StreamStatement, writer);
+}
+
+static double
+Script_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static void
+Script_AddJob (const char *input, const char *output)
+{
+  struct Script_job job;
+
+  job.input = input;
+  job.output = output;
+
+  ARRAY_ADD (&Script_batchJobs, job);
+
+  if (ARRAY_RESULT (&Script_batchJobs))
+    err (EX_OSERR, "memory allocation failed");
+}
+
+/* Reads a manifest listing one `INPUT OUTPUT' pair per line.  Empty lines
+ * and lines starting with `#' are ignored.  */
+static void
+Script_ReadManifest (const char *path)
+{
+  char line[8192];
+  unsigned int lineNumber = 0;
+  FILE *manifest;
+
+  if (!strcmp (path, "-"))
+    manifest = stdin;
+  else if (!(manifest = fopen (path, "r")))
+    err (EXIT_FAILURE, "Failed to open `%s' for reading", path);
+
+  while (fgets (line, sizeof (line), manifest))
+    {
+      char *input, *output, *state;
+
+      ++lineNumber;
+
+      if (!(input = strtok_r (line, " \t\r\n", &state)) || *input == '#')
+        continue;
+
+      if (!(output = strtok_r (NULL, " \t\r\n", &state))
+          || strtok_r (NULL, " \t\r\n", &state))
+        errx (EX_DATAERR, "%s:%u: Expected INPUT OUTPUT", path, lineNumber);
+
+      if (!(input = strdup (input)) || !(output = strdup (output)))
+        err (EX_OSERR, "strdup failed");
+
+      Script_AddJob (input, output);
+    }
+
+  if (ferror (manifest))
+    err (EXIT_FAILURE, "Error reading `%s'", path);
+
+  if (manifest != stdin)
+    fclose (manifest);
+}
+
+/* Parses `input' and writes it as a binary script.  Returns -1 if the
+ * script could not be parsed.  */
+static int
+Script_ConvertBinary (struct script_parse_context *context, FILE *input,
+                      struct script_writer *writer)
+{
+  if (-1 == Script_ParseFile (context, input, writer))
+    return -1;
+
+  if (!Script_stream)
+    {
+      if (!Script_noFold)
+        SCRIPT_Fold (context);
+
+      SCRIPT_Optimize (context);
+      script_writer_dump (writer, context);
+    }
+
+  script_writer_finish (writer);
+
+  return 0;
+}
+
+/* Converts one batch job, reusing the calling thread's writer.  Returns -1
+ * after reporting the error if the job failed.  */
+static int
+Script_BatchConvert (const struct Script_job *job, struct script_writer **writer)
+{
+  struct script_parse_context context;
+  struct stat st;
+  FILE *input, *output;
+  double start, elapsed;
+  int result;
+
+  start = Script_Now ();
+
+  if (!(input = fopen (job->input, "r")))
+    {
+      warn ("Failed to open `%s' for reading", job->input);
+
+      return -1;
+    }
+
+  if (!(output = fopen (job->output, "wb")))
+    {
+      warn ("Failed to open `%s' for writing", job->output);
+      fclose (input);
+
+      return -1;
+    }
+
+  if (*writer)
+    script_writer_reset (*writer, output);
+  else
+    *writer = Script_CreateWriter (output);
+
+  result = Script_ConvertBinary (&context, input, *writer);
+
+  arena_free (&context.statement_arena);
+
+  if (-1 == fstat (fileno (input), &st))
+    st.st_size = 0;
+
+  fclose (input);
+
+  if (fclose (output))
+    err (EX_IOERR, "Error writing `%s'", job->output);
+
+  if (result == -1)
+    {
+      warnx ("%s: failed to parse script", job->input);
+      unlink (job->output);
+
+      return -1;
+    }
+
+  elapsed = Script_Now () - start;
+
+  fprintf (stderr, "%s: %lld bytes in %.2f ms (%.1f MB/s)\n",
+           job->input, (long long) st.st_size, elapsed * 1.0e3,
+           st.st_size / elapsed / 1.0e6);
+
+  pthread_mutex_lock (&Script_batchMutex);
+  Script_batchInputSize += st.st_size;
+  pthread_mutex_unlock (&Script_batchMutex);
+
+  return 0;
+}
+
+static void *
+Script_BatchThread (void *arg)
+{
+  struct script_writer *writer = NULL;
+
+  for (;;)
+    {
+      const struct Script_job *job;
+
+      pthread_mutex_lock (&Script_batchMutex);
+
+      if (Script_batchNext == ARRAY_COUNT (&Script_batchJobs))
+        {
+          pthread_mutex_unlock (&Script_batchMutex);
+
+          break;
+        }
+
+      job = &ARRAY_GET (&Script_batchJobs, Script_batchNext++);
+
+      pthread_mutex_unlock (&Script_batchMutex);
+
+      if (-1 == Script_BatchConvert (job, &writer))
+        {
+          pthread_mutex_lock (&Script_batchMutex);
+          Script_batchFailed = 1;
+          pthread_mutex_unlock (&Script_batchMutex);
+        }
+    }
+
+  if (writer)
+    script_writer_free (writer);
+
+  return NULL;
+}
+
+/* Converts all batch jobs on a pool of `Script_jobs' threads */
+static int
+Script_RunBatch (void)
+{
+  pthread_t *threads;
+  double start, elapsed;
+  long i, threadCount;
+
+  threadCount = Script_jobs;
+
+  if (threadCount > (long) ARRAY_COUNT (&Script_batchJobs))
+    threadCount = ARRAY_COUNT (&Script_batchJobs);
+
+  if (!(threads = calloc (threadCount, sizeof (*threads))))
+    err (EX_OSERR, "calloc failed");
+
+  start = Script_Now ();
+
+  for (i = 0; i < threadCount; ++i)
+    {
+      if (0 != (errno = pthread_create (&threads[i], 0, Script_BatchThread, 0)))
+        err (EX_OSERR, "pthread_create failed");
+    }
+
+  for (i = 0; i < threadCount; ++i)
+    pthread_join (threads[i], 0);
+
+  elapsed = Script_Now () - start;
+
+  fprintf (stderr, "%zu scripts, %lld bytes in %.2f s (%.1f MB/s, %ld threads)\n",
+           ARRAY_COUNT (&Script_batchJobs), (long long) Script_batchInputSize,
+           elapsed, Script_batchInputSize / elapsed / 1.0e6, threadCount);
+
+  free (threads);
+
+  return Script_batchFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int
 main (int argc, char **argv)
 {
   struct script_parse_context context;
+  struct script_writer *writer = NULL;
   int i;
 
-  while(-1 != (i = getopt_long(argc, argv, "", Script_longOptions, NULL)))
+  while(-1 != (i = getopt_long(argc, argv, "j:", Script_longOptions, NULL)))
     {
       switch(i)
         {
@@ -52,6 +391,40 @@ main (int argc, char **argv)
 
           break;
 
+        case 's':
+
+          Script_schemaPath = optarg;
+
+          break;
+
+        case 'H':
+
+          Script_schemaHeaderPath = optarg;
+
+          break;
+
+        case 'P':
+
+          Script_schemaPrefix = optarg;
+
+          break;
+
+        case 'M':
+
+          Script_manifestPath = optarg;
+          Script_batch = 1;
+
+          break;
+
+        case 'j':
+
+          Script_jobs = strtol (optarg, 0, 0);
+
+          if (Script_jobs <= 0)
+            errx (EX_USAGE, "Job count must be positive");
+
+          break;
+
         case '?':
 
           fprintf(stderr, "Try `%s --help' for more information.\n", argv[0]);
@@ -64,13 +437,34 @@ main (int argc, char **argv)
     {
       fprintf(stdout,
               "Usage: %s [OPTION]... SCRIPT\n"
+              "  or:  %s --batch [OPTION]... [INPUT OUTPUT]...\n"
               "\n"
               "  -f, --format=FORMAT      set output format\n"
               "  -p, --pointer-size=BITS  set size of pointers on target platform\n"
+              "      --stream             emit each top-level statement as soon as it is\n"
+              "                           parsed, using memory proportional to the largest\n"
+              "                           statement instead of the whole script\n"
+              "      --no-fold            do not evaluate constant expressions in binary\n"
+              "                           output\n"
+              "      --relative           store pointers as 32 bit self-relative offsets\n"
+              "                           that need no relocation when loaded\n"
+              "      --string-table       store identifiers and statement signatures once\n"
+              "                           in a hashed string table, referenced by ID\n"
+              "      --schema=FILE        lay out statements listed in FILE as fixed\n"
+              "                           structs, implying --string-table\n"
+              "      --schema-header=FILE write C declarations for the schema to FILE\n"
+              "      --schema-prefix=NAME prefix names in the schema header with NAME\n"
+              "                           (default `bsd')\n"
+              "      --batch              convert each INPUT to OUTPUT in binary format on\n"
+              "                           a pool of threads, reporting throughput\n"
+              "      --manifest=FILE      read INPUT OUTPUT pairs from FILE, one per line;\n"
+              "                           implies --batch\n"
+              "  -j, --jobs=COUNT         use COUNT threads in batch mode (default: one\n"
+              "                           per processor)\n"
               "      --help     display this help and exit\n"
               "      --version  display version information\n"
               "\n"
-              "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+              "Report bugs to <morten.hustveit@gmail.com>\n", argv[0], argv[0]);
 
       return EXIT_SUCCESS;
     }
@@ -82,11 +476,56 @@ main (int argc, char **argv)
       return EXIT_SUCCESS;
     }
 
+  if (Script_stream && strcmp (Script_format, "binary"))
+    errx (EX_USAGE, "--stream is only supported with the binary format");
+
+  if (Script_schemaHeaderPath && !Script_schemaPath)
+    errx (EX_USAGE, "--schema-header requires --schema");
+
+  if (Script_schemaPath)
+    {
+      Script_schema = script_schema_load (Script_schemaPath);
+
+      if (Script_schemaHeaderPath)
+        Script_WriteSchemaHeader ();
+    }
+
+  if (Script_batch)
+    {
+      if (strcmp (Script_format, "binary"))
+        errx (EX_USAGE, "--batch is only supported with the binary format");
+
+      if ((argc - optind) & 1)
+        errx (EX_USAGE, "Usage: %s --batch [OPTION]... [INPUT OUTPUT]...", argv[0]);
+
+      if (Script_manifestPath)
+        Script_ReadManifest (Script_manifestPath);
+
+      for (i = optind; i < argc; i += 2)
+        Script_AddJob (argv[i], argv[i + 1]);
+
+      if (!ARRAY_COUNT (&Script_batchJobs))
+        errx (EX_USAGE, "No scripts to convert");
+
+      if (!Script_jobs && 0 >= (Script_jobs = sysconf (_SC_NPROCESSORS_ONLN)))
+        Script_jobs = 1;
+
+      i = Script_RunBatch ();
+
+      if (Script_schema)
+        script_schema_free (Script_schema);
+
+      return i;
+    }
+
+  if (Script_stream)
+    writer = Script_CreateWriter (stdout);
+
   if (optind + 1 < argc)
     errx (EX_USAGE, "Usage: %s [OPTION]... [SCRIPT]", argv[0]);
   else if (optind == argc)
     {
-      if (-1 == script_parse_file (&context, stdin))
+      if (-1 == Script_ParseFile (&context, stdin, writer))
         return EXIT_FAILURE;
     }
   else
@@ -96,16 +535,36 @@ main (int argc, char **argv)
       if(!(input = fopen(argv[optind], "r")))
         err (EXIT_FAILURE, "%s: failed to open `%s' for reading", argv[0], argv[optind]);
 
-      if (-1 == script_parse_file (&context, input))
+      if (-1 == Script_ParseFile (&context, input, writer))
         return EXIT_FAILURE;
 
       fclose (input);
     }
 
+  if (Script_stream)
+    {
+      script_writer_finish (writer);
+      script_writer_free (writer);
+      arena_free (&context.statement_arena);
+
+      if (Script_schema)
+        script_schema_free (Script_schema);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (!Script_noFold && !strcmp (Script_format, "binary"))
+    SCRIPT_Fold (&context);
+
   SCRIPT_Optimize (&context);
 
   if (!strcmp (Script_format, "binary"))
-    script_dump_binary (&context, Script_pointerSize);
+    {
+      writer = Script_CreateWriter (stdout);
+      script_writer_dump (writer, &context);
+      script_writer_finish (writer);
+      script_writer_free (writer);
+    }
   else if (!strcmp (Script_format, "html"))
     script_dump_html (&context);
   else
@@ -117,5 +576,8 @@ main (int argc, char **argv)
 
   arena_free(&context.statement_arena);
 
+  if (Script_schema)
+    script_schema_free (Script_schema);
+
   return EXIT_SUCCESS;
 }
@@ -11,13 +11,33 @@ extern "C" {
 #endif
 
 #define SCRIPT_DEGREES (3.14159265358979323846 / 180.0)
+
+struct script_parse_context;
+struct script_schema;
+struct ScriptStatement;
+
+/* Called for each top-level statement as soon as it has been parsed.  The
+ * statement is not added to the statement list, so the callback may reset
+ * `statement_arena' once it is done with it.  */
+typedef void (*script_statement_callback) (struct script_parse_context *context,
+                                           struct ScriptStatement *statement,
+                                           void *arg);
+
 struct script_parse_context
 {
   void *scanner;
   struct arena_info statement_arena;
   int error;
 
+  /* Position of the lexer, for error messages */
+  unsigned int line;
+  unsigned int character;
+
   struct ScriptStatement *statements;
+  struct ScriptStatement *last_statement;
+
+  script_statement_callback statement_callback;
+  void *statement_callback_arg;
 };
 
 struct ScriptStatement
@@ -57,6 +77,13 @@ enum ScriptExpressionType
   ScriptExpressionDivide,
 };
 
+/* Decoded contents of a data(...) literal */
+struct ScriptBinary
+{
+  size_t size;
+  const unsigned char *data;
+};
+
 struct ScriptExpression
 {
   enum ScriptExpressionType type;
@@ -66,7 +93,7 @@ struct ScriptExpression
     struct ScriptExpression *expression;
     struct ScriptStatement *statement;
     const char *string;
-    const char *binary;
+    const struct ScriptBinary *binary;
     const char *numeric;
     const char *identifier;
   } lhs;
@@ -77,17 +104,92 @@ struct ScriptExpression
   off_t offset;
 };
 
+/* Evaluates constant subexpressions and removes parentheses and identity
+ * operations such as x × 1 and x + 0.  */
+void
+SCRIPT_Fold (struct script_parse_context *context);
+
 void
 SCRIPT_Optimize (struct script_parse_context *context);
 
 int
 script_parse_file(struct script_parse_context *context, FILE *file);
 
+int
+script_parse_file_streaming(struct script_parse_context *context, FILE *file,
+                            script_statement_callback callback, void *arg);
+
 void
 script_dump (struct script_parse_context *context);
 
+/* Writer for the binary format.  Output goes to `file', or is kept in
+ * memory if `file' is NULL.  Writers share no state, so separate scripts
+ * may be written concurrently.  */
+struct script_writer;
+
+/* Store pointers as 32 bit offsets relative to their own location, so the
+ * output can be used without relocation.  */
+#define SCRIPT_WRITER_RELATIVE 0x0001
+
+/* Store identifiers and statement signatures once, in a hashed string table,
+ * and refer to them by 32 bit IDs.  */
+#define SCRIPT_WRITER_STRING_TABLE 0x0002
+
+struct script_writer *
+script_writer_create (FILE *file, int ptrsize, unsigned int flags);
+
+/* Lays out statements whose signature is in `schema' as the structs of
+ * the header written by script_schema_write_header, instead of as a
+ * signature ID and parameter pointers.  Requires SCRIPT_WRITER_STRING_TABLE,
+ * and must be called before anything is emitted.  */
+void
+script_writer_set_schema (struct script_writer *writer,
+                          const struct script_schema *schema);
+
+/* Starts a new script, keeping the pointer size and allocated buffers */
+void
+script_writer_reset (struct script_writer *writer, FILE *file);
+
+void
+script_writer_free (struct script_writer *writer);
+
+/* Returns the output of a memory writer */
+const void *
+script_writer_data (const struct script_writer *writer, size_t *size);
+
+/* Emits all statements of a parsed script */
+void
+script_writer_dump (struct script_writer *writer,
+                    struct script_parse_context *context);
+
+/* Emits a single top-level statement after those already written */
+void
+script_writer_statement (struct script_writer *writer,
+                         struct ScriptStatement *statement);
+
+/* Writes the pointer table and root pointer, and flushes the output */
+void
+script_writer_finish (struct script_writer *writer);
+
+/* Reads a statement schema: one statement per line, given as an identifier
+ * followed by NAME:TYPE for each parameter, where TYPE is one of u32,
+ * float, string, binary, identifier, statement or expression.  `#' starts a
+ * comment.  Exits with an error message on invalid input, including names
+ * that would clash in the generated header.  */
+struct script_schema *
+script_schema_load (const char *path);
+
+void
+script_schema_free (struct script_schema *schema);
+
+/* Writes a C header with a struct per schema statement and a perfect hash
+ * mapping signatures to statement types.  Names are prefixed by `prefix'.
+ * Structs and type constants are named after the statement identifier, or,
+ * when several statements share it, the identifier and parameter names
+ * joined by double underscores.  */
 void
-script_dump_binary (struct script_parse_context *context, int ptrsize);
+script_schema_write_header (const struct script_schema *schema, FILE *output,
+                            const char *prefix);
 
 void
 script_dump_html (struct script_parse_context *context);
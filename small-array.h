@@ -0,0 +1,201 @@
+#ifndef SMALL_ARRAY_H_
+#define SMALL_ARRAY_H_ 1
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <type_traits>
+
+/* C++ companion to the ARRAY_* macros, for trivially copyable elements.
+ * The first `N' elements are stored inside the object, so short arrays
+ * never touch the heap.  grow () and advance () are the counterparts of
+ * ARRAY_GROW, ARRAY_END and ARRAY_ADVANCE: they let a caller write many
+ * elements with a single capacity check.  */
+template <typename T, size_t N>
+struct small_array
+{
+  static_assert (std::is_trivial<T>::value, "small_array elements are copied with memcpy");
+
+  small_array ()
+    : elements (inlineElements), count (0), alloc (N)
+  {
+  }
+
+  small_array (const small_array &other)
+    : elements (inlineElements), count (0), alloc (N)
+  {
+    append (other.elements, other.count);
+  }
+
+  small_array (small_array &&other)
+    : elements (inlineElements), count (0), alloc (N)
+  {
+    take (other);
+  }
+
+  ~small_array ()
+  {
+    if (elements != inlineElements)
+      free (elements);
+  }
+
+  small_array &
+  operator= (const small_array &other)
+  {
+    if (this != &other)
+      {
+        count = 0;
+        append (other.elements, other.count);
+      }
+
+    return *this;
+  }
+
+  small_array &
+  operator= (small_array &&other)
+  {
+    if (this != &other)
+      {
+        if (elements != inlineElements)
+          free (elements);
+
+        elements = inlineElements;
+        count = 0;
+        alloc = N;
+
+        take (other);
+      }
+
+    return *this;
+  }
+
+  size_t size () const { return count; }
+  bool empty () const { return !count; }
+
+  T *data () { return elements; }
+  const T *data () const { return elements; }
+
+  T *begin () { return elements; }
+  T *end () { return elements + count; }
+  const T *begin () const { return elements; }
+  const T *end () const { return elements + count; }
+
+  T &operator[] (size_t index) { return elements[index]; }
+  const T &operator[] (size_t index) const { return elements[index]; }
+
+  void clear () { count = 0; }
+
+  void
+  reserve (size_t total)
+  {
+    if (total > alloc)
+      resize (total);
+  }
+
+  /* Returns room for at least `extra' elements after the last one.  The
+   * caller writes into it, then calls advance () with the number written.  */
+  T *
+  grow (size_t extra)
+  {
+    if (count + extra > alloc)
+      expand (count + extra);
+
+    return elements + count;
+  }
+
+  void
+  advance (size_t extra)
+  {
+    assert (count + extra <= alloc);
+
+    count += extra;
+  }
+
+  void
+  push_back (const T &value)
+  {
+    if (count == alloc)
+      expand (count + 1);
+
+    elements[count++] = value;
+  }
+
+  void
+  append (const T *values, size_t extra)
+  {
+    if (extra)
+      memcpy (grow (extra), values, extra * sizeof (T));
+
+    count += extra;
+  }
+
+  bool
+  operator== (const small_array &other) const
+  {
+    return count == other.count
+           && (!count || !memcmp (elements, other.elements, count * sizeof (T)));
+  }
+
+  bool
+  operator!= (const small_array &other) const
+  {
+    return !(*this == other);
+  }
+
+private:
+
+  /* Moves the heap storage of `other' here, or copies its inline
+   * elements.  */
+  void
+  take (small_array &other)
+  {
+    if (other.elements != other.inlineElements)
+      {
+        elements = other.elements;
+        count = other.count;
+        alloc = other.alloc;
+
+        other.elements = other.inlineElements;
+        other.alloc = N;
+      }
+    else
+      append (other.elements, other.count);
+
+    other.count = 0;
+  }
+
+  void
+  expand (size_t total)
+  {
+    resize (alloc * 2 > total ? alloc * 2 : total);
+  }
+
+  void
+  resize (size_t newAlloc)
+  {
+    T *newElements;
+
+    if (elements == inlineElements)
+      {
+        if (!(newElements = (T *) malloc (newAlloc * sizeof (T))))
+          throw std::bad_alloc ();
+
+        memcpy (newElements, elements, count * sizeof (T));
+      }
+    else if (!(newElements = (T *) realloc (elements, newAlloc * sizeof (T))))
+      throw std::bad_alloc ();
+
+    elements = newElements;
+    alloc = newAlloc;
+  }
+
+  T *elements;
+  size_t count;
+  size_t alloc;
+
+  T inlineElements[N];
+};
+
+#endif /* !SMALL_ARRAY_H_ */
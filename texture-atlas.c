@@ -0,0 +1,597 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include "png-wrapper.h"
+
+static int TextureAtlas_printHelp;
+static int TextureAtlas_printVersion;
+static const char *TextureAtlas_output;
+static const char *TextureAtlas_format;
+static unsigned int TextureAtlas_pageSize = 2048;
+static unsigned int TextureAtlas_padding = 4;
+static unsigned int TextureAtlas_align = 4;
+
+static struct option TextureAtlas_longOptions[] =
+{
+    { "output",    required_argument, 0, 'o' },
+    { "format",    required_argument, 0, 'f' },
+    { "page-size", required_argument, 0, 'S' },
+    { "padding",   required_argument, 0, 'P' },
+    { "align",     required_argument, 0, 'A' },
+    { "help",      no_argument, &TextureAtlas_printHelp, 1 },
+    { "version",   no_argument, &TextureAtlas_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+struct TextureAtlas_Rect
+{
+  unsigned int x, y, width, height;
+};
+
+/* A source image.  `cell' is the area it occupies on its page, including
+ * padding, rounded up to the alignment.  */
+struct TextureAtlas_Image
+{
+  const char *path;
+  unsigned int width, height;
+
+  size_t page;
+  struct TextureAtlas_Rect cell;
+};
+
+/* An atlas page, packed with MaxRects: `free' holds every maximal empty
+ * rectangle, which may overlap each other */
+struct TextureAtlas_Page
+{
+  struct TextureAtlas_Rect *free;
+  size_t freeCount, freeAlloc;
+
+  unsigned int width, height;
+};
+
+static struct TextureAtlas_Image *TextureAtlas_images;
+static size_t TextureAtlas_imageCount;
+
+static struct TextureAtlas_Page *TextureAtlas_pages;
+static size_t TextureAtlas_pageCount;
+
+static unsigned int
+TextureAtlas_RoundUp (unsigned int value, unsigned int multiple)
+{
+  return (value + multiple - 1) / multiple * multiple;
+}
+
+static int
+TextureAtlas_IsPowerOfTwo (unsigned int value)
+{
+  return value && !(value & (value - 1));
+}
+
+static void
+TextureAtlas_AddFree (struct TextureAtlas_Page *page, unsigned int x, unsigned int y,
+                      unsigned int width, unsigned int height)
+{
+  struct TextureAtlas_Rect *rect;
+
+  if (!width || !height)
+    return;
+
+  if (page->freeCount == page->freeAlloc)
+    {
+      page->freeAlloc = page->freeAlloc ? page->freeAlloc * 2 : 16;
+
+      if (!(page->free = realloc (page->free, page->freeAlloc * sizeof (*page->free))))
+        err (EX_OSERR, "realloc failed");
+    }
+
+  rect = &page->free[page->freeCount++];
+  rect->x = x;
+  rect->y = y;
+  rect->width = width;
+  rect->height = height;
+}
+
+static int
+TextureAtlas_Contains (const struct TextureAtlas_Rect *outer, const struct TextureAtlas_Rect *inner)
+{
+  return inner->x >= outer->x && inner->y >= outer->y
+         && inner->x + inner->width <= outer->x + outer->width
+         && inner->y + inner->height <= outer->y + outer->height;
+}
+
+/* Places a cell on a page, at the free rectangle that leaves the shortest
+ * side over.  Returns -1 if it doesn't fit.  */
+static int
+TextureAtlas_Insert (struct TextureAtlas_Page *page, struct TextureAtlas_Rect *cell)
+{
+  struct TextureAtlas_Rect placed;
+  unsigned int bestShort = ~0U, bestLong = ~0U;
+  size_t i, j, count;
+
+  for (i = 0; i < page->freeCount; ++i)
+    {
+      const struct TextureAtlas_Rect *rect = &page->free[i];
+      unsigned int dx, dy, shortSide, longSide;
+
+      if (rect->width < cell->width || rect->height < cell->height)
+        continue;
+
+      dx = rect->width - cell->width;
+      dy = rect->height - cell->height;
+      shortSide = (dx < dy) ? dx : dy;
+      longSide = (dx < dy) ? dy : dx;
+
+      if (shortSide < bestShort || (shortSide == bestShort && longSide < bestLong))
+        {
+          cell->x = rect->x;
+          cell->y = rect->y;
+          bestShort = shortSide;
+          bestLong = longSide;
+        }
+    }
+
+  if (bestShort == ~0U)
+    return -1;
+
+  placed = *cell;
+
+  /* Replace every free rectangle the cell overlaps with the parts of it
+   * on each side of the cell.  The first `count' entries are yet to be
+   * checked; new ones are appended after them.  */
+
+  count = page->freeCount;
+
+  for (i = 0; i < count; )
+    {
+      struct TextureAtlas_Rect rect = page->free[i];
+
+      if (placed.x >= rect.x + rect.width || placed.x + placed.width <= rect.x
+          || placed.y >= rect.y + rect.height || placed.y + placed.height <= rect.y)
+        {
+          ++i;
+
+          continue;
+        }
+
+      page->free[i] = page->free[--count];
+      page->free[count] = page->free[--page->freeCount];
+
+      if (placed.x > rect.x)
+        TextureAtlas_AddFree (page, rect.x, rect.y, placed.x - rect.x, rect.height);
+
+      if (placed.x + placed.width < rect.x + rect.width)
+        TextureAtlas_AddFree (page, placed.x + placed.width, rect.y,
+                              rect.x + rect.width - placed.x - placed.width, rect.height);
+
+      if (placed.y > rect.y)
+        TextureAtlas_AddFree (page, rect.x, rect.y, rect.width, placed.y - rect.y);
+
+      if (placed.y + placed.height < rect.y + rect.height)
+        TextureAtlas_AddFree (page, rect.x, placed.y + placed.height,
+                              rect.width, rect.y + rect.height - placed.y - placed.height);
+    }
+
+  /* Drop free rectangles inside others */
+
+  for (i = 0; i < page->freeCount; )
+    {
+      for (j = 0; j < page->freeCount; ++j)
+        {
+          if (i != j && TextureAtlas_Contains (&page->free[j], &page->free[i])
+              && (!TextureAtlas_Contains (&page->free[i], &page->free[j]) || i > j))
+            break;
+        }
+
+      if (j < page->freeCount)
+        page->free[i] = page->free[--page->freeCount];
+      else
+        ++i;
+    }
+
+  if (placed.x + placed.width > page->width)
+    page->width = placed.x + placed.width;
+
+  if (placed.y + placed.height > page->height)
+    page->height = placed.y + placed.height;
+
+  return 0;
+}
+
+/* Orders images by their longest side, then by area, largest first */
+static int
+TextureAtlas_CompareImages (const void *lhs, const void *rhs)
+{
+  const struct TextureAtlas_Image *a = lhs, *b = rhs;
+  unsigned int sideA, sideB;
+
+  sideA = (a->cell.width > a->cell.height) ? a->cell.width : a->cell.height;
+  sideB = (b->cell.width > b->cell.height) ? b->cell.width : b->cell.height;
+
+  if (sideA != sideB)
+    return (sideA > sideB) ? -1 : 1;
+
+  if (a->cell.width * a->cell.height != b->cell.width * b->cell.height)
+    return (a->cell.width * a->cell.height > b->cell.width * b->cell.height) ? -1 : 1;
+
+  return strcmp (a->path, b->path);
+}
+
+/* Packs the unplaced images into a page of the given size, largest
+ * first, skipping those that don't fit.  Returns the number placed.  */
+static size_t
+TextureAtlas_TryPage (struct TextureAtlas_Page *page, size_t pageIndex,
+                      unsigned int width, unsigned int height)
+{
+  size_t i, placed = 0;
+
+  page->freeCount = 0;
+  page->width = 0;
+  page->height = 0;
+  TextureAtlas_AddFree (page, 0, 0, width, height);
+
+  for (i = 0; i < TextureAtlas_imageCount; ++i)
+    {
+      struct TextureAtlas_Image *image = &TextureAtlas_images[i];
+
+      if (image->page < pageIndex)
+        continue;
+
+      if (!TextureAtlas_Insert (page, &image->cell))
+        {
+          image->page = pageIndex;
+          ++placed;
+        }
+      else
+        image->page = (size_t) -1;
+    }
+
+  return placed;
+}
+
+/* Fills pages one at a time.  Each page is the smallest power of two size,
+ * up to --page-size, that holds all remaining images, or as many as fit in
+ * the largest page.  */
+static void
+TextureAtlas_Pack (void)
+{
+  size_t i, remaining, area;
+
+  qsort (TextureAtlas_images, TextureAtlas_imageCount, sizeof (*TextureAtlas_images),
+         TextureAtlas_CompareImages);
+
+  for (i = 0; i < TextureAtlas_imageCount; ++i)
+    TextureAtlas_images[i].page = (size_t) -1;
+
+  for (remaining = TextureAtlas_imageCount; remaining; )
+    {
+      struct TextureAtlas_Page *page;
+      unsigned int width, height;
+
+      if (!(TextureAtlas_pages = realloc (TextureAtlas_pages, (TextureAtlas_pageCount + 1)
+                                                              * sizeof (*TextureAtlas_pages))))
+        err (EX_OSERR, "realloc failed");
+
+      page = &TextureAtlas_pages[TextureAtlas_pageCount];
+      memset (page, 0, sizeof (*page));
+
+      for (i = 0, area = 0; i < TextureAtlas_imageCount; ++i)
+        {
+          if (TextureAtlas_images[i].page == (size_t) -1)
+            area += (size_t) TextureAtlas_images[i].cell.width * TextureAtlas_images[i].cell.height;
+        }
+
+      width = height = TextureAtlas_align;
+
+      for (;;)
+        {
+          if ((size_t) width * height >= area
+              && TextureAtlas_TryPage (page, TextureAtlas_pageCount, width, height) == remaining)
+            break;
+
+          if (width == TextureAtlas_pageSize && height == TextureAtlas_pageSize)
+            {
+              TextureAtlas_TryPage (page, TextureAtlas_pageCount, width, height);
+
+              break;
+            }
+
+          if (width <= height)
+            width *= 2;
+          else
+            height *= 2;
+        }
+
+      for (i = 0; i < TextureAtlas_imageCount; ++i)
+        remaining -= (TextureAtlas_images[i].page == TextureAtlas_pageCount);
+
+      /* Trim to the images placed, which may not fill the largest page */
+
+      for (width = TextureAtlas_align; width < page->width; width *= 2)
+        ;
+
+      for (height = TextureAtlas_align; height < page->height; height *= 2)
+        ;
+
+      page->width = width;
+      page->height = height;
+
+      free (page->free);
+      page->free = NULL;
+
+      ++TextureAtlas_pageCount;
+    }
+}
+
+/* Copies an image into its cell of a page, extending its edge pixels into
+ * the padding around it.  Both are ARGB, bottom row first.  */
+static void
+TextureAtlas_Blit (unsigned char *pageData, const struct TextureAtlas_Page *page,
+                   const unsigned char *imageData, const struct TextureAtlas_Image *image)
+{
+  unsigned int x, y;
+
+  for (y = 0; y < image->cell.height; ++y)
+    {
+      unsigned char *output;
+      const unsigned char *input;
+      int sourceY;
+
+      /* Rows counted from the top */
+
+      sourceY = (int) y - (int) TextureAtlas_padding;
+
+      if (sourceY < 0)
+        sourceY = 0;
+      else if (sourceY >= (int) image->height)
+        sourceY = image->height - 1;
+
+      output = pageData + ((size_t) (page->height - image->cell.y - y - 1) * page->width
+                           + image->cell.x) * 4;
+      input = imageData + (size_t) (image->height - sourceY - 1) * image->width * 4;
+
+      for (x = 0; x < image->cell.width; ++x, output += 4)
+        {
+          int sourceX;
+
+          sourceX = (int) x - (int) TextureAtlas_padding;
+
+          if (sourceX < 0)
+            sourceX = 0;
+          else if (sourceX >= (int) image->width)
+            sourceX = image->width - 1;
+
+          memcpy (output, input + sourceX * 4, 4);
+        }
+    }
+}
+
+/* Writes the page images, and the layout read by bm-fbx-convert --atlas */
+static void
+TextureAtlas_Write (void)
+{
+  char *path;
+  FILE *layout;
+  size_t i, j;
+
+  if (!(path = malloc (strlen (TextureAtlas_output) + 32)))
+    err (EX_OSERR, "malloc failed");
+
+  sprintf (path, "%s.atlas", TextureAtlas_output);
+
+  if (!(layout = fopen (path, "w")))
+    err (EXIT_FAILURE, "Failed to open `%s' for writing", path);
+
+  for (j = 0; j < TextureAtlas_pageCount; ++j)
+    {
+      const struct TextureAtlas_Page *page = &TextureAtlas_pages[j];
+      unsigned char *pageData;
+
+      if (!(pageData = calloc ((size_t) page->width * page->height, 4)))
+        err (EX_OSERR, "calloc failed");
+
+      for (i = 0; i < TextureAtlas_imageCount; ++i)
+        {
+          const struct TextureAtlas_Image *image = &TextureAtlas_images[i];
+          void *imageData;
+          unsigned int width, height;
+
+          if (image->page != j)
+            continue;
+
+          if (-1 == png_load (image->path, &imageData, &width, &height))
+            errx (EXIT_FAILURE, "Failed to load `%s'", image->path);
+
+          if (width != image->width || height != image->height)
+            errx (EXIT_FAILURE, "`%s' changed while packing", image->path);
+
+          TextureAtlas_Blit (pageData, page, imageData, image);
+
+          free (imageData);
+        }
+
+      sprintf (path, "%s-%zu.png", TextureAtlas_output, j);
+
+      if (-1 == png_save (path, pageData, page->width, page->height))
+        exit (EXIT_FAILURE);
+
+      free (pageData);
+
+      fprintf (layout, "page\t%s\t%u\t%u\n", path, page->width, page->height);
+
+      /* Pages are converted by bm-texture-convert --batch */
+
+      printf ("%s\t%s-%zu.pvr", path, TextureAtlas_output, j);
+
+      if (TextureAtlas_format)
+        printf ("\t%s", TextureAtlas_format);
+
+      putchar ('\n');
+    }
+
+  for (i = 0; i < TextureAtlas_imageCount; ++i)
+    {
+      const struct TextureAtlas_Image *image = &TextureAtlas_images[i];
+
+      fprintf (layout, "image\t%s\t%zu\t%u\t%u\t%u\t%u\n",
+               image->path, image->page,
+               image->cell.x + TextureAtlas_padding, image->cell.y + TextureAtlas_padding,
+               image->width, image->height);
+    }
+
+  sprintf (path, "%s.atlas", TextureAtlas_output);
+
+  if (ferror (layout) | fclose (layout))
+    err (EXIT_FAILURE, "Failed to write `%s'", path);
+
+  free (path);
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned long long used = 0, total = 0;
+  size_t j;
+  int i;
+
+  while (-1 != (i = getopt_long (argc, argv, "f:o:", TextureAtlas_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 'o':
+
+          TextureAtlas_output = optarg;
+
+          break;
+
+        case 'f':
+
+          TextureAtlas_format = optarg;
+
+          break;
+
+        case 'S':
+
+          TextureAtlas_pageSize = strtol (optarg, 0, 0);
+
+          if (!TextureAtlas_IsPowerOfTwo (TextureAtlas_pageSize))
+            errx (EX_USAGE, "Page size must be a power of two");
+
+          break;
+
+        case 'P':
+
+          TextureAtlas_padding = strtol (optarg, 0, 0);
+
+          break;
+
+        case 'A':
+
+          TextureAtlas_align = strtol (optarg, 0, 0);
+
+          if (!TextureAtlas_IsPowerOfTwo (TextureAtlas_align))
+            errx (EX_USAGE, "Alignment must be a power of two");
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (TextureAtlas_printHelp)
+    {
+      fprintf (stdout,
+              "Usage: %s [OPTION]... --output=PREFIX IMAGE...\n"
+              "\n"
+              "Packs PNG images into atlas pages PREFIX-0.png, PREFIX-1.png and so on,\n"
+              "and writes where each image went to PREFIX.atlas, for bm-fbx-convert\n"
+              "--atlas.  A job list converting the pages to PREFIX-0.pvr and so on is\n"
+              "printed for bm-texture-convert --batch=-.\n"
+              "\n"
+              "  -o, --output=PREFIX      name the output files after PREFIX\n"
+              "  -f, --format=FORMAT      add FORMAT to each job for bm-texture-convert\n"
+              "      --page-size=SIZE     make pages at most SIZE pixels square (%u)\n"
+              "      --padding=PIXELS     surround each image with PIXELS copies of its\n"
+              "                           edge (%u); mipmaps do not mix images until\n"
+              "                           the padding shrinks below a pixel\n"
+              "      --align=PIXELS       start every padded image on a multiple of\n"
+              "                           PIXELS (%u), so compressed blocks never\n"
+              "                           straddle two images\n"
+              "      --help     display this help and exit\n"
+              "      --version  display version information\n"
+              "\n"
+              "Report bugs to <morten.hustveit@gmail.com>\n", argv[0],
+              TextureAtlas_pageSize, TextureAtlas_padding, TextureAtlas_align);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (TextureAtlas_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (!TextureAtlas_output || optind == argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]... --output=PREFIX IMAGE...", argv[0]);
+
+  if (TextureAtlas_align > TextureAtlas_pageSize)
+    errx (EX_USAGE, "Alignment must not exceed the page size");
+
+  TextureAtlas_imageCount = argc - optind;
+
+  if (!(TextureAtlas_images = calloc (TextureAtlas_imageCount, sizeof (*TextureAtlas_images))))
+    err (EX_OSERR, "calloc failed");
+
+  for (j = 0; j < TextureAtlas_imageCount; ++j)
+    {
+      struct TextureAtlas_Image *image = &TextureAtlas_images[j];
+      struct png_stream *stream;
+
+      image->path = argv[optind + j];
+
+      /* Only the header is read until the pages are drawn */
+
+      if (!(stream = png_stream_open (image->path, &image->width, &image->height, NULL)))
+        errx (EXIT_FAILURE, "Failed to open `%s'", image->path);
+
+      png_stream_close (stream);
+
+      image->cell.width = TextureAtlas_RoundUp (image->width + 2 * TextureAtlas_padding, TextureAtlas_align);
+      image->cell.height = TextureAtlas_RoundUp (image->height + 2 * TextureAtlas_padding, TextureAtlas_align);
+
+      if (image->cell.width > TextureAtlas_pageSize || image->cell.height > TextureAtlas_pageSize)
+        errx (EX_DATAERR, "`%s' is too large for a %u pixel page with padding",
+              image->path, TextureAtlas_pageSize);
+    }
+
+  TextureAtlas_Pack ();
+  TextureAtlas_Write ();
+
+  for (j = 0; j < TextureAtlas_imageCount; ++j)
+    used += (unsigned long long) TextureAtlas_images[j].width * TextureAtlas_images[j].height;
+
+  for (j = 0; j < TextureAtlas_pageCount; ++j)
+    total += (unsigned long long) TextureAtlas_pages[j].width * TextureAtlas_pages[j].height;
+
+  fprintf (stderr, "Texture binds: %zu images in %zu atlas pages, %.1f%% of page area used\n",
+           TextureAtlas_imageCount, TextureAtlas_pageCount, used * 100.0 / total);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,1168 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "texture.h"
+
+/* BC1, BC3 and BC7 store 4x4 pixel blocks, with pixels in row major
+ * order.  BC1 interpolates a 4 colour palette between two RGB565
+ * endpoints; three colours and transparent black if the endpoints are
+ * stored in descending order.  BC3 adds a block of alpha interpolated
+ * between two 8 bit endpoints before each BC1 block.
+ *
+ * BC7 has eight modes.  Only the two without partitions are written, which
+ * avoids searching the partition tables.  Mode 6 has one RGBA endpoint
+ * pair with 7 bits per channel plus a shared low bit for each endpoint,
+ * and 16 interpolation steps.  Mode 5 has separate RGB and alpha endpoints
+ * with 4 steps each, and is tried for blocks with varying alpha.  */
+
+static const float texture_bc1_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+static const int texture_bc7_weights[16] =
+{
+  0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+struct texture_bc_block
+{
+  /* Channels in R, G, B, A order, then by pixel */
+  float pixels[4][16];
+
+  /* Zero for pixels left out of the colour fit */
+  float weights[16];
+};
+
+struct texture_bc_encoder
+{
+  const struct texture_bc_options *options;
+  const unsigned char *argb;
+  unsigned int width, height;
+  unsigned int blocksX, blocksY;
+  unsigned int threads;
+  unsigned char *output;
+};
+
+static int
+texture_bc_clamp (int value)
+{
+  return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+static size_t
+texture_bc_block_size (enum texture_bc_format format)
+{
+  return (format == TEXTURE_BC1) ? 8 : 16;
+}
+
+static void
+texture_bc_load_block (struct texture_bc_block *block,
+                       const struct texture_bc_encoder *encoder,
+                       unsigned int bx, unsigned int by)
+{
+  unsigned int i;
+
+  for (i = 0; i < 16; ++i)
+    {
+      const unsigned char *pixel;
+      unsigned int x, y;
+
+      /* Blocks on the right and bottom edges repeat the last pixels */
+
+      x = bx * 4 + i % 4;
+      y = by * 4 + i / 4;
+
+      if (x >= encoder->width)
+        x = encoder->width - 1;
+
+      if (y >= encoder->height)
+        y = encoder->height - 1;
+
+      pixel = encoder->argb + 4 * ((size_t) y * encoder->width + x);
+
+      block->pixels[0][i] = pixel[1];
+      block->pixels[1][i] = pixel[2];
+      block->pixels[2][i] = pixel[3];
+      block->pixels[3][i] = pixel[0];
+      block->weights[i] = 1.0f;
+    }
+}
+
+/* Finds the closest of `count' palette entries to each pixel, comparing
+ * the first `channels' channels.  Returns the weighted squared error.  */
+static float
+texture_bc_fit (unsigned char *indices, const struct texture_bc_block *block,
+                const float (*palette)[4], unsigned int count, unsigned int channels)
+{
+  unsigned int i, k, c;
+  float error = 0.0f;
+
+#if defined(__SSE2__)
+  for (i = 0; i < 16; i += 4)
+    {
+      __m128 best, bestIndex, sum;
+      float tmp[4];
+
+      best = _mm_set1_ps (FLT_MAX);
+      bestIndex = _mm_setzero_ps ();
+
+      for (k = 0; k < count; ++k)
+        {
+          __m128 distance, closer;
+
+          distance = _mm_setzero_ps ();
+
+          for (c = 0; c < channels; ++c)
+            {
+              __m128 d;
+
+              d = _mm_sub_ps (_mm_loadu_ps (block->pixels[c] + i), _mm_set1_ps (palette[k][c]));
+              distance = _mm_add_ps (distance, _mm_mul_ps (d, d));
+            }
+
+          closer = _mm_cmplt_ps (distance, best);
+          best = _mm_min_ps (best, distance);
+          bestIndex = _mm_or_ps (_mm_and_ps (closer, _mm_set1_ps (k)),
+                                 _mm_andnot_ps (closer, bestIndex));
+        }
+
+      sum = _mm_mul_ps (best, _mm_loadu_ps (block->weights + i));
+      _mm_storeu_ps (tmp, sum);
+      error += tmp[0] + tmp[1] + tmp[2] + tmp[3];
+
+      _mm_storeu_ps (tmp, bestIndex);
+
+      for (k = 0; k < 4; ++k)
+        indices[i + k] = (unsigned char) tmp[k];
+    }
+#else
+  for (i = 0; i < 16; ++i)
+    {
+      float best = FLT_MAX;
+
+      for (k = 0; k < count; ++k)
+        {
+          float distance = 0.0f;
+
+          for (c = 0; c < channels; ++c)
+            {
+              float d;
+
+              d = block->pixels[c][i] - palette[k][c];
+              distance += d * d;
+            }
+
+          if (distance < best)
+            {
+              best = distance;
+              indices[i] = k;
+            }
+        }
+
+      error += best * block->weights[i];
+    }
+#endif
+
+  return error;
+}
+
+/* Finds the endpoints of the line through the pixels' principal axis that
+ * span their projections onto it */
+static void
+texture_bc_principal_endpoints (float endpoints[2][4], const struct texture_bc_block *block,
+                                unsigned int channels)
+{
+  float mean[4] = { 0 }, covariance[4][4] = { { 0 } }, axis[4] = { 1, 1, 1, 1 };
+  float total = 0.0f, low = FLT_MAX, high = -FLT_MAX;
+  unsigned int i, c, d, iteration;
+
+  for (i = 0; i < 16; ++i)
+    {
+      total += block->weights[i];
+
+      for (c = 0; c < channels; ++c)
+        mean[c] += block->pixels[c][i] * block->weights[i];
+    }
+
+  if (!total)
+    {
+      memset (endpoints, 0, sizeof (float) * 8);
+
+      return;
+    }
+
+  for (c = 0; c < channels; ++c)
+    mean[c] /= total;
+
+  for (i = 0; i < 16; ++i)
+    {
+      for (c = 0; c < channels; ++c)
+        for (d = c; d < channels; ++d)
+          covariance[c][d] += (block->pixels[c][i] - mean[c]) * (block->pixels[d][i] - mean[d])
+                              * block->weights[i];
+    }
+
+  for (c = 0; c < channels; ++c)
+    for (d = 0; d < c; ++d)
+      covariance[c][d] = covariance[d][c];
+
+  /* Power iteration converges to the eigenvector of the largest eigenvalue */
+
+  for (iteration = 0; iteration < 8; ++iteration)
+    {
+      float next[4] = { 0 }, length = 0.0f;
+
+      for (c = 0; c < channels; ++c)
+        {
+          for (d = 0; d < channels; ++d)
+            next[c] += covariance[c][d] * axis[d];
+
+          length += next[c] * next[c];
+        }
+
+      if (length < 1.0e-12f)
+        break;
+
+      length = 1.0f / sqrtf (length);
+
+      for (c = 0; c < channels; ++c)
+        axis[c] = next[c] * length;
+    }
+
+  for (i = 0; i < 16; ++i)
+    {
+      float t = 0.0f;
+
+      if (!block->weights[i])
+        continue;
+
+      for (c = 0; c < channels; ++c)
+        t += (block->pixels[c][i] - mean[c]) * axis[c];
+
+      if (t < low) low = t;
+      if (t > high) high = t;
+    }
+
+  if (low > high)
+    low = high = 0.0f;
+
+  for (c = 0; c < channels; ++c)
+    {
+      endpoints[0][c] = mean[c] + axis[c] * low;
+      endpoints[1][c] = mean[c] + axis[c] * high;
+    }
+
+  for (; c < 4; ++c)
+    endpoints[0][c] = endpoints[1][c] = 255.0f;
+}
+
+/* Finds the endpoints that minimize the squared error for the given
+ * indices, by least squares.  Returns zero if the indices don't determine
+ * both endpoints.  */
+static int
+texture_bc_least_squares (float endpoints[2][4], const struct texture_bc_block *block,
+                          const unsigned char *indices, const float *weights,
+                          unsigned int channels)
+{
+  float aa = 0.0f, ab = 0.0f, bb = 0.0f, ap[4] = { 0 }, bp[4] = { 0 }, det;
+  unsigned int i, c;
+
+  for (i = 0; i < 16; ++i)
+    {
+      float a, b;
+
+      b = weights[indices[i]];
+      a = 1.0f - b;
+
+      aa += a * a * block->weights[i];
+      ab += a * b * block->weights[i];
+      bb += b * b * block->weights[i];
+
+      for (c = 0; c < channels; ++c)
+        {
+          ap[c] += a * block->pixels[c][i] * block->weights[i];
+          bp[c] += b * block->pixels[c][i] * block->weights[i];
+        }
+    }
+
+  det = aa * bb - ab * ab;
+
+  if (fabsf (det) < 1.0e-6f)
+    return 0;
+
+  det = 1.0f / det;
+
+  for (c = 0; c < channels; ++c)
+    {
+      endpoints[0][c] = (ap[c] * bb - bp[c] * ab) * det;
+      endpoints[1][c] = (bp[c] * aa - ap[c] * ab) * det;
+    }
+
+  return 1;
+}
+
+static unsigned int
+texture_bc1_pack565 (const float *color)
+{
+  int r, g, b;
+
+  r = (int) (color[0] * 31.0f / 255.0f + 0.5f);
+  g = (int) (color[1] * 63.0f / 255.0f + 0.5f);
+  b = (int) (color[2] * 31.0f / 255.0f + 0.5f);
+
+  r = (r < 0) ? 0 : (r > 31) ? 31 : r;
+  g = (g < 0) ? 0 : (g > 63) ? 63 : g;
+  b = (b < 0) ? 0 : (b > 31) ? 31 : b;
+
+  return (r << 11) | (g << 5) | b;
+}
+
+static void
+texture_bc1_unpack565 (int *color, unsigned int value)
+{
+  color[0] = ((value >> 8) & 0xf8) | (value >> 13);
+  color[1] = ((value >> 3) & 0xfc) | ((value >> 9) & 3);
+  color[2] = ((value << 3) & 0xf8) | ((value >> 2) & 7);
+}
+
+/* Computes the RGBA palette of a BC1 block with the given endpoints */
+static void
+texture_bc1_palette (int palette[4][4], unsigned int c0, unsigned int c1)
+{
+  unsigned int c;
+
+  texture_bc1_unpack565 (palette[0], c0);
+  texture_bc1_unpack565 (palette[1], c1);
+  palette[0][3] = palette[1][3] = 255;
+
+  for (c = 0; c < 3; ++c)
+    {
+      if (c0 > c1)
+        {
+          palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+          palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+      else
+        {
+          palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+          palette[3][c] = 0;
+        }
+    }
+
+  palette[2][3] = 255;
+  palette[3][3] = (c0 > c1) ? 255 : 0;
+}
+
+/* Fits indices to quantized BC1 endpoints, returning the error */
+static float
+texture_bc1_evaluate (unsigned char *indices, const struct texture_bc_block *block,
+                      unsigned int c0, unsigned int c1)
+{
+  int palette[4][4];
+  float floatPalette[4][4];
+  unsigned int k, c;
+
+  texture_bc1_palette (palette, c0, c1);
+
+  for (k = 0; k < 4; ++k)
+    for (c = 0; c < 4; ++c)
+      floatPalette[k][c] = palette[k][c];
+
+  /* Transparent black is only used for transparent pixels */
+
+  return texture_bc_fit (indices, block, (const float (*)[4]) floatPalette, (c0 > c1) ? 4 : 3, 3);
+}
+
+/* Compresses the colours of a block to BC1.  If `punchThrough' is set,
+ * pixels with alpha below one half are stored as transparent.  */
+static void
+texture_bc1_encode_block (unsigned char *output, struct texture_bc_block *block,
+                          unsigned int iterations, int punchThrough)
+{
+  static const float threeColorWeights[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+  float endpoints[2][4], error, bestError;
+  unsigned char indices[16], bestIndices[16];
+  unsigned int i, iteration, c0, c1, best0, best1, transparent = 0;
+  uint32_t bits = 0;
+
+  if (punchThrough)
+    {
+      for (i = 0; i < 16; ++i)
+        {
+          if (block->pixels[3][i] < 128.0f)
+            {
+              block->weights[i] = 0.0f;
+              ++transparent;
+            }
+        }
+    }
+
+  texture_bc_principal_endpoints (endpoints, block, 3);
+
+  /* Four colour mode needs the first endpoint to be larger, three colour
+   * mode the second */
+
+  c0 = texture_bc1_pack565 (endpoints[1]);
+  c1 = texture_bc1_pack565 (endpoints[0]);
+
+  if (transparent ? (c0 > c1) : (c0 < c1))
+    {
+      unsigned int tmp = c0;
+      c0 = c1;
+      c1 = tmp;
+    }
+
+  bestError = texture_bc1_evaluate (bestIndices, block, c0, c1);
+  best0 = c0;
+  best1 = c1;
+
+  for (iteration = 0; iteration < iterations; ++iteration)
+    {
+      if (!texture_bc_least_squares (endpoints, block, bestIndices,
+                                     (best0 > best1) ? texture_bc1_weights : threeColorWeights, 3))
+        break;
+
+      c0 = texture_bc1_pack565 (endpoints[0]);
+      c1 = texture_bc1_pack565 (endpoints[1]);
+
+      if (transparent ? (c0 > c1) : (c0 < c1))
+        {
+          unsigned int tmp = c0;
+          c0 = c1;
+          c1 = tmp;
+        }
+
+      if (c0 == best0 && c1 == best1)
+        break;
+
+      if ((error = texture_bc1_evaluate (indices, block, c0, c1)) >= bestError)
+        break;
+
+      bestError = error;
+      best0 = c0;
+      best1 = c1;
+      memcpy (bestIndices, indices, sizeof (indices));
+    }
+
+  /* Equal endpoints select three colour mode, which only matters if index
+   * 3 is used */
+
+  if (!transparent && best0 == best1)
+    memset (bestIndices, 0, sizeof (bestIndices));
+
+  for (i = 0; i < 16; ++i)
+    {
+      unsigned int index;
+
+      index = bestIndices[i];
+
+      if (transparent && !block->weights[i])
+        index = 3;
+
+      bits |= (uint32_t) index << (2 * i);
+    }
+
+  output[0] = best0;
+  output[1] = best0 >> 8;
+  output[2] = best1;
+  output[3] = best1 >> 8;
+  output[4] = bits;
+  output[5] = bits >> 8;
+  output[6] = bits >> 16;
+  output[7] = bits >> 24;
+}
+
+/* Computes the 8 entry palette of a BC3 alpha block */
+static void
+texture_bc3_alpha_palette (int *palette, int a0, int a1)
+{
+  unsigned int k;
+
+  palette[0] = a0;
+  palette[1] = a1;
+
+  if (a0 > a1)
+    {
+      for (k = 1; k < 7; ++k)
+        palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+    }
+  else
+    {
+      for (k = 1; k < 5; ++k)
+        palette[k + 1] = ((5 - k) * a0 + k * a1) / 5;
+
+      palette[6] = 0;
+      palette[7] = 255;
+    }
+}
+
+static unsigned int
+texture_bc3_alpha_fit (unsigned char *indices, const struct texture_bc_block *block,
+                       int a0, int a1)
+{
+  int palette[8];
+  unsigned int i, k, error = 0;
+
+  texture_bc3_alpha_palette (palette, a0, a1);
+
+  for (i = 0; i < 16; ++i)
+    {
+      unsigned int best = ~0U;
+      int alpha;
+
+      alpha = (int) block->pixels[3][i];
+
+      for (k = 0; k < 8; ++k)
+        {
+          unsigned int d;
+
+          d = (palette[k] - alpha) * (palette[k] - alpha);
+
+          if (d < best)
+            {
+              best = d;
+              indices[i] = k;
+            }
+        }
+
+      error += best;
+    }
+
+  return error;
+}
+
+/* Compresses the alpha channel of a block.  Both the 8 step mode spanning
+ * all values and the 6 step mode spanning values other than 0 and 255 are
+ * tried.  */
+static void
+texture_bc3_encode_alpha (unsigned char *output, const struct texture_bc_block *block)
+{
+  unsigned char indices[16], bestIndices[16];
+  unsigned int i, error, bestError;
+  int low = 255, high = 0, innerLow = 255, innerHigh = 0, best0, best1;
+  uint64_t bits = 0;
+
+  for (i = 0; i < 16; ++i)
+    {
+      int alpha;
+
+      alpha = (int) block->pixels[3][i];
+
+      if (alpha < low) low = alpha;
+      if (alpha > high) high = alpha;
+
+      if (alpha != 0 && alpha < innerLow) innerLow = alpha;
+      if (alpha != 255 && alpha > innerHigh) innerHigh = alpha;
+    }
+
+  best0 = high;
+  best1 = low;
+  bestError = texture_bc3_alpha_fit (bestIndices, block, best0, best1);
+
+  if (innerLow <= innerHigh
+      && (error = texture_bc3_alpha_fit (indices, block, innerLow, innerHigh)) < bestError)
+    {
+      best0 = innerLow;
+      best1 = innerHigh;
+      memcpy (bestIndices, indices, sizeof (indices));
+    }
+
+  for (i = 0; i < 16; ++i)
+    bits |= (uint64_t) bestIndices[i] << (3 * i);
+
+  output[0] = best0;
+  output[1] = best1;
+
+  for (i = 0; i < 6; ++i)
+    output[2 + i] = bits >> (8 * i);
+}
+
+/* Quantizes a BC7 mode 6 endpoint to 7 bits per channel plus a shared low
+ * bit, choosing the low bit with the smaller error.  An opaque endpoint
+ * always gets a low bit of 1, since 255 is odd and opaque texels must stay
+ * exactly opaque whatever the color error.  */
+static void
+texture_bc7_quantize (int *quantized, unsigned int *pbit, const float *endpoint)
+{
+  unsigned int p, c;
+  float bestError = FLT_MAX;
+
+  for (p = (endpoint[3] >= 254.5f) ? 1 : 0; p < 2; ++p)
+    {
+      int values[4];
+      float error = 0.0f;
+
+      for (c = 0; c < 4; ++c)
+        {
+          float d;
+
+          values[c] = (int) ((endpoint[c] - p) * 0.5f + 0.5f);
+          values[c] = (values[c] < 0) ? 0 : (values[c] > 127) ? 127 : values[c];
+
+          d = (values[c] * 2 + p) - endpoint[c];
+          error += d * d;
+        }
+
+      if (error < bestError)
+        {
+          bestError = error;
+          memcpy (quantized, values, sizeof (values));
+          *pbit = p;
+        }
+    }
+}
+
+static float
+texture_bc7_evaluate (unsigned char *indices, const struct texture_bc_block *block,
+                      const int (*quantized)[4], const unsigned int *pbits)
+{
+  float palette[16][4];
+  unsigned int k, c;
+
+  for (k = 0; k < 16; ++k)
+    {
+      for (c = 0; c < 4; ++c)
+        {
+          int e0, e1;
+
+          e0 = quantized[0][c] * 2 + pbits[0];
+          e1 = quantized[1][c] * 2 + pbits[1];
+
+          palette[k][c] = ((64 - texture_bc7_weights[k]) * e0 + texture_bc7_weights[k] * e1 + 32) >> 6;
+        }
+    }
+
+  return texture_bc_fit (indices, block, (const float (*)[4]) palette, 16, 4);
+}
+
+/* Appends `count' bits of `value' to a 128 bit block, least significant bit
+ * first */
+static void
+texture_bc7_put (unsigned char *output, unsigned int *offset, unsigned int count,
+                 unsigned int value)
+{
+  unsigned int i;
+
+  for (i = 0; i < count; ++i, ++*offset)
+    {
+      if (value & (1U << i))
+        output[*offset >> 3] |= 1 << (*offset & 7);
+    }
+}
+
+/* Compresses a block to BC7 mode 6, returning the squared error */
+static float
+texture_bc7_encode_mode6 (unsigned char *output, const struct texture_bc_block *block,
+                          unsigned int iterations)
+{
+  float endpoints[2][4], weights[16], error, bestError;
+  int quantized[2][4], bestQuantized[2][4];
+  unsigned char indices[16], bestIndices[16];
+  unsigned int pbits[2], bestPbits[2], iteration, i, c, offset = 0;
+
+  for (i = 0; i < 16; ++i)
+    weights[i] = texture_bc7_weights[i] / 64.0f;
+
+  texture_bc_principal_endpoints (endpoints, block, 4);
+  texture_bc7_quantize (bestQuantized[0], &bestPbits[0], endpoints[0]);
+  texture_bc7_quantize (bestQuantized[1], &bestPbits[1], endpoints[1]);
+  bestError = texture_bc7_evaluate (bestIndices, block, (const int (*)[4]) bestQuantized, bestPbits);
+
+  for (iteration = 0; iteration < iterations && bestError > 0.0f; ++iteration)
+    {
+      if (!texture_bc_least_squares (endpoints, block, bestIndices, weights, 4))
+        break;
+
+      texture_bc7_quantize (quantized[0], &pbits[0], endpoints[0]);
+      texture_bc7_quantize (quantized[1], &pbits[1], endpoints[1]);
+
+      if ((error = texture_bc7_evaluate (indices, block, (const int (*)[4]) quantized, pbits)) >= bestError)
+        break;
+
+      bestError = error;
+      memcpy (bestQuantized, quantized, sizeof (quantized));
+      memcpy (bestPbits, pbits, sizeof (pbits));
+      memcpy (bestIndices, indices, sizeof (indices));
+    }
+
+  /* The most significant bit of the first index is implied to be zero */
+
+  if (bestIndices[0] & 8)
+    {
+      int tmp[4];
+      unsigned int tmpPbit;
+
+      memcpy (tmp, bestQuantized[0], sizeof (tmp));
+      memcpy (bestQuantized[0], bestQuantized[1], sizeof (tmp));
+      memcpy (bestQuantized[1], tmp, sizeof (tmp));
+
+      tmpPbit = bestPbits[0];
+      bestPbits[0] = bestPbits[1];
+      bestPbits[1] = tmpPbit;
+
+      for (i = 0; i < 16; ++i)
+        bestIndices[i] = 15 - bestIndices[i];
+    }
+
+  memset (output, 0, 16);
+
+  texture_bc7_put (output, &offset, 7, 1 << 6);
+
+  for (c = 0; c < 4; ++c)
+    {
+      texture_bc7_put (output, &offset, 7, bestQuantized[0][c]);
+      texture_bc7_put (output, &offset, 7, bestQuantized[1][c]);
+    }
+
+  texture_bc7_put (output, &offset, 1, bestPbits[0]);
+  texture_bc7_put (output, &offset, 1, bestPbits[1]);
+  texture_bc7_put (output, &offset, 3, bestIndices[0]);
+
+  for (i = 1; i < 16; ++i)
+    texture_bc7_put (output, &offset, 4, bestIndices[i]);
+
+  return bestError;
+}
+
+static int
+texture_bc7_expand7 (int value)
+{
+  return (value << 1) | (value >> 6);
+}
+
+static float
+texture_bc7_evaluate_mode5 (unsigned char *indices, const struct texture_bc_block *block,
+                            const int (*quantized)[3])
+{
+  float palette[4][4];
+  unsigned int k, c;
+
+  for (k = 0; k < 4; ++k)
+    {
+      for (c = 0; c < 3; ++c)
+        {
+          int e0, e1, weight;
+
+          e0 = texture_bc7_expand7 (quantized[0][c]);
+          e1 = texture_bc7_expand7 (quantized[1][c]);
+          weight = texture_bc7_weights[k * 5];
+
+          palette[k][c] = ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+        }
+    }
+
+  return texture_bc_fit (indices, block, (const float (*)[4]) palette, 4, 3);
+}
+
+/* Fits 2 bit alpha indices between two 8 bit endpoints, returning the
+ * squared error */
+static float
+texture_bc7_fit_alpha (unsigned char *indices, const struct texture_bc_block *block,
+                       int a0, int a1)
+{
+  unsigned int i, k;
+  float error = 0.0f;
+
+  for (i = 0; i < 16; ++i)
+    {
+      float best = FLT_MAX;
+
+      for (k = 0; k < 4; ++k)
+        {
+          float d;
+          int weight;
+
+          weight = texture_bc7_weights[k * 5];
+          d = (((64 - weight) * a0 + weight * a1 + 32) >> 6) - block->pixels[3][i];
+
+          if (d * d < best)
+            {
+              best = d * d;
+              indices[i] = k;
+            }
+        }
+
+      error += best;
+    }
+
+  return error;
+}
+
+/* Compresses a block to BC7 mode 5, which stores colour and alpha with
+ * separate endpoints and indices, returning the squared error */
+static float
+texture_bc7_encode_mode5 (unsigned char *output, const struct texture_bc_block *block,
+                          unsigned int iterations)
+{
+  static const float weights[4] = { 0.0f, 21.0f / 64.0f, 43.0f / 64.0f, 1.0f };
+  float endpoints[2][4], error, bestError = FLT_MAX, alphaError;
+  int quantized[2][3], best[2][3], alpha[2] = { 255, 0 };
+  unsigned char indices[16], bestIndices[16], alphaIndices[16];
+  unsigned int iteration, i, c, offset = 0;
+
+  texture_bc_principal_endpoints (endpoints, block, 3);
+
+  for (i = 0; i < 16; ++i)
+    {
+      if (block->pixels[3][i] < alpha[0]) alpha[0] = block->pixels[3][i];
+      if (block->pixels[3][i] > alpha[1]) alpha[1] = block->pixels[3][i];
+    }
+
+  for (iteration = 0; ; ++iteration)
+    {
+      for (c = 0; c < 3; ++c)
+        {
+          quantized[0][c] = texture_bc_clamp ((int) (endpoints[0][c] + 0.5f)) >> 1;
+          quantized[1][c] = texture_bc_clamp ((int) (endpoints[1][c] + 0.5f)) >> 1;
+        }
+
+      error = texture_bc7_evaluate_mode5 (indices, block, (const int (*)[3]) quantized);
+
+      if (error >= bestError)
+        break;
+
+      bestError = error;
+      memcpy (best, quantized, sizeof (best));
+      memcpy (bestIndices, indices, sizeof (indices));
+
+      if (iteration == iterations
+          || !texture_bc_least_squares (endpoints, block, bestIndices, weights, 3))
+        break;
+    }
+
+  alphaError = texture_bc7_fit_alpha (alphaIndices, block, alpha[0], alpha[1]);
+
+  /* The most significant bit of each first index is implied to be zero */
+
+  if (bestIndices[0] & 2)
+    {
+      int tmp[3];
+
+      memcpy (tmp, best[0], sizeof (tmp));
+      memcpy (best[0], best[1], sizeof (tmp));
+      memcpy (best[1], tmp, sizeof (tmp));
+
+      for (i = 0; i < 16; ++i)
+        bestIndices[i] = 3 - bestIndices[i];
+    }
+
+  if (alphaIndices[0] & 2)
+    {
+      int tmp = alpha[0];
+
+      alpha[0] = alpha[1];
+      alpha[1] = tmp;
+
+      for (i = 0; i < 16; ++i)
+        alphaIndices[i] = 3 - alphaIndices[i];
+    }
+
+  memset (output, 0, 16);
+
+  texture_bc7_put (output, &offset, 6, 1 << 5);
+
+  /* No channel rotation */
+
+  texture_bc7_put (output, &offset, 2, 0);
+
+  for (c = 0; c < 3; ++c)
+    {
+      texture_bc7_put (output, &offset, 7, best[0][c]);
+      texture_bc7_put (output, &offset, 7, best[1][c]);
+    }
+
+  texture_bc7_put (output, &offset, 8, alpha[0]);
+  texture_bc7_put (output, &offset, 8, alpha[1]);
+
+  for (i = 0; i < 16; ++i)
+    texture_bc7_put (output, &offset, i ? 2 : 1, bestIndices[i]);
+
+  for (i = 0; i < 16; ++i)
+    texture_bc7_put (output, &offset, i ? 2 : 1, alphaIndices[i]);
+
+  return bestError + alphaError;
+}
+
+static void
+texture_bc7_encode_block (unsigned char *output, const struct texture_bc_block *block,
+                          unsigned int iterations)
+{
+  unsigned char mode5[16];
+  float error;
+  unsigned int i;
+
+  error = texture_bc7_encode_mode6 (output, block, iterations);
+
+  /* Blocks with varying alpha often do better with alpha on its own */
+
+  for (i = 1; i < 16; ++i)
+    {
+      if (block->pixels[3][i] != block->pixels[3][0])
+        break;
+    }
+
+  if (i < 16 && error > 0.0f
+      && texture_bc7_encode_mode5 (mode5, block, iterations) < error)
+    memcpy (output, mode5, sizeof (mode5));
+}
+
+static void
+texture_bc_thread (void *arg, unsigned int thread)
+{
+  struct texture_bc_encoder *encoder = arg;
+  struct texture_bc_block block;
+  enum texture_bc_format format;
+  unsigned int bx, by, iterations;
+
+  format = encoder->options->format;
+  iterations = encoder->options->iterations;
+
+  for (by = thread; by < encoder->blocksY; by += encoder->threads)
+    {
+      for (bx = 0; bx < encoder->blocksX; ++bx)
+        {
+          unsigned char *output;
+
+          output = encoder->output
+                   + ((size_t) by * encoder->blocksX + bx) * texture_bc_block_size (format);
+
+          texture_bc_load_block (&block, encoder, bx, by);
+
+          switch (format)
+            {
+            case TEXTURE_BC1:
+
+              texture_bc1_encode_block (output, &block, iterations, 1);
+
+              break;
+
+            case TEXTURE_BC3:
+
+              texture_bc3_encode_alpha (output, &block);
+              texture_bc1_encode_block (output + 8, &block, iterations, 0);
+
+              break;
+
+            case TEXTURE_BC7:
+
+              texture_bc7_encode_block (output, &block, iterations);
+
+              break;
+            }
+        }
+    }
+}
+
+size_t
+texture_bc_size (unsigned int width, unsigned int height, enum texture_bc_format format)
+{
+  return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * texture_bc_block_size (format);
+}
+
+void
+texture_bc_encode (void *output, const unsigned char *argb,
+                   unsigned int width, unsigned int height,
+                   const struct texture_bc_options *options)
+{
+  struct texture_bc_encoder encoder;
+
+  memset (&encoder, 0, sizeof (encoder));
+
+  encoder.options = options;
+  encoder.argb = argb;
+  encoder.width = width;
+  encoder.height = height;
+  encoder.blocksX = (width + 3) / 4;
+  encoder.blocksY = (height + 3) / 4;
+  encoder.output = output;
+
+  encoder.threads = options->threads ? options->threads : 1;
+
+  if (encoder.threads > encoder.blocksY)
+    encoder.threads = encoder.blocksY;
+
+  /* Each thread takes every `threads'th row of blocks */
+
+  texture_run_threads (encoder.threads, texture_bc_thread, &encoder);
+}
+
+/* Reads `count' bits from a 128 bit block, least significant bit first */
+static unsigned int
+texture_bc7_get (const unsigned char *input, unsigned int *offset, unsigned int count)
+{
+  unsigned int i, result = 0;
+
+  for (i = 0; i < count; ++i, ++*offset)
+    result |= ((input[*offset >> 3] >> (*offset & 7)) & 1) << i;
+
+  return result;
+}
+
+static void
+texture_bc7_decode_block (int rgba[16][4], const unsigned char *input)
+{
+  int endpoints[2][4];
+  unsigned int i, c, offset = 0, pbits[2], mode;
+
+  mode = texture_bc7_get (input, &offset, 6);
+
+  if (mode == (1 << 5))
+    {
+      unsigned int rotation, colorOffset, alphaOffset;
+
+      /* Mode 5 */
+
+      rotation = texture_bc7_get (input, &offset, 2);
+
+      for (c = 0; c < 3; ++c)
+        {
+          endpoints[0][c] = texture_bc7_expand7 (texture_bc7_get (input, &offset, 7));
+          endpoints[1][c] = texture_bc7_expand7 (texture_bc7_get (input, &offset, 7));
+        }
+
+      endpoints[0][3] = texture_bc7_get (input, &offset, 8);
+      endpoints[1][3] = texture_bc7_get (input, &offset, 8);
+
+      colorOffset = offset;
+      alphaOffset = offset + 31;
+
+      for (i = 0; i < 16; ++i)
+        {
+          unsigned int weight;
+          int tmp;
+
+          weight = texture_bc7_weights[texture_bc7_get (input, &colorOffset, i ? 2 : 1) * 5];
+
+          for (c = 0; c < 3; ++c)
+            rgba[i][c] = ((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6;
+
+          weight = texture_bc7_weights[texture_bc7_get (input, &alphaOffset, i ? 2 : 1) * 5];
+
+          rgba[i][3] = ((64 - weight) * endpoints[0][3] + weight * endpoints[1][3] + 32) >> 6;
+
+          if (rotation)
+            {
+              tmp = rgba[i][3];
+              rgba[i][3] = rgba[i][rotation - 1];
+              rgba[i][rotation - 1] = tmp;
+            }
+        }
+
+      return;
+    }
+
+  if (mode != 0 || texture_bc7_get (input, &offset, 1) != 1)
+    {
+      memset (rgba, 0, sizeof (int) * 64);
+
+      return;
+    }
+
+  /* Mode 6 */
+
+  for (c = 0; c < 4; ++c)
+    {
+      endpoints[0][c] = texture_bc7_get (input, &offset, 7);
+      endpoints[1][c] = texture_bc7_get (input, &offset, 7);
+    }
+
+  pbits[0] = texture_bc7_get (input, &offset, 1);
+  pbits[1] = texture_bc7_get (input, &offset, 1);
+
+  for (c = 0; c < 4; ++c)
+    {
+      endpoints[0][c] = endpoints[0][c] * 2 + pbits[0];
+      endpoints[1][c] = endpoints[1][c] * 2 + pbits[1];
+    }
+
+  for (i = 0; i < 16; ++i)
+    {
+      unsigned int index, weight;
+
+      index = texture_bc7_get (input, &offset, i ? 4 : 3);
+      weight = texture_bc7_weights[index];
+
+      for (c = 0; c < 4; ++c)
+        rgba[i][c] = ((64 - weight) * endpoints[0][c] + weight * endpoints[1][c] + 32) >> 6;
+    }
+}
+
+void
+texture_bc_decode (unsigned char *rgba, const void *input,
+                   unsigned int width, unsigned int height,
+                   enum texture_bc_format format)
+{
+  const unsigned char *block;
+  unsigned int bx, by, blocksX, blocksY;
+
+  block = input;
+  blocksX = (width + 3) / 4;
+  blocksY = (height + 3) / 4;
+
+  for (by = 0; by < blocksY; ++by)
+    {
+      for (bx = 0; bx < blocksX; ++bx, block += texture_bc_block_size (format))
+        {
+          int pixels[16][4];
+          unsigned int i;
+
+          if (format == TEXTURE_BC7)
+            texture_bc7_decode_block (pixels, block);
+          else
+            {
+              const unsigned char *color;
+              int palette[4][4];
+              uint32_t bits;
+
+              color = (format == TEXTURE_BC3) ? block + 8 : block;
+
+              texture_bc1_palette (palette,
+                                   color[0] | (color[1] << 8),
+                                   color[2] | (color[3] << 8));
+
+              bits = color[4] | (color[5] << 8) | (color[6] << 16) | ((uint32_t) color[7] << 24);
+
+              for (i = 0; i < 16; ++i)
+                memcpy (pixels[i], palette[(bits >> (2 * i)) & 3], sizeof (pixels[i]));
+
+              if (format == TEXTURE_BC3)
+                {
+                  int alphaPalette[8];
+                  uint64_t alphaBits = 0;
+
+                  texture_bc3_alpha_palette (alphaPalette, block[0], block[1]);
+
+                  for (i = 0; i < 6; ++i)
+                    alphaBits |= (uint64_t) block[2 + i] << (8 * i);
+
+                  for (i = 0; i < 16; ++i)
+                    pixels[i][3] = alphaPalette[(alphaBits >> (3 * i)) & 7];
+                }
+            }
+
+          for (i = 0; i < 16; ++i)
+            {
+              unsigned char *pixel;
+              unsigned int x, y, c;
+
+              x = bx * 4 + i % 4;
+              y = by * 4 + i / 4;
+
+              if (x >= width || y >= height)
+                continue;
+
+              pixel = rgba + 4 * ((size_t) y * width + x);
+
+              for (c = 0; c < 4; ++c)
+                pixel[c] = texture_bc_clamp (pixels[i][c]);
+            }
+        }
+    }
+}
@@ -0,0 +1,644 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "png-wrapper.h"
+#include "texture.h"
+
+static int TextureBench_printHelp;
+static int TextureBench_printVersion;
+static unsigned int TextureBench_iterations = 3;
+static long TextureBench_jobs;
+static int TextureBench_mipmaps;
+static const char *TextureBench_formatList;
+
+static struct option TextureBench_longOptions[] =
+{
+    { "iterations", required_argument, 0, 'n' },
+    { "jobs",     required_argument, 0, 'j' },
+    { "mipmaps",  no_argument, &TextureBench_mipmaps, 1 },
+    { "formats",  required_argument, 0, 'F' },
+    { "help",     no_argument, &TextureBench_printHelp, 1 },
+    { "version",  no_argument, &TextureBench_printVersion, 1 },
+    { 0, 0, 0, 0 }
+};
+
+enum TextureBench_Family
+{
+  TEXTUREBENCH_PVRTC,
+  TEXTUREBENCH_LIBPVRTC,
+  TEXTUREBENCH_ETC,
+  TEXTUREBENCH_BC
+};
+
+/* Formats measured by default.  `format' is the 2 bit flag for PVRTC, and
+ * the texture_etc_format or texture_bc_format otherwise.  The -lib PVRTC
+ * formats use the prebuilt libPVRTC, for comparison.  */
+static const struct TextureBench_Format
+{
+  const char *name;
+  enum TextureBench_Family family;
+  int format;
+} TextureBench_formats[] =
+{
+  { "pvrtc2",    TEXTUREBENCH_PVRTC, 1 },
+  { "pvrtc4",    TEXTUREBENCH_PVRTC, 0 },
+  { "pvrtc2-lib", TEXTUREBENCH_LIBPVRTC, 1 },
+  { "pvrtc4-lib", TEXTUREBENCH_LIBPVRTC, 0 },
+  { "etc1",      TEXTUREBENCH_ETC,   TEXTURE_ETC1 },
+  { "etc2",      TEXTUREBENCH_ETC,   TEXTURE_ETC2_RGB },
+  { "etc2-rgba", TEXTUREBENCH_ETC,   TEXTURE_ETC2_RGBA },
+  { "bc1",       TEXTUREBENCH_BC,    TEXTURE_BC1 },
+  { "bc3",       TEXTUREBENCH_BC,    TEXTURE_BC3 },
+  { "bc7",       TEXTUREBENCH_BC,    TEXTURE_BC7 }
+};
+
+#define TEXTUREBENCH_FORMAT_COUNT (sizeof (TextureBench_formats) / sizeof (TextureBench_formats[0]))
+
+/* Quality levels: ETC search tiers, or PVRTC and BC refinement passes */
+static const char *TextureBench_qualityNames[] = { "fast", "medium", "high" };
+static const unsigned int TextureBench_iterationLevels[] = { 0, 1, 4 };
+
+#define TEXTUREBENCH_QUALITY_COUNT 3
+
+static const char *TextureBench_filterNames[] = { "box", "kaiser", "lanczos" };
+
+static double
+TextureBench_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+static size_t
+TextureBench_Size (const struct TextureBench_Format *format,
+                   unsigned int width, unsigned int height)
+{
+  switch (format->family)
+    {
+    case TEXTUREBENCH_PVRTC:
+    case TEXTUREBENCH_LIBPVRTC: return texture_pvrtc_size (width, height, format->format);
+    case TEXTUREBENCH_ETC: return texture_etc_size (width, height, format->format);
+    case TEXTUREBENCH_BC: return texture_bc_size (width, height, format->format);
+    }
+
+  return 0;
+}
+
+static void
+TextureBench_Encode (const struct TextureBench_Format *format, unsigned int quality,
+                     void *output, const unsigned char *argb,
+                     unsigned int width, unsigned int height)
+{
+  struct texture_pvrtc_options pvrtc;
+  struct texture_etc_options etc;
+  struct texture_bc_options bc;
+
+  switch (format->family)
+    {
+    case TEXTUREBENCH_PVRTC:
+
+      pvrtc.use2bit = format->format;
+      pvrtc.iterations = TextureBench_iterationLevels[quality];
+      pvrtc.threads = TextureBench_jobs;
+      texture_pvrtc_encode (output, argb, width, height, &pvrtc);
+
+      break;
+
+    case TEXTUREBENCH_LIBPVRTC:
+
+      pvrtc.use2bit = format->format;
+      pvrtc.iterations = TextureBench_iterationLevels[quality];
+      pvrtc.threads = 1;
+      texture_libpvrtc_encode (output, argb, width, height, &pvrtc);
+
+      break;
+
+    case TEXTUREBENCH_ETC:
+
+      etc.format = format->format;
+      etc.quality = quality;
+      etc.threads = TextureBench_jobs;
+      texture_etc_encode (output, argb, width, height, &etc);
+
+      break;
+
+    case TEXTUREBENCH_BC:
+
+      bc.format = format->format;
+      bc.iterations = TextureBench_iterationLevels[quality];
+      bc.threads = TextureBench_jobs;
+      texture_bc_encode (output, argb, width, height, &bc);
+
+      break;
+    }
+}
+
+/* Decodes to RGBA with the PVRTools reference decoders where they exist,
+ * that is for PVRTC and ETC1 */
+static void
+TextureBench_Decode (const struct TextureBench_Format *format, unsigned char *rgba,
+                     const void *input, unsigned int width, unsigned int height)
+{
+  switch (format->family)
+    {
+    case TEXTUREBENCH_PVRTC:
+    case TEXTUREBENCH_LIBPVRTC:
+
+      texture_pvrtools_decode_pvrtc (rgba, input, width, height, format->format);
+
+      break;
+
+    case TEXTUREBENCH_ETC:
+
+      if (format->format == TEXTURE_ETC1)
+        texture_pvrtools_decode_etc1 (rgba, input, width, height);
+      else
+        texture_etc_decode (rgba, input, width, height, format->format);
+
+      break;
+
+    case TEXTUREBENCH_BC:
+
+      texture_bc_decode (rgba, input, width, height, format->format);
+
+      break;
+    }
+}
+
+/* Returns the mean structural similarity of the luma of an ARGB image and
+ * an RGBA image, over 8x8 windows spaced 4 pixels apart */
+static double
+TextureBench_SSIM (const unsigned char *argb, const unsigned char *rgba,
+                   unsigned int width, unsigned int height)
+{
+  static const double c1 = (0.01 * 255) * (0.01 * 255), c2 = (0.03 * 255) * (0.03 * 255);
+  unsigned int windowWidth, windowHeight, x0, y0, x, y;
+  double sum = 0.0;
+  size_t count = 0;
+
+  windowWidth = (width < 8) ? width : 8;
+  windowHeight = (height < 8) ? height : 8;
+
+  for (y0 = 0; y0 + windowHeight <= height; y0 += 4)
+    {
+      for (x0 = 0; x0 + windowWidth <= width; x0 += 4)
+        {
+          double ma = 0.0, mb = 0.0, aa = 0.0, bb = 0.0, ab = 0.0, n;
+
+          for (y = y0; y < y0 + windowHeight; ++y)
+            {
+              for (x = x0; x < x0 + windowWidth; ++x)
+                {
+                  const unsigned char *pa, *pb;
+                  double la, lb;
+
+                  pa = argb + ((size_t) y * width + x) * 4;
+                  pb = rgba + ((size_t) y * width + x) * 4;
+
+                  la = 0.299 * pa[1] + 0.587 * pa[2] + 0.114 * pa[3];
+                  lb = 0.299 * pb[0] + 0.587 * pb[1] + 0.114 * pb[2];
+
+                  ma += la;
+                  mb += lb;
+                  aa += la * la;
+                  bb += lb * lb;
+                  ab += la * lb;
+                }
+            }
+
+          n = windowWidth * windowHeight;
+          ma /= n;
+          mb /= n;
+          aa = aa / n - ma * ma;
+          bb = bb / n - mb * mb;
+          ab = ab / n - ma * mb;
+
+          sum += (2.0 * ma * mb + c1) * (2.0 * ab + c2)
+                 / ((ma * ma + mb * mb + c1) * (aa + bb + c2));
+          ++count;
+        }
+    }
+
+  return sum / count;
+}
+
+/* Stores the root mean square error of each channel, in RGBA order */
+static void
+TextureBench_ChannelError (double *rmse, const unsigned char *argb, const unsigned char *rgba,
+                           unsigned int width, unsigned int height)
+{
+  double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+  size_t i, count;
+  unsigned int c;
+
+  count = (size_t) width * height;
+
+  for (i = 0; i < count; ++i, argb += 4, rgba += 4)
+    {
+      for (c = 0; c < 4; ++c)
+        {
+          int d;
+
+          d = argb[(c + 1) & 3] - rgba[c];
+          sum[c] += d * d;
+        }
+    }
+
+  for (c = 0; c < 4; ++c)
+    rmse[c] = sqrt (sum[c] / count);
+}
+
+/* Prints one CSV row per quality level of a format */
+static void
+TextureBench_RunFormat (const char *path, const unsigned char *argb,
+                        unsigned int width, unsigned int height,
+                        const struct TextureBench_Format *format)
+{
+  unsigned char *output, *decoded;
+  unsigned int quality, iteration;
+  size_t size;
+
+  size = TextureBench_Size (format, width, height);
+
+  if (!(output = malloc (size))
+      || !(decoded = malloc ((size_t) width * height * 4)))
+    err (EX_OSERR, "malloc failed");
+
+  for (quality = 0; quality < TEXTUREBENCH_QUALITY_COUNT; ++quality)
+    {
+      double start, elapsed, rmse[4];
+      char qualityName[16];
+
+      start = TextureBench_Now ();
+
+      for (iteration = 0; iteration < TextureBench_iterations; ++iteration)
+        TextureBench_Encode (format, quality, output, argb, width, height);
+
+      elapsed = TextureBench_Now () - start;
+
+      TextureBench_Decode (format, decoded, output, width, height);
+      TextureBench_ChannelError (rmse, argb, decoded, width, height);
+
+      if (format->family == TEXTUREBENCH_ETC)
+        strcpy (qualityName, TextureBench_qualityNames[quality]);
+      else
+        sprintf (qualityName, "%u", TextureBench_iterationLevels[quality]);
+
+      printf ("%s,%u,%u,%s,%s,%zu,%.3f,%.3f,%.3f,%.5f,%.3f,%.3f,%.3f,%.3f\n",
+              path, width, height, format->name, qualityName, size,
+              size * 8.0 / ((double) width * height),
+              (double) width * height * TextureBench_iterations / elapsed / 1.0e6,
+              texture_psnr_argb_rgba (argb, decoded, width, height),
+              TextureBench_SSIM (argb, decoded, width, height),
+              rmse[0], rmse[1], rmse[2], rmse[3]);
+      fflush (stdout);
+    }
+
+  free (decoded);
+  free (output);
+}
+
+/* Upsamples an ARGB image to twice its size with bilinear filtering */
+static void
+TextureBench_Upsample (unsigned char *output, const unsigned char *input,
+                       unsigned int width, unsigned int height)
+{
+  unsigned int x, y, c;
+
+  for (y = 0; y < height * 2; ++y)
+    {
+      float fy;
+      unsigned int y0, y1;
+
+      fy = (y + 0.5f) * 0.5f - 0.5f;
+
+      if (fy < 0.0f)
+        fy = 0.0f;
+
+      y0 = (unsigned int) fy;
+      y1 = (y0 + 1 < height) ? y0 + 1 : y0;
+      fy -= y0;
+
+      for (x = 0; x < width * 2; ++x)
+        {
+          float fx;
+          unsigned int x0, x1;
+
+          fx = (x + 0.5f) * 0.5f - 0.5f;
+
+          if (fx < 0.0f)
+            fx = 0.0f;
+
+          x0 = (unsigned int) fx;
+          x1 = (x0 + 1 < width) ? x0 + 1 : x0;
+          fx -= x0;
+
+          for (c = 0; c < 4; ++c)
+            {
+              float top, bottom;
+
+              top = input[(y0 * width + x0) * 4 + c] * (1.0f - fx) + input[(y0 * width + x1) * 4 + c] * fx;
+              bottom = input[(y1 * width + x0) * 4 + c] * (1.0f - fx) + input[(y1 * width + x1) * 4 + c] * fx;
+
+              *output++ = (unsigned char) (top * (1.0f - fy) + bottom * fy + 0.5f);
+            }
+        }
+    }
+}
+
+/* Returns the PSNR between two ARGB images, with colours premultiplied by
+ * alpha, since the colour of transparent pixels is not seen */
+static double
+TextureBench_PSNR (const unsigned char *a, const unsigned char *b, size_t count)
+{
+  double sum = 0.0;
+  size_t i;
+  unsigned int c;
+
+  for (i = 0; i < count; ++i, a += 4, b += 4)
+    {
+      sum += (a[0] - b[0]) * (a[0] - b[0]);
+
+      for (c = 1; c < 4; ++c)
+        {
+          double d;
+
+          d = (a[c] * a[0] - b[c] * b[0]) / 255.0;
+          sum += d * d;
+        }
+    }
+
+  return sum ? 10.0 * log10 (255.0 * 255.0 * 4.0 * count / sum) : INFINITY;
+}
+
+/* Builds a mipmap chain, returning the time taken.  The largest change in
+ * alpha coverage at one half in levels of at least 16x16 pixels is stored
+ * in `drift'.  */
+static double
+TextureBench_BuildChain (unsigned char *levels[2], const unsigned char *argb,
+                         unsigned int width, unsigned int height,
+                         const struct texture_mip_options *options,
+                         int preserve, double *drift)
+{
+  double start, elapsed = 0.0, coverage;
+  unsigned char *swap;
+
+  coverage = texture_mip_coverage (argb, width, height, 0.5f);
+  memcpy (levels[0], argb, (size_t) width * height * 4);
+
+  *drift = 0.0;
+
+  while (width > 1 || height > 1)
+    {
+      double change;
+
+      start = TextureBench_Now ();
+
+      texture_mip_downsample (levels[1], levels[0], width, height, options);
+
+      if (width > 1)
+        width /= 2;
+
+      if (height > 1)
+        height /= 2;
+
+      if (preserve)
+        texture_mip_preserve_coverage (levels[1], width, height, 0.5f, coverage);
+
+      elapsed += TextureBench_Now () - start;
+
+      /* Coverage is too coarse to compare in the smallest levels */
+
+      change = fabs (texture_mip_coverage (levels[1], width, height, 0.5f) - coverage);
+
+      if (width * height >= 256 && change > *drift)
+        *drift = change;
+
+      swap = levels[0];
+      levels[0] = levels[1];
+      levels[1] = swap;
+    }
+
+  return elapsed;
+}
+
+/* Measures building a full mipmap chain with each filter.  Quality is the
+ * PSNR of the second level scaled back up against the first, and the
+ * largest change in alpha coverage at one half over the chain, without and
+ * with coverage preservation.  */
+static void
+TextureBench_RunMipmaps (const char *path, const unsigned char *argb,
+                         unsigned int width, unsigned int height)
+{
+  struct texture_mip_options options;
+  unsigned char *levels[2], *upsampled;
+  unsigned int filter, iteration;
+
+  if (!(levels[0] = malloc ((size_t) width * height * 4))
+      || !(levels[1] = malloc ((size_t) width * height * 4))
+      || !(upsampled = malloc ((size_t) width * height * 4)))
+    err (EX_OSERR, "malloc failed");
+
+  for (filter = TEXTURE_MIP_BOX; filter <= TEXTURE_MIP_LANCZOS; ++filter)
+    {
+      double elapsed = 0.0, psnr = NAN, drift, preservedDrift;
+
+      memset (&options, 0, sizeof (options));
+      options.filter = filter;
+      options.threads = TextureBench_jobs;
+
+      for (iteration = 0; iteration < TextureBench_iterations; ++iteration)
+        elapsed += TextureBench_BuildChain (levels, argb, width, height, &options, 0, &drift);
+
+      if (!(width & 1) && !(height & 1))
+        {
+          texture_mip_downsample (levels[1], argb, width, height, &options);
+          TextureBench_Upsample (upsampled, levels[1], width / 2, height / 2);
+          psnr = TextureBench_PSNR (argb, upsampled, (size_t) width * height);
+        }
+
+      TextureBench_BuildChain (levels, argb, width, height, &options, 1, &preservedDrift);
+
+      /* A full chain has about a third as many pixels as its first level */
+
+      printf ("%-24s %-10s %8.2f Mpix/s  %6.2f dB  coverage drift %.3f, %.3f preserved\n",
+              path, TextureBench_filterNames[filter],
+              (double) width * height * 4.0 / 3.0 * TextureBench_iterations / elapsed / 1.0e6,
+              psnr, drift, preservedDrift);
+    }
+
+  free (upsampled);
+  free (levels[1]);
+  free (levels[0]);
+}
+
+int
+main (int argc, char **argv)
+{
+  unsigned char selected[TEXTUREBENCH_FORMAT_COUNT];
+  unsigned int format;
+  int i;
+
+  while (-1 != (i = getopt_long (argc, argv, "F:j:n:", TextureBench_longOptions, NULL)))
+    {
+      switch (i)
+        {
+        case 0:
+
+          break;
+
+        case 'F':
+
+          TextureBench_formatList = optarg;
+
+          break;
+
+        case 'j':
+
+          TextureBench_jobs = strtol (optarg, 0, 0);
+
+          if (TextureBench_jobs <= 0)
+            errx (EX_USAGE, "Job count must be positive");
+
+          break;
+
+        case 'n':
+
+          TextureBench_iterations = strtol (optarg, 0, 0);
+
+          if (!TextureBench_iterations)
+            errx (EX_USAGE, "Iteration count must be positive");
+
+          break;
+
+        case '?':
+
+          fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
+
+          return EXIT_FAILURE;
+        }
+    }
+
+  if (TextureBench_printHelp)
+    {
+      fprintf (stdout,
+               "Usage: %s [OPTION]... IMAGE...\n"
+               "\n"
+               "Measures each texture encoder at each quality level, or mipmap\n"
+               "generation with each filter.  Encoder results are printed as CSV:\n"
+               "size, encoding speed, PSNR including alpha, SSIM of luma and the RMS\n"
+               "error of each channel.  PVRTC and ETC1 are decoded with the PVRTools\n"
+               "reference decoders.\n"
+               "\n"
+               "  -F, --formats=LIST       measure only the comma separated formats in\n"
+               "                           LIST: pvrtc2, pvrtc4, pvrtc2-lib, pvrtc4-lib,\n"
+               "                           etc1, etc2, etc2-rgba, bc1, bc3, bc7 (default:\n"
+               "                           all)\n"
+               "  -j, --jobs=COUNT         use COUNT threads (default: one per CPU)\n"
+               "      --mipmaps            measure mipmap filters instead of encoders\n"
+               "  -n, --iterations=COUNT   compress each image COUNT times\n"
+               "      --help     display this help and exit\n"
+               "      --version  display version information\n"
+               "\n"
+               "Report bugs to <morten.hustveit@gmail.com>\n", argv[0]);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (TextureBench_printVersion)
+    {
+      puts (PACKAGE_STRING);
+
+      return EXIT_SUCCESS;
+    }
+
+  if (optind == argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]... IMAGE...", argv[0]);
+
+  if (!TextureBench_jobs && 0 >= (TextureBench_jobs = sysconf (_SC_NPROCESSORS_ONLN)))
+    TextureBench_jobs = 1;
+
+  memset (selected, !TextureBench_formatList, sizeof (selected));
+
+  if (TextureBench_formatList)
+    {
+      const char *name = TextureBench_formatList;
+
+      while (*name)
+        {
+          size_t length;
+
+          length = strcspn (name, ",");
+
+          for (format = 0; format < TEXTUREBENCH_FORMAT_COUNT; ++format)
+            {
+              if (strlen (TextureBench_formats[format].name) == length
+                  && !strncmp (TextureBench_formats[format].name, name, length))
+                break;
+            }
+
+          if (format == TEXTUREBENCH_FORMAT_COUNT)
+            errx (EX_USAGE, "Unknown format '%.*s'", (int) length, name);
+
+          selected[format] = 1;
+          name += length;
+
+          if (*name == ',')
+            ++name;
+        }
+    }
+
+  if (!TextureBench_mipmaps)
+    puts ("image,width,height,format,quality,bytes,bits_per_pixel,mpix_per_s,"
+          "psnr_db,ssim,rmse_r,rmse_g,rmse_b,rmse_a");
+
+  for (i = optind; i < argc; ++i)
+    {
+      void *input;
+      unsigned int width, height;
+
+      if (-1 == png_load (argv[i], &input, &width, &height))
+        errx (EXIT_FAILURE, "png_load failed for %s", argv[i]);
+
+      if (TextureBench_mipmaps)
+        TextureBench_RunMipmaps (argv[i], input, width, height);
+      else
+        {
+          for (format = 0; format < TEXTUREBENCH_FORMAT_COUNT; ++format)
+            {
+              if (!selected[format])
+                continue;
+
+              if ((TextureBench_formats[format].family == TEXTUREBENCH_PVRTC
+                   || TextureBench_formats[format].family == TEXTUREBENCH_LIBPVRTC)
+                  && ((width & (width - 1)) || (height & (height - 1))))
+                {
+                  warnx ("Skipping %s for %s, which is not a power of two in size",
+                         TextureBench_formats[format].name, argv[i]);
+
+                  continue;
+                }
+
+              TextureBench_RunFormat (argv[i], input, width, height, &TextureBench_formats[format]);
+            }
+        }
+
+      free (input);
+    }
+
+  return EXIT_SUCCESS;
+}
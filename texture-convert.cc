@@ -3,57 +3,1355 @@
 #endif
 
 #include <err.h>
-#include <fcntl.h>
+#include <errno.h>
 #include <getopt.h>
+#include <math.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sysexits.h>
+#include <time.h>
 #include <unistd.h>
 
-#include <pvrtc.h>
+#include <PVRTTexture.h>
 
 #include "png-wrapper.h"
+#include "texture.h"
 
 static int Texture_printHelp;
 static int Texture_printVersion;
 static const char *Texture_format = "pvrtc";
+static long Texture_jobs;
+static unsigned int Texture_quality = 4;
+static int Texture_verify;
+static int Texture_libPVRTC;
+static enum texture_mip_filter Texture_mipmapFilter = TEXTURE_MIP_KAISER;
+static int Texture_linear;
+static float Texture_alphaCutoff;
+static const char *Texture_batchPath;
+static int Texture_daemon;
+static double Texture_psnrBudget = 38.0;
+
+/* Guards the batch job queue, and standard output while jobs run */
+static pthread_mutex_t Texture_batchMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Texture_batchCond = PTHREAD_COND_INITIALIZER;
 
 static struct option Texture_longOptions[] =
 {
     { "format", required_argument, 0, 'f' },
+    { "jobs",     required_argument, 0, 'j' },
+    { "quality",  required_argument, 0, 'q' },
+    { "verify",   no_argument, &Texture_verify, 1 },
+    { "libpvrtc", no_argument, &Texture_libPVRTC, 1 },
+    { "mipmap-filter", required_argument, 0, 'M' },
+    { "linear",   no_argument, &Texture_linear, 1 },
+    { "alpha-coverage", required_argument, 0, 'A' },
+    { "batch",    required_argument, 0, 'B' },
+    { "daemon",   no_argument, &Texture_daemon, 1 },
+    { "psnr",     required_argument, 0, 'P' },
     { "help",     no_argument, &Texture_printHelp, 1 },
     { "version",  no_argument, &Texture_printVersion, 1 },
     { 0, 0, 0, 0 }
 };
 
-struct TEXTURE_PVRTCHeader
-{
-  uint32_t height;
-  uint32_t width;
-  uint32_t numMipmaps;
-  uint32_t flags;
-  uint32_t dataLength;
-  uint32_t bpp;
-  uint32_t bitmaskRed;
-  uint32_t bitmaskGreen;
-  uint32_t bitmaskBlue;
-  uint32_t bitmaskAlpha;
-  uint32_t pvrTag;
-  uint32_t numSurfs;
+/* Metadata block listing where each mipmap level is stored.  Levels are
+ * written smallest first, unlike the PVR v3 convention, so that a loader
+ * can upload a usable texture from the start of the file and fetch the
+ * larger levels later.  The data holds one 32 bit (offset, size) pair per
+ * level, in the byte order of the header, indexed from the largest level.
+ * Offsets are counted from the end of the metadata.  */
+#define TEXTURE_METADATA_FOURCC  0x00544d42 /* 'B' 'M' 'T' 0 */
+#define TEXTURE_METADATA_LEVELS  0
+
+/* Rows of the first level decoded and encoded at a time, when the codec
+ * allows it.  A multiple of the block size.  */
+#define TEXTURE_BAND_ROWS        128
+
+/* The automatic formats estimate quality by encoding a mosaic of up to
+ * 8x8 tiles of 32x32 pixels, evenly spaced across the image */
+#define TEXTURE_SAMPLE_TILES     8
+#define TEXTURE_SAMPLE_TILE_SIZE 32
+
+static double
+Texture_Now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+}
+
+/* Decodes the next `count' rows of an image, adding the time taken to
+ * `*loadTime' unless it is NULL */
+static int
+Texture_ReadRows (struct png_stream *stream, unsigned char *rows, unsigned int count,
+                  double *loadTime)
+{
+  double start;
+  int result;
+
+  start = Texture_Now ();
+  result = png_stream_read (stream, rows, count);
+
+  if (loadTime)
+    *loadTime += Texture_Now () - start;
+
+  return result;
+}
+
+/* Compression format used for every mipmap level */
+struct Texture_Codec
+{
+  /* Format name, as given to --format */
+  const char *name;
+
+  size_t (*size) (const struct Texture_Codec *codec, unsigned int width, unsigned int height);
+  void (*encode) (const struct Texture_Codec *codec, void *output, const unsigned char *argb,
+                  unsigned int width, unsigned int height);
+
+  /* Decodes to RGBA for --verify */
+  void (*decode) (const struct Texture_Codec *codec, unsigned char *rgba, const void *input,
+                  unsigned int width, unsigned int height);
+
+  struct texture_pvrtc_options pvrtc;
+  struct texture_etc_options etc;
+  struct texture_bc_options bc;
+
+  /* Threads used for filtering mipmaps */
+  long threads;
+
+  /* Blocks are independent, so a level can be encoded a band of block
+   * rows at a time */
+  int bands;
+};
+
+static size_t
+Texture_SizePVRTC (const struct Texture_Codec *codec, unsigned int width, unsigned int height)
+{
+  return texture_pvrtc_size (width, height, codec->pvrtc.use2bit);
+}
+
+static void
+Texture_EncodePVRTC (const struct Texture_Codec *codec, void *output, const unsigned char *argb,
+                     unsigned int width, unsigned int height)
+{
+  texture_pvrtc_encode (output, argb, width, height, &codec->pvrtc);
+}
+
+/* texture_libpvrtc_encode swaps out stdout, so batch jobs must not report
+ * meanwhile */
+static void
+Texture_EncodeLibPVRTC (const struct Texture_Codec *codec, void *output, const unsigned char *argb,
+                        unsigned int width, unsigned int height)
+{
+  pthread_mutex_lock (&Texture_batchMutex);
+
+  texture_libpvrtc_encode (output, argb, width, height, &codec->pvrtc);
+
+  pthread_mutex_unlock (&Texture_batchMutex);
+}
+
+static void
+Texture_DecodePVRTC (const struct Texture_Codec *codec, unsigned char *rgba, const void *input,
+                     unsigned int width, unsigned int height)
+{
+  texture_pvrtools_decode_pvrtc (rgba, input, width, height, codec->pvrtc.use2bit);
+}
+
+static size_t
+Texture_SizeETC (const struct Texture_Codec *codec, unsigned int width, unsigned int height)
+{
+  return texture_etc_size (width, height, codec->etc.format);
+}
+
+static void
+Texture_EncodeETC (const struct Texture_Codec *codec, void *output, const unsigned char *argb,
+                   unsigned int width, unsigned int height)
+{
+  texture_etc_encode (output, argb, width, height, &codec->etc);
+}
+
+static void
+Texture_DecodeETC (const struct Texture_Codec *codec, unsigned char *rgba, const void *input,
+                   unsigned int width, unsigned int height)
+{
+  if (codec->etc.format == TEXTURE_ETC1)
+    texture_pvrtools_decode_etc1 (rgba, input, width, height);
+  else
+    texture_etc_decode (rgba, input, width, height, codec->etc.format);
+}
+
+static size_t
+Texture_SizeBC (const struct Texture_Codec *codec, unsigned int width, unsigned int height)
+{
+  return texture_bc_size (width, height, codec->bc.format);
+}
+
+static void
+Texture_EncodeBC (const struct Texture_Codec *codec, void *output, const unsigned char *argb,
+                  unsigned int width, unsigned int height)
+{
+  texture_bc_encode (output, argb, width, height, &codec->bc);
+}
+
+static void
+Texture_DecodeBC (const struct Texture_Codec *codec, unsigned char *rgba, const void *input,
+                  unsigned int width, unsigned int height)
+{
+  texture_bc_decode (rgba, input, width, height, codec->bc.format);
+}
+
+/* Writes one PVR v3 metadata block */
+static void
+Texture_WriteMetadata (FILE *output, uint32_t fourCC, uint32_t key,
+                       const void *data, uint32_t size)
+{
+  uint32_t blockHeader[3];
+
+  blockHeader[0] = fourCC;
+  blockHeader[1] = key;
+  blockHeader[2] = size;
+
+  fwrite (blockHeader, 1, sizeof (blockHeader), output);
+  fwrite (data, 1, size, output);
+}
+
+/* Returns the sum of squared errors of an encoded image, for --verify */
+static double
+Texture_SquaredError (const struct Texture_Codec *codec, unsigned char *decoded,
+                      const unsigned char *argb, const void *encoded,
+                      unsigned int width, unsigned int height)
+{
+  double psnr;
+
+  codec->decode (codec, decoded, encoded, width, height);
+
+  psnr = texture_psnr_argb_rgba (argb, decoded, width, height);
+
+  return isinf (psnr) ? 0.0 : 255.0 * 255.0 * 4.0 * width * height / pow (10.0, psnr / 10.0);
+}
+
+static void
+Texture_PrintLevel (unsigned int levelIndex, unsigned int width, unsigned int height,
+                    double squaredError, double elapsed)
+{
+  fprintf (stderr, "level %u: %ux%u, %.2f dB PSNR, %.2f ms\n",
+           levelIndex, width, height,
+           squaredError ? 10.0 * log10 (255.0 * 255.0 * 4.0 * width * height / squaredError) : INFINITY,
+           elapsed * 1.0e3);
+}
+
+/* Encodes the first level a band of rows at a time as they are decoded,
+ * and filters the same rows into the second level, so that the full size
+ * image is never held in memory.  The second level is stored bottom row
+ * first in `nextLevel'.  Returns -1 if the image can't be decoded.  */
+static int
+Texture_StreamFirstLevel (unsigned char *output, unsigned char *nextLevel,
+                          struct png_stream *stream, unsigned int width, unsigned int height,
+                          const struct Texture_Codec *codec,
+                          const struct texture_mip_options *mipOptions, double *coverage,
+                          double *loadTime)
+{
+  struct texture_mip_stream *mip = NULL;
+  unsigned char *band, *flipped, *decoded = NULL;
+  unsigned int row, bandHeight, bottom, y;
+  size_t covered = 0;
+  double squaredError = 0.0, elapsed = 0.0, start;
+  int result = 0;
+
+  if (!(band = (unsigned char *) malloc ((size_t) width * TEXTURE_BAND_ROWS * 4))
+      || !(flipped = (unsigned char *) malloc ((size_t) width * TEXTURE_BAND_ROWS * 4))
+      || (Texture_verify && !(decoded = (unsigned char *) malloc ((size_t) width * TEXTURE_BAND_ROWS * 4))))
+    err (EX_OSERR, "malloc failed");
+
+  if (width > 1 || height > 1)
+    mip = texture_mip_stream_begin (nextLevel, width, height, mipOptions);
+
+  /* Rows arrive top first, but are stored bottom first, so the first band
+   * ends with the top row of blocks, which is partial when the height is
+   * not a multiple of the block size.  Every band after it is whole.  */
+
+  for (row = 0; row < height; row += bandHeight)
+    {
+      unsigned char *blocks;
+
+      bandHeight = row ? TEXTURE_BAND_ROWS : (height - 1) % TEXTURE_BAND_ROWS + 1;
+
+      if (-1 == Texture_ReadRows (stream, band, bandHeight, loadTime))
+        {
+          result = -1;
+
+          break;
+        }
+
+      if (mip)
+        texture_mip_stream_rows (mip, band, bandHeight);
+
+      if (Texture_alphaCutoff > 0.0f)
+        covered += (size_t) (texture_mip_coverage (band, width, bandHeight, Texture_alphaCutoff)
+                             * width * bandHeight + 0.5);
+
+      for (y = 0; y < bandHeight; ++y)
+        memcpy (flipped + (size_t) y * width * 4,
+                band + (size_t) (bandHeight - y - 1) * width * 4, (size_t) width * 4);
+
+      bottom = height - row - bandHeight;
+      blocks = output + codec->size (codec, width, bottom);
+
+      start = Texture_Now ();
+
+      codec->encode (codec, blocks, flipped, width, bandHeight);
+
+      elapsed += Texture_Now () - start;
+
+      if (Texture_verify)
+        squaredError += Texture_SquaredError (codec, decoded, flipped, blocks, width, bandHeight);
+    }
+
+  if (mip)
+    {
+      unsigned int nextWidth, nextHeight;
+
+      texture_mip_stream_end (mip);
+
+      nextWidth = (width > 1) ? width / 2 : 1;
+      nextHeight = (height > 1) ? height / 2 : 1;
+
+      for (y = 0; y < nextHeight / 2; ++y)
+        {
+          unsigned char *top, *bottomRow;
+          size_t x;
+
+          top = nextLevel + (size_t) y * nextWidth * 4;
+          bottomRow = nextLevel + (size_t) (nextHeight - y - 1) * nextWidth * 4;
+
+          for (x = 0; x < (size_t) nextWidth * 4; ++x)
+            {
+              unsigned char tmp = top[x];
+
+              top[x] = bottomRow[x];
+              bottomRow[x] = tmp;
+            }
+        }
+    }
+
+  if (!result)
+    {
+      *coverage = (double) covered / ((size_t) width * height);
+
+      if (Texture_verify)
+        Texture_PrintLevel (0, width, height, squaredError, elapsed);
+    }
+
+  free (decoded);
+  free (flipped);
+  free (band);
+
+  return result;
+}
+
+/* Writes the header, metadata and all mipmap levels of an image.  Every
+ * level is encoded before anything is written, so that the smallest can be
+ * stored first.  Time spent decoding the image is added to `*loadTime'
+ * unless it is NULL.  Returns -1 if the image can't be decoded.  */
+static int
+Texture_WriteLevels (FILE *file, PVRTextureHeaderV3 *header, struct png_stream *stream,
+                     unsigned int width, unsigned int height,
+                     const struct Texture_Codec *codec, double *loadTime)
+{
+  struct texture_mip_options mipOptions;
+  unsigned char *data, *level, *next, *swap, *decoded = NULL;
+  uint32_t levels[32][2];
+  unsigned char orientation[3];
+  size_t dataSize = 0;
+  unsigned int levelIndex, levelCount, levelWidth, levelHeight, row;
+  double start, coverage = 0.0;
+
+  /* Lay out the levels from the smallest up */
+
+  levelWidth = width;
+  levelHeight = height;
+
+  for (levelCount = 1; levelWidth > 1 || levelHeight > 1; ++levelCount)
+    {
+      if (levelWidth > 1)
+        levelWidth /= 2;
+
+      if (levelHeight > 1)
+        levelHeight /= 2;
+    }
+
+  for (levelIndex = levelCount; levelIndex-- > 0; )
+    {
+      levelWidth = width >> levelIndex;
+      levelHeight = height >> levelIndex;
+
+      levels[levelIndex][0] = dataSize;
+      levels[levelIndex][1] = codec->size (codec, levelWidth ? levelWidth : 1,
+                                           levelHeight ? levelHeight : 1);
+      dataSize += levels[levelIndex][1];
+    }
+
+  if (!(data = (unsigned char *) malloc (dataSize)))
+    err (EX_OSERR, "malloc failed");
+
+  memset (&mipOptions, 0, sizeof (mipOptions));
+  mipOptions.filter = Texture_mipmapFilter;
+  mipOptions.linear = Texture_linear;
+  mipOptions.threads = codec->threads;
+
+  /* Levels alternate between two buffers, the second large enough for
+   * the level after the first */
+
+  if (codec->bands)
+    {
+      if (!(level = (unsigned char *) malloc ((size_t) ((width + 1) / 2) * ((height + 1) / 2) * 4))
+          || !(next = (unsigned char *) malloc ((size_t) ((width + 3) / 4) * ((height + 3) / 4) * 4)))
+        err (EX_OSERR, "malloc failed");
+
+      if (-1 == Texture_StreamFirstLevel (data + levels[0][0], level, stream, width, height,
+                                          codec, &mipOptions, &coverage, loadTime))
+        {
+          free (next);
+          free (level);
+          free (data);
+
+          return -1;
+        }
+
+      levelIndex = 1;
+
+      if (width > 1)
+        width /= 2;
+
+      if (height > 1)
+        height /= 2;
+
+      if (Texture_alphaCutoff > 0.0f && levelCount > 1)
+        texture_mip_preserve_coverage (level, width, height, Texture_alphaCutoff, coverage);
+    }
+  else
+    {
+      if (!(level = (unsigned char *) malloc ((size_t) width * height * 4))
+          || !(next = (unsigned char *) malloc ((size_t) ((width + 1) / 2) * ((height + 1) / 2) * 4)))
+        err (EX_OSERR, "malloc failed");
+
+      for (row = 0; row < height; ++row)
+        {
+          if (-1 == Texture_ReadRows (stream, level + (size_t) (height - row - 1) * width * 4, 1,
+                                      loadTime))
+            {
+              free (next);
+              free (level);
+              free (data);
+
+              return -1;
+            }
+        }
+
+      levelIndex = 0;
+
+      if (Texture_alphaCutoff > 0.0f)
+        coverage = texture_mip_coverage (level, width, height, Texture_alphaCutoff);
+    }
+
+  for (; levelIndex < levelCount; ++levelIndex)
+    {
+      unsigned char *output;
+
+      output = data + levels[levelIndex][0];
+
+      start = Texture_Now ();
+
+      codec->encode (codec, output, level, width, height);
+
+      if (Texture_verify)
+        {
+          double elapsed;
+
+          elapsed = Texture_Now () - start;
+
+          if (!decoded && !(decoded = (unsigned char *) malloc ((size_t) width * height * 4)))
+            err (EX_OSERR, "malloc failed");
+
+          Texture_PrintLevel (levelIndex, width, height,
+                              Texture_SquaredError (codec, decoded, level, output, width, height),
+                              elapsed);
+        }
+
+      if (levelIndex + 1 == levelCount)
+        break;
+
+      texture_mip_downsample (next, level, width, height, &mipOptions);
+
+      if (width > 1)
+        width /= 2;
+
+      if (height > 1)
+        height /= 2;
+
+      if (Texture_alphaCutoff > 0.0f)
+        texture_mip_preserve_coverage (next, width, height, Texture_alphaCutoff, coverage);
+
+      swap = level;
+      level = next;
+      next = swap;
+    }
+
+  /* Levels are stored bottom row first */
+
+  orientation[ePVRTAxisX] = ePVRTOrientRight;
+  orientation[ePVRTAxisY] = ePVRTOrientUp;
+  orientation[ePVRTAxisZ] = ePVRTOrientIn;
+
+  header->u32MIPMapCount = levelCount;
+  header->u32MetaDataSize = 12 + sizeof (orientation) + 12 + levelCount * sizeof (levels[0]);
+
+  fwrite (header, 1, PVRTEX3_HEADERSIZE, file);
+
+  Texture_WriteMetadata (file, PVRTEX3_IDENT, ePVRTMetaDataTextureOrientation,
+                         orientation, sizeof (orientation));
+  Texture_WriteMetadata (file, TEXTURE_METADATA_FOURCC, TEXTURE_METADATA_LEVELS,
+                         levels, levelCount * sizeof (levels[0]));
+
+  fwrite (data, 1, dataSize, file);
+
+  free (next);
+  free (level);
+  free (decoded);
+  free (data);
+
+  return 0;
+}
+
+/* Returns non-zero if any pixel of a PNG image is not fully opaque.  The
+ * image is decoded a band at a time, and the time taken is added to
+ * `*loadTime' unless it is NULL.  */
+static int
+Texture_HasAlpha (const char *path, double *loadTime)
+{
+  struct png_stream *stream;
+  unsigned char *band;
+  unsigned int width, height, row, count;
+  size_t i;
+  double start;
+  int hasAlpha;
+
+  start = Texture_Now ();
+
+  if (!(stream = png_stream_open (path, &width, &height, &hasAlpha)))
+    return 0;
+
+  if (!(band = (unsigned char *) malloc ((size_t) width * TEXTURE_BAND_ROWS * 4)))
+    err (EX_OSERR, "malloc failed");
+
+  for (row = 0; hasAlpha && row < height; row += count)
+    {
+      count = (height - row < TEXTURE_BAND_ROWS) ? height - row : TEXTURE_BAND_ROWS;
+
+      if (-1 == png_stream_read (stream, band, count))
+        break;
+
+      for (i = 0; i < (size_t) width * count; ++i)
+        {
+          if (band[i * 4] != 0xff)
+            break;
+        }
+
+      if (i < (size_t) width * count)
+        break;
+    }
+
+  hasAlpha = hasAlpha && row < height;
+
+  free (band);
+  png_stream_close (stream);
+
+  if (loadTime)
+    *loadTime += Texture_Now () - start;
+
+  return hasAlpha;
+}
+
+/* Chooses the codec and pixel format for an image in a named format.
+ * `hasAlpha' is negative if the image has not been checked for alpha yet;
+ * the time taken to check it is added to `*loadTime' unless it is NULL.
+ * Returns -1 and stores a message in `error' if the image can't be stored
+ * in the format.  */
+static int
+Texture_SetupFormat (PVRTextureHeaderV3 *header, struct Texture_Codec *codec,
+                     const char *format, const char *path, int hasAlpha,
+                     unsigned int width, unsigned int height, long threads,
+                     double *loadTime, char *error, size_t errorSize)
+{
+  header->u32Width = width;
+  header->u32Height = height;
+  header->u32ColourSpace = Texture_linear ? ePVRTCSpacelRGB : ePVRTCSpacesRGB;
+  header->u32ChannelType = ePVRTVarTypeUnsignedByteNorm;
+
+  memset (codec, 0, sizeof (*codec));
+  codec->name = format;
+  codec->threads = threads;
+
+  if (!strcmp (format, "pvrtc") || !strcmp (format, "pvrtc4"))
+    {
+      if ((width & (width - 1)) || (height & (height - 1)))
+        {
+          snprintf (error, errorSize, "PVRTC requires power of two dimensions, got %ux%u", width, height);
+
+          return -1;
+        }
+
+      codec->size = Texture_SizePVRTC;
+      codec->encode = Texture_libPVRTC ? Texture_EncodeLibPVRTC : Texture_EncodePVRTC;
+      codec->decode = Texture_DecodePVRTC;
+      codec->pvrtc.use2bit = !strcmp (format, "pvrtc");
+      codec->pvrtc.iterations = Texture_quality;
+      codec->pvrtc.threads = threads;
+
+      if (hasAlpha < 0)
+        hasAlpha = Texture_HasAlpha (path, loadTime);
+
+      if (hasAlpha)
+        header->u64PixelFormat = codec->pvrtc.use2bit ? ePVRTPF_PVRTCI_2bpp_RGBA : ePVRTPF_PVRTCI_4bpp_RGBA;
+      else
+        header->u64PixelFormat = codec->pvrtc.use2bit ? ePVRTPF_PVRTCI_2bpp_RGB : ePVRTPF_PVRTCI_4bpp_RGB;
+    }
+  else if (!strcmp (format, "etc1") || !strcmp (format, "etc2"))
+    {
+      codec->size = Texture_SizeETC;
+      codec->encode = Texture_EncodeETC;
+      codec->decode = Texture_DecodeETC;
+      codec->etc.threads = threads;
+      codec->bands = 1;
+      codec->etc.quality = (Texture_quality >= 2) ? TEXTURE_ETC_HIGH
+                           : Texture_quality ? TEXTURE_ETC_MEDIUM : TEXTURE_ETC_FAST;
+
+      if (!strcmp (format, "etc1"))
+        {
+          codec->etc.format = TEXTURE_ETC1;
+          header->u64PixelFormat = ePVRTPF_ETC1;
+        }
+      else if (hasAlpha < 0 ? Texture_HasAlpha (path, loadTime) : hasAlpha)
+        {
+          codec->etc.format = TEXTURE_ETC2_RGBA;
+          header->u64PixelFormat = ePVRTPF_ETC2_RGBA;
+        }
+      else
+        {
+          codec->etc.format = TEXTURE_ETC2_RGB;
+          header->u64PixelFormat = ePVRTPF_ETC2_RGB;
+        }
+    }
+  else if (!strcmp (format, "bc1") || !strcmp (format, "bc3")
+           || !strcmp (format, "bc7"))
+    {
+      codec->size = Texture_SizeBC;
+      codec->encode = Texture_EncodeBC;
+      codec->decode = Texture_DecodeBC;
+      codec->bc.iterations = Texture_quality;
+      codec->bc.threads = threads;
+      codec->bands = 1;
+
+      if (!strcmp (format, "bc1"))
+        {
+          codec->bc.format = TEXTURE_BC1;
+          header->u64PixelFormat = ePVRTPF_BC1;
+        }
+      else if (!strcmp (format, "bc3"))
+        {
+          codec->bc.format = TEXTURE_BC3;
+          header->u64PixelFormat = ePVRTPF_BC3;
+        }
+      else
+        {
+          codec->bc.format = TEXTURE_BC7;
+          header->u64PixelFormat = ePVRTPF_BC7;
+        }
+    }
+  else
+    {
+      snprintf (error, errorSize, "Unknown format '%s'", format);
+
+      return -1;
+    }
+
+  return 0;
+}
+
+/* Properties of an image that decide which formats suit it */
+struct Texture_Analysis
+{
+  /* Some pixel is not fully opaque */
+  int alpha;
+
+  /* Every pixel is either fully opaque or fully transparent */
+  int binaryAlpha;
+
+  /* Tiles of the image joined into one, top row first */
+  unsigned char *sample;
+  unsigned int sampleWidth, sampleHeight;
+};
+
+/* Chooses the number and size of the sample tiles along one axis */
+static void
+Texture_SampleAxis (unsigned int size, unsigned int *count, unsigned int *tileSize)
+{
+  if (size <= TEXTURE_SAMPLE_TILES * TEXTURE_SAMPLE_TILE_SIZE)
+    {
+      *count = 1;
+      *tileSize = size;
+    }
+  else
+    {
+      *count = TEXTURE_SAMPLE_TILES;
+      *tileSize = TEXTURE_SAMPLE_TILE_SIZE;
+    }
+}
+
+/* Returns the first pixel of sample tile `index' along an axis.  Tiles
+ * are aligned to the 4x4 block grid, and don't overlap.  */
+static unsigned int
+Texture_SampleStart (unsigned int size, unsigned int count, unsigned int tileSize,
+                     unsigned int index)
+{
+  if (count == 1)
+    return 0;
+
+  return ((size_t) (size - tileSize) * index / (count - 1)) & ~3U;
+}
+
+/* Measures a PNG image and copies the sample tiles out of it, decoding a
+ * band at a time.  The time taken is added to `*loadTime' unless it is
+ * NULL.  Returns -1 if the image can't be decoded.  */
+static int
+Texture_Analyze (struct Texture_Analysis *analysis, const char *path, double *loadTime)
+{
+  struct png_stream *stream;
+  unsigned char *band;
+  unsigned int width, height, row, count, x, y;
+  unsigned int tilesX, tilesY, tileWidth, tileHeight, tileX, tileY;
+  double start;
+  int result = 0;
+
+  start = Texture_Now ();
+
+  memset (analysis, 0, sizeof (*analysis));
+  analysis->binaryAlpha = 1;
+
+  if (!(stream = png_stream_open (path, &width, &height, NULL)))
+    return -1;
+
+  Texture_SampleAxis (width, &tilesX, &tileWidth);
+  Texture_SampleAxis (height, &tilesY, &tileHeight);
+
+  analysis->sampleWidth = tilesX * tileWidth;
+  analysis->sampleHeight = tilesY * tileHeight;
+
+  if (!(band = (unsigned char *) malloc ((size_t) width * TEXTURE_BAND_ROWS * 4))
+      || !(analysis->sample = (unsigned char *) malloc ((size_t) analysis->sampleWidth
+                                                        * analysis->sampleHeight * 4)))
+    err (EX_OSERR, "malloc failed");
+
+  for (row = 0; row < height; row += count)
+    {
+      count = (height - row < TEXTURE_BAND_ROWS) ? height - row : TEXTURE_BAND_ROWS;
+
+      if (-1 == png_stream_read (stream, band, count))
+        {
+          result = -1;
+
+          break;
+        }
+
+      for (y = row; y < row + count; ++y)
+        {
+          const unsigned char *line, *pixel;
+
+          line = band + (size_t) (y - row) * width * 4;
+
+          for (x = 0, pixel = line; x < width; ++x, pixel += 4)
+            {
+              if (pixel[0] != 0xff)
+                {
+                  analysis->alpha = 1;
+
+                  if (pixel[0])
+                    analysis->binaryAlpha = 0;
+                }
+            }
+
+          for (tileY = 0; tileY < tilesY; ++tileY)
+            {
+              unsigned int top;
+
+              top = Texture_SampleStart (height, tilesY, tileHeight, tileY);
+
+              if (y < top || y >= top + tileHeight)
+                continue;
+
+              for (tileX = 0; tileX < tilesX; ++tileX)
+                {
+                  memcpy (analysis->sample + ((size_t) (tileY * tileHeight + y - top) * analysis->sampleWidth
+                                              + tileX * tileWidth) * 4,
+                          line + (size_t) Texture_SampleStart (width, tilesX, tileWidth, tileX) * 4,
+                          tileWidth * 4);
+                }
+            }
+        }
+    }
+
+  free (band);
+  png_stream_close (stream);
+
+  if (loadTime)
+    *loadTime += Texture_Now () - start;
+
+  if (result == -1)
+    {
+      free (analysis->sample);
+      analysis->sample = NULL;
+    }
+
+  return result;
+}
+
+/* Chooses the codec and pixel format for an image, like
+ * Texture_SetupFormat.  The automatic formats, such as "etc-auto", pick
+ * a format of their family: those the image's alpha rules out are
+ * skipped, and the rest are tried from the smallest and fastest up, until
+ * one encodes the sample tiles within --psnr, measured over all four
+ * channels as --verify measures it.  If none does, the one closest to it
+ * wins.  The decision is logged to standard error.  Time spent decoding
+ * the image to analyze it is added to `*loadTime' unless it is NULL.  */
+static int
+Texture_Setup (PVRTextureHeaderV3 *header, struct Texture_Codec *codec,
+               const char *format, const char *path,
+               unsigned int width, unsigned int height, long threads,
+               double *loadTime, char *error, size_t errorSize)
+{
+  struct Texture_Analysis analysis;
+  const char *candidates[3], *chosen = NULL;
+  unsigned char *encoded, *decoded;
+  char log[512];
+  double bestPSNR = -INFINITY;
+  size_t length;
+  unsigned int i, candidateCount = 0;
+
+  if (strcmp (format, "pvrtc-auto") && strcmp (format, "etc-auto")
+      && strcmp (format, "bc-auto"))
+    return Texture_SetupFormat (header, codec, format, path, -1,
+                                width, height, threads, loadTime, error, errorSize);
+
+  if (-1 == Texture_Analyze (&analysis, path, loadTime))
+    {
+      snprintf (error, errorSize, "Failed to analyze `%s'", path);
+
+      return -1;
+    }
+
+  if (!strcmp (format, "pvrtc-auto"))
+    {
+      candidates[candidateCount++] = "pvrtc";
+      candidates[candidateCount++] = "pvrtc4";
+    }
+  else if (!strcmp (format, "etc-auto"))
+    {
+      /* ETC1 can't store alpha, but is supported by more devices */
+
+      if (!analysis.alpha)
+        candidates[candidateCount++] = "etc1";
+
+      candidates[candidateCount++] = "etc2";
+    }
+  else
+    {
+      /* BC1 stores 1 bit alpha, and BC3 wastes its alpha block on opaque
+       * images */
+
+      if (analysis.binaryAlpha)
+        candidates[candidateCount++] = "bc1";
+
+      if (analysis.alpha)
+        candidates[candidateCount++] = "bc3";
+
+      candidates[candidateCount++] = "bc7";
+    }
+
+  length = snprintf (log, sizeof (log), "%s: %s;", path,
+                     !analysis.alpha ? "opaque" : analysis.binaryAlpha ? "1 bit alpha" : "alpha");
+
+  if (!(decoded = (unsigned char *) malloc ((size_t) analysis.sampleWidth * analysis.sampleHeight * 4)))
+    err (EX_OSERR, "malloc failed");
+
+  for (i = 0; i < candidateCount; ++i)
+    {
+      double psnr;
+
+      if (-1 == Texture_SetupFormat (header, codec, candidates[i], path, analysis.alpha,
+                                     width, height, threads, NULL, error, errorSize))
+        {
+          free (decoded);
+          free (analysis.sample);
+
+          return -1;
+        }
+
+      if (!(encoded = (unsigned char *) malloc (codec->size (codec, analysis.sampleWidth,
+                                                             analysis.sampleHeight))))
+        err (EX_OSERR, "malloc failed");
+
+      codec->encode (codec, encoded, analysis.sample, analysis.sampleWidth, analysis.sampleHeight);
+      codec->decode (codec, decoded, encoded, analysis.sampleWidth, analysis.sampleHeight);
+
+      psnr = texture_psnr_argb_rgba (analysis.sample, decoded, analysis.sampleWidth, analysis.sampleHeight);
+
+      free (encoded);
+
+      if (length < sizeof (log))
+        length += snprintf (log + length, sizeof (log) - length, " %s %.2f dB", candidates[i], psnr);
+
+      if (psnr > bestPSNR)
+        {
+          chosen = candidates[i];
+          bestPSNR = psnr;
+        }
+
+      if (psnr >= Texture_psnrBudget)
+        break;
+    }
+
+  free (decoded);
+  free (analysis.sample);
+
+  fprintf (stderr, "%s; using %s\n", log, chosen);
+
+  return Texture_SetupFormat (header, codec, chosen, path, analysis.alpha,
+                              width, height, threads, NULL, error, errorSize);
+}
+
+/* A conversion read from a batch manifest */
+struct Texture_Job
+{
+  char *input;
+  char *output;
+  char *format;
+
+  unsigned int index;
+
+  /* Size from the PNG header, so that large images can be started first */
+  uint64_t pixels;
+
+  double queued;
 };
 
+/* Jobs not yet started, as a binary heap with the most pixels on top */
+static struct Texture_Job *Texture_pending;
+static size_t Texture_pendingCount, Texture_pendingAlloc;
+
+static unsigned int Texture_jobCount, Texture_finishedCount, Texture_failedCount;
+static int Texture_manifestClosed;
+static mode_t Texture_umask;
+
+/* Returns the pixel count stored in the IHDR chunk of a PNG file, or 0 if
+ * the file can't be read */
+static uint64_t
+Texture_PeekPixels (const char *path)
+{
+  unsigned char buffer[24];
+  FILE *file;
+  size_t size;
+
+  if (!(file = fopen (path, "rb")))
+    return 0;
+
+  size = fread (buffer, 1, sizeof (buffer), file);
+
+  fclose (file);
+
+  if (size < sizeof (buffer)
+      || memcmp (buffer, "\x89PNG", 4) || memcmp (buffer + 12, "IHDR", 4))
+    return 0;
+
+  return (uint64_t) ((buffer[16] << 24) | (buffer[17] << 16) | (buffer[18] << 8) | buffer[19])
+         * ((buffer[20] << 24) | (buffer[21] << 16) | (buffer[22] << 8) | buffer[23]);
+}
+
+static void
+Texture_PrintString (const char *string)
+{
+  putchar ('"');
+
+  for (; *string; ++string)
+    {
+      if (*string == '"' || *string == '\\')
+        printf ("\\%c", *string);
+      else if ((unsigned char) *string < 0x20)
+        printf ("\\u%04x", *string);
+      else
+        putchar (*string);
+    }
+
+  putchar ('"');
+}
+
+/* Prints one line of JSON describing a finished job, or a failed one if
+ * `error' is set */
+static void
+Texture_Report (const struct Texture_Job *job, const char *error,
+                const PVRTextureHeaderV3 *header, const struct Texture_Codec *codec, long size,
+                double wait, double load, double encode)
+{
+  pthread_mutex_lock (&Texture_batchMutex);
+
+  ++Texture_finishedCount;
+
+  if (error)
+    ++Texture_failedCount;
+
+  printf ("{\"event\":\"%s\",\"job\":%u,\"input\":", error ? "error" : "done", job->index);
+  Texture_PrintString (job->input);
+
+  if (job->output)
+    {
+      printf (",\"output\":");
+      Texture_PrintString (job->output);
+    }
+
+  if (error)
+    {
+      printf (",\"message\":");
+      Texture_PrintString (error);
+    }
+  else
+    printf (",\"format\":\"%s\",\"width\":%u,\"height\":%u,\"levels\":%u,\"bytes\":%ld,"
+            "\"wait-ms\":%.1f,\"load-ms\":%.1f,\"encode-ms\":%.1f",
+            codec->name, header->u32Width, header->u32Height, header->u32MIPMapCount, size,
+            wait * 1.0e3, load * 1.0e3, encode * 1.0e3);
+
+  printf (",\"finished\":%u,\"total\":%u}\n", Texture_finishedCount, Texture_jobCount);
+  fflush (stdout);
+
+  pthread_mutex_unlock (&Texture_batchMutex);
+}
+
+/* Converts one image, writing to a temporary file that replaces the output
+ * only when complete */
+static void
+Texture_RunJob (const struct Texture_Job *job)
+{
+  PVRTextureHeaderV3 header;
+  struct Texture_Codec codec;
+  struct png_stream *input;
+  unsigned int width, height;
+  char error[256], *tmpPath;
+  double start, wait, load;
+  FILE *file;
+  long size;
+  int fd;
+
+  start = Texture_Now ();
+  wait = start - job->queued;
+
+  if (!(input = png_stream_open (job->input, &width, &height, NULL)))
+    {
+      Texture_Report (job, "Failed to open PNG image", 0, 0, 0, 0.0, 0.0, 0.0);
+
+      return;
+    }
+
+  /* Decoding is interleaved with encoding, so load time is the header,
+   * the analysis passes and every png_stream_read added up */
+
+  load = Texture_Now () - start;
+
+  /* Jobs run in parallel, so each is encoded on a single thread */
+
+  if (Texture_Setup (&header, &codec, job->format, job->input,
+                     width, height, 1, &load, error, sizeof (error)))
+    {
+      Texture_Report (job, error, 0, 0, 0, 0.0, 0.0, 0.0);
+      png_stream_close (input);
+
+      return;
+    }
+
+  if (!(tmpPath = (char *) malloc (strlen (job->output) + sizeof (".XXXXXX"))))
+    err (EX_OSERR, "malloc failed");
+
+  strcpy (tmpPath, job->output);
+  strcat (tmpPath, ".XXXXXX");
+
+  if (-1 == (fd = mkstemp (tmpPath)))
+    {
+      snprintf (error, sizeof (error), "Failed to create `%s': %s", tmpPath, strerror (errno));
+      Texture_Report (job, error, 0, 0, 0, 0.0, 0.0, 0.0);
+      free (tmpPath);
+      png_stream_close (input);
+
+      return;
+    }
+
+  fchmod (fd, 0666 & ~Texture_umask);
+
+  if (!(file = fdopen (fd, "wb")))
+    err (EX_OSERR, "fdopen failed");
+
+  if (-1 == Texture_WriteLevels (file, &header, input, width, height, &codec, &load))
+    {
+      fclose (file);
+      unlink (tmpPath);
+      Texture_Report (job, "PNG decoding failed", 0, 0, 0, 0.0, 0.0, 0.0);
+      free (tmpPath);
+      png_stream_close (input);
+
+      return;
+    }
+
+  size = ftell (file);
+
+  if (ferror (file) | fclose (file))
+    {
+      snprintf (error, sizeof (error), "Failed to write `%s': %s", tmpPath, strerror (errno));
+      unlink (tmpPath);
+      Texture_Report (job, error, 0, 0, 0, 0.0, 0.0, 0.0);
+    }
+  else if (-1 == rename (tmpPath, job->output))
+    {
+      snprintf (error, sizeof (error), "Failed to rename `%s': %s", tmpPath, strerror (errno));
+      unlink (tmpPath);
+      Texture_Report (job, error, 0, 0, 0, 0.0, 0.0, 0.0);
+    }
+  else
+    Texture_Report (job, 0, &header, &codec, size, wait, load, Texture_Now () - start - load);
+
+  free (tmpPath);
+  png_stream_close (input);
+}
+
+static void
+Texture_FreeJob (struct Texture_Job *job)
+{
+  free (job->input);
+  free (job->output);
+  free (job->format);
+}
+
+/* Adds a job to the heap of pending jobs.  The caller holds the batch
+ * mutex.  */
+static void
+Texture_PushJob (const struct Texture_Job *job)
+{
+  size_t i, parent;
+
+  if (Texture_pendingCount == Texture_pendingAlloc)
+    {
+      Texture_pendingAlloc = Texture_pendingAlloc ? Texture_pendingAlloc * 2 : 64;
+
+      if (!(Texture_pending = (struct Texture_Job *) realloc (Texture_pending, Texture_pendingAlloc * sizeof (*Texture_pending))))
+        err (EX_OSERR, "realloc failed");
+    }
+
+  for (i = Texture_pendingCount++; i > 0; i = parent)
+    {
+      parent = (i - 1) / 2;
+
+      if (Texture_pending[parent].pixels >= job->pixels)
+        break;
+
+      Texture_pending[i] = Texture_pending[parent];
+    }
+
+  Texture_pending[i] = *job;
+}
+
+/* Removes the largest pending job.  The caller holds the batch mutex.  */
+static void
+Texture_PopJob (struct Texture_Job *job)
+{
+  struct Texture_Job last;
+  size_t i, child;
+
+  *job = Texture_pending[0];
+  last = Texture_pending[--Texture_pendingCount];
+
+  for (i = 0; (child = i * 2 + 1) < Texture_pendingCount; i = child)
+    {
+      if (child + 1 < Texture_pendingCount
+          && Texture_pending[child + 1].pixels > Texture_pending[child].pixels)
+        ++child;
+
+      if (last.pixels >= Texture_pending[child].pixels)
+        break;
+
+      Texture_pending[i] = Texture_pending[child];
+    }
+
+  Texture_pending[i] = last;
+}
+
+/* Queues the jobs in a manifest, one per line: an input PNG, an output path
+ * and optionally a format, separated by tabs.  Empty lines and lines
+ * starting with `#' are ignored.  */
+static void
+Texture_ReadManifest (FILE *manifest)
+{
+  char *line = NULL;
+  size_t lineAlloc = 0;
+  ssize_t length;
+
+  while (-1 != (length = getline (&line, &lineAlloc, manifest)))
+    {
+      struct Texture_Job job;
+      char *fields[3];
+      unsigned int fieldCount = 0;
+      char *ch;
+
+      while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+        line[--length] = 0;
+
+      if (!length || line[0] == '#')
+        continue;
+
+      for (ch = line; fieldCount < 3; ++ch)
+        {
+          fields[fieldCount++] = ch;
+
+          if (!(ch = strchr (ch, '\t')))
+            break;
+
+          *ch = 0;
+        }
+
+      memset (&job, 0, sizeof (job));
+
+      if (!(job.input = strdup (fields[0]))
+          || (fieldCount > 1 && !(job.output = strdup (fields[1])))
+          || !(job.format = strdup ((fieldCount > 2) ? fields[2] : Texture_format)))
+        err (EX_OSERR, "strdup failed");
+
+      job.pixels = Texture_PeekPixels (job.input);
+
+      pthread_mutex_lock (&Texture_batchMutex);
+
+      job.index = Texture_jobCount++;
+      job.queued = Texture_Now ();
+
+      pthread_mutex_unlock (&Texture_batchMutex);
+
+      if (fieldCount < 2)
+        {
+          Texture_Report (&job, "Expected an input and an output path separated by a tab",
+                          0, 0, 0, 0.0, 0.0, 0.0);
+          Texture_FreeJob (&job);
+
+          continue;
+        }
+
+      pthread_mutex_lock (&Texture_batchMutex);
+
+      Texture_PushJob (&job);
+      pthread_cond_signal (&Texture_batchCond);
+
+      pthread_mutex_unlock (&Texture_batchMutex);
+    }
+
+  if (ferror (manifest))
+    err (EXIT_FAILURE, "Error reading job list");
+
+  free (line);
+
+  pthread_mutex_lock (&Texture_batchMutex);
+
+  Texture_manifestClosed = 1;
+  pthread_cond_broadcast (&Texture_batchCond);
+
+  pthread_mutex_unlock (&Texture_batchMutex);
+}
+
+/* Runs pending jobs until the manifest is closed and none are left.  In
+ * daemon mode, thread 0 reads the manifest instead.  */
+static void
+Texture_BatchThread (void *arg, unsigned int thread)
+{
+  struct Texture_Job job;
+
+  if (Texture_daemon && !thread)
+    {
+      Texture_ReadManifest ((FILE *) arg);
+
+      return;
+    }
+
+  for (;;)
+    {
+      pthread_mutex_lock (&Texture_batchMutex);
+
+      while (!Texture_pendingCount && !Texture_manifestClosed)
+        pthread_cond_wait (&Texture_batchCond, &Texture_batchMutex);
+
+      if (!Texture_pendingCount)
+        {
+          pthread_mutex_unlock (&Texture_batchMutex);
+
+          break;
+        }
+
+      Texture_PopJob (&job);
+
+      pthread_mutex_unlock (&Texture_batchMutex);
+
+      Texture_RunJob (&job);
+      Texture_FreeJob (&job);
+    }
+}
+
+/* Converts the images listed in a manifest on a pool of worker threads,
+ * largest first.  In daemon mode, conversion starts as soon as each line
+ * is read, and stops when the manifest is closed.  Otherwise the whole
+ * manifest is read first.  Returns the process exit status.  */
+static int
+Texture_RunBatch (FILE *manifest)
+{
+  double start;
+
+  start = Texture_Now ();
+
+  Texture_umask = umask (0);
+  umask (Texture_umask);
+
+  if (Texture_daemon)
+    texture_run_threads (Texture_jobs + 1, Texture_BatchThread, manifest);
+  else
+    {
+      Texture_ReadManifest (manifest);
+      texture_run_threads (Texture_jobs, Texture_BatchThread, manifest);
+    }
+
+  printf ("{\"event\":\"finished\",\"total\":%u,\"failed\":%u,\"elapsed-ms\":%.1f}\n",
+          Texture_jobCount, Texture_failedCount, (Texture_Now () - start) * 1.0e3);
+
+  free (Texture_pending);
+
+  return Texture_failedCount ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int
 main (int argc, char **argv)
 {
-  void *input, *output;
-  unsigned int width, height, output_size;
-  int use2bit = 1;
+  PVRTextureHeaderV3 header;
+  struct Texture_Codec codec;
+  struct png_stream *input;
+  unsigned int width, height;
+  char error[256];
 
   int i;
 
-  while (-1 != (i = getopt_long (argc, argv, "", Texture_longOptions, NULL)))
+  while (-1 != (i = getopt_long (argc, argv, "f:j:q:", Texture_longOptions, NULL)))
     {
       switch (i)
         {
@@ -67,6 +1365,55 @@ main (int argc, char **argv)
 
           break;
 
+        case 'j':
+
+          Texture_jobs = strtol (optarg, 0, 0);
+
+          if (Texture_jobs <= 0)
+            errx (EX_USAGE, "Job count must be positive");
+
+          break;
+
+        case 'q':
+
+          Texture_quality = strtol (optarg, 0, 0);
+
+          break;
+
+        case 'M':
+
+          if (!strcmp (optarg, "box"))
+            Texture_mipmapFilter = TEXTURE_MIP_BOX;
+          else if (!strcmp (optarg, "kaiser"))
+            Texture_mipmapFilter = TEXTURE_MIP_KAISER;
+          else if (!strcmp (optarg, "lanczos"))
+            Texture_mipmapFilter = TEXTURE_MIP_LANCZOS;
+          else
+            errx (EX_USAGE, "Unknown mipmap filter '%s'", optarg);
+
+          break;
+
+        case 'B':
+
+          Texture_batchPath = optarg;
+
+          break;
+
+        case 'P':
+
+          Texture_psnrBudget = strtod (optarg, 0);
+
+          break;
+
+        case 'A':
+
+          Texture_alphaCutoff = strtod (optarg, 0);
+
+          if (Texture_alphaCutoff <= 0.0f || Texture_alphaCutoff >= 1.0f)
+            errx (EX_USAGE, "Alpha coverage cutoff must be between 0 and 1");
+
+          break;
+
         case '?':
 
           fprintf (stderr, "Try `%s --help' for more information.\n", argv[0]);
@@ -79,12 +1426,44 @@ main (int argc, char **argv)
     {
       fprintf (stdout,
               "Usage: %s [OPTION]... IMAGE\n"
+              "  or:  %s [OPTION]... --batch=FILE\n"
+              "  or:  %s [OPTION]... --daemon\n"
               "\n"
               "  -f, --format=FORMAT      set output format (%s)\n"
+              "                           pvrtc (2 bits per pixel), pvrtc4, etc1, etc2,\n"
+              "                           bc1, bc3, bc7, or pvrtc-auto, etc-auto, bc-auto\n"
+              "                           to pick the smallest format of the family that\n"
+              "                           suits the image's alpha and meets --psnr\n"
+              "  -j, --jobs=COUNT         use COUNT threads (default: one per CPU)\n"
+              "  -q, --quality=LEVEL      refine PVRTC and BC colours LEVEL times\n"
+              "                           (default: %u);\n"
+              "                           ETC searches fast (0), medium (1) or high (2+)\n"
+              "      --psnr=DB            quality the automatic formats aim for (default:\n"
+              "                           %.0f dB), over all four channels, as --verify\n"
+              "                           reports it\n"
+              "      --verify             decode each level and report its PSNR\n"
+              "      --libpvrtc           encode PVRTC with the prebuilt libPVRTC at\n"
+              "                           quality LEVEL (at most 4), single threaded\n"
+              "      --mipmap-filter=FILTER  filter mipmaps with box, kaiser (default)\n"
+              "                           or lanczos\n"
+              "      --linear             filter colours as linear values, not sRGB, for\n"
+              "                           normal maps and other data\n"
+              "      --alpha-coverage=CUTOFF  keep the fraction of pixels with alpha\n"
+              "                           above CUTOFF (e.g. 0.5) the same in every mipmap\n"
+              "      --batch=FILE         convert the jobs listed in FILE (- for standard\n"
+              "                           input), largest image first\n"
+              "      --daemon             convert jobs as they are read from standard input,\n"
+              "                           until it is closed\n"
               "      --help     display this help and exit\n"
               "      --version  display version information\n"
               "\n"
-              "Report bugs to <morten.hustveit@gmail.com>\n", argv[0], Texture_format);
+              "A single IMAGE is converted to standard output.  Each line of\n"
+              "a job list holds an input PNG, an output path and optionally a format,\n"
+              "separated by tabs.  Jobs run in parallel, and a line of JSON is written\n"
+              "to standard output as each one finishes.\n"
+              "\n"
+              "Report bugs to <morten.hustveit@gmail.com>\n", argv[0], argv[0], argv[0],
+              Texture_format, Texture_quality, Texture_psnrBudget);
 
       return EXIT_SUCCESS;
     }
@@ -96,46 +1475,38 @@ main (int argc, char **argv)
       return EXIT_SUCCESS;
     }
 
-  if (optind + 1 != argc)
-    errx (EX_USAGE, "Usage: %s [OPTION]... IMAGE", argv[0]);
+  if (!Texture_jobs && 0 >= (Texture_jobs = sysconf (_SC_NPROCESSORS_ONLN)))
+    Texture_jobs = 1;
 
-  if (-1 == png_load (argv[optind], &input, &width, &height))
-    errx (EXIT_FAILURE, "png_load failed");
-
-  if (!strcmp (Texture_format, "pvrtc"))
+  if (Texture_batchPath || Texture_daemon)
     {
-      struct TEXTURE_PVRTCHeader header;
-      int fdNull, stdoutBackup;
+      FILE *manifest;
 
-      output_size = pvrtc_size (width, height, 1 /* mip map */, use2bit);
+      if (optind != argc)
+        errx (EX_USAGE, "Usage: %s [OPTION]... --batch=FILE", argv[0]);
 
-      output = malloc (output_size);
+      if (!Texture_batchPath || !strcmp (Texture_batchPath, "-"))
+        manifest = stdin;
+      else if (!(manifest = fopen (Texture_batchPath, "r")))
+        err (EXIT_FAILURE, "Failed to open `%s' for reading", Texture_batchPath);
 
-      /* Hack to quench pvrtc_compress' progress reports */
-      fdNull = open ("/dev/null", O_WRONLY);
-      stdoutBackup = dup (1);
-      dup2 (fdNull, 1);
-      close (fdNull);
+      return Texture_RunBatch (manifest);
+    }
 
-      pvrtc_info_output (NULL);
-      pvrtc_compress (input, output, width, height,
-                      1 /* mip map */,
-                      1 /* alpha on */,
-                      use2bit,
-                      0 /* quality (0-4) */);
+  if (optind + 1 != argc)
+    errx (EX_USAGE, "Usage: %s [OPTION]... IMAGE", argv[0]);
 
-      dup2 (stdoutBackup, 1);
+  if (!(input = png_stream_open (argv[optind], &width, &height, NULL)))
+    errx (EXIT_FAILURE, "Failed to open PNG image");
 
-      memset (&header, 0, sizeof (header));
-      header.width = width;
-      header.height = height;
+  if (Texture_Setup (&header, &codec, Texture_format, argv[optind],
+                     width, height, Texture_jobs, NULL, error, sizeof (error)))
+    errx (EXIT_FAILURE, "%s", error);
 
-      fwrite (&header, 1, sizeof (header), stdout);
-    }
-  else
-    err (EX_USAGE, "Unknown format '%s'", Texture_format);
+  if (-1 == Texture_WriteLevels (stdout, &header, input, width, height, &codec, NULL))
+    errx (EXIT_FAILURE, "Failed to convert `%s'", argv[optind]);
 
-  fwrite (output, 1, output_size, stdout);
+  png_stream_close (input);
 
   return EXIT_SUCCESS;
 }
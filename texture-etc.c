@@ -0,0 +1,1499 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <limits.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "texture.h"
+
+/* An ETC block encodes 4x4 pixels in 64 bits.  In the ETC1 modes, the block
+ * is split into two halves of 2x4 or (flipped) 4x2 pixels, each with a base
+ * colour and a table of four offsets added to all channels.  The base
+ * colours are stored either as two 4 bit colours ("individual" mode), or as
+ * a 5 bit colour and a 3 bit difference ("differential" mode).
+ *
+ * ETC2 reuses differential blocks whose difference overflows a channel for
+ * three more modes: T and H, which paint pixels with one of four colours
+ * derived from two base colours, and planar, which interpolates three
+ * colours.  ETC2 RGBA adds a 64 bit EAC alpha block before each colour
+ * block.
+ *
+ * Bits are numbered as in the specification, with bit 63 being the most
+ * significant bit of the first byte.  Pixel `i' of a block is at x = i / 4,
+ * y = i % 4.  */
+
+#define TEXTURE_ETC_BLOCK_SIZE 4
+
+static const int texture_etc_tables[8][4] =
+{
+  {  2,   8,  -2,   -8 },
+  {  5,  17,  -5,  -17 },
+  {  9,  29,  -9,  -29 },
+  { 13,  42, -13,  -42 },
+  { 18,  60, -18,  -60 },
+  { 24,  80, -24,  -80 },
+  { 33, 106, -33, -106 },
+  { 47, 183, -47, -183 }
+};
+
+/* Distances of the T and H modes */
+static const int texture_etc_distances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+static const int texture_etc_alpha_tables[16][8] =
+{
+  { -3, -6,  -9, -15, 2, 5, 8, 14 },
+  { -3, -7, -10, -13, 2, 6, 9, 12 },
+  { -2, -5,  -8, -13, 1, 4, 7, 12 },
+  { -2, -4,  -6, -13, 1, 3, 5, 12 },
+  { -3, -6,  -8, -12, 2, 5, 7, 11 },
+  { -3, -7,  -9, -11, 2, 6, 8, 10 },
+  { -4, -7,  -8, -11, 3, 6, 7, 10 },
+  { -3, -5,  -8, -11, 2, 4, 7, 10 },
+  { -2, -6,  -8, -10, 1, 5, 7,  9 },
+  { -2, -5,  -8, -10, 1, 4, 7,  9 },
+  { -2, -4,  -8, -10, 1, 3, 7,  9 },
+  { -2, -5,  -7, -10, 1, 4, 6,  9 },
+  { -3, -4,  -7, -10, 2, 3, 6,  9 },
+  { -1, -2,  -3, -10, 0, 1, 2,  9 },
+  { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+  { -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+/* Neighbours of a colour tried when refining base colours */
+static const int texture_etc_steps[26][3] =
+{
+  { -1,  0,  0 }, { 1, 0, 0 }, { 0, -1,  0 }, { 0, 1, 0 }, {  0,  0, -1 }, { 0, 0, 1 },
+  { -1, -1,  0 }, { -1, 1, 0 }, { 1, -1,  0 }, { 1, 1, 0 },
+  { -1,  0, -1 }, { -1, 0, 1 }, { 1,  0, -1 }, { 1, 0, 1 },
+  {  0, -1, -1 }, { 0, -1, 1 }, { 0,  1, -1 }, { 0, 1, 1 },
+  { -1, -1, -1 }, { -1, -1, 1 }, { -1, 1, -1 }, { -1, 1, 1 },
+  {  1, -1, -1 }, { 1, -1, 1 }, { 1, 1, -1 }, { 1, 1, 1 }
+};
+
+struct texture_etc_block
+{
+  /* Pixels in the block's column major order */
+  int rgb[16][3];
+  int alpha[16];
+
+  /* Channels of each half of the block, by flip bit */
+  float half[2][2][3][8];
+  unsigned char halfPixels[2][2][8];
+};
+
+struct texture_etc_encoder
+{
+  const struct texture_etc_options *options;
+  const unsigned char *argb;
+  unsigned int width, height;
+  unsigned int blocksX, blocksY;
+  unsigned int threads;
+  unsigned char *output;
+};
+
+struct texture_etc_decoder
+{
+  const unsigned char *input;
+  unsigned char *rgba;
+  unsigned int width, height;
+  unsigned int blocksX, blocksY;
+  enum texture_etc_format format;
+};
+
+static int
+texture_etc_clamp (int value)
+{
+  return (value < 0) ? 0 : (value > 255) ? 255 : value;
+}
+
+/* Expands a colour channel of `bits' bits to 8 bits */
+static int
+texture_etc_expand (int value, unsigned int bits)
+{
+  return (value << (8 - bits)) | (value >> (2 * bits - 8));
+}
+
+/* Returns the `bits' bit value whose expansion is closest to `value' */
+static int
+texture_etc_quantize (float value, unsigned int bits)
+{
+  int max, guess, i, best = 0;
+  float bestError = 1.0e9f;
+
+  max = (1 << bits) - 1;
+  guess = (int) (value * max / 255.0f + 0.5f);
+
+  for (i = guess - 1; i <= guess + 1; ++i)
+    {
+      float error;
+
+      if (i < 0 || i > max)
+        continue;
+
+      error = texture_etc_expand (i, bits) - value;
+      error *= error;
+
+      if (error < bestError)
+        {
+          bestError = error;
+          best = i;
+        }
+    }
+
+  return best;
+}
+
+static unsigned int
+texture_etc_distance (const int *a, const int *b)
+{
+  int dr, dg, db;
+
+  dr = a[0] - b[0];
+  dg = a[1] - b[1];
+  db = a[2] - b[2];
+
+  return dr * dr + dg * dg + db * db;
+}
+
+static int
+texture_etc_signed3 (unsigned int value)
+{
+  return (value & 4) ? (int) value - 8 : (int) value;
+}
+
+static void
+texture_etc_put (uint64_t *bits, unsigned int shift, unsigned int width, uint64_t value)
+{
+  *bits |= (value & ((1u << width) - 1)) << shift;
+}
+
+static unsigned int
+texture_etc_get (uint64_t bits, unsigned int shift, unsigned int width)
+{
+  return (bits >> shift) & ((1u << width) - 1);
+}
+
+static void
+texture_etc_load_block (struct texture_etc_block *block,
+                        const struct texture_etc_encoder *encoder,
+                        unsigned int bx, unsigned int by)
+{
+  unsigned int i, flip, half, count[2][2] = { { 0, 0 }, { 0, 0 } };
+
+  for (i = 0; i < 16; ++i)
+    {
+      const unsigned char *pixel;
+      unsigned int x, y;
+
+      /* Blocks on the right and bottom edges repeat the last pixels */
+
+      x = bx * TEXTURE_ETC_BLOCK_SIZE + i / 4;
+      y = by * TEXTURE_ETC_BLOCK_SIZE + i % 4;
+
+      if (x >= encoder->width)
+        x = encoder->width - 1;
+
+      if (y >= encoder->height)
+        y = encoder->height - 1;
+
+      pixel = encoder->argb + 4 * ((size_t) y * encoder->width + x);
+
+      block->alpha[i] = pixel[0];
+      block->rgb[i][0] = pixel[1];
+      block->rgb[i][1] = pixel[2];
+      block->rgb[i][2] = pixel[3];
+
+      for (flip = 0; flip < 2; ++flip)
+        {
+          unsigned int c, n;
+
+          half = flip ? ((i % 4) >= 2) : ((i / 4) >= 2);
+          n = count[flip][half]++;
+
+          block->halfPixels[flip][half][n] = i;
+
+          for (c = 0; c < 3; ++c)
+            block->half[flip][half][c][n] = block->rgb[i][c];
+        }
+    }
+}
+
+/* Returns the squared error of half a block with the given base colour and
+ * offset table, clamping the offset colours.  */
+static unsigned int
+texture_etc_clamped_error (const float (*pixels)[8], const int *base, unsigned int t)
+{
+  unsigned int error, k;
+
+#if defined(__SSE2__)
+  __m128 min0, min1, sum;
+  float tmp[4];
+
+  min0 = min1 = _mm_set1_ps (1.0e9f);
+
+  for (k = 0; k < 4; ++k)
+    {
+      __m128 r, g, b, d0, d1, e0, e1;
+      int offset;
+
+      offset = texture_etc_tables[t][k];
+
+      r = _mm_set1_ps (texture_etc_clamp (base[0] + offset));
+      g = _mm_set1_ps (texture_etc_clamp (base[1] + offset));
+      b = _mm_set1_ps (texture_etc_clamp (base[2] + offset));
+
+      d0 = _mm_sub_ps (r, _mm_loadu_ps (pixels[0]));
+      d1 = _mm_sub_ps (r, _mm_loadu_ps (pixels[0] + 4));
+      e0 = _mm_mul_ps (d0, d0);
+      e1 = _mm_mul_ps (d1, d1);
+
+      d0 = _mm_sub_ps (g, _mm_loadu_ps (pixels[1]));
+      d1 = _mm_sub_ps (g, _mm_loadu_ps (pixels[1] + 4));
+      e0 = _mm_add_ps (e0, _mm_mul_ps (d0, d0));
+      e1 = _mm_add_ps (e1, _mm_mul_ps (d1, d1));
+
+      d0 = _mm_sub_ps (b, _mm_loadu_ps (pixels[2]));
+      d1 = _mm_sub_ps (b, _mm_loadu_ps (pixels[2] + 4));
+      e0 = _mm_add_ps (e0, _mm_mul_ps (d0, d0));
+      e1 = _mm_add_ps (e1, _mm_mul_ps (d1, d1));
+
+      min0 = _mm_min_ps (min0, e0);
+      min1 = _mm_min_ps (min1, e1);
+    }
+
+  sum = _mm_add_ps (min0, min1);
+  _mm_storeu_ps (tmp, sum);
+
+  error = (unsigned int) (tmp[0] + tmp[1] + tmp[2] + tmp[3]);
+#else
+  unsigned int i;
+
+  error = 0;
+
+  for (i = 0; i < 8; ++i)
+    {
+      unsigned int best = UINT_MAX;
+
+      for (k = 0; k < 4; ++k)
+        {
+          int color[3], pixel[3], offset;
+          unsigned int e;
+
+          offset = texture_etc_tables[t][k];
+
+          color[0] = texture_etc_clamp (base[0] + offset);
+          color[1] = texture_etc_clamp (base[1] + offset);
+          color[2] = texture_etc_clamp (base[2] + offset);
+
+          pixel[0] = pixels[0][i];
+          pixel[1] = pixels[1][i];
+          pixel[2] = pixels[2][i];
+
+          if ((e = texture_etc_distance (color, pixel)) < best)
+            best = e;
+        }
+
+      error += best;
+    }
+#endif
+
+  return error;
+}
+
+/* Returns the squared error of half a block with the given base colour,
+ * using the best of the eight offset tables, which is stored in `table'.
+ *
+ * While no offset colour is clamped, the error of offset `o' for a pixel
+ * whose difference from the base colour has squared length `d' and channel
+ * sum `s' is d - 2os + 3o^2.  The tables hold offsets in pairs of +o and -o,
+ * so each pair contributes at best d - 2o|s| + 3o^2, and the per pixel sums
+ * are shared by all tables.  */
+static unsigned int
+texture_etc_half_error (const float (*pixels)[8], const int *base, unsigned int *table)
+{
+  unsigned int t, bestError = UINT_MAX;
+  int low, high;
+
+#if defined(__SSE2__)
+  __m128 s0, s1, d, signMask;
+  float tmp[4];
+
+  signMask = _mm_castsi128_ps (_mm_set1_epi32 (0x7fffffff));
+  s0 = s1 = d = _mm_setzero_ps ();
+
+  for (t = 0; t < 3; ++t)
+    {
+      __m128 base4, d0, d1;
+
+      base4 = _mm_set1_ps (base[t]);
+      d0 = _mm_sub_ps (_mm_loadu_ps (pixels[t]), base4);
+      d1 = _mm_sub_ps (_mm_loadu_ps (pixels[t] + 4), base4);
+
+      s0 = _mm_add_ps (s0, d0);
+      s1 = _mm_add_ps (s1, d1);
+      d = _mm_add_ps (d, _mm_add_ps (_mm_mul_ps (d0, d0), _mm_mul_ps (d1, d1)));
+    }
+
+  s0 = _mm_and_ps (s0, signMask);
+  s1 = _mm_and_ps (s1, signMask);
+#else
+  float s[8], d = 0.0f;
+  unsigned int i, c;
+
+  for (i = 0; i < 8; ++i)
+    {
+      s[i] = 0.0f;
+
+      for (c = 0; c < 3; ++c)
+        {
+          float delta;
+
+          delta = pixels[c][i] - base[c];
+          s[i] += delta;
+          d += delta * delta;
+        }
+
+      s[i] = (s[i] < 0.0f) ? -s[i] : s[i];
+    }
+#endif
+
+  low = base[0];
+  high = base[0];
+
+  for (t = 1; t < 3; ++t)
+    {
+      if (base[t] < low) low = base[t];
+      if (base[t] > high) high = base[t];
+    }
+
+  for (t = 0; t < 8; ++t)
+    {
+      unsigned int error;
+      int a, b;
+
+      a = texture_etc_tables[t][0];
+      b = texture_etc_tables[t][1];
+
+      if (low - b < 0 || high + b > 255)
+        {
+          error = texture_etc_clamped_error (pixels, base, t);
+        }
+      else
+        {
+#if defined(__SSE2__)
+          __m128 a2, b2, a3, b3, e;
+
+          a2 = _mm_set1_ps (-2.0f * a);
+          b2 = _mm_set1_ps (-2.0f * b);
+          a3 = _mm_set1_ps (3.0f * a * a);
+          b3 = _mm_set1_ps (3.0f * b * b);
+
+          e = _mm_add_ps (_mm_min_ps (_mm_add_ps (a3, _mm_mul_ps (a2, s0)),
+                                      _mm_add_ps (b3, _mm_mul_ps (b2, s0))),
+                          _mm_min_ps (_mm_add_ps (a3, _mm_mul_ps (a2, s1)),
+                                      _mm_add_ps (b3, _mm_mul_ps (b2, s1))));
+          e = _mm_add_ps (e, d);
+          _mm_storeu_ps (tmp, e);
+
+          error = (unsigned int) (tmp[0] + tmp[1] + tmp[2] + tmp[3]);
+#else
+          float sum = d;
+
+          for (i = 0; i < 8; ++i)
+            {
+              float ea, eb;
+
+              ea = 3.0f * a * a - 2.0f * a * s[i];
+              eb = 3.0f * b * b - 2.0f * b * s[i];
+              sum += (ea < eb) ? ea : eb;
+            }
+
+          error = (unsigned int) sum;
+#endif
+        }
+
+      if (error < bestError)
+        {
+          bestError = error;
+          *table = t;
+        }
+    }
+
+  return bestError;
+}
+
+static unsigned int
+texture_etc_code_error (const float (*pixels)[8], const int *code, unsigned int bits,
+                        unsigned int *table)
+{
+  int base[3];
+
+  base[0] = texture_etc_expand (code[0], bits);
+  base[1] = texture_etc_expand (code[1], bits);
+  base[2] = texture_etc_expand (code[2], bits);
+
+  return texture_etc_half_error (pixels, base, table);
+}
+
+/* Moves a `bits' bit base colour to neighbouring values while that reduces
+ * the error.  If `anchor' is set, the colour must stay within the range of
+ * a differential colour relative to it.  */
+static unsigned int
+texture_etc_refine (const float (*pixels)[8], int *code, unsigned int bits,
+                    const int *anchor, enum texture_etc_quality quality,
+                    unsigned int *table)
+{
+  unsigned int error, steps, round, i, c, stepTable;
+  int max;
+
+  max = (1 << bits) - 1;
+  error = texture_etc_code_error (pixels, code, bits, table);
+
+  if (quality == TEXTURE_ETC_FAST)
+    return error;
+
+  steps = (quality == TEXTURE_ETC_HIGH) ? 26 : 6;
+
+  for (round = 0; round < 16; ++round)
+    {
+      int best[3];
+      unsigned int bestError = error;
+
+      for (i = 0; i < steps; ++i)
+        {
+          int candidate[3];
+          unsigned int candidateError;
+
+          for (c = 0; c < 3; ++c)
+            {
+              candidate[c] = code[c] + texture_etc_steps[i][c];
+
+              if (candidate[c] < 0 || candidate[c] > max)
+                break;
+
+              if (anchor && (candidate[c] < anchor[c] - 4 || candidate[c] > anchor[c] + 3))
+                break;
+            }
+
+          if (c < 3)
+            continue;
+
+          candidateError = texture_etc_code_error (pixels, candidate, bits, &stepTable);
+
+          if (candidateError < bestError)
+            {
+              bestError = candidateError;
+              memcpy (best, candidate, sizeof (best));
+            }
+        }
+
+      if (bestError == error)
+        break;
+
+      memcpy (code, best, sizeof (best));
+      error = bestError;
+    }
+
+  texture_etc_code_error (pixels, code, bits, table);
+
+  return error;
+}
+
+/* Stores the pixel indices of one half of an ETC1 block */
+static void
+texture_etc_put_half_indices (uint64_t *bits, const struct texture_etc_block *block,
+                              unsigned int flip, unsigned int half,
+                              const int *base, unsigned int table)
+{
+  unsigned int n, k;
+
+  for (n = 0; n < 8; ++n)
+    {
+      unsigned int pixel, best = 0, bestError = UINT_MAX;
+
+      pixel = block->halfPixels[flip][half][n];
+
+      for (k = 0; k < 4; ++k)
+        {
+          int color[3], offset;
+          unsigned int error;
+
+          offset = texture_etc_tables[table][k];
+
+          color[0] = texture_etc_clamp (base[0] + offset);
+          color[1] = texture_etc_clamp (base[1] + offset);
+          color[2] = texture_etc_clamp (base[2] + offset);
+
+          if ((error = texture_etc_distance (color, block->rgb[pixel])) < bestError)
+            {
+              bestError = error;
+              best = k;
+            }
+        }
+
+      /* Most significant index bits in the upper half */
+
+      *bits |= (uint64_t) (best >> 1) << (16 + pixel);
+      *bits |= (uint64_t) (best & 1) << pixel;
+    }
+}
+
+static void
+texture_etc_average (const float (*pixels)[8], float *average)
+{
+  unsigned int c, i;
+
+  for (c = 0; c < 3; ++c)
+    {
+      average[c] = 0.0f;
+
+      for (i = 0; i < 8; ++i)
+        average[c] += pixels[c][i];
+
+      average[c] /= 8.0f;
+    }
+}
+
+/* Finds the best ETC1 encoding of a block */
+static unsigned int
+texture_etc_encode_etc1 (const struct texture_etc_block *block,
+                         enum texture_etc_quality quality, uint64_t *result)
+{
+  unsigned int flip, c, bestError = UINT_MAX;
+
+  for (flip = 0; flip < 2; ++flip)
+    {
+      float average[2][3];
+      int code[2][3], base[2][3];
+      unsigned int table[2], error;
+      uint64_t bits;
+
+      texture_etc_average ((const float (*)[8]) block->half[flip][0], average[0]);
+      texture_etc_average ((const float (*)[8]) block->half[flip][1], average[1]);
+
+      /* Individual mode */
+
+      for (c = 0; c < 3; ++c)
+        {
+          code[0][c] = texture_etc_quantize (average[0][c], 4);
+          code[1][c] = texture_etc_quantize (average[1][c], 4);
+        }
+
+      error = texture_etc_refine ((const float (*)[8]) block->half[flip][0], code[0], 4, 0, quality, &table[0])
+              + texture_etc_refine ((const float (*)[8]) block->half[flip][1], code[1], 4, 0, quality, &table[1]);
+
+      if (error < bestError)
+        {
+          bits = 0;
+
+          for (c = 0; c < 3; ++c)
+            {
+              texture_etc_put (&bits, 60 - 8 * c, 4, code[0][c]);
+              texture_etc_put (&bits, 56 - 8 * c, 4, code[1][c]);
+              base[0][c] = texture_etc_expand (code[0][c], 4);
+              base[1][c] = texture_etc_expand (code[1][c], 4);
+            }
+
+          texture_etc_put (&bits, 37, 3, table[0]);
+          texture_etc_put (&bits, 34, 3, table[1]);
+          texture_etc_put (&bits, 32, 1, flip);
+
+          texture_etc_put_half_indices (&bits, block, flip, 0, base[0], table[0]);
+          texture_etc_put_half_indices (&bits, block, flip, 1, base[1], table[1]);
+
+          bestError = error;
+          *result = bits;
+        }
+
+      /* Differential mode.  When the two halves are too different, either
+       * half may be moved towards the other.  */
+
+      for (c = 0; c < 3; ++c)
+        {
+          code[0][c] = texture_etc_quantize (average[0][c], 5);
+          code[1][c] = texture_etc_quantize (average[1][c], 5);
+        }
+
+      error = texture_etc_refine ((const float (*)[8]) block->half[flip][0], code[0], 5, 0, quality, &table[0])
+              + texture_etc_refine ((const float (*)[8]) block->half[flip][1], code[1], 5, 0, quality, &table[1]);
+
+      for (c = 0; c < 3; ++c)
+        {
+          if (code[1][c] - code[0][c] < -4 || code[1][c] - code[0][c] > 3)
+            break;
+        }
+
+      if (c < 3)
+        {
+          int moved[2][3];
+          unsigned int movedTable[2], movedError[2];
+
+          memcpy (moved, code, sizeof (moved));
+
+          for (c = 0; c < 3; ++c)
+            {
+              if (moved[1][c] < code[0][c] - 4)
+                moved[1][c] = code[0][c] - 4;
+              else if (moved[1][c] > code[0][c] + 3)
+                moved[1][c] = code[0][c] + 3;
+            }
+
+          movedError[1] = texture_etc_code_error ((const float (*)[8]) block->half[flip][0], code[0], 5, &table[0])
+                          + texture_etc_refine ((const float (*)[8]) block->half[flip][1], moved[1], 5, code[0], quality, &movedTable[1]);
+
+          for (c = 0; c < 3; ++c)
+            {
+              if (moved[0][c] < code[1][c] - 3)
+                moved[0][c] = code[1][c] - 3;
+              else if (moved[0][c] > code[1][c] + 4)
+                moved[0][c] = code[1][c] + 4;
+            }
+
+          movedError[0] = texture_etc_code_error ((const float (*)[8]) block->half[flip][0], moved[0], 5, &movedTable[0])
+                          + texture_etc_code_error ((const float (*)[8]) block->half[flip][1], code[1], 5, &table[1]);
+
+          if (movedError[0] < movedError[1])
+            {
+              memcpy (code[0], moved[0], sizeof (code[0]));
+              table[0] = movedTable[0];
+              error = movedError[0];
+            }
+          else
+            {
+              memcpy (code[1], moved[1], sizeof (code[1]));
+              table[1] = movedTable[1];
+              error = movedError[1];
+            }
+        }
+
+      if (error < bestError)
+        {
+          bits = 0;
+
+          for (c = 0; c < 3; ++c)
+            {
+              texture_etc_put (&bits, 59 - 8 * c, 5, code[0][c]);
+              texture_etc_put (&bits, 56 - 8 * c, 3, code[1][c] - code[0][c]);
+              base[0][c] = texture_etc_expand (code[0][c], 5);
+              base[1][c] = texture_etc_expand (code[1][c], 5);
+            }
+
+          texture_etc_put (&bits, 37, 3, table[0]);
+          texture_etc_put (&bits, 34, 3, table[1]);
+          texture_etc_put (&bits, 33, 1, 1);
+          texture_etc_put (&bits, 32, 1, flip);
+
+          texture_etc_put_half_indices (&bits, block, flip, 0, base[0], table[0]);
+          texture_etc_put_half_indices (&bits, block, flip, 1, base[1], table[1]);
+
+          bestError = error;
+          *result = bits;
+        }
+    }
+
+  return bestError;
+}
+
+/* Sets filler bit `bit' so that the 5 bit value at `shift' plus the signed
+ * 3 bit value below it stays within 0 to 31.  */
+static void
+texture_etc_avoid_overflow (uint64_t *bits, unsigned int shift, unsigned int bit)
+{
+  int sum;
+
+  sum = texture_etc_get (*bits, shift + 3, 5) + texture_etc_signed3 (texture_etc_get (*bits, shift, 3));
+
+  if (sum < 0)
+    *bits |= (uint64_t) 1 << bit;
+}
+
+/* Sets the filler bits of a 5 bit value at `shift' plus the signed 3 bit
+ * value below it so that their sum overflows, which selects one of the
+ * ETC2 modes.  Bits `shift' + 5 to `shift' + 7 and `shift' + 2 must be
+ * fillers.  */
+static void
+texture_etc_force_overflow (uint64_t *bits, unsigned int shift)
+{
+  unsigned int high, low;
+
+  high = texture_etc_get (*bits, shift + 3, 2);
+  low = texture_etc_get (*bits, shift, 2);
+
+  if (high + low >= 4)
+    *bits |= (uint64_t) 7 << (shift + 5);
+  else
+    *bits |= (uint64_t) 1 << (shift + 2);
+}
+
+/* Returns the planar mode colour of a channel at a pixel */
+static int
+texture_etc_planar (int o, int h, int v, unsigned int x, unsigned int y)
+{
+  return texture_etc_clamp ((int) (x * (h - o) + y * (v - o) + 4 * o + 2) >> 2);
+}
+
+/* Finds the best ETC2 planar encoding of a block.  The three colours are
+ * fitted per channel by least squares, and the neighbouring quantized
+ * values are searched.  */
+static unsigned int
+texture_etc_encode_planar (const struct texture_etc_block *block, uint64_t *result)
+{
+  static const unsigned int channelBits[3] = { 6, 7, 6 };
+  int codes[3][3];
+  unsigned int c, i, error = 0;
+  uint64_t bits = 0;
+
+  for (c = 0; c < 3; ++c)
+    {
+      float mean = 0.0f, dx = 0.0f, dy = 0.0f, o, h, v;
+      int guess[3], best[3] = { 0, 0, 0 }, delta[3], expanded[3];
+      unsigned int bestError = UINT_MAX;
+
+      for (i = 0; i < 16; ++i)
+        {
+          mean += block->rgb[i][c];
+          dx += (i / 4 - 1.5f) * block->rgb[i][c];
+          dy += (i % 4 - 1.5f) * block->rgb[i][c];
+        }
+
+      mean /= 16.0f;
+      dx /= 20.0f;
+      dy /= 20.0f;
+
+      o = mean - 1.5f * dx - 1.5f * dy;
+      h = o + 4.0f * dx;
+      v = o + 4.0f * dy;
+
+      guess[0] = texture_etc_quantize ((o < 0.0f) ? 0.0f : (o > 255.0f) ? 255.0f : o, channelBits[c]);
+      guess[1] = texture_etc_quantize ((h < 0.0f) ? 0.0f : (h > 255.0f) ? 255.0f : h, channelBits[c]);
+      guess[2] = texture_etc_quantize ((v < 0.0f) ? 0.0f : (v > 255.0f) ? 255.0f : v, channelBits[c]);
+
+      for (delta[0] = -1; delta[0] <= 1; ++delta[0])
+        for (delta[1] = -1; delta[1] <= 1; ++delta[1])
+          for (delta[2] = -1; delta[2] <= 1; ++delta[2])
+            {
+              unsigned int k, e = 0;
+              int max;
+
+              max = (1 << channelBits[c]) - 1;
+
+              for (k = 0; k < 3; ++k)
+                {
+                  if (guess[k] + delta[k] < 0 || guess[k] + delta[k] > max)
+                    break;
+
+                  expanded[k] = texture_etc_expand (guess[k] + delta[k], channelBits[c]);
+                }
+
+              if (k < 3)
+                continue;
+
+              for (i = 0; i < 16; ++i)
+                {
+                  int d;
+
+                  d = texture_etc_planar (expanded[0], expanded[1], expanded[2], i / 4, i % 4)
+                      - block->rgb[i][c];
+                  e += d * d;
+                }
+
+              if (e < bestError)
+                {
+                  bestError = e;
+
+                  for (k = 0; k < 3; ++k)
+                    best[k] = guess[k] + delta[k];
+                }
+            }
+
+      memcpy (codes[c], best, sizeof (best));
+      error += bestError;
+    }
+
+  /* codes[channel][o, h, v] */
+
+  texture_etc_put (&bits, 57, 6, codes[0][0]);
+  texture_etc_put (&bits, 56, 1, codes[1][0] >> 6);
+  texture_etc_put (&bits, 49, 6, codes[1][0]);
+  texture_etc_put (&bits, 48, 1, codes[2][0] >> 5);
+  texture_etc_put (&bits, 43, 2, codes[2][0] >> 3);
+  texture_etc_put (&bits, 39, 3, codes[2][0]);
+  texture_etc_put (&bits, 34, 5, codes[0][1] >> 1);
+  texture_etc_put (&bits, 33, 1, 1);
+  texture_etc_put (&bits, 32, 1, codes[0][1]);
+  texture_etc_put (&bits, 25, 7, codes[1][1]);
+  texture_etc_put (&bits, 19, 6, codes[2][1]);
+  texture_etc_put (&bits, 13, 6, codes[0][2]);
+  texture_etc_put (&bits, 6, 7, codes[1][2]);
+  texture_etc_put (&bits, 0, 6, codes[2][2]);
+
+  /* Red and green must not overflow, blue must */
+
+  texture_etc_avoid_overflow (&bits, 56, 63);
+  texture_etc_avoid_overflow (&bits, 48, 55);
+  texture_etc_force_overflow (&bits, 40);
+
+  *result = bits;
+
+  return error;
+}
+
+/* Splits the pixels of a block into two clusters, returning zero if all
+ * pixels have the same colour.  */
+static int
+texture_etc_cluster (const struct texture_etc_block *block, unsigned char *cluster,
+                     float means[2][3])
+{
+  unsigned int i, c, iteration, count[2];
+
+  /* Start from the two pixels furthest apart along the largest channel
+   * range */
+
+  int min[3] = { 255, 255, 255 }, max[3] = { 0, 0, 0 }, axis = 0;
+  unsigned int lo = 0, hi = 0;
+
+  for (i = 0; i < 16; ++i)
+    {
+      for (c = 0; c < 3; ++c)
+        {
+          if (block->rgb[i][c] < min[c]) min[c] = block->rgb[i][c];
+          if (block->rgb[i][c] > max[c]) max[c] = block->rgb[i][c];
+        }
+    }
+
+  for (c = 1; c < 3; ++c)
+    {
+      if (max[c] - min[c] > max[axis] - min[axis])
+        axis = c;
+    }
+
+  if (max[axis] == min[axis])
+    return 0;
+
+  for (i = 0; i < 16; ++i)
+    {
+      if (block->rgb[i][axis] < block->rgb[lo][axis]) lo = i;
+      if (block->rgb[i][axis] > block->rgb[hi][axis]) hi = i;
+    }
+
+  for (c = 0; c < 3; ++c)
+    {
+      means[0][c] = block->rgb[lo][c];
+      means[1][c] = block->rgb[hi][c];
+    }
+
+  for (iteration = 0; iteration < 4; ++iteration)
+    {
+      float sums[2][3] = { { 0 } };
+
+      count[0] = count[1] = 0;
+
+      for (i = 0; i < 16; ++i)
+        {
+          float d0 = 0.0f, d1 = 0.0f;
+
+          for (c = 0; c < 3; ++c)
+            {
+              d0 += (block->rgb[i][c] - means[0][c]) * (block->rgb[i][c] - means[0][c]);
+              d1 += (block->rgb[i][c] - means[1][c]) * (block->rgb[i][c] - means[1][c]);
+            }
+
+          cluster[i] = d1 < d0;
+          ++count[cluster[i]];
+
+          for (c = 0; c < 3; ++c)
+            sums[cluster[i]][c] += block->rgb[i][c];
+        }
+
+      if (!count[0] || !count[1])
+        return 0;
+
+      for (c = 0; c < 3; ++c)
+        {
+          means[0][c] = sums[0][c] / count[0];
+          means[1][c] = sums[1][c] / count[1];
+        }
+    }
+
+  return 1;
+}
+
+/* Returns the error of painting a block with the closest of four colours,
+ * and optionally stores the indices.  */
+static unsigned int
+texture_etc_paint_error (const struct texture_etc_block *block, int paint[4][3],
+                         uint64_t *bits)
+{
+  unsigned int i, k, error = 0;
+
+  for (i = 0; i < 16; ++i)
+    {
+      unsigned int best = 0, bestError = UINT_MAX, e;
+
+      for (k = 0; k < 4; ++k)
+        {
+          if ((e = texture_etc_distance (paint[k], block->rgb[i])) < bestError)
+            {
+              bestError = e;
+              best = k;
+            }
+        }
+
+      error += bestError;
+
+      if (bits)
+        {
+          *bits |= (uint64_t) (best >> 1) << (16 + i);
+          *bits |= (uint64_t) (best & 1) << i;
+        }
+    }
+
+  return error;
+}
+
+static void
+texture_etc_offset_color (int *output, const int *color, int offset)
+{
+  output[0] = texture_etc_clamp (color[0] + offset);
+  output[1] = texture_etc_clamp (color[1] + offset);
+  output[2] = texture_etc_clamp (color[2] + offset);
+}
+
+/* Finds the best ETC2 T and H mode encodings of a block, from two clusters
+ * of its pixels.  */
+static unsigned int
+texture_etc_encode_th (const struct texture_etc_block *block, uint64_t *result)
+{
+  unsigned char cluster[16];
+  float means[2][3];
+  int code[2][3], color[2][3], paint[4][3];
+  unsigned int c, d, single, bestError = UINT_MAX, error;
+  uint64_t bits;
+
+  if (!texture_etc_cluster (block, cluster, means))
+    return UINT_MAX;
+
+  for (c = 0; c < 3; ++c)
+    {
+      code[0][c] = texture_etc_quantize (means[0][c], 4);
+      code[1][c] = texture_etc_quantize (means[1][c], 4);
+      color[0][c] = texture_etc_expand (code[0][c], 4);
+      color[1][c] = texture_etc_expand (code[1][c], 4);
+    }
+
+  /* T mode: one cluster is a single colour, the other is painted with its
+   * mean and the mean plus or minus the distance */
+
+  for (single = 0; single < 2; ++single)
+    {
+      const int *c1 = code[single], *c2 = code[!single];
+
+      for (d = 0; d < 8; ++d)
+        {
+          memcpy (paint[0], color[single], sizeof (paint[0]));
+          texture_etc_offset_color (paint[1], color[!single], texture_etc_distances[d]);
+          memcpy (paint[2], color[!single], sizeof (paint[2]));
+          texture_etc_offset_color (paint[3], color[!single], -texture_etc_distances[d]);
+
+          if ((error = texture_etc_paint_error (block, paint, 0)) >= bestError)
+            continue;
+
+          bits = 0;
+
+          texture_etc_put (&bits, 59, 2, c1[0] >> 2);
+          texture_etc_put (&bits, 56, 2, c1[0]);
+          texture_etc_put (&bits, 52, 4, c1[1]);
+          texture_etc_put (&bits, 48, 4, c1[2]);
+          texture_etc_put (&bits, 44, 4, c2[0]);
+          texture_etc_put (&bits, 40, 4, c2[1]);
+          texture_etc_put (&bits, 36, 4, c2[2]);
+          texture_etc_put (&bits, 34, 2, d >> 1);
+          texture_etc_put (&bits, 33, 1, 1);
+          texture_etc_put (&bits, 32, 1, d);
+
+          texture_etc_force_overflow (&bits, 56);
+          texture_etc_paint_error (block, paint, &bits);
+
+          bestError = error;
+          *result = bits;
+        }
+    }
+
+  /* H mode: both clusters are painted with their mean plus or minus the
+   * distance.  The lowest bit of the distance index is not stored, but
+   * implied by the order of the two colours.  */
+
+  for (d = 0; d < 8; ++d)
+    {
+      unsigned int first, value[2];
+      const int *c1, *c2;
+
+      value[0] = (code[0][0] << 8) | (code[0][1] << 4) | code[0][2];
+      value[1] = (code[1][0] << 8) | (code[1][1] << 4) | code[1][2];
+
+      if (value[0] == value[1] && !(d & 1))
+        continue;
+
+      first = ((value[0] >= value[1]) == (d & 1)) ? 0 : 1;
+      c1 = code[first];
+      c2 = code[!first];
+
+      texture_etc_offset_color (paint[0], color[first], texture_etc_distances[d]);
+      texture_etc_offset_color (paint[1], color[first], -texture_etc_distances[d]);
+      texture_etc_offset_color (paint[2], color[!first], texture_etc_distances[d]);
+      texture_etc_offset_color (paint[3], color[!first], -texture_etc_distances[d]);
+
+      if ((error = texture_etc_paint_error (block, paint, 0)) >= bestError)
+        continue;
+
+      bits = 0;
+
+      texture_etc_put (&bits, 59, 4, c1[0]);
+      texture_etc_put (&bits, 56, 3, c1[1] >> 1);
+      texture_etc_put (&bits, 52, 1, c1[1]);
+      texture_etc_put (&bits, 51, 1, c1[2] >> 3);
+      texture_etc_put (&bits, 47, 3, c1[2]);
+      texture_etc_put (&bits, 43, 4, c2[0]);
+      texture_etc_put (&bits, 39, 4, c2[1]);
+      texture_etc_put (&bits, 35, 4, c2[2]);
+      texture_etc_put (&bits, 34, 1, d >> 2);
+      texture_etc_put (&bits, 33, 1, 1);
+      texture_etc_put (&bits, 32, 1, d >> 1);
+
+      texture_etc_avoid_overflow (&bits, 56, 63);
+      texture_etc_force_overflow (&bits, 48);
+      texture_etc_paint_error (block, paint, &bits);
+
+      bestError = error;
+      *result = bits;
+    }
+
+  return bestError;
+}
+
+/* Finds the best EAC encoding of the alpha channel of a block */
+static uint64_t
+texture_etc_encode_alpha (const struct texture_etc_block *block,
+                          enum texture_etc_quality quality)
+{
+  unsigned int t, i, k, bestError = UINT_MAX;
+  int min = 255, max = 0, radius, baseDelta, multiplierDelta;
+  uint64_t result = 0;
+
+  for (i = 0; i < 16; ++i)
+    {
+      if (block->alpha[i] < min) min = block->alpha[i];
+      if (block->alpha[i] > max) max = block->alpha[i];
+    }
+
+  radius = (quality == TEXTURE_ETC_HIGH) ? 2 : (quality == TEXTURE_ETC_MEDIUM) ? 1 : 0;
+
+  for (t = 0; t < 16; ++t)
+    {
+      const int *table = texture_etc_alpha_tables[t];
+      int span, guessMultiplier, guessBase;
+
+      /* Map the smallest and largest offsets onto the alpha range */
+
+      span = table[7] - table[3];
+      guessMultiplier = (max - min + span / 2) / span;
+
+      if (guessMultiplier < 1)
+        guessMultiplier = 1;
+
+      guessBase = min - table[3] * guessMultiplier;
+
+      for (multiplierDelta = -radius; multiplierDelta <= radius; ++multiplierDelta)
+        {
+          int multiplier;
+
+          multiplier = guessMultiplier + multiplierDelta;
+
+          if (multiplier < 1 || multiplier > 15)
+            continue;
+
+          for (baseDelta = -2 * radius; baseDelta <= 2 * radius; ++baseDelta)
+            {
+              unsigned int error = 0;
+              int base;
+
+              base = texture_etc_clamp (guessBase + baseDelta
+                                        + (max - min - span * multiplier) / 2);
+
+              for (i = 0; i < 16 && error < bestError; ++i)
+                {
+                  unsigned int best = UINT_MAX;
+
+                  for (k = 0; k < 8; ++k)
+                    {
+                      int d;
+
+                      d = texture_etc_clamp (base + table[k] * multiplier) - block->alpha[i];
+
+                      if ((unsigned int) (d * d) < best)
+                        best = d * d;
+                    }
+
+                  error += best;
+                }
+
+              if (error >= bestError)
+                continue;
+
+              bestError = error;
+
+              result = (uint64_t) base << 56 | (uint64_t) multiplier << 52 | (uint64_t) t << 48;
+
+              for (i = 0; i < 16; ++i)
+                {
+                  unsigned int bestIndex = 0, best = UINT_MAX;
+
+                  for (k = 0; k < 8; ++k)
+                    {
+                      int d;
+
+                      d = texture_etc_clamp (base + table[k] * multiplier) - block->alpha[i];
+
+                      if ((unsigned int) (d * d) < best)
+                        {
+                          best = d * d;
+                          bestIndex = k;
+                        }
+                    }
+
+                  result |= (uint64_t) bestIndex << (45 - 3 * i);
+                }
+            }
+        }
+    }
+
+  return result;
+}
+
+static void
+texture_etc_store (unsigned char *output, uint64_t bits)
+{
+  unsigned int i;
+
+  for (i = 0; i < 8; ++i)
+    output[i] = bits >> (56 - 8 * i);
+}
+
+static void
+texture_etc_thread (void *arg, unsigned int thread)
+{
+  struct texture_etc_encoder *encoder = arg;
+  struct texture_etc_block block;
+  unsigned int bx, by, threads, blockSize;
+  enum texture_etc_format format;
+  enum texture_etc_quality quality;
+
+  format = encoder->options->format;
+  quality = encoder->options->quality;
+  threads = encoder->threads;
+  blockSize = (format == TEXTURE_ETC2_RGBA) ? 16 : 8;
+
+  for (by = thread; by < encoder->blocksY; by += threads)
+    {
+      for (bx = 0; bx < encoder->blocksX; ++bx)
+        {
+          unsigned char *output;
+          uint64_t bits = 0, candidate = 0;
+          unsigned int error, candidateError;
+
+          output = encoder->output + ((size_t) by * encoder->blocksX + bx) * blockSize;
+
+          texture_etc_load_block (&block, encoder, bx, by);
+
+          if (format == TEXTURE_ETC2_RGBA)
+            {
+              texture_etc_store (output, texture_etc_encode_alpha (&block, quality));
+              output += 8;
+            }
+
+          error = texture_etc_encode_etc1 (&block, quality, &bits);
+
+          if (format != TEXTURE_ETC1 && error)
+            {
+              if ((candidateError = texture_etc_encode_planar (&block, &candidate)) < error)
+                {
+                  error = candidateError;
+                  bits = candidate;
+                }
+
+              if (quality != TEXTURE_ETC_FAST
+                  && (candidateError = texture_etc_encode_th (&block, &candidate)) < error)
+                {
+                  error = candidateError;
+                  bits = candidate;
+                }
+            }
+
+          texture_etc_store (output, bits);
+        }
+    }
+}
+
+size_t
+texture_etc_size (unsigned int width, unsigned int height, enum texture_etc_format format)
+{
+  size_t blocks;
+
+  blocks = (size_t) ((width + 3) / 4) * ((height + 3) / 4);
+
+  return blocks * ((format == TEXTURE_ETC2_RGBA) ? 16 : 8);
+}
+
+void
+texture_etc_encode (void *output, const unsigned char *argb,
+                    unsigned int width, unsigned int height,
+                    const struct texture_etc_options *options)
+{
+  struct texture_etc_encoder encoder;
+
+  memset (&encoder, 0, sizeof (encoder));
+
+  encoder.options = options;
+  encoder.argb = argb;
+  encoder.width = width;
+  encoder.height = height;
+  encoder.blocksX = (width + 3) / 4;
+  encoder.blocksY = (height + 3) / 4;
+  encoder.output = output;
+
+  encoder.threads = options->threads ? options->threads : 1;
+
+  if (encoder.threads > encoder.blocksY)
+    encoder.threads = encoder.blocksY;
+
+  /* Each thread takes every `threads'th row of blocks */
+
+  texture_run_threads (encoder.threads, texture_etc_thread, &encoder);
+}
+
+static uint64_t
+texture_etc_load (const unsigned char *input)
+{
+  uint64_t result = 0;
+  unsigned int i;
+
+  for (i = 0; i < 8; ++i)
+    result = (result << 8) | input[i];
+
+  return result;
+}
+
+/* Decodes the colours of one block to `rgb', in the block's pixel order */
+static void
+texture_etc_decode_color (int rgb[16][3], uint64_t bits, int etc2)
+{
+  int base[2][3], paint[4][3];
+  unsigned int i, c, table[2], flip, index;
+
+  if (texture_etc_get (bits, 33, 1))
+    {
+      int sum[3];
+
+      for (c = 0; c < 3; ++c)
+        {
+          base[0][c] = texture_etc_get (bits, 59 - 8 * c, 5);
+          sum[c] = base[0][c] + texture_etc_signed3 (texture_etc_get (bits, 56 - 8 * c, 3));
+        }
+
+      if (etc2 && (sum[0] < 0 || sum[0] > 31))
+        {
+          /* T mode */
+
+          int c1[3], c2[3], d;
+
+          c1[0] = texture_etc_expand ((texture_etc_get (bits, 59, 2) << 2) | texture_etc_get (bits, 56, 2), 4);
+          c1[1] = texture_etc_expand (texture_etc_get (bits, 52, 4), 4);
+          c1[2] = texture_etc_expand (texture_etc_get (bits, 48, 4), 4);
+          c2[0] = texture_etc_expand (texture_etc_get (bits, 44, 4), 4);
+          c2[1] = texture_etc_expand (texture_etc_get (bits, 40, 4), 4);
+          c2[2] = texture_etc_expand (texture_etc_get (bits, 36, 4), 4);
+          d = texture_etc_distances[(texture_etc_get (bits, 34, 2) << 1) | texture_etc_get (bits, 32, 1)];
+
+          memcpy (paint[0], c1, sizeof (paint[0]));
+          texture_etc_offset_color (paint[1], c2, d);
+          memcpy (paint[2], c2, sizeof (paint[2]));
+          texture_etc_offset_color (paint[3], c2, -d);
+        }
+      else if (etc2 && (sum[1] < 0 || sum[1] > 31))
+        {
+          /* H mode */
+
+          int c1[3], c2[3], d;
+          unsigned int v1, v2;
+
+          v1 = (texture_etc_get (bits, 59, 4) << 8)
+               | (((texture_etc_get (bits, 56, 3) << 1) | texture_etc_get (bits, 52, 1)) << 4)
+               | (texture_etc_get (bits, 51, 1) << 3) | texture_etc_get (bits, 47, 3);
+          v2 = texture_etc_get (bits, 35, 12);
+
+          for (c = 0; c < 3; ++c)
+            {
+              c1[c] = texture_etc_expand ((v1 >> (8 - 4 * c)) & 0xf, 4);
+              c2[c] = texture_etc_expand ((v2 >> (8 - 4 * c)) & 0xf, 4);
+            }
+
+          d = texture_etc_distances[(texture_etc_get (bits, 34, 1) << 2)
+                                    | (texture_etc_get (bits, 32, 1) << 1)
+                                    | (v1 >= v2)];
+
+          texture_etc_offset_color (paint[0], c1, d);
+          texture_etc_offset_color (paint[1], c1, -d);
+          texture_etc_offset_color (paint[2], c2, d);
+          texture_etc_offset_color (paint[3], c2, -d);
+        }
+      else if (etc2 && (sum[2] < 0 || sum[2] > 31))
+        {
+          /* Planar mode */
+
+          int o[3], h[3], v[3];
+
+          o[0] = texture_etc_expand (texture_etc_get (bits, 57, 6), 6);
+          o[1] = texture_etc_expand ((texture_etc_get (bits, 56, 1) << 6) | texture_etc_get (bits, 49, 6), 7);
+          o[2] = texture_etc_expand ((texture_etc_get (bits, 48, 1) << 5) | (texture_etc_get (bits, 43, 2) << 3)
+                                     | texture_etc_get (bits, 39, 3), 6);
+          h[0] = texture_etc_expand ((texture_etc_get (bits, 34, 5) << 1) | texture_etc_get (bits, 32, 1), 6);
+          h[1] = texture_etc_expand (texture_etc_get (bits, 25, 7), 7);
+          h[2] = texture_etc_expand (texture_etc_get (bits, 19, 6), 6);
+          v[0] = texture_etc_expand (texture_etc_get (bits, 13, 6), 6);
+          v[1] = texture_etc_expand (texture_etc_get (bits, 6, 7), 7);
+          v[2] = texture_etc_expand (texture_etc_get (bits, 0, 6), 6);
+
+          for (i = 0; i < 16; ++i)
+            for (c = 0; c < 3; ++c)
+              rgb[i][c] = texture_etc_planar (o[c], h[c], v[c], i / 4, i % 4);
+
+          return;
+        }
+      else
+        {
+          for (c = 0; c < 3; ++c)
+            {
+              base[1][c] = texture_etc_expand (sum[c] & 31, 5);
+              base[0][c] = texture_etc_expand (base[0][c], 5);
+            }
+
+          goto offsets;
+        }
+
+      for (i = 0; i < 16; ++i)
+        {
+          index = (texture_etc_get (bits, 16 + i, 1) << 1) | texture_etc_get (bits, i, 1);
+          memcpy (rgb[i], paint[index], sizeof (rgb[i]));
+        }
+
+      return;
+    }
+
+  for (c = 0; c < 3; ++c)
+    {
+      base[0][c] = texture_etc_expand (texture_etc_get (bits, 60 - 8 * c, 4), 4);
+      base[1][c] = texture_etc_expand (texture_etc_get (bits, 56 - 8 * c, 4), 4);
+    }
+
+offsets:
+
+  table[0] = texture_etc_get (bits, 37, 3);
+  table[1] = texture_etc_get (bits, 34, 3);
+  flip = texture_etc_get (bits, 32, 1);
+
+  for (i = 0; i < 16; ++i)
+    {
+      unsigned int half;
+
+      half = flip ? ((i % 4) >= 2) : ((i / 4) >= 2);
+      index = (texture_etc_get (bits, 16 + i, 1) << 1) | texture_etc_get (bits, i, 1);
+
+      texture_etc_offset_color (rgb[i], base[half], texture_etc_tables[table[half]][index]);
+    }
+}
+
+static void
+texture_etc_decode_thread (void *arg, unsigned int thread)
+{
+  struct texture_etc_decoder *decoder = arg;
+  unsigned int bx, by, blockSize;
+
+  (void) thread;
+
+  blockSize = (decoder->format == TEXTURE_ETC2_RGBA) ? 16 : 8;
+
+  for (by = 0; by < decoder->blocksY; ++by)
+    {
+      for (bx = 0; bx < decoder->blocksX; ++bx)
+        {
+          const unsigned char *input;
+          int rgb[16][3], alpha[16];
+          unsigned int i;
+
+          input = decoder->input + ((size_t) by * decoder->blocksX + bx) * blockSize;
+
+          for (i = 0; i < 16; ++i)
+            alpha[i] = 255;
+
+          if (decoder->format == TEXTURE_ETC2_RGBA)
+            {
+              uint64_t bits;
+              int base, multiplier;
+              const int *table;
+
+              bits = texture_etc_load (input);
+              base = bits >> 56;
+              multiplier = (bits >> 52) & 0xf;
+              table = texture_etc_alpha_tables[(bits >> 48) & 0xf];
+
+              for (i = 0; i < 16; ++i)
+                alpha[i] = texture_etc_clamp (base + table[(bits >> (45 - 3 * i)) & 7] * multiplier);
+
+              input += 8;
+            }
+
+          texture_etc_decode_color (rgb, texture_etc_load (input), decoder->format != TEXTURE_ETC1);
+
+          for (i = 0; i < 16; ++i)
+            {
+              unsigned char *pixel;
+              unsigned int x, y;
+
+              x = bx * TEXTURE_ETC_BLOCK_SIZE + i / 4;
+              y = by * TEXTURE_ETC_BLOCK_SIZE + i % 4;
+
+              if (x >= decoder->width || y >= decoder->height)
+                continue;
+
+              pixel = decoder->rgba + 4 * ((size_t) y * decoder->width + x);
+              pixel[0] = rgb[i][0];
+              pixel[1] = rgb[i][1];
+              pixel[2] = rgb[i][2];
+              pixel[3] = alpha[i];
+            }
+        }
+    }
+}
+
+void
+texture_etc_decode (unsigned char *rgba, const void *input,
+                    unsigned int width, unsigned int height,
+                    enum texture_etc_format format)
+{
+  struct texture_etc_decoder decoder;
+
+  decoder.input = input;
+  decoder.rgba = rgba;
+  decoder.width = width;
+  decoder.height = height;
+  decoder.blocksX = (width + 3) / 4;
+  decoder.blocksY = (height + 3) / 4;
+  decoder.format = format;
+
+  texture_etc_decode_thread (&decoder, 0);
+}
@@ -0,0 +1,602 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "texture.h"
+
+/* Mipmaps are filtered separably: input rows are filtered horizontally
+ * into premultiplied RGBA floats, and columns of those rows are filtered
+ * into output rows.  Rows arrive in chunks, and only the filtered rows
+ * still needed by the vertical taps are kept, in a ring buffer, so an
+ * image can be supplied a band at a time.  Colour channels are converted
+ * from sRGB to linear light first, unless the image holds linear data like
+ * normal maps.  */
+
+/* Filter support, in output pixels on each side of the centre */
+#define TEXTURE_MIP_BOX_RADIUS      0.5f
+#define TEXTURE_MIP_WINDOWED_RADIUS 3.0f
+
+#define TEXTURE_MIP_KAISER_ALPHA    4.0f
+
+/* Input rows filtered horizontally per pass */
+#define TEXTURE_MIP_CHUNK_ROWS      64
+
+/* Sample positions and weights of each output pixel along one axis */
+struct texture_mip_taps
+{
+  unsigned int *start;
+  unsigned int *count;
+  float *weights;
+  unsigned int stride;
+};
+
+struct texture_mip_stream
+{
+  struct texture_mip_options options;
+  unsigned char *output;
+  unsigned int width, height, outputWidth, outputHeight, threads;
+
+  struct texture_mip_taps horizontal, vertical;
+
+  /* Horizontally filtered rows, as premultiplied RGBA; input row `y' is
+   * stored at index `y % ringRows' */
+  float *ring;
+  unsigned int ringRows;
+
+  /* Per thread scratch rows of `width' pixels */
+  float *scratch;
+
+  /* Rows received and rows written */
+  unsigned int inputRow, outputRow;
+
+  /* Work of the current pass */
+  const unsigned char *chunk;
+  unsigned int chunkRows, emitRows, passThreads;
+};
+
+static pthread_once_t texture_mip_once = PTHREAD_ONCE_INIT;
+
+/* Linear value of each sRGB code, and the linear values half way between
+ * consecutive codes */
+static float texture_mip_linear[256];
+static float texture_mip_thresholds[255];
+
+static void
+texture_mip_init (void)
+{
+  unsigned int i;
+
+  for (i = 0; i < 256; ++i)
+    {
+      double value;
+
+      value = i / 255.0;
+
+      texture_mip_linear[i] = (value <= 0.04045) ? value / 12.92
+                              : pow ((value + 0.055) / 1.055, 2.4);
+    }
+
+  for (i = 0; i < 255; ++i)
+    {
+      double value;
+
+      value = (i + 0.5) / 255.0;
+
+      texture_mip_thresholds[i] = (value <= 0.04045) ? value / 12.92
+                                  : pow ((value + 0.055) / 1.055, 2.4);
+    }
+}
+
+/* Returns the sRGB code closest to a linear value */
+static unsigned char
+texture_mip_srgb (float value)
+{
+  unsigned int low = 0, high = 255;
+
+  while (low < high)
+    {
+      unsigned int middle = (low + high) / 2;
+
+      if (value < texture_mip_thresholds[middle])
+        high = middle;
+      else
+        low = middle + 1;
+    }
+
+  return low;
+}
+
+static unsigned char
+texture_mip_unorm (float value)
+{
+  return (value <= 0.0f) ? 0 : (value >= 1.0f) ? 255 : (unsigned char) (value * 255.0f + 0.5f);
+}
+
+static double
+texture_mip_sinc (double x)
+{
+  if (fabs (x) < 1.0e-6)
+    return 1.0;
+
+  x *= M_PI;
+
+  return sin (x) / x;
+}
+
+/* Modified Bessel function of the first kind, order zero */
+static double
+texture_mip_bessel0 (double x)
+{
+  double sum = 1.0, term = 1.0;
+  unsigned int k;
+
+  for (k = 1; k < 32; ++k)
+    {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+    }
+
+  return sum;
+}
+
+static double
+texture_mip_kernel (enum texture_mip_filter filter, double x)
+{
+  double t;
+
+  switch (filter)
+    {
+    case TEXTURE_MIP_BOX:
+
+      return (fabs (x) < TEXTURE_MIP_BOX_RADIUS) ? 1.0 : 0.0;
+
+    case TEXTURE_MIP_KAISER:
+
+      t = x / TEXTURE_MIP_WINDOWED_RADIUS;
+
+      if (t <= -1.0 || t >= 1.0)
+        return 0.0;
+
+      return texture_mip_sinc (x)
+             * texture_mip_bessel0 (TEXTURE_MIP_KAISER_ALPHA * sqrt (1.0 - t * t))
+             / texture_mip_bessel0 (TEXTURE_MIP_KAISER_ALPHA);
+
+    case TEXTURE_MIP_LANCZOS:
+
+      if (x <= -TEXTURE_MIP_WINDOWED_RADIUS || x >= TEXTURE_MIP_WINDOWED_RADIUS)
+        return 0.0;
+
+      return texture_mip_sinc (x) * texture_mip_sinc (x / TEXTURE_MIP_WINDOWED_RADIUS);
+    }
+
+  return 0.0;
+}
+
+/* Computes the taps resampling `size' pixels to `outputSize' pixels.  Taps
+ * beyond the edges are added to the edge pixels.  */
+static void
+texture_mip_make_taps (struct texture_mip_taps *taps, enum texture_mip_filter filter,
+                       unsigned int size, unsigned int outputSize)
+{
+  double scale, radius;
+  unsigned int x;
+
+  scale = (double) size / outputSize;
+  radius = ((filter == TEXTURE_MIP_BOX) ? TEXTURE_MIP_BOX_RADIUS : TEXTURE_MIP_WINDOWED_RADIUS) * scale;
+
+  taps->stride = (unsigned int) ceil (2.0 * radius) + 2;
+
+  if (!(taps->start = calloc (outputSize, sizeof (*taps->start)))
+      || !(taps->count = calloc (outputSize, sizeof (*taps->count)))
+      || !(taps->weights = calloc ((size_t) outputSize * taps->stride, sizeof (*taps->weights))))
+    err (EX_OSERR, "calloc failed");
+
+  for (x = 0; x < outputSize; ++x)
+    {
+      double center, sum = 0.0;
+      float *weights;
+      int first, last, low, high, i;
+      unsigned int k;
+
+      center = (x + 0.5) * scale - 0.5;
+      first = (int) ceil (center - radius);
+      last = (int) floor (center + radius);
+
+      low = (first < 0) ? 0 : (first >= (int) size) ? (int) size - 1 : first;
+      high = (last < 0) ? 0 : (last >= (int) size) ? (int) size - 1 : last;
+
+      taps->start[x] = low;
+      taps->count[x] = high - low + 1;
+
+      weights = taps->weights + (size_t) x * taps->stride;
+
+      for (i = first; i <= last; ++i)
+        {
+          double weight;
+          int j;
+
+          weight = texture_mip_kernel (filter, (i - center) / scale);
+          j = (i < 0) ? 0 : (i >= (int) size) ? (int) size - 1 : i;
+
+          weights[j - low] += weight;
+          sum += weight;
+        }
+
+      for (k = 0; k < taps->count[x]; ++k)
+        weights[k] = (sum != 0.0) ? weights[k] / sum : 1.0f / taps->count[x];
+    }
+}
+
+static void
+texture_mip_free_taps (struct texture_mip_taps *taps)
+{
+  free (taps->weights);
+  free (taps->count);
+  free (taps->start);
+}
+
+/* Converts one ARGB row to premultiplied RGBA floats */
+static void
+texture_mip_load_row (float *output, const unsigned char *input, unsigned int width, int linear)
+{
+  unsigned int x;
+
+  for (x = 0; x < width; ++x, input += 4, output += 4)
+    {
+      float alpha;
+
+      alpha = input[0] * (1.0f / 255.0f);
+
+      if (linear)
+        {
+          output[0] = input[1] * (1.0f / 255.0f) * alpha;
+          output[1] = input[2] * (1.0f / 255.0f) * alpha;
+          output[2] = input[3] * (1.0f / 255.0f) * alpha;
+        }
+      else
+        {
+          output[0] = texture_mip_linear[input[1]] * alpha;
+          output[1] = texture_mip_linear[input[2]] * alpha;
+          output[2] = texture_mip_linear[input[3]] * alpha;
+        }
+
+      output[3] = alpha;
+    }
+}
+
+/* Sums `count' RGBA pixels scaled by their weights */
+static void
+texture_mip_filter_pixel (float *output, const float *input, const float *weights,
+                          unsigned int count)
+{
+  unsigned int k;
+
+#if defined(__SSE2__)
+  __m128 sum = _mm_setzero_ps ();
+
+  for (k = 0; k < count; ++k)
+    sum = _mm_add_ps (sum, _mm_mul_ps (_mm_set1_ps (weights[k]), _mm_loadu_ps (input + 4 * k)));
+
+  _mm_storeu_ps (output, sum);
+#else
+  output[0] = output[1] = output[2] = output[3] = 0.0f;
+
+  for (k = 0; k < count; ++k)
+    {
+      output[0] += weights[k] * input[4 * k + 0];
+      output[1] += weights[k] * input[4 * k + 1];
+      output[2] += weights[k] * input[4 * k + 2];
+      output[3] += weights[k] * input[4 * k + 3];
+    }
+#endif
+}
+
+/* Adds `weight' times a row of floats to an accumulator row */
+static void
+texture_mip_accumulate_row (float *sum, const float *input, float weight, size_t count)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__)
+  __m128 w = _mm_set1_ps (weight);
+
+  for (; i + 4 <= count; i += 4)
+    _mm_storeu_ps (sum + i, _mm_add_ps (_mm_loadu_ps (sum + i),
+                                        _mm_mul_ps (w, _mm_loadu_ps (input + i))));
+#endif
+
+  for (; i < count; ++i)
+    sum[i] += weight * input[i];
+}
+
+static void
+texture_mip_horizontal (void *arg, unsigned int thread)
+{
+  struct texture_mip_stream *stream = arg;
+  const struct texture_mip_taps *taps = &stream->horizontal;
+  float *row;
+  unsigned int x, y;
+
+  row = stream->scratch + (size_t) thread * stream->width * 4;
+
+  for (y = thread; y < stream->chunkRows; y += stream->passThreads)
+    {
+      float *output;
+
+      texture_mip_load_row (row, stream->chunk + (size_t) y * stream->width * 4, stream->width,
+                            stream->options.linear);
+
+      output = stream->ring
+               + (size_t) ((stream->inputRow + y) % stream->ringRows) * stream->outputWidth * 4;
+
+      for (x = 0; x < stream->outputWidth; ++x)
+        texture_mip_filter_pixel (output + x * 4, row + taps->start[x] * 4,
+                                  taps->weights + x * taps->stride, taps->count[x]);
+    }
+}
+
+static void
+texture_mip_vertical (void *arg, unsigned int thread)
+{
+  struct texture_mip_stream *stream = arg;
+  const struct texture_mip_taps *taps = &stream->vertical;
+  float *sum;
+  unsigned int i, x, y, k;
+
+  sum = stream->scratch + (size_t) thread * stream->width * 4;
+
+  for (i = thread; i < stream->emitRows; i += stream->passThreads)
+    {
+      unsigned char *output;
+
+      y = stream->outputRow + i;
+
+      memset (sum, 0, sizeof (*sum) * 4 * stream->outputWidth);
+
+      for (k = 0; k < taps->count[y]; ++k)
+        texture_mip_accumulate_row (sum,
+                                    stream->ring + (size_t) ((taps->start[y] + k) % stream->ringRows) * stream->outputWidth * 4,
+                                    taps->weights[y * taps->stride + k],
+                                    (size_t) stream->outputWidth * 4);
+
+      output = stream->output + (size_t) y * stream->outputWidth * 4;
+
+      for (x = 0; x < stream->outputWidth; ++x, output += 4)
+        {
+          const float *pixel = sum + x * 4;
+          float alpha, scale;
+          unsigned int c;
+
+          /* Negative lobes may ring past the valid range */
+
+          alpha = (pixel[3] < 0.0f) ? 0.0f : (pixel[3] > 1.0f) ? 1.0f : pixel[3];
+          scale = (alpha > 0.0f) ? 1.0f / alpha : 0.0f;
+
+          output[0] = texture_mip_unorm (alpha);
+
+          for (c = 0; c < 3; ++c)
+            {
+              float value;
+
+              value = pixel[c] * scale;
+
+              output[c + 1] = stream->options.linear ? texture_mip_unorm (value)
+                              : texture_mip_srgb (value);
+            }
+        }
+    }
+}
+
+struct texture_mip_stream *
+texture_mip_stream_begin (unsigned char *output, unsigned int width, unsigned int height,
+                          const struct texture_mip_options *options)
+{
+  struct texture_mip_stream *stream;
+
+  pthread_once (&texture_mip_once, texture_mip_init);
+
+  if (!(stream = calloc (1, sizeof (*stream))))
+    err (EX_OSERR, "calloc failed");
+
+  stream->options = *options;
+  stream->output = output;
+  stream->width = width;
+  stream->height = height;
+  stream->outputWidth = (width > 1) ? width / 2 : 1;
+  stream->outputHeight = (height > 1) ? height / 2 : 1;
+  stream->threads = options->threads ? options->threads : 1;
+
+  texture_mip_make_taps (&stream->horizontal, options->filter, width, stream->outputWidth);
+  texture_mip_make_taps (&stream->vertical, options->filter, height, stream->outputHeight);
+
+  /* Rows from the first tap of the next output row to the end of the
+   * current chunk.  A tap spans at most `stride' rows.  */
+
+  stream->ringRows = stream->vertical.stride + TEXTURE_MIP_CHUNK_ROWS;
+
+  if (stream->ringRows > height)
+    stream->ringRows = height;
+
+  if (!(stream->ring = malloc (sizeof (*stream->ring) * 4 * stream->outputWidth * stream->ringRows))
+      || !(stream->scratch = malloc (sizeof (*stream->scratch) * 4 * width * stream->threads)))
+    err (EX_OSERR, "malloc failed");
+
+  return stream;
+}
+
+void
+texture_mip_stream_rows (struct texture_mip_stream *stream, const unsigned char *rows,
+                         unsigned int count)
+{
+  const struct texture_mip_taps *taps = &stream->vertical;
+
+  while (count)
+    {
+      stream->chunk = rows;
+      stream->chunkRows = (count < TEXTURE_MIP_CHUNK_ROWS) ? count : TEXTURE_MIP_CHUNK_ROWS;
+      stream->passThreads = (stream->threads < stream->chunkRows) ? stream->threads : stream->chunkRows;
+
+      texture_run_threads (stream->passThreads, texture_mip_horizontal, stream);
+
+      stream->inputRow += stream->chunkRows;
+      rows += (size_t) stream->chunkRows * stream->width * 4;
+      count -= stream->chunkRows;
+
+      /* Write every output row whose taps have all arrived.  The passes
+       * run one after the other, since output rows read input rows
+       * filtered by every thread.  */
+
+      stream->emitRows = 0;
+
+      while (stream->outputRow + stream->emitRows < stream->outputHeight
+             && (taps->start[stream->outputRow + stream->emitRows]
+                 + taps->count[stream->outputRow + stream->emitRows]) <= stream->inputRow)
+        ++stream->emitRows;
+
+      if (!stream->emitRows)
+        continue;
+
+      stream->passThreads = (stream->threads < stream->emitRows) ? stream->threads : stream->emitRows;
+
+      texture_run_threads (stream->passThreads, texture_mip_vertical, stream);
+
+      stream->outputRow += stream->emitRows;
+    }
+}
+
+void
+texture_mip_stream_end (struct texture_mip_stream *stream)
+{
+  free (stream->scratch);
+  free (stream->ring);
+  texture_mip_free_taps (&stream->vertical);
+  texture_mip_free_taps (&stream->horizontal);
+  free (stream);
+}
+
+void
+texture_mip_downsample (unsigned char *output, const unsigned char *input,
+                        unsigned int width, unsigned int height,
+                        const struct texture_mip_options *options)
+{
+  struct texture_mip_stream *stream;
+
+  stream = texture_mip_stream_begin (output, width, height, options);
+  texture_mip_stream_rows (stream, input, height);
+  texture_mip_stream_end (stream);
+}
+
+static void
+texture_mip_alpha_histogram (unsigned int *histogram, const unsigned char *argb,
+                             unsigned int width, unsigned int height)
+{
+  size_t i, count;
+
+  memset (histogram, 0, sizeof (*histogram) * 256);
+
+  count = (size_t) width * height;
+
+  for (i = 0; i < count; ++i)
+    ++histogram[argb[i * 4]];
+}
+
+/* Returns the alpha value texture_mip_preserve_coverage writes for `alpha'
+ * at `scale' */
+static unsigned char
+texture_mip_scale_alpha (unsigned int alpha, float scale)
+{
+  float value;
+
+  value = alpha * scale + 0.5f;
+
+  return (value >= 255.0f) ? 255 : (unsigned char) value;
+}
+
+/* Returns the fraction of pixels whose alpha, multiplied by `scale' and
+ * rounded as it would be written, is above `cutoff' */
+static double
+texture_mip_histogram_coverage (const unsigned int *histogram, float cutoff, float scale)
+{
+  double covered = 0.0, total = 0.0;
+  unsigned int a;
+
+  for (a = 0; a < 256; ++a)
+    {
+      if (texture_mip_scale_alpha (a, scale) > cutoff * 255.0f)
+        covered += histogram[a];
+
+      total += histogram[a];
+    }
+
+  return covered / total;
+}
+
+double
+texture_mip_coverage (const unsigned char *argb, unsigned int width, unsigned int height,
+                      float cutoff)
+{
+  unsigned int histogram[256];
+
+  texture_mip_alpha_histogram (histogram, argb, width, height);
+
+  return texture_mip_histogram_coverage (histogram, cutoff, 1.0f);
+}
+
+void
+texture_mip_preserve_coverage (unsigned char *argb, unsigned int width, unsigned int height,
+                               float cutoff, double coverage)
+{
+  unsigned int histogram[256], iteration;
+  float low = 0.0f, high = 4.0f, scale;
+  size_t i, count;
+
+  texture_mip_alpha_histogram (histogram, argb, width, height);
+
+  if (texture_mip_histogram_coverage (histogram, cutoff, 1.0f) == coverage)
+    return;
+
+  /* Coverage grows with the scale, so bisect for the target, stopping at
+   * the first scale that matches it */
+
+  for (iteration = 0; iteration < 20; ++iteration)
+    {
+      double current;
+
+      scale = (low + high) * 0.5f;
+      current = texture_mip_histogram_coverage (histogram, cutoff, scale);
+
+      if (current < coverage)
+        low = scale;
+      else if (current > coverage)
+        high = scale;
+      else
+        break;
+    }
+
+  /* Small levels can't match the coverage exactly; take the closer side */
+
+  if (iteration == 20)
+    {
+      if (fabs (texture_mip_histogram_coverage (histogram, cutoff, low) - coverage)
+          < fabs (texture_mip_histogram_coverage (histogram, cutoff, high) - coverage))
+        scale = low;
+      else
+        scale = high;
+    }
+
+  count = (size_t) width * height;
+
+  for (i = 0; i < count; ++i)
+    argb[i * 4] = texture_mip_scale_alpha (argb[i * 4], scale);
+}
@@ -0,0 +1,1356 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "texture.h"
+
+/* PVRTC stores an image as a grid of 64 bit words, one per block of 4x4
+ * pixels (8x4 in 2 bit mode).  Each word holds two low resolution colours,
+ * A and B, and a modulation value for each of its pixels.  The decoder
+ * upscales the A and B images bilinearly, with samples at block centres,
+ * and blends them by modulation.  A word therefore also affects the pixels
+ * of its eight neighbours, so blocks can't be encoded in isolation.
+ *
+ * The encoder starts from a low-pass image with one sample per block, and
+ * spreads A and B around it along the principal axis of the pixels each
+ * block affects.  It then refines the endpoints by least squares given the
+ * modulation, in four passes per iteration.  Each pass updates blocks whose
+ * coordinates have the same parity, which don't share any pixels, so the
+ * blocks within a pass are independent and are divided between threads.  */
+
+#define TEXTURE_PVRTC_BLOCK_HEIGHT 4
+
+/* Offset added to pixel values when fitting colours, to make up for the
+ * rounding down of the decoder */
+#define TEXTURE_PVRTC_BIAS 0.5f
+
+/* Modulation values of 2 bit codes, in eighths */
+static const unsigned char texture_pvrtc_levels[4] = { 0, 3, 5, 8 };
+
+/* Modulation values of the punch-through mode of 4 bit PVRTC, where code 2
+ * also makes the pixel transparent */
+static const unsigned char texture_pvrtc_punch_levels[4] = { 0, 4, 4, 8 };
+
+#define TEXTURE_PVRTC_PUNCH 0x10
+
+/* In the interpolated modes of 2 bit PVRTC, the first pixel and, in modes
+ * 2 and 3, the centre pixel lose a bit to mode flags, leaving codes 0 and
+ * 3 */
+#define TEXTURE_PVRTC_RESTRICTED2(mode, x, y) \
+  ((!(x) && !(y)) || ((mode) >= 2 && (x) == 4 && (y) == 2))
+
+struct texture_pvrtc_block
+{
+  /* Colours A and B as decoded before interpolation: RGB in 5 bits and
+   * alpha in 4 bits */
+  unsigned int color[2][4];
+
+  /* The same colours in 8 bit precision, for fitting */
+  float endpoint[2][4];
+
+  uint16_t packed[2];
+
+  uint32_t modulation;
+  unsigned int mode;
+};
+
+struct texture_pvrtc_encoder
+{
+  const struct texture_pvrtc_options *options;
+
+  unsigned int width, height;
+  unsigned int blockWidth;
+  unsigned int blocksX, blocksY;
+
+  /* log2 of the sum of the interpolation weights */
+  unsigned int weightShift;
+
+  /* RGBA pixels of the image, and of the interpolated A and B images */
+  unsigned char *pixels;
+  unsigned char *upscaled[2];
+
+  /* Modulation of each pixel in eighths, ORed with TEXTURE_PVRTC_PUNCH for
+   * transparent pixels */
+  unsigned char *modulation;
+
+  /* Best 2 bit modulation code of each pixel, ignoring the constraints of
+   * the interpolated modes.  Only used in 2 bit mode.  */
+  unsigned char *ideal;
+
+  /* 2 bit codes of the stored pixels as chosen by the current and the
+   * previous iteration, alternately.  Only used in 2 bit mode.  */
+  unsigned char *codes[2];
+
+  struct texture_pvrtc_block *blocks;
+
+  uint32_t *output;
+
+  unsigned int threads;
+  pthread_barrier_t barrier;
+};
+
+size_t
+texture_pvrtc_size (unsigned int width, unsigned int height, int use2bit)
+{
+  if (width < (use2bit ? 16u : 8u))
+    width = use2bit ? 16 : 8;
+
+  if (height < 8)
+    height = 8;
+
+  return (size_t) width * height / (use2bit ? 4 : 2);
+}
+
+/* Returns the position of a block in the output, in the same Morton order
+ * as TwiddleUV in PVRTDecompress.cpp.  */
+static unsigned int
+texture_pvrtc_twiddle (unsigned int x, unsigned int y,
+                       unsigned int blocksX, unsigned int blocksY)
+{
+  unsigned int result = 0, bit, shift = 0, min, rest;
+
+  min = blocksX;
+  rest = y;
+
+  if (blocksY < blocksX)
+    {
+      min = blocksY;
+      rest = x;
+    }
+
+  for (bit = 1; bit < min; bit <<= 1, shift += 2)
+    {
+      if (y & bit)
+        result |= 1u << shift;
+
+      if (x & bit)
+        result |= 2u << shift;
+    }
+
+  /* Remaining bits of the larger dimension go on top */
+
+  return result | ((rest >> (shift / 2)) << shift);
+}
+
+/* Expands a colour channel of `bits' bits to 5 bits, as the decoder does */
+static unsigned int
+texture_pvrtc_expand (unsigned int value, unsigned int bits)
+{
+  switch (bits)
+    {
+    case 3: return (value << 2) | (value >> 1);
+    case 4: return (value << 1) | (value >> 3);
+    default: return value;
+    }
+}
+
+static unsigned int
+texture_pvrtc_expand8 (unsigned int value5)
+{
+  return (value5 << 3) | (value5 >> 2);
+}
+
+/* Finds the `bits' bit code whose decoded value is closest to `value', and
+ * returns the squared error.  */
+static float
+texture_pvrtc_quantize_channel (float value, unsigned int bits, unsigned int *code)
+{
+  unsigned int max, guess, i;
+  float bestError = 1.0e9f;
+
+  max = (1u << bits) - 1;
+  guess = (unsigned int) (value * max / 255.0f);
+
+  for (i = guess ? guess - 1 : 0; i <= guess + 1 && i <= max; ++i)
+    {
+      float error;
+
+      error = texture_pvrtc_expand8 (texture_pvrtc_expand (i, bits)) - value;
+      error *= error;
+
+      if (error < bestError)
+        {
+          bestError = error;
+          *code = i;
+        }
+    }
+
+  return bestError;
+}
+
+/* Alpha is stored in 3 bits, and expanded to 4 bits with a zero at the
+ * right */
+static float
+texture_pvrtc_quantize_alpha (float value, unsigned int *code)
+{
+  unsigned int guess, i;
+  float bestError = 1.0e9f;
+
+  guess = (unsigned int) (value / 34.0f);
+
+  for (i = guess ? guess - 1 : 0; i <= guess + 1 && i <= 7; ++i)
+    {
+      float error;
+
+      error = i * 34.0f - value;
+      error *= error;
+
+      if (error < bestError)
+        {
+          bestError = error;
+          *code = i;
+        }
+    }
+
+  return bestError;
+}
+
+/* Sets colour A (`index' 0) or B of a block to the representable colour
+ * closest to the RGBA value `target', in either the opaque or the
+ * translucent format.  */
+static void
+texture_pvrtc_set_color (struct texture_pvrtc_block *block, unsigned int index,
+                         const float *target)
+{
+  unsigned int opaque[3], translucent[4];
+  unsigned int blueBits, c;
+  float opaqueError, translucentError;
+
+  /* Colour A has one bit less for blue, used by the modulation mode */
+
+  blueBits = index ? 5 : 4;
+
+  opaqueError = (255.0f - target[3]) * (255.0f - target[3]);
+  opaqueError += texture_pvrtc_quantize_channel (target[0], 5, &opaque[0]);
+  opaqueError += texture_pvrtc_quantize_channel (target[1], 5, &opaque[1]);
+  opaqueError += texture_pvrtc_quantize_channel (target[2], blueBits, &opaque[2]);
+
+  translucentError = texture_pvrtc_quantize_alpha (target[3], &translucent[3]);
+  translucentError += texture_pvrtc_quantize_channel (target[0], 4, &translucent[0]);
+  translucentError += texture_pvrtc_quantize_channel (target[1], 4, &translucent[1]);
+  translucentError += texture_pvrtc_quantize_channel (target[2], blueBits - 1, &translucent[2]);
+
+  if (opaqueError <= translucentError)
+    {
+      block->packed[index] = 0x8000 | (opaque[0] << 10) | (opaque[1] << 5)
+                             | (opaque[2] << (index ? 0 : 1));
+
+      block->color[index][0] = opaque[0];
+      block->color[index][1] = opaque[1];
+      block->color[index][2] = texture_pvrtc_expand (opaque[2], blueBits);
+      block->color[index][3] = 0xf;
+    }
+  else
+    {
+      block->packed[index] = (translucent[3] << 12) | (translucent[0] << 8)
+                             | (translucent[1] << 4)
+                             | (translucent[2] << (index ? 0 : 1));
+
+      block->color[index][0] = texture_pvrtc_expand (translucent[0], 4);
+      block->color[index][1] = texture_pvrtc_expand (translucent[1], 4);
+      block->color[index][2] = texture_pvrtc_expand (translucent[2], blueBits - 1);
+      block->color[index][3] = translucent[3] << 1;
+    }
+
+  for (c = 0; c < 3; ++c)
+    block->endpoint[index][c] = texture_pvrtc_expand8 (block->color[index][c]);
+
+  block->endpoint[index][3] = block->color[index][3] * 17;
+}
+
+/* Finds the four blocks whose colours are interpolated at a pixel, in the
+ * order top left, top right, bottom left, bottom right, and their weights,
+ * which add up to 1 << weightShift.  */
+static void
+texture_pvrtc_neighbours (const struct texture_pvrtc_encoder *encoder,
+                          unsigned int x, unsigned int y,
+                          unsigned int *index, unsigned int *weight)
+{
+  unsigned int x0, y0, x1, y1, fx, fy, blockWidth;
+
+  blockWidth = encoder->blockWidth;
+
+  /* Block centres are half a block from the corner */
+
+  x += encoder->width - blockWidth / 2;
+  y += encoder->height - TEXTURE_PVRTC_BLOCK_HEIGHT / 2;
+
+  fx = x % blockWidth;
+  fy = y % TEXTURE_PVRTC_BLOCK_HEIGHT;
+
+  x0 = (x / blockWidth) % encoder->blocksX;
+  y0 = (y / TEXTURE_PVRTC_BLOCK_HEIGHT) % encoder->blocksY;
+  x1 = (x0 + 1) % encoder->blocksX;
+  y1 = (y0 + 1) % encoder->blocksY;
+
+  index[0] = y0 * encoder->blocksX + x0;
+  index[1] = y0 * encoder->blocksX + x1;
+  index[2] = y1 * encoder->blocksX + x0;
+  index[3] = y1 * encoder->blocksX + x1;
+
+  weight[0] = (blockWidth - fx) * (TEXTURE_PVRTC_BLOCK_HEIGHT - fy);
+  weight[1] = fx * (TEXTURE_PVRTC_BLOCK_HEIGHT - fy);
+  weight[2] = (blockWidth - fx) * fy;
+  weight[3] = fx * fy;
+}
+
+/* Returns the squared error of a pixel decoded with modulation `m' */
+static unsigned int
+texture_pvrtc_error (const unsigned char *pixel, const unsigned char *a,
+                     const unsigned char *b, unsigned int m, int punch)
+{
+  unsigned int result = 0, c;
+  int d;
+
+  for (c = 0; c < 3; ++c)
+    {
+      d = ((a[c] * (8 - m) + b[c] * m) >> 3) - pixel[c];
+      result += d * d;
+    }
+
+  d = punch ? pixel[3] : ((a[3] * (8 - m) + b[3] * m) >> 3) - pixel[3];
+
+  return result + d * d;
+}
+
+/* Initializes the colours of a block from the pixels it affects, weighted
+ * as the decoder weights the block at each of them.  The weighted mean is
+ * the block's sample of a low-pass image, and A and B go to the extremes
+ * of the pixels along their principal axis through it.  Extremes of the
+ * block's own pixels leave the colour between block centres to chance,
+ * which costs several dB on smooth images.  */
+static void
+texture_pvrtc_init_block (struct texture_pvrtc_encoder *encoder,
+                          unsigned int bx, unsigned int by)
+{
+  struct texture_pvrtc_block *block;
+  float mean[4] = { 0 }, cov[4][4] = { { 0 } }, axis[4], target[4];
+  float min = 0.0f, max = 0.0f, length, total = 0.0f;
+  unsigned int x, y, c, d, i, centerX, centerY, blockWidth, largest = 0;
+  int dx, dy;
+
+  block = &encoder->blocks[by * encoder->blocksX + bx];
+  blockWidth = encoder->blockWidth;
+
+  centerX = bx * blockWidth + blockWidth / 2 + encoder->width;
+  centerY = by * TEXTURE_PVRTC_BLOCK_HEIGHT + TEXTURE_PVRTC_BLOCK_HEIGHT / 2 + encoder->height;
+
+  for (dy = 1 - TEXTURE_PVRTC_BLOCK_HEIGHT; dy < TEXTURE_PVRTC_BLOCK_HEIGHT; ++dy)
+    {
+      for (dx = 1 - (int) blockWidth; dx < (int) blockWidth; ++dx)
+        {
+          const unsigned char *pixel;
+          float w;
+
+          x = (centerX + dx) % encoder->width;
+          y = (centerY + dy) % encoder->height;
+          pixel = encoder->pixels + 4 * ((size_t) y * encoder->width + x);
+
+          w = (blockWidth - abs (dx)) * (TEXTURE_PVRTC_BLOCK_HEIGHT - abs (dy));
+
+          for (c = 0; c < 4; ++c)
+            mean[c] += w * pixel[c];
+
+          total += w;
+        }
+    }
+
+  for (c = 0; c < 4; ++c)
+    mean[c] /= total;
+
+  for (dy = 1 - TEXTURE_PVRTC_BLOCK_HEIGHT; dy < TEXTURE_PVRTC_BLOCK_HEIGHT; ++dy)
+    {
+      for (dx = 1 - (int) blockWidth; dx < (int) blockWidth; ++dx)
+        {
+          const unsigned char *pixel;
+          float w;
+
+          x = (centerX + dx) % encoder->width;
+          y = (centerY + dy) % encoder->height;
+          pixel = encoder->pixels + 4 * ((size_t) y * encoder->width + x);
+
+          w = (blockWidth - abs (dx)) * (TEXTURE_PVRTC_BLOCK_HEIGHT - abs (dy));
+
+          for (c = 0; c < 4; ++c)
+            for (d = 0; d < 4; ++d)
+              cov[c][d] += w * (pixel[c] - mean[c]) * (pixel[d] - mean[d]);
+        }
+    }
+
+  /* Power iteration, starting from the row of the channel with the largest
+   * variance */
+
+  for (c = 1; c < 4; ++c)
+    {
+      if (cov[c][c] > cov[largest][largest])
+        largest = c;
+    }
+
+  if (cov[largest][largest] > 1.0f)
+    {
+      memcpy (axis, cov[largest], sizeof (axis));
+
+      for (i = 0; i < 8; ++i)
+        {
+          float next[4];
+
+          length = 0.0f;
+
+          for (c = 0; c < 4; ++c)
+            {
+              next[c] = cov[c][0] * axis[0] + cov[c][1] * axis[1]
+                        + cov[c][2] * axis[2] + cov[c][3] * axis[3];
+
+              length += next[c] * next[c];
+            }
+
+          length = sqrtf (length);
+
+          for (c = 0; c < 4; ++c)
+            axis[c] = next[c] / length;
+        }
+
+      min = 1.0e9f;
+      max = -1.0e9f;
+
+      for (dy = 1 - TEXTURE_PVRTC_BLOCK_HEIGHT; dy < TEXTURE_PVRTC_BLOCK_HEIGHT; ++dy)
+        {
+          for (dx = 1 - (int) blockWidth; dx < (int) blockWidth; ++dx)
+            {
+              const unsigned char *pixel;
+              float t = 0.0f;
+
+              x = (centerX + dx) % encoder->width;
+              y = (centerY + dy) % encoder->height;
+              pixel = encoder->pixels + 4 * ((size_t) y * encoder->width + x);
+
+              for (c = 0; c < 4; ++c)
+                t += (pixel[c] - mean[c]) * axis[c];
+
+              if (t < min) min = t;
+              if (t > max) max = t;
+            }
+        }
+    }
+  else
+    memset (axis, 0, sizeof (axis));
+
+  for (c = 0; c < 4; ++c)
+    {
+      target[c] = mean[c] + min * axis[c];
+      target[c] = (target[c] < 0.0f) ? 0.0f : (target[c] > 255.0f) ? 255.0f : target[c];
+    }
+
+  texture_pvrtc_set_color (block, 0, target);
+
+  for (c = 0; c < 4; ++c)
+    {
+      target[c] = mean[c] + max * axis[c];
+      target[c] = (target[c] < 0.0f) ? 0.0f : (target[c] > 255.0f) ? 255.0f : target[c];
+    }
+
+  texture_pvrtc_set_color (block, 1, target);
+}
+
+/* Interpolates colours A and B at every pixel of a row of blocks, exactly
+ * as the decoder does.  */
+static void
+texture_pvrtc_upscale (struct texture_pvrtc_encoder *encoder, unsigned int by)
+{
+  unsigned int x, y, i, c, index[4], weight[4];
+  unsigned int shift, rgbShift, alphaShift;
+
+  shift = encoder->weightShift;
+  rgbShift = shift - 3;
+  alphaShift = shift - 4;
+
+  for (y = by * TEXTURE_PVRTC_BLOCK_HEIGHT; y < (by + 1) * TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+    {
+      for (x = 0; x < encoder->width; ++x)
+        {
+          size_t offset;
+
+          offset = 4 * ((size_t) y * encoder->width + x);
+
+          texture_pvrtc_neighbours (encoder, x, y, index, weight);
+
+          for (i = 0; i < 2; ++i)
+            {
+              unsigned char *output;
+
+              output = encoder->upscaled[i] + offset;
+
+              for (c = 0; c < 4; ++c)
+                {
+                  unsigned int sum;
+
+                  sum = weight[0] * encoder->blocks[index[0]].color[i][c]
+                        + weight[1] * encoder->blocks[index[1]].color[i][c]
+                        + weight[2] * encoder->blocks[index[2]].color[i][c]
+                        + weight[3] * encoder->blocks[index[3]].color[i][c];
+
+                  /* 5 to 8 bits for colour, 4 to 8 bits for alpha */
+
+                  if (c < 3)
+                    output[c] = (sum >> (shift + 2)) + (sum >> rgbShift);
+                  else
+                    output[c] = (sum >> shift) + (sum >> alphaShift);
+                }
+            }
+
+          if (encoder->ideal)
+            {
+              unsigned int error, bestError = ~0u;
+
+              for (i = 0; i < 4; ++i)
+                {
+                  error = texture_pvrtc_error (encoder->pixels + offset,
+                                               encoder->upscaled[0] + offset,
+                                               encoder->upscaled[1] + offset,
+                                               texture_pvrtc_levels[i], 0);
+
+                  if (error < bestError)
+                    {
+                      bestError = error;
+                      encoder->ideal[offset / 4] = i;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Chooses the modulation mode and values of a 4 bit block */
+static void
+texture_pvrtc_modulate4 (struct texture_pvrtc_encoder *encoder,
+                         unsigned int bx, unsigned int by)
+{
+  struct texture_pvrtc_block *block;
+  uint32_t bits[2] = { 0, 0 };
+  unsigned int totalError[2] = { 0, 0 };
+  unsigned int x, y, mode, i;
+
+  block = &encoder->blocks[by * encoder->blocksX + bx];
+
+  for (mode = 0; mode < 2; ++mode)
+    {
+      for (y = 0; y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+        {
+          for (x = 0; x < 4; ++x)
+            {
+              unsigned int error, bestError = ~0u, best = 0;
+              size_t offset;
+
+              offset = 4 * ((size_t) (by * TEXTURE_PVRTC_BLOCK_HEIGHT + y) * encoder->width
+                            + bx * 4 + x);
+
+              for (i = 0; i < 4; ++i)
+                {
+                  error = texture_pvrtc_error (encoder->pixels + offset,
+                                               encoder->upscaled[0] + offset,
+                                               encoder->upscaled[1] + offset,
+                                               mode ? texture_pvrtc_punch_levels[i]
+                                                    : texture_pvrtc_levels[i],
+                                               mode && i == 2);
+
+                  if (error < bestError)
+                    {
+                      bestError = error;
+                      best = i;
+                    }
+                }
+
+              bits[mode] |= best << (2 * (y * 4 + x));
+              totalError[mode] += bestError;
+            }
+        }
+    }
+
+  mode = totalError[1] < totalError[0];
+
+  block->mode = mode;
+  block->modulation = bits[mode];
+
+  for (y = 0; y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+    {
+      for (x = 0; x < 4; ++x)
+        {
+          unsigned int code;
+
+          code = (bits[mode] >> (2 * (y * 4 + x))) & 3;
+
+          encoder->modulation[(by * TEXTURE_PVRTC_BLOCK_HEIGHT + y) * encoder->width + bx * 4 + x]
+            = mode ? (texture_pvrtc_punch_levels[code] | ((code == 2) ? TEXTURE_PVRTC_PUNCH : 0))
+                   : texture_pvrtc_levels[code];
+        }
+    }
+}
+
+/* Returns the 2 bit modulation code at a position relative to a 2 bit
+ * block, taking it from `codes' inside the block and from `neighbours',
+ * the codes of the whole image, outside it.  */
+static unsigned int
+texture_pvrtc_code2 (const struct texture_pvrtc_encoder *encoder,
+                     const unsigned char *neighbours, unsigned int bx, unsigned int by,
+                     unsigned char codes[TEXTURE_PVRTC_BLOCK_HEIGHT][8], int x, int y)
+{
+  unsigned int gx, gy;
+
+  if (x >= 0 && x < 8 && y >= 0 && y < TEXTURE_PVRTC_BLOCK_HEIGHT)
+    return codes[y][x];
+
+  gx = (bx * 8 + x + encoder->width) % encoder->width;
+  gy = (by * TEXTURE_PVRTC_BLOCK_HEIGHT + y + encoder->height) % encoder->height;
+
+  return neighbours[gy * encoder->width + gx];
+}
+
+/* Returns the modulation of a pixel of a 2 bit block in eighths, as the
+ * decoder derives it in `mode' from the stored codes */
+static unsigned int
+texture_pvrtc_value2 (const struct texture_pvrtc_encoder *encoder,
+                      const unsigned char *neighbours, unsigned int bx, unsigned int by,
+                      unsigned char codes[TEXTURE_PVRTC_BLOCK_HEIGHT][8],
+                      unsigned int mode, int x, int y)
+{
+  unsigned int left, right, up, down;
+
+  if (!mode || !((x ^ y) & 1))
+    return texture_pvrtc_levels[codes[y][x]];
+
+  left = texture_pvrtc_levels[texture_pvrtc_code2 (encoder, neighbours, bx, by, codes, x - 1, y)];
+  right = texture_pvrtc_levels[texture_pvrtc_code2 (encoder, neighbours, bx, by, codes, x + 1, y)];
+  up = texture_pvrtc_levels[texture_pvrtc_code2 (encoder, neighbours, bx, by, codes, x, y - 1)];
+  down = texture_pvrtc_levels[texture_pvrtc_code2 (encoder, neighbours, bx, by, codes, x, y + 1)];
+
+  if (mode == 1)
+    return (left + right + up + down + 2) / 4;
+  else if (mode == 2)
+    return (left + right + 1) / 2;
+  else
+    return (up + down + 1) / 2;
+}
+
+/* Returns the squared error of a stored pixel of a 2 bit block and of the
+ * pixels of the block interpolated from it */
+static unsigned int
+texture_pvrtc_local_error2 (const struct texture_pvrtc_encoder *encoder,
+                            const unsigned char *neighbours, unsigned int bx, unsigned int by,
+                            unsigned char codes[TEXTURE_PVRTC_BLOCK_HEIGHT][8],
+                            unsigned int mode, int x, int y)
+{
+  static const int around[5][2] = { { 0, 0 }, { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+  unsigned int result = 0, i;
+
+  for (i = 0; i < 5; ++i)
+    {
+      size_t offset;
+      int nx, ny;
+
+      nx = x + around[i][0];
+      ny = y + around[i][1];
+
+      if (nx < 0 || nx >= 8 || ny < 0 || ny >= TEXTURE_PVRTC_BLOCK_HEIGHT)
+        continue;
+
+      offset = (size_t) (by * TEXTURE_PVRTC_BLOCK_HEIGHT + ny) * encoder->width + bx * 8 + nx;
+
+      result += texture_pvrtc_error (encoder->pixels + 4 * offset,
+                                     encoder->upscaled[0] + 4 * offset,
+                                     encoder->upscaled[1] + 4 * offset,
+                                     texture_pvrtc_value2 (encoder, neighbours, bx, by,
+                                                           codes, mode, nx, ny), 0);
+    }
+
+  return result;
+}
+
+/* Chooses the modulation mode and values of a 2 bit block.  Mode 0 has one
+ * bit per pixel.  The other modes store 2 bits for every other pixel in a
+ * checkerboard pattern, and interpolate the rest from the stored neighbours
+ * on both axes (mode 1), horizontally (mode 2) or vertically (mode 3).
+ *
+ * Interpolation reaches into neighbouring blocks, whose codes are being
+ * chosen concurrently.  It uses the codes they stored in the previous
+ * iteration, and their ideal codes in the first.  */
+static void
+texture_pvrtc_modulate2 (struct texture_pvrtc_encoder *encoder,
+                         unsigned int bx, unsigned int by, unsigned int iteration)
+{
+  struct texture_pvrtc_block *block;
+  const unsigned char *neighbours;
+  unsigned char codes[4][TEXTURE_PVRTC_BLOCK_HEIGHT][8];
+  unsigned char values[4][TEXTURE_PVRTC_BLOCK_HEIGHT][8];
+  unsigned int totalError[4] = { 0, 0, 0, 0 };
+  unsigned int x, y, mode, best = 0;
+  uint32_t bits = 0;
+
+  block = &encoder->blocks[by * encoder->blocksX + bx];
+  neighbours = iteration ? encoder->codes[(iteration - 1) & 1] : encoder->ideal;
+
+  for (mode = 0; mode < 4; ++mode)
+    {
+      /* Choose stored values first, since interpolated values depend on
+       * them */
+
+      for (y = 0; y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+        {
+          for (x = 0; x < 8; ++x)
+            {
+              const unsigned char *pixel, *a, *b;
+              size_t offset;
+              unsigned int error0, error8;
+
+              if (mode && ((x ^ y) & 1))
+                continue;
+
+              offset = (size_t) (by * TEXTURE_PVRTC_BLOCK_HEIGHT + y) * encoder->width + bx * 8 + x;
+
+              if (mode && !TEXTURE_PVRTC_RESTRICTED2 (mode, x, y))
+                {
+                  codes[mode][y][x] = encoder->ideal[offset];
+
+                  continue;
+                }
+
+              pixel = encoder->pixels + 4 * offset;
+              a = encoder->upscaled[0] + 4 * offset;
+              b = encoder->upscaled[1] + 4 * offset;
+
+              error0 = texture_pvrtc_error (pixel, a, b, 0, 0);
+              error8 = texture_pvrtc_error (pixel, a, b, 8, 0);
+
+              codes[mode][y][x] = (error8 < error0) ? 3 : 0;
+            }
+        }
+
+      /* The ideal code of a stored pixel ignores the pixels interpolated
+       * from it, so revise each stored code once with them included */
+
+      for (y = 0; mode && y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+        {
+          for (x = y & 1; x < 8; x += 2)
+            {
+              unsigned int code, error, bestError = ~0u, bestCode = 0;
+
+              for (code = 0; code < 4; ++code)
+                {
+                  if (TEXTURE_PVRTC_RESTRICTED2 (mode, x, y) && code != 0 && code != 3)
+                    continue;
+
+                  codes[mode][y][x] = code;
+
+                  error = texture_pvrtc_local_error2 (encoder, neighbours, bx, by,
+                                                      codes[mode], mode, x, y);
+
+                  if (error < bestError)
+                    {
+                      bestError = error;
+                      bestCode = code;
+                    }
+                }
+
+              codes[mode][y][x] = bestCode;
+            }
+        }
+
+      for (y = 0; y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+        {
+          for (x = 0; x < 8; ++x)
+            {
+              size_t offset;
+
+              offset = (size_t) (by * TEXTURE_PVRTC_BLOCK_HEIGHT + y) * encoder->width + bx * 8 + x;
+
+              values[mode][y][x] = texture_pvrtc_value2 (encoder, neighbours, bx, by,
+                                                         codes[mode], mode, x, y);
+              totalError[mode] += texture_pvrtc_error (encoder->pixels + 4 * offset,
+                                                       encoder->upscaled[0] + 4 * offset,
+                                                       encoder->upscaled[1] + 4 * offset,
+                                                       values[mode][y][x], 0);
+            }
+        }
+    }
+
+  for (mode = 1; mode < 4; ++mode)
+    {
+      if (totalError[mode] < totalError[best])
+        best = mode;
+    }
+
+  if (!best)
+    {
+      for (y = 0; y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+        for (x = 0; x < 8; ++x)
+          bits |= (uint32_t) (codes[0][y][x] & 1) << (y * 8 + x);
+    }
+  else
+    {
+      unsigned int shift = 0;
+
+      for (y = 0; y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+        {
+          for (x = 0; x < 8; ++x)
+            {
+              if ((x ^ y) & 1)
+                continue;
+
+              bits |= (uint32_t) codes[best][y][x] << shift;
+              shift += 2;
+            }
+        }
+
+      /* The low bit of the first pixel selects between mode 1 and modes 2
+       * and 3, and the low bit of the centre pixel selects between modes 2
+       * and 3 */
+
+      bits &= ~(uint32_t) 1;
+
+      if (best >= 2)
+        {
+          bits |= 1;
+          bits &= ~((uint32_t) 1 << 20);
+
+          if (best == 3)
+            bits |= (uint32_t) 1 << 20;
+        }
+    }
+
+  block->mode = (best != 0);
+  block->modulation = bits;
+
+  for (y = 0; y < TEXTURE_PVRTC_BLOCK_HEIGHT; ++y)
+    {
+      size_t offset;
+
+      offset = (size_t) (by * TEXTURE_PVRTC_BLOCK_HEIGHT + y) * encoder->width + bx * 8;
+
+      memcpy (encoder->modulation + offset, values[best][y], 8);
+
+      /* Neighbours only interpolate from stored pixels */
+
+      for (x = 0; x < 8; ++x)
+        {
+          if (!best || !((x ^ y) & 1))
+            encoder->codes[iteration & 1][offset + x] = codes[best][y][x];
+        }
+    }
+}
+
+#if defined(__SSE2__)
+static __m128
+texture_pvrtc_load (const unsigned char *rgba)
+{
+  __m128i zero, value;
+  int tmp;
+
+  memcpy (&tmp, rgba, sizeof (tmp));
+
+  zero = _mm_setzero_si128 ();
+  value = _mm_unpacklo_epi8 (_mm_cvtsi32_si128 (tmp), zero);
+  value = _mm_unpacklo_epi16 (value, zero);
+
+  return _mm_cvtepi32_ps (value);
+}
+#endif
+
+/* Returns the number of bits channel `c' of colour `index' of a block is
+ * stored in, or 0 for the implicit alpha of opaque colours */
+static unsigned int
+texture_pvrtc_channel_bits (const struct texture_pvrtc_block *block,
+                            unsigned int index, unsigned int c)
+{
+  if (block->packed[index] & 0x8000)
+    return (c == 3) ? 0 : (c == 2 && !index) ? 4 : 5;
+
+  return (c == 3 || (c == 2 && !index)) ? 3 : 4;
+}
+
+/* Moves each channel of colours A and B of a block to whichever of the
+ * codes next to its nearest one gives the least error, evaluated with the
+ * decoder's integer arithmetic.  Truncation in the decoder makes the
+ * nearest code to the least squares solution a poor guess.  */
+static void
+texture_pvrtc_round (struct texture_pvrtc_encoder *encoder,
+                     unsigned int bx, unsigned int by)
+{
+  struct texture_pvrtc_sample
+  {
+    /* Interpolation sums of the other three blocks */
+    unsigned int other[2][4];
+
+    unsigned int weight, modulation, punch;
+    const unsigned char *pixel;
+  } samples[(2 * 8 - 1) * (2 * TEXTURE_PVRTC_BLOCK_HEIGHT - 1)];
+
+  struct texture_pvrtc_block *block;
+  float target[2][4];
+  unsigned int index[4], weight[4], centerX, centerY, blockWidth, shift;
+  unsigned int count = 0, c, i, j;
+  int dx, dy;
+
+  block = &encoder->blocks[by * encoder->blocksX + bx];
+  blockWidth = encoder->blockWidth;
+  shift = encoder->weightShift;
+
+  centerX = bx * blockWidth + blockWidth / 2 + encoder->width;
+  centerY = by * TEXTURE_PVRTC_BLOCK_HEIGHT + TEXTURE_PVRTC_BLOCK_HEIGHT / 2 + encoder->height;
+
+  for (dy = 1 - TEXTURE_PVRTC_BLOCK_HEIGHT; dy < TEXTURE_PVRTC_BLOCK_HEIGHT; ++dy)
+    {
+      for (dx = 1 - (int) blockWidth; dx < (int) blockWidth; ++dx)
+        {
+          struct texture_pvrtc_sample *sample;
+          unsigned int x, y;
+          size_t offset;
+
+          x = (centerX + dx) % encoder->width;
+          y = (centerY + dy) % encoder->height;
+          offset = (size_t) y * encoder->width + x;
+
+          sample = &samples[count++];
+          memset (sample->other, 0, sizeof (sample->other));
+
+          texture_pvrtc_neighbours (encoder, x, y, index, weight);
+
+          for (j = 0; j < 4; ++j)
+            {
+              if (&encoder->blocks[index[j]] == block)
+                {
+                  sample->weight = weight[j];
+
+                  continue;
+                }
+
+              for (i = 0; i < 2; ++i)
+                for (c = 0; c < 4; ++c)
+                  sample->other[i][c] += weight[j] * encoder->blocks[index[j]].color[i][c];
+            }
+
+          sample->modulation = encoder->modulation[offset] & ~TEXTURE_PVRTC_PUNCH;
+          sample->punch = encoder->modulation[offset] & TEXTURE_PVRTC_PUNCH;
+          sample->pixel = encoder->pixels + 4 * offset;
+        }
+    }
+
+  for (c = 0; c < 4; ++c)
+    {
+      unsigned int bits[2], code[2], best[2], bestError = ~0u;
+      int da, db;
+
+      for (i = 0; i < 2; ++i)
+        {
+          bits[i] = texture_pvrtc_channel_bits (block, i, c);
+          code[i] = (c == 3) ? block->color[i][c] >> 1 : block->color[i][c] >> (5 - bits[i]);
+          best[i] = block->color[i][c];
+        }
+
+      for (da = -1; da <= 1; ++da)
+        {
+          for (db = -1; db <= 1; ++db)
+            {
+              unsigned int value[2], error = 0;
+              int candidate[2];
+
+              candidate[0] = code[0] + da;
+              candidate[1] = code[1] + db;
+
+              /* Opaque alpha has no code to vary */
+
+              for (i = 0; i < 2; ++i)
+                {
+                  if (!bits[i])
+                    {
+                      if (i ? db : da)
+                        break;
+
+                      value[i] = block->color[i][c];
+                    }
+                  else if (candidate[i] < 0 || candidate[i] >= (1 << bits[i]))
+                    break;
+                  else if (c == 3)
+                    value[i] = candidate[i] << 1;
+                  else
+                    value[i] = texture_pvrtc_expand (candidate[i], bits[i]);
+                }
+
+              if (i < 2)
+                continue;
+
+              for (j = 0; j < count && error < bestError; ++j)
+                {
+                  const struct texture_pvrtc_sample *sample = &samples[j];
+                  unsigned int sa, sb;
+                  int a, b, d;
+
+                  if (c == 3 && sample->punch)
+                    continue;
+
+                  sa = sample->other[0][c] + sample->weight * value[0];
+                  sb = sample->other[1][c] + sample->weight * value[1];
+
+                  if (c < 3)
+                    {
+                      a = (sa >> (shift + 2)) + (sa >> (shift - 3));
+                      b = (sb >> (shift + 2)) + (sb >> (shift - 3));
+                    }
+                  else
+                    {
+                      a = (sa >> shift) + (sa >> (shift - 4));
+                      b = (sb >> shift) + (sb >> (shift - 4));
+                    }
+
+                  d = ((a * (8 - sample->modulation) + b * sample->modulation) >> 3)
+                      - sample->pixel[c];
+                  error += d * d;
+                }
+
+              if (error < bestError)
+                {
+                  bestError = error;
+                  best[0] = value[0];
+                  best[1] = value[1];
+                }
+            }
+        }
+
+      for (i = 0; i < 2; ++i)
+        target[i][c] = (c < 3) ? texture_pvrtc_expand8 (best[i]) : best[i] * 17.0f;
+    }
+
+  /* The targets are exactly representable in the format each colour is
+   * already in, so the format stays the same */
+
+  texture_pvrtc_set_color (block, 0, target[0]);
+  texture_pvrtc_set_color (block, 1, target[1]);
+}
+
+/* Replaces the colours of a block with the least squares fit to the pixels
+ * it affects, given the modulation and the colours of other blocks.  The
+ * decoder truncates when it interpolates, so the fit aims half a step
+ * above each pixel.  */
+static void
+texture_pvrtc_fit (struct texture_pvrtc_encoder *encoder,
+                   unsigned int bx, unsigned int by)
+{
+  struct texture_pvrtc_block *block;
+  float saa[4], sab[4], sbb[4], sat[4], sbt[4], target[2][4], scale;
+  unsigned int index[4], weight[4], centerX, centerY, blockWidth, c, j;
+  int dx, dy;
+
+#if defined(__SSE2__)
+  __m128 vsaa, vsab, vsbb, vsat, vsbt, blockA, blockB, bias;
+
+  vsaa = vsab = vsbb = vsat = vsbt = _mm_setzero_ps ();
+  bias = _mm_set1_ps (TEXTURE_PVRTC_BIAS);
+#else
+  memset (saa, 0, sizeof (saa));
+  memset (sab, 0, sizeof (sab));
+  memset (sbb, 0, sizeof (sbb));
+  memset (sat, 0, sizeof (sat));
+  memset (sbt, 0, sizeof (sbt));
+#endif
+
+  block = &encoder->blocks[by * encoder->blocksX + bx];
+  blockWidth = encoder->blockWidth;
+  scale = 1.0f / (1 << encoder->weightShift);
+
+  centerX = bx * blockWidth + blockWidth / 2 + encoder->width;
+  centerY = by * TEXTURE_PVRTC_BLOCK_HEIGHT + TEXTURE_PVRTC_BLOCK_HEIGHT / 2 + encoder->height;
+
+#if defined(__SSE2__)
+  blockA = _mm_loadu_ps (block->endpoint[0]);
+  blockB = _mm_loadu_ps (block->endpoint[1]);
+#endif
+
+  for (dy = 1 - TEXTURE_PVRTC_BLOCK_HEIGHT; dy < TEXTURE_PVRTC_BLOCK_HEIGHT; ++dy)
+    {
+      for (dx = 1 - (int) blockWidth; dx < (int) blockWidth; ++dx)
+        {
+          unsigned int x, y, modulation;
+          float m, wa, wb, w, alphaMask;
+          size_t offset;
+
+          x = (centerX + dx) % encoder->width;
+          y = (centerY + dy) % encoder->height;
+          offset = (size_t) y * encoder->width + x;
+
+          modulation = encoder->modulation[offset];
+          m = (modulation & ~TEXTURE_PVRTC_PUNCH) * 0.125f;
+
+          /* Transparent pixels don't depend on alpha */
+
+          alphaMask = (modulation & TEXTURE_PVRTC_PUNCH) ? 0.0f : 1.0f;
+
+          w = (blockWidth - abs (dx)) * (TEXTURE_PVRTC_BLOCK_HEIGHT - abs (dy)) * scale;
+          wa = w * (1.0f - m);
+          wb = w * m;
+
+          texture_pvrtc_neighbours (encoder, x, y, index, weight);
+
+#if defined(__SSE2__)
+          {
+            __m128 pixel, recon, va, vb, t, vm, mask;
+
+            vm = _mm_set1_ps (m);
+            recon = _mm_setzero_ps ();
+
+            for (j = 0; j < 4; ++j)
+              {
+                const struct texture_pvrtc_block *neighbour;
+                __m128 a, b;
+
+                neighbour = &encoder->blocks[index[j]];
+
+                a = _mm_loadu_ps (neighbour->endpoint[0]);
+                b = _mm_loadu_ps (neighbour->endpoint[1]);
+
+                recon = _mm_add_ps (recon, _mm_mul_ps (_mm_set1_ps (weight[j] * scale),
+                                                       _mm_add_ps (a, _mm_mul_ps (vm, _mm_sub_ps (b, a)))));
+              }
+
+            mask = _mm_setr_ps (1.0f, 1.0f, 1.0f, alphaMask);
+            va = _mm_mul_ps (_mm_set1_ps (wa), mask);
+            vb = _mm_mul_ps (_mm_set1_ps (wb), mask);
+
+            /* The pixel value the block should produce, with the
+             * contribution of the other blocks removed */
+
+            pixel = _mm_add_ps (texture_pvrtc_load (encoder->pixels + 4 * offset), bias);
+            t = _mm_add_ps (_mm_sub_ps (pixel, recon),
+                            _mm_add_ps (_mm_mul_ps (va, blockA), _mm_mul_ps (vb, blockB)));
+
+            vsaa = _mm_add_ps (vsaa, _mm_mul_ps (va, va));
+            vsab = _mm_add_ps (vsab, _mm_mul_ps (va, vb));
+            vsbb = _mm_add_ps (vsbb, _mm_mul_ps (vb, vb));
+            vsat = _mm_add_ps (vsat, _mm_mul_ps (va, t));
+            vsbt = _mm_add_ps (vsbt, _mm_mul_ps (vb, t));
+          }
+#else
+          for (c = 0; c < 4; ++c)
+            {
+              float recon = 0.0f, t, a, b;
+
+              for (j = 0; j < 4; ++j)
+                {
+                  const struct texture_pvrtc_block *neighbour;
+
+                  neighbour = &encoder->blocks[index[j]];
+
+                  recon += weight[j] * scale * (neighbour->endpoint[0][c]
+                                                + m * (neighbour->endpoint[1][c] - neighbour->endpoint[0][c]));
+                }
+
+              a = (c == 3) ? wa * alphaMask : wa;
+              b = (c == 3) ? wb * alphaMask : wb;
+
+              t = encoder->pixels[4 * offset + c] + TEXTURE_PVRTC_BIAS - recon
+                  + a * block->endpoint[0][c] + b * block->endpoint[1][c];
+
+              saa[c] += a * a;
+              sab[c] += a * b;
+              sbb[c] += b * b;
+              sat[c] += a * t;
+              sbt[c] += b * t;
+            }
+#endif
+        }
+    }
+
+#if defined(__SSE2__)
+  _mm_storeu_ps (saa, vsaa);
+  _mm_storeu_ps (sab, vsab);
+  _mm_storeu_ps (sbb, vsbb);
+  _mm_storeu_ps (sat, vsat);
+  _mm_storeu_ps (sbt, vsbt);
+#endif
+
+  for (c = 0; c < 4; ++c)
+    {
+      float det, a, b;
+
+      a = block->endpoint[0][c];
+      b = block->endpoint[1][c];
+
+      det = saa[c] * sbb[c] - sab[c] * sab[c];
+
+      if (det > 1.0e-3f * saa[c] * sbb[c] && det > 1.0e-9f)
+        {
+          a = (sbb[c] * sat[c] - sab[c] * sbt[c]) / det;
+          b = (saa[c] * sbt[c] - sab[c] * sat[c]) / det;
+        }
+      else if (sbb[c] < 1.0e-6f && saa[c] > 1.0e-6f)
+        a = sat[c] / saa[c];
+      else if (saa[c] < 1.0e-6f && sbb[c] > 1.0e-6f)
+        b = sbt[c] / sbb[c];
+      else if (saa[c] + sbb[c] > 1.0e-6f)
+        a = b = (sat[c] + sbt[c]) / (saa[c] + 2.0f * sab[c] + sbb[c]);
+
+      target[0][c] = (a < 0.0f) ? 0.0f : (a > 255.0f) ? 255.0f : a;
+      target[1][c] = (b < 0.0f) ? 0.0f : (b > 255.0f) ? 255.0f : b;
+    }
+
+  texture_pvrtc_set_color (block, 0, target[0]);
+  texture_pvrtc_set_color (block, 1, target[1]);
+
+  texture_pvrtc_round (encoder, bx, by);
+}
+
+static void
+texture_pvrtc_thread (void *arg, unsigned int thread)
+{
+  struct texture_pvrtc_encoder *encoder = arg;
+  unsigned int bx, by, iteration, pass;
+
+  for (by = thread; by < encoder->blocksY; by += encoder->threads)
+    for (bx = 0; bx < encoder->blocksX; ++bx)
+      texture_pvrtc_init_block (encoder, bx, by);
+
+  for (iteration = 0; ; ++iteration)
+    {
+      pthread_barrier_wait (&encoder->barrier);
+
+      for (by = thread; by < encoder->blocksY; by += encoder->threads)
+        texture_pvrtc_upscale (encoder, by);
+
+      pthread_barrier_wait (&encoder->barrier);
+
+      for (by = thread; by < encoder->blocksY; by += encoder->threads)
+        {
+          for (bx = 0; bx < encoder->blocksX; ++bx)
+            {
+              if (encoder->options->use2bit)
+                texture_pvrtc_modulate2 (encoder, bx, by, iteration);
+              else
+                texture_pvrtc_modulate4 (encoder, bx, by);
+            }
+        }
+
+      if (iteration == encoder->options->iterations)
+        break;
+
+      for (pass = 0; pass < 4; ++pass)
+        {
+          pthread_barrier_wait (&encoder->barrier);
+
+          for (by = thread; by < encoder->blocksY; by += encoder->threads)
+            {
+              if ((by & 1) != (pass >> 1))
+                continue;
+
+              for (bx = pass & 1; bx < encoder->blocksX; bx += 2)
+                texture_pvrtc_fit (encoder, bx, by);
+            }
+        }
+    }
+
+  /* Modulation of each block is final once it has been chosen, so no
+   * barrier is needed before packing */
+
+  for (by = thread; by < encoder->blocksY; by += encoder->threads)
+    {
+      for (bx = 0; bx < encoder->blocksX; ++bx)
+        {
+          const struct texture_pvrtc_block *block;
+          uint32_t *word;
+
+          block = &encoder->blocks[by * encoder->blocksX + bx];
+          word = encoder->output + 2 * texture_pvrtc_twiddle (bx, by, encoder->blocksX, encoder->blocksY);
+
+          word[0] = block->modulation;
+          word[1] = ((uint32_t) block->packed[1] << 16) | block->packed[0] | block->mode;
+        }
+    }
+}
+
+void
+texture_pvrtc_encode (void *output, const unsigned char *argb,
+                      unsigned int width, unsigned int height,
+                      const struct texture_pvrtc_options *options)
+{
+  struct texture_pvrtc_encoder encoder;
+  size_t pixelCount, i;
+  unsigned int x, y;
+
+  assert (width && !(width & (width - 1)));
+  assert (height && !(height & (height - 1)));
+
+  memset (&encoder, 0, sizeof (encoder));
+
+  encoder.options = options;
+  encoder.blockWidth = options->use2bit ? 8 : 4;
+  encoder.weightShift = options->use2bit ? 5 : 4;
+
+  /* Small images are repeated to fill the smallest texture of 2x2 blocks */
+
+  encoder.width = (width < 2 * encoder.blockWidth) ? 2 * encoder.blockWidth : width;
+  encoder.height = (height < 2 * TEXTURE_PVRTC_BLOCK_HEIGHT) ? 2 * TEXTURE_PVRTC_BLOCK_HEIGHT : height;
+  encoder.blocksX = encoder.width / encoder.blockWidth;
+  encoder.blocksY = encoder.height / TEXTURE_PVRTC_BLOCK_HEIGHT;
+
+  pixelCount = (size_t) encoder.width * encoder.height;
+
+  if (!(encoder.pixels = malloc (pixelCount * 4))
+      || !(encoder.upscaled[0] = malloc (pixelCount * 4))
+      || !(encoder.upscaled[1] = malloc (pixelCount * 4))
+      || !(encoder.modulation = malloc (pixelCount))
+      || !(encoder.blocks = calloc (encoder.blocksX * encoder.blocksY, sizeof (*encoder.blocks))))
+    err (EX_OSERR, "malloc failed");
+
+  if (options->use2bit
+      && (!(encoder.ideal = malloc (pixelCount))
+          || !(encoder.codes[0] = malloc (pixelCount))
+          || !(encoder.codes[1] = malloc (pixelCount))))
+    err (EX_OSERR, "malloc failed");
+
+  for (y = 0, i = 0; y < encoder.height; ++y)
+    {
+      for (x = 0; x < encoder.width; ++x, i += 4)
+        {
+          const unsigned char *pixel;
+
+          pixel = argb + 4 * ((size_t) (y % height) * width + (x % width));
+
+          encoder.pixels[i] = pixel[1];
+          encoder.pixels[i + 1] = pixel[2];
+          encoder.pixels[i + 2] = pixel[3];
+          encoder.pixels[i + 3] = pixel[0];
+        }
+    }
+
+  encoder.output = output;
+
+  encoder.threads = options->threads ? options->threads : 1;
+
+  if (encoder.threads > encoder.blocksY)
+    encoder.threads = encoder.blocksY;
+
+  if (0 != (errno = pthread_barrier_init (&encoder.barrier, 0, encoder.threads)))
+    err (EX_OSERR, "pthread_barrier_init failed");
+
+  texture_run_threads (encoder.threads, texture_pvrtc_thread, &encoder);
+
+  pthread_barrier_destroy (&encoder.barrier);
+
+  free (encoder.codes[1]);
+  free (encoder.codes[0]);
+  free (encoder.ideal);
+  free (encoder.blocks);
+  free (encoder.modulation);
+  free (encoder.upscaled[1]);
+  free (encoder.upscaled[0]);
+  free (encoder.pixels);
+}
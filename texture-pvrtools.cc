@@ -0,0 +1,95 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+
+#include <PVRTDecompress.h>
+#include <pvrtc.h>
+
+#include "texture.h"
+
+/* C interface to the PVRTools reference decoders, and to the prebuilt
+ * libPVRTC encoder */
+
+/* libPVRTC keeps global state, so calls are serialized.  It also prints
+ * progress to stdout regardless of pvrtc_info_output, so stdout points at
+ * /dev/null during calls.  */
+static pthread_mutex_t texture_libpvrtc_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *texture_libpvrtc_null;
+
+void
+texture_libpvrtc_encode (void *output, const unsigned char *argb,
+                         unsigned int width, unsigned int height,
+                         const struct texture_pvrtc_options *options)
+{
+  FILE *output_stdout;
+
+  /* The library only accepts images of at least 2x2 blocks */
+
+  if (width < (options->use2bit ? 16u : 8u) || height < 8)
+    {
+      texture_pvrtc_encode (output, argb, width, height, options);
+
+      return;
+    }
+
+  pthread_mutex_lock (&texture_libpvrtc_lock);
+
+  if (!texture_libpvrtc_null && !(texture_libpvrtc_null = fopen ("/dev/null", "w")))
+    err (EX_OSERR, "Failed to open /dev/null");
+
+  output_stdout = stdout;
+  stdout = texture_libpvrtc_null;
+
+  pvrtc_info_output (NULL);
+  pvrtc_compress ((void *) argb, output, width, height, 0, 1, options->use2bit,
+                  (options->iterations < 4) ? options->iterations : 4);
+
+  stdout = output_stdout;
+
+  pthread_mutex_unlock (&texture_libpvrtc_lock);
+}
+
+void
+texture_pvrtools_decode_pvrtc (unsigned char *rgba, const void *input,
+                               unsigned int width, unsigned int height, int use2bit)
+{
+  PVRTDecompressPVRTC (input, use2bit, width, height, rgba);
+}
+
+void
+texture_pvrtools_decode_etc1 (unsigned char *rgba, const void *input,
+                              unsigned int width, unsigned int height)
+{
+  unsigned char *padded;
+  unsigned int y, paddedWidth, paddedHeight;
+
+  /* PVRTDecompressETC writes whole blocks, so decode into a buffer padded
+   * to the block size, and crop */
+
+  paddedWidth = (width + 3) & ~3U;
+  paddedHeight = (height + 3) & ~3U;
+
+  if (paddedWidth == width && paddedHeight == height)
+    {
+      PVRTDecompressETC (input, width, height, rgba, 0);
+
+      return;
+    }
+
+  if (!(padded = (unsigned char *) malloc ((size_t) paddedWidth * paddedHeight * 4)))
+    err (EX_OSERR, "malloc failed");
+
+  PVRTDecompressETC (input, paddedWidth, paddedHeight, padded, 0);
+
+  for (y = 0; y < height; ++y)
+    memcpy (rgba + (size_t) y * width * 4, padded + (size_t) y * paddedWidth * 4, width * 4);
+
+  free (padded);
+}
@@ -0,0 +1,100 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sysexits.h>
+
+#include "texture.h"
+
+struct texture_thread
+{
+  void (*function) (void *arg, unsigned int thread);
+  void *arg;
+  unsigned int index;
+};
+
+static void *
+texture_thread_main (void *arg)
+{
+  struct texture_thread *thread = arg;
+
+  thread->function (thread->arg, thread->index);
+
+  return NULL;
+}
+
+void
+texture_run_threads (unsigned int threads,
+                     void (*function) (void *arg, unsigned int thread),
+                     void *arg)
+{
+  struct texture_thread *state;
+  pthread_t *handles;
+  unsigned int i;
+
+  if (threads <= 1)
+    {
+      function (arg, 0);
+
+      return;
+    }
+
+  if (!(state = calloc (threads, sizeof (*state)))
+      || !(handles = calloc (threads, sizeof (*handles))))
+    err (EX_OSERR, "calloc failed");
+
+  /* The calling thread does the work of thread 0 */
+
+  for (i = 0; i < threads; ++i)
+    {
+      state[i].function = function;
+      state[i].arg = arg;
+      state[i].index = i;
+    }
+
+  for (i = 1; i < threads; ++i)
+    {
+      if (0 != (errno = pthread_create (&handles[i], 0, texture_thread_main, &state[i])))
+        err (EX_OSERR, "pthread_create failed");
+    }
+
+  function (arg, 0);
+
+  for (i = 1; i < threads; ++i)
+    pthread_join (handles[i], 0);
+
+  free (handles);
+  free (state);
+}
+
+double
+texture_psnr_argb_rgba (const unsigned char *argb, const unsigned char *rgba,
+                        unsigned int width, unsigned int height)
+{
+  double sum = 0.0;
+  size_t i, count;
+
+  count = (size_t) width * height;
+
+  for (i = 0; i < count; ++i, argb += 4, rgba += 4)
+    {
+      int r, g, b, a;
+
+      a = argb[0] - rgba[3];
+      r = argb[1] - rgba[0];
+      g = argb[2] - rgba[1];
+      b = argb[3] - rgba[2];
+
+      sum += r * r + g * g + b * b + a * a;
+    }
+
+  if (!sum)
+    return INFINITY;
+
+  return 10.0 * log10 (255.0 * 255.0 * 4.0 * count / sum);
+}
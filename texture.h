@@ -0,0 +1,239 @@
+#ifndef TEXTURE_H_
+#define TEXTURE_H_ 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Images passed to the encoders are arrays of 8 bit ARGB pixels, as
+ * returned by png_load.  */
+
+struct texture_pvrtc_options
+{
+  /* 2 instead of 4 bits per pixel */
+  int use2bit;
+
+  /* Number of endpoint refinement passes.  Zero uses the endpoints found by
+   * principal component analysis of each block.  */
+  unsigned int iterations;
+
+  /* Number of threads encoding separate blocks */
+  unsigned int threads;
+};
+
+/* Returns the number of bytes of one PVRTC compressed image.  Images
+ * narrower than 8 (16 in 2 bit mode) or shorter than 8 pixels are stored at
+ * that size, with the image repeated to fill it.  */
+size_t
+texture_pvrtc_size (unsigned int width, unsigned int height, int use2bit);
+
+/* Compresses an image whose width and height are powers of two.  The output
+ * decodes with PVRTDecompressPVRTC.  */
+void
+texture_pvrtc_encode (void *output, const unsigned char *argb,
+                      unsigned int width, unsigned int height,
+                      const struct texture_pvrtc_options *options);
+
+enum texture_etc_format
+{
+  TEXTURE_ETC1,
+  TEXTURE_ETC2_RGB,
+
+  /* ETC2 colour blocks, each preceded by an EAC alpha block */
+  TEXTURE_ETC2_RGBA
+};
+
+enum texture_etc_quality
+{
+  /* Quantized averages of each half block */
+  TEXTURE_ETC_FAST,
+
+  /* Base colours refined along each axis; ETC2 T and H modes */
+  TEXTURE_ETC_MEDIUM,
+
+  /* Base colours refined towards all 26 neighbours */
+  TEXTURE_ETC_HIGH
+};
+
+struct texture_etc_options
+{
+  enum texture_etc_format format;
+  enum texture_etc_quality quality;
+
+  /* Number of threads encoding separate rows of blocks */
+  unsigned int threads;
+};
+
+/* Returns the number of bytes of one ETC compressed image.  Images are
+ * padded to a multiple of 4 pixels in each direction.  */
+size_t
+texture_etc_size (unsigned int width, unsigned int height,
+                  enum texture_etc_format format);
+
+/* Compresses an image of any size.  ETC1 output decodes with
+ * PVRTDecompressETC.  */
+void
+texture_etc_encode (void *output, const unsigned char *argb,
+                    unsigned int width, unsigned int height,
+                    const struct texture_etc_options *options);
+
+/* Decompresses an ETC1 or ETC2 image to 8 bit RGBA pixels */
+void
+texture_etc_decode (unsigned char *rgba, const void *input,
+                    unsigned int width, unsigned int height,
+                    enum texture_etc_format format);
+
+enum texture_bc_format
+{
+  /* RGB with optional 1 bit alpha, 4 bits per pixel */
+  TEXTURE_BC1,
+
+  /* BC1 colour blocks, each preceded by an interpolated alpha block */
+  TEXTURE_BC3,
+
+  /* RGBA, 8 bits per pixel */
+  TEXTURE_BC7
+};
+
+struct texture_bc_options
+{
+  enum texture_bc_format format;
+
+  /* Number of least squares endpoint refinement passes */
+  unsigned int iterations;
+
+  /* Number of threads encoding separate rows of blocks */
+  unsigned int threads;
+};
+
+/* Returns the number of bytes of one BC compressed image.  Images are
+ * padded to a multiple of 4 pixels in each direction.  */
+size_t
+texture_bc_size (unsigned int width, unsigned int height,
+                 enum texture_bc_format format);
+
+/* Compresses an image of any size.  In BC1, pixels with alpha below 128
+ * become transparent.  */
+void
+texture_bc_encode (void *output, const unsigned char *argb,
+                   unsigned int width, unsigned int height,
+                   const struct texture_bc_options *options);
+
+/* Decompresses a BC image to 8 bit RGBA pixels.  Only the BC7 modes that
+ * texture_bc_encode writes, 5 and 6, are supported; other BC7 blocks decode
+ * to transparent black.  */
+void
+texture_bc_decode (unsigned char *rgba, const void *input,
+                   unsigned int width, unsigned int height,
+                   enum texture_bc_format format);
+
+enum texture_mip_filter
+{
+  /* Average of 2x2 pixels */
+  TEXTURE_MIP_BOX,
+
+  /* Sinc windowed by a Kaiser window, 3 output pixels in radius */
+  TEXTURE_MIP_KAISER,
+
+  /* Lanczos with 3 lobes */
+  TEXTURE_MIP_LANCZOS
+};
+
+struct texture_mip_options
+{
+  enum texture_mip_filter filter;
+
+  /* Colours are linear values, such as normals, rather than sRGB */
+  int linear;
+
+  /* Number of threads filtering separate rows */
+  unsigned int threads;
+};
+
+/* Computes the next mipmap level of an ARGB image, halving each dimension
+ * larger than one pixel.  Colours are filtered in linear light, weighted
+ * by alpha.  `output' must not overlap `input'.  */
+void
+texture_mip_downsample (unsigned char *output, const unsigned char *input,
+                        unsigned int width, unsigned int height,
+                        const struct texture_mip_options *options);
+
+struct texture_mip_stream;
+
+/* Starts computing the next mipmap level of an ARGB image whose rows are
+ * supplied in order by texture_mip_stream_rows, so that the whole image
+ * need not be in memory at once.  Output rows are written to `output' as
+ * soon as their inputs have arrived, in the same order as input rows.  */
+struct texture_mip_stream *
+texture_mip_stream_begin (unsigned char *output, unsigned int width, unsigned int height,
+                          const struct texture_mip_options *options);
+
+/* Supplies the next `count' rows of the input image */
+void
+texture_mip_stream_rows (struct texture_mip_stream *stream, const unsigned char *rows,
+                         unsigned int count);
+
+/* Frees a stream.  Output rows whose inputs were not all supplied are left
+ * unwritten.  */
+void
+texture_mip_stream_end (struct texture_mip_stream *stream);
+
+/* Returns the fraction of pixels whose alpha is above `cutoff', between 0
+ * and 1 */
+double
+texture_mip_coverage (const unsigned char *argb, unsigned int width, unsigned int height,
+                      float cutoff);
+
+/* Scales the alpha of a mipmap level so that the fraction of pixels above
+ * `cutoff' matches `coverage', as measured on the first level.  This
+ * keeps alpha tested foliage from thinning out in smaller levels.  */
+void
+texture_mip_preserve_coverage (unsigned char *argb, unsigned int width, unsigned int height,
+                               float cutoff, double coverage);
+
+/* Runs `function' on `threads' threads, passing each thread its index, and
+ * waits for all of them to return.  */
+void
+texture_run_threads (unsigned int threads,
+                     void (*function) (void *arg, unsigned int thread),
+                     void *arg);
+
+/* Encodes PVRTC like texture_pvrtc_encode, but with pvrtc_compress from
+ * the prebuilt libPVRTC, at quality `iterations' (at most 4).  Single
+ * threaded, and slower by an order of magnitude, but still ahead of the
+ * in-tree encoder on some images.  Levels too small for the library go to
+ * texture_pvrtc_encode.  The library's progress output is discarded by
+ * pointing stdout at /dev/null during the call, so other threads must not
+ * use stdout meanwhile.  */
+void
+texture_libpvrtc_encode (void *output, const unsigned char *argb,
+                         unsigned int width, unsigned int height,
+                         const struct texture_pvrtc_options *options);
+
+/* Decodes PVRTC to RGBA with PVRTDecompressPVRTC, the PVRTools reference
+ * decoder */
+void
+texture_pvrtools_decode_pvrtc (unsigned char *rgba, const void *input,
+                               unsigned int width, unsigned int height, int use2bit);
+
+/* Decodes ETC1 to RGBA with PVRTDecompressETC.  Unlike that function, any
+ * image size is accepted.  */
+void
+texture_pvrtools_decode_etc1 (unsigned char *rgba, const void *input,
+                              unsigned int width, unsigned int height);
+
+/* Returns the peak signal to noise ratio between an ARGB image and an RGBA
+ * image, such as the output of PVRTDecompressPVRTC, in decibels.  Alpha is
+ * included in the error.  */
+double
+texture_psnr_argb_rgba (const unsigned char *argb, const unsigned char *rgba,
+                        unsigned int width, unsigned int height);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* !TEXTURE_H_ */
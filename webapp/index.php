@@ -520,7 +520,12 @@ $conversions =
         'application/vnd.badgermind.sd application/vnd.badgermind.sd.binary.0' => '/usr/local/bin/bm-script-convert',
         'application/vnd.badgermind.sd application/vnd.badgermind.sd.binary64.0' => '/usr/local/bin/bm-script-convert --pointer-size=64',
         'application/vnd.badgermind.sd text/html' => '/usr/local/bin/bm-script-convert --format=html',
-        'image/png application/vnd.powervr.pvrtc' => '/usr/local/bin/bm-texture-convert --format=pvrtc');
+        'image/png application/vnd.powervr.pvrtc' => '/usr/local/bin/bm-texture-convert --format=pvrtc',
+        'image/png application/vnd.khronos.etc1' => '/usr/local/bin/bm-texture-convert --format=etc1',
+        'image/png application/vnd.khronos.etc2' => '/usr/local/bin/bm-texture-convert --format=etc2',
+        'image/png application/vnd.microsoft.bc1' => '/usr/local/bin/bm-texture-convert --format=bc1',
+        'image/png application/vnd.microsoft.bc3' => '/usr/local/bin/bm-texture-convert --format=bc3',
+        'image/png application/vnd.microsoft.bc7' => '/usr/local/bin/bm-texture-convert --format=bc7');
 
 if (isset($_GET['media-type']) && isset($conversions["$content_type {$_GET['media-type']}"]))
 {